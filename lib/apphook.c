@@ -164,6 +164,7 @@ app_startup(void)
   value_pairs_global_init();
   service_management_init();
   scratch_buffers_allocator_init();
+  log_msg_thread_init();
   main_loop_thread_resource_init();
   nondumpable_setlogger(nondumpable_allocator_logger);
   secret_storage_init();
@@ -209,6 +210,7 @@ app_shutdown(void)
   run_application_hook(AH_SHUTDOWN, TRUE);
   main_loop_thread_resource_deinit();
   secret_storage_deinit();
+  log_msg_thread_deinit();
   scratch_buffers_allocator_deinit();
   scratch_buffers_global_deinit();
   value_pairs_global_deinit();
@@ -252,6 +254,7 @@ void
 app_thread_start(void)
 {
   scratch_buffers_allocator_init();
+  log_msg_thread_init();
   dns_caching_thread_init();
   main_loop_call_thread_init();
 }
@@ -261,5 +264,7 @@ app_thread_stop(void)
 {
   main_loop_call_thread_deinit();
   dns_caching_thread_deinit();
+  log_template_thread_deinit();
+  log_msg_thread_deinit();
   scratch_buffers_allocator_deinit();
 }
@@ -338,6 +338,10 @@ extern struct _StatsOptions *last_stats_options;
 %token KW_ON_ERROR                    10510
 
 %token KW_RETRIES                     10511
+%token KW_BATCH_LINES                 10512
+%token KW_BATCH_TIMEOUT               10513
+%token KW_WORKERS                     10514
+%token KW_WORKER_PARTITION_KEY        10515
 
 /* END_DECLS */
 
@@ -1185,6 +1189,22 @@ threaded_dest_driver_option
         {
           log_threaded_dest_driver_set_max_retries(last_driver, $3);
         }
+        | KW_BATCH_LINES '(' nonnegative_integer ')'
+        {
+          log_threaded_dest_driver_set_batch_lines(last_driver, $3);
+        }
+        | KW_BATCH_TIMEOUT '(' nonnegative_integer ')'
+        {
+          log_threaded_dest_driver_set_batch_timeout(last_driver, $3);
+        }
+        | KW_WORKERS '(' positive_integer ')'
+        {
+          log_threaded_dest_driver_set_num_workers(last_driver, $3);
+        }
+        | KW_WORKER_PARTITION_KEY '(' template_content ')'
+        {
+          log_threaded_dest_driver_set_worker_partition_key_ref(last_driver, $3);
+        }
         | dest_driver_option
         ;
 
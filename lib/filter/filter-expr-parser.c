@@ -56,7 +56,9 @@ static CfgLexerKeyword filter_expr_keywords[] =
   { "match",      KW_MATCH },
   { "netmask",      KW_NETMASK },
   { "tags",     KW_TAGS },
+  { "netmask_list",       KW_NETMASK_LIST },
   { "in_list",            KW_IN_LIST },
+  { "match_any",          KW_MATCH_ANY },
 #if SYSLOG_NG_ENABLE_IPV6
   { "netmask6",     KW_NETMASK6 },
 #endif
@@ -76,6 +76,15 @@ filter_expr_eval_root(FilterExprNode *self, LogMessage **msg, const LogPathOptio
   return filter_expr_eval_root_with_context(self, msg, 1, path_options);
 }
 
+gboolean
+filter_expr_get_literals(FilterExprNode *self, NVHandle *handle, GPtrArray *literals)
+{
+  if (self->comp || !self->get_literals)
+    return FALSE;
+
+  return self->get_literals(self, handle, literals);
+}
+
 FilterExprNode *
 filter_expr_ref(FilterExprNode *self)
 {
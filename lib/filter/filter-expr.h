@@ -41,6 +41,11 @@ struct _FilterExprNode
   const gchar *type;
   void (*init)(FilterExprNode *self, GlobalConfig *cfg);
   gboolean (*eval)(FilterExprNode *self, LogMessage **msg, gint num_msg);
+  /* optional: if the node is a test for equality between a single value
+   * of the message and a set of literals, return the handle of the value
+   * and add the literals (allocated strings) to @literals, see
+   * LogMultiplexer */
+  gboolean (*get_literals)(FilterExprNode *self, NVHandle *handle, GPtrArray *literals);
   void (*free_fn)(FilterExprNode *self);
   StatsCounterItem *matched;
   StatsCounterItem *not_matched;
@@ -58,6 +63,7 @@ gboolean filter_expr_eval_with_context(FilterExprNode *self, LogMessage **msgs,
 gboolean filter_expr_eval_root(FilterExprNode *self, LogMessage **msg, const LogPathOptions *path_options);
 gboolean filter_expr_eval_root_with_context(FilterExprNode *self, LogMessage **msgs, gint num_msg,
                                             const LogPathOptions *path_options);
+gboolean filter_expr_get_literals(FilterExprNode *self, NVHandle *handle, GPtrArray *literals);
 void filter_expr_node_init_instance(FilterExprNode *self);
 FilterExprNode *filter_expr_ref(FilterExprNode *self);
 void filter_expr_unref(FilterExprNode *self);
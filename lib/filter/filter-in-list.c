@@ -57,6 +57,25 @@ filter_in_list_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
   return result ^ s->comp;
 }
 
+static gboolean
+_add_literal(gpointer key, gpointer value, gpointer user_data)
+{
+  GPtrArray *literals = (GPtrArray *) user_data;
+
+  g_ptr_array_add(literals, g_strdup((const gchar *) key));
+  return FALSE;
+}
+
+static gboolean
+filter_in_list_get_literals(FilterExprNode *s, NVHandle *handle, GPtrArray *literals)
+{
+  FilterInList *self = (FilterInList *)s;
+
+  g_tree_foreach(self->tree, _add_literal, literals);
+  *handle = self->value_handle;
+  return TRUE;
+}
+
 static void
 filter_in_list_free(FilterExprNode *s)
 {
@@ -95,6 +114,7 @@ filter_in_list_new(const gchar *list_file, const gchar *property)
   fclose(stream);
 
   self->super.eval = filter_in_list_eval;
+  self->super.get_literals = filter_in_list_get_literals;
   self->super.free_fn = filter_in_list_free;
   return &self->super;
 }
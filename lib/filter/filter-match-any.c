@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "filter-match-any.h"
+#include "str-utils.h"
+#include "messages.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+static gboolean
+filter_match_any_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
+{
+  FilterMatchAny *self = (FilterMatchAny *) s;
+  LogMessage *msg = msgs[num_msg - 1];
+  const gchar *value;
+  gssize len = 0;
+  gboolean result;
+
+  value = log_msg_get_value(msg, self->value_handle, &len);
+  APPEND_ZERO(value, value, len);
+
+  result = multi_matcher_match(self->multi_matcher, msg, self->value_handle, value, len);
+  msg_debug("match-any() evaluation started",
+            evt_tag_str("value", log_msg_get_value_name(self->value_handle, NULL)),
+            evt_tag_int("result", result),
+            evt_tag_printf("msg", "%p", msg));
+  return result ^ s->comp;
+}
+
+static void
+filter_match_any_init(FilterExprNode *s, GlobalConfig *cfg)
+{
+  FilterMatchAny *self = (FilterMatchAny *) s;
+
+  if (self->matcher_options.flags & LMF_STORE_MATCHES)
+    self->super.modify = TRUE;
+}
+
+static void
+filter_match_any_free(FilterExprNode *s)
+{
+  FilterMatchAny *self = (FilterMatchAny *) s;
+
+  multi_matcher_free(self->multi_matcher);
+  log_matcher_options_destroy(&self->matcher_options);
+}
+
+/* one pattern per line, empty lines and lines starting with '#' are ignored */
+gboolean
+filter_match_any_load_patterns(FilterMatchAny *self, GlobalConfig *cfg, const gchar *list_file, GError **error)
+{
+  FILE *stream;
+  gchar line[16384];
+  gint lineno = 0;
+  gboolean success = TRUE;
+
+  stream = fopen(list_file, "r");
+  if (!stream)
+    {
+      g_set_error(error, LOG_MATCHER_ERROR, 0, "Error opening match-any() pattern file %s: %s",
+                  list_file, g_strerror(errno));
+      return FALSE;
+    }
+
+  log_matcher_options_init(&self->matcher_options, cfg);
+  while (success && fgets(line, sizeof(line), stream) != NULL)
+    {
+      gsize len = strlen(line);
+      LogMatcher *matcher;
+
+      lineno++;
+      if (len > 0 && line[len - 1] == '\n')
+        line[--len] = '\0';
+      if (line[0] == '\0' || line[0] == '#')
+        continue;
+
+      matcher = log_matcher_new(cfg, &self->matcher_options);
+      success = log_matcher_compile(matcher, line, error);
+      if (success)
+        multi_matcher_add(self->multi_matcher, matcher, self->matcher_options.type);
+      else
+        g_prefix_error(error, "%s:%d: ", list_file, lineno);
+      log_matcher_unref(matcher);
+    }
+  fclose(stream);
+
+  multi_matcher_compile(self->multi_matcher);
+  msg_debug("match-any() patterns loaded",
+            evt_tag_str("file", list_file),
+            evt_tag_int("patterns", multi_matcher_get_size(self->multi_matcher)),
+            evt_tag_int("prefiltered", multi_matcher_get_prefiltered_size(self->multi_matcher)));
+  return success;
+}
+
+FilterMatchAny *
+filter_match_any_new(void)
+{
+  FilterMatchAny *self = g_new0(FilterMatchAny, 1);
+
+  filter_expr_node_init_instance(&self->super);
+  self->value_handle = LM_V_MESSAGE;
+  self->multi_matcher = multi_matcher_new();
+  self->super.init = filter_match_any_init;
+  self->super.eval = filter_match_any_eval;
+  self->super.free_fn = filter_match_any_free;
+  self->super.type = "match-any";
+  log_matcher_options_defaults(&self->matcher_options);
+  self->matcher_options.flags |= LMF_MATCH_ONLY;
+  return self;
+}
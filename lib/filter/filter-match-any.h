@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef FILTER_MATCH_ANY_H_INCLUDED
+#define FILTER_MATCH_ANY_H_INCLUDED
+
+#include "filter-expr.h"
+#include "logmatcher.h"
+#include "multi-matcher.h"
+
+/* matches if any of the patterns listed in a file matches a value */
+typedef struct _FilterMatchAny
+{
+  FilterExprNode super;
+  NVHandle value_handle;
+  LogMatcherOptions matcher_options;
+  MultiMatcher *multi_matcher;
+} FilterMatchAny;
+
+gboolean filter_match_any_load_patterns(FilterMatchAny *self, GlobalConfig *cfg, const gchar *list_file,
+                                        GError **error);
+FilterMatchAny *filter_match_any_new(void);
+
+#endif
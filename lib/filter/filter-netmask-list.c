@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "filter-netmask-list.h"
+#include "gsocket.h"
+#include "logmsg/logmsg.h"
+#include "str-utils.h"
+#include "messages.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+/*
+ * The networks are stored in a path compressed binary trie (one for IPv4
+ * and one for IPv6), keyed by the network address bits.  As we are only
+ * interested in whether any of the networks contain an address, networks
+ * covered by a shorter prefix are not stored at all.
+ */
+
+#define NETMASK_TRIE_MAX_BITS 128
+
+typedef struct _NetmaskTrieNode NetmaskTrieNode;
+struct _NetmaskTrieNode
+{
+  guint8 prefix[NETMASK_TRIE_MAX_BITS / 8];
+  gint prefix_len;
+  gboolean terminal;
+  NetmaskTrieNode *child[2];
+};
+
+static inline gint
+_get_bit(const guint8 *key, gint bit)
+{
+  return (key[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+/* number of leading bits two keys have in common, up to max_bits */
+static gint
+_common_prefix_len(const guint8 *key1, const guint8 *key2, gint max_bits)
+{
+  gint bit = 0;
+
+  while (bit + 8 <= max_bits && key1[bit / 8] == key2[bit / 8])
+    bit += 8;
+  while (bit < max_bits && _get_bit(key1, bit) == _get_bit(key2, bit))
+    bit++;
+  return bit;
+}
+
+static NetmaskTrieNode *
+_node_new(const guint8 *key, gint prefix_len, gboolean terminal)
+{
+  NetmaskTrieNode *node = g_new0(NetmaskTrieNode, 1);
+
+  memcpy(node->prefix, key, (prefix_len + 7) / 8);
+  node->prefix_len = prefix_len;
+  node->terminal = terminal;
+  return node;
+}
+
+static void
+_node_free(NetmaskTrieNode *node)
+{
+  if (!node)
+    return;
+
+  _node_free(node->child[0]);
+  _node_free(node->child[1]);
+  g_free(node);
+}
+
+static void
+_node_free_children(NetmaskTrieNode *node)
+{
+  _node_free(node->child[0]);
+  _node_free(node->child[1]);
+  node->child[0] = node->child[1] = NULL;
+}
+
+static void
+_trie_insert(NetmaskTrieNode **root, const guint8 *key, gint prefix_len)
+{
+  NetmaskTrieNode **slot = root;
+
+  while (*slot)
+    {
+      NetmaskTrieNode *node = *slot;
+      gint common = _common_prefix_len(node->prefix, key, MIN(node->prefix_len, prefix_len));
+
+      if (common < node->prefix_len)
+        {
+          /* split the edge leading to node */
+          NetmaskTrieNode *split = _node_new(key, common, common == prefix_len);
+
+          if (split->terminal)
+            {
+              /* the new network covers node and everything below it */
+              _node_free(node);
+            }
+          else
+            {
+              split->child[_get_bit(node->prefix, common)] = node;
+              split->child[_get_bit(key, common)] = _node_new(key, prefix_len, TRUE);
+            }
+          *slot = split;
+          return;
+        }
+
+      if (node->terminal)
+        return;
+
+      if (node->prefix_len == prefix_len)
+        {
+          node->terminal = TRUE;
+          _node_free_children(node);
+          return;
+        }
+      slot = &node->child[_get_bit(key, node->prefix_len)];
+    }
+  *slot = _node_new(key, prefix_len, TRUE);
+}
+
+static gboolean
+_trie_lookup(NetmaskTrieNode *node, const guint8 *key)
+{
+  while (node)
+    {
+      if (_common_prefix_len(node->prefix, key, node->prefix_len) < node->prefix_len)
+        return FALSE;
+      if (node->terminal)
+        return TRUE;
+      node = node->child[_get_bit(key, node->prefix_len)];
+    }
+  return FALSE;
+}
+
+typedef struct _FilterNetmaskList
+{
+  FilterExprNode super;
+  NVHandle value_handle;
+  NetmaskTrieNode *ipv4_networks;
+  NetmaskTrieNode *ipv6_networks;
+} FilterNetmaskList;
+
+static const guint8 ipv4_mapped_prefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+static gboolean
+_lookup_ipv6(FilterNetmaskList *self, const struct in6_addr *address)
+{
+  if (memcmp(address->s6_addr, ipv4_mapped_prefix, sizeof(ipv4_mapped_prefix)) == 0)
+    return _trie_lookup(self->ipv4_networks, &address->s6_addr[12]);
+  return _trie_lookup(self->ipv6_networks, address->s6_addr);
+}
+
+static gboolean
+_lookup_value(FilterNetmaskList *self, LogMessage *msg)
+{
+  const gchar *value;
+  gssize len = 0;
+  struct in_addr ipv4;
+  struct in6_addr ipv6;
+
+  value = log_msg_get_value(msg, self->value_handle, &len);
+  APPEND_ZERO(value, value, len);
+
+  if (inet_pton(AF_INET, value, &ipv4) == 1)
+    return _trie_lookup(self->ipv4_networks, (const guint8 *) &ipv4.s_addr);
+  if (inet_pton(AF_INET6, value, &ipv6) == 1)
+    return _lookup_ipv6(self, &ipv6);
+  return FALSE;
+}
+
+static gboolean
+_lookup_saddr(FilterNetmaskList *self, LogMessage *msg)
+{
+  if (!msg->saddr || msg->saddr->sa.sa_family == AF_UNIX)
+    {
+      struct in_addr loopback = { .s_addr = htonl(INADDR_LOOPBACK) };
+
+      return _trie_lookup(self->ipv4_networks, (const guint8 *) &loopback.s_addr) ||
+             _lookup_ipv6(self, &in6addr_loopback);
+    }
+
+  if (g_sockaddr_inet_check(msg->saddr))
+    return _trie_lookup(self->ipv4_networks,
+                        (const guint8 *) &((struct sockaddr_in *) &msg->saddr->sa)->sin_addr.s_addr);
+#if SYSLOG_NG_ENABLE_IPV6
+  if (g_sockaddr_inet6_check(msg->saddr))
+    return _lookup_ipv6(self, &((struct sockaddr_in6 *) &msg->saddr->sa)->sin6_addr);
+#endif
+  return FALSE;
+}
+
+static gboolean
+filter_netmask_list_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
+{
+  FilterNetmaskList *self = (FilterNetmaskList *) s;
+  LogMessage *msg = msgs[num_msg - 1];
+  gboolean result;
+
+  if (self->value_handle)
+    result = _lookup_value(self, msg);
+  else
+    result = _lookup_saddr(self, msg);
+
+  msg_debug("netmask-list() evaluation started",
+            evt_tag_str("value", self->value_handle ? log_msg_get_value_name(self->value_handle, NULL) : "saddr"),
+            evt_tag_int("result", result),
+            evt_tag_printf("msg", "%p", msg));
+  return result ^ s->comp;
+}
+
+/* accepts "address" and "address/prefix" for both IPv4 and IPv6 */
+static gboolean
+_add_network(FilterNetmaskList *self, gchar *cidr)
+{
+  gchar *slash = strchr(cidr, '/');
+  guint8 address[NETMASK_TRIE_MAX_BITS / 8];
+  NetmaskTrieNode **trie;
+  gint max_prefix;
+  gint prefix;
+
+  if (slash)
+    *slash = '\0';
+
+  if (inet_pton(AF_INET, cidr, address) == 1)
+    {
+      trie = &self->ipv4_networks;
+      max_prefix = 32;
+    }
+  else if (inet_pton(AF_INET6, cidr, address) == 1)
+    {
+      trie = &self->ipv6_networks;
+      max_prefix = 128;
+    }
+  else
+    {
+      return FALSE;
+    }
+
+  prefix = max_prefix;
+  if (slash)
+    {
+      gchar *end;
+
+      prefix = strtol(slash + 1, &end, 10);
+      if (end == slash + 1 || *end || prefix < 0 || prefix > max_prefix)
+        return FALSE;
+    }
+
+  _trie_insert(trie, address, prefix);
+  return TRUE;
+}
+
+static void
+filter_netmask_list_free(FilterExprNode *s)
+{
+  FilterNetmaskList *self = (FilterNetmaskList *) s;
+
+  _node_free(self->ipv4_networks);
+  _node_free(self->ipv6_networks);
+}
+
+/* one network per line, empty lines and lines starting with '#' are ignored */
+FilterExprNode *
+filter_netmask_list_new(const gchar *list_file, const gchar *property)
+{
+  FilterNetmaskList *self;
+  FILE *stream;
+  gchar line[256];
+  gint lineno = 0;
+
+  stream = fopen(list_file, "r");
+  if (!stream)
+    {
+      msg_error("Error opening netmask-list filter list file",
+                evt_tag_str("file", list_file),
+                evt_tag_error("errno"));
+      return NULL;
+    }
+
+  self = g_new0(FilterNetmaskList, 1);
+  filter_expr_node_init_instance(&self->super);
+  self->value_handle = property ? log_msg_get_value_handle(property) : 0;
+  self->super.eval = filter_netmask_list_eval;
+  self->super.free_fn = filter_netmask_list_free;
+  self->super.type = "netmask-list";
+
+  while (fgets(line, sizeof(line), stream) != NULL)
+    {
+      gchar *cidr = g_strstrip(line);
+
+      lineno++;
+      if (cidr[0] == '\0' || cidr[0] == '#')
+        continue;
+
+      if (!_add_network(self, cidr))
+        {
+          msg_error("Invalid network in netmask-list filter list file",
+                    evt_tag_str("file", list_file),
+                    evt_tag_int("line", lineno),
+                    evt_tag_str("network", cidr));
+          fclose(stream);
+          filter_expr_unref(&self->super);
+          return NULL;
+        }
+    }
+  fclose(stream);
+  return &self->super;
+}
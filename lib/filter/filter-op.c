@@ -22,13 +22,28 @@
  *
  */
 #include "filter-op.h"
+#include "filter-re.h"
+#include "multi-matcher.h"
+#include "str-utils.h"
+#include "messages.h"
+
+/* "or" expressions with at least this many regexp alternatives on the same
+ * value are evaluated using a MultiMatcher */
+#define FOP_OR_MULTI_MATCHER_MIN_PATTERNS 8
 
 typedef struct _FilterOp
 {
   FilterExprNode super;
   FilterExprNode *left, *right;
+
+  /* "or" only: the flattened alternatives not covered by multi_matcher */
+  MultiMatcher *multi_matcher;
+  NVHandle multi_matcher_handle;
+  GPtrArray *other_operands;
 } FilterOp;
 
+static void fop_or_init(FilterExprNode *s, GlobalConfig *cfg);
+
 static void
 fop_init(FilterExprNode *s, GlobalConfig *cfg)
 {
@@ -43,11 +58,23 @@ fop_init(FilterExprNode *s, GlobalConfig *cfg)
   self->super.modify = self->left->modify || self->right->modify;
 }
 
+static void
+fop_or_free_multi_matcher(FilterOp *self)
+{
+  if (self->multi_matcher)
+    multi_matcher_free(self->multi_matcher);
+  if (self->other_operands)
+    g_ptr_array_free(self->other_operands, TRUE);
+  self->multi_matcher = NULL;
+  self->other_operands = NULL;
+}
+
 static void
 fop_free(FilterExprNode *s)
 {
   FilterOp *self = (FilterOp *) s;
 
+  fop_or_free_multi_matcher(self);
   filter_expr_unref(self->left);
   filter_expr_unref(self->right);
 }
@@ -69,13 +96,160 @@ fop_or_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
           || filter_expr_eval_with_context(self->right, msgs, num_msg)) ^ s->comp;
 }
 
+static gboolean
+fop_or_get_literals(FilterExprNode *s, NVHandle *handle, GPtrArray *literals)
+{
+  FilterOp *self = (FilterOp *) s;
+  NVHandle left_handle, right_handle;
+
+  if (!filter_expr_get_literals(self->left, &left_handle, literals) ||
+      !filter_expr_get_literals(self->right, &right_handle, literals))
+    return FALSE;
+
+  *handle = left_handle;
+  return left_handle == right_handle;
+}
+
+static gboolean
+fop_or_multi_matcher_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
+{
+  FilterOp *self = (FilterOp *) s;
+  LogMessage *msg = msgs[num_msg - 1];
+  const gchar *value;
+  gssize len = 0;
+  gint i;
+
+  value = log_msg_get_value(msg, self->multi_matcher_handle, &len);
+  APPEND_ZERO(value, value, len);
+  if (multi_matcher_match(self->multi_matcher, msg, self->multi_matcher_handle, value, len))
+    return !s->comp;
+
+  for (i = 0; i < self->other_operands->len; i++)
+    {
+      if (filter_expr_eval_with_context(g_ptr_array_index(self->other_operands, i), msgs, num_msg))
+        return !s->comp;
+    }
+  return s->comp;
+}
+
+static void
+_collect_or_operands(FilterExprNode *node, GPtrArray *operands)
+{
+  if (node->init == fop_or_init && !node->comp)
+    {
+      FilterOp *op = (FilterOp *) node;
+
+      /* only the outermost "or" needs the MultiMatcher */
+      fop_or_free_multi_matcher(op);
+      op->super.eval = fop_or_eval;
+      _collect_or_operands(op->left, operands);
+      _collect_or_operands(op->right, operands);
+      return;
+    }
+  g_ptr_array_add(operands, node);
+}
+
+/* returns the value handle most of the regexp operands refer to */
+static NVHandle
+_find_most_common_handle(GPtrArray *operands, gint *count)
+{
+  GHashTable *counts = g_hash_table_new(g_direct_hash, g_direct_equal);
+  NVHandle best_handle = 0;
+  gint best_count = 0;
+  gint i;
+
+  for (i = 0; i < operands->len; i++)
+    {
+      NVHandle handle;
+      const gchar *type;
+
+      if (!filter_re_get_matcher(g_ptr_array_index(operands, i), &handle, &type))
+        continue;
+
+      gint c = GPOINTER_TO_INT(g_hash_table_lookup(counts, GUINT_TO_POINTER(handle))) + 1;
+      g_hash_table_insert(counts, GUINT_TO_POINTER(handle), GINT_TO_POINTER(c));
+      if (c > best_count)
+        {
+          best_count = c;
+          best_handle = handle;
+        }
+    }
+  g_hash_table_destroy(counts);
+  *count = best_count;
+  return best_handle;
+}
+
+static void
+fop_or_build_multi_matcher(FilterOp *self)
+{
+  GPtrArray *operands;
+  NVHandle handle;
+  gint count, i;
+
+  fop_or_free_multi_matcher(self);
+  self->super.eval = fop_or_eval;
+
+  /* the merged alternatives are evaluated before the rest, which would
+   * change the side effects of the ones that modify the message, e.g.
+   * store-matches */
+  if (self->super.modify)
+    return;
+
+  operands = g_ptr_array_new();
+  _collect_or_operands(self->left, operands);
+  _collect_or_operands(self->right, operands);
+
+  handle = _find_most_common_handle(operands, &count);
+  if (count < FOP_OR_MULTI_MATCHER_MIN_PATTERNS)
+    {
+      g_ptr_array_free(operands, TRUE);
+      return;
+    }
+
+  self->multi_matcher = multi_matcher_new();
+  self->multi_matcher_handle = handle;
+  self->other_operands = g_ptr_array_new();
+  for (i = 0; i < operands->len; i++)
+    {
+      FilterExprNode *operand = g_ptr_array_index(operands, i);
+      NVHandle operand_handle;
+      const gchar *type;
+      LogMatcher *matcher = filter_re_get_matcher(operand, &operand_handle, &type);
+
+      if (matcher && operand_handle == handle)
+        multi_matcher_add(self->multi_matcher, matcher, type);
+      else
+        g_ptr_array_add(self->other_operands, operand);
+    }
+  multi_matcher_compile(self->multi_matcher);
+  g_ptr_array_free(operands, TRUE);
+
+  msg_debug("Merging the alternatives of an or expression",
+            evt_tag_str("value", log_msg_get_value_name(handle, NULL)),
+            evt_tag_int("patterns", multi_matcher_get_size(self->multi_matcher)),
+            evt_tag_int("prefiltered", multi_matcher_get_prefiltered_size(self->multi_matcher)),
+            evt_tag_int("other_operands", self->other_operands->len));
+  self->super.eval = fop_or_multi_matcher_eval;
+}
+
+static void
+fop_or_init(FilterExprNode *s, GlobalConfig *cfg)
+{
+  FilterOp *self = (FilterOp *) s;
+
+  fop_init(s, cfg);
+  fop_or_build_multi_matcher(self);
+}
+
 FilterExprNode *
 fop_or_new(FilterExprNode *e1, FilterExprNode *e2)
 {
   FilterOp *self = g_new0(FilterOp, 1);
 
   fop_init_instance(self);
+  self->super.init = fop_or_init;
   self->super.eval = fop_or_eval;
+  self->super.get_literals = fop_or_get_literals;
   self->left = e1;
   self->right = e2;
   self->super.type = "OR";
@@ -110,6 +110,15 @@ log_filter_pipe_free(LogPipe *s)
   log_pipe_free_method(s);
 }
 
+FilterExprNode *
+log_filter_pipe_get_expr(LogPipe *s)
+{
+  if (s->queue != log_filter_pipe_queue)
+    return NULL;
+
+  return ((LogFilterPipe *) s)->expr;
+}
+
 LogPipe *
 log_filter_pipe_new(FilterExprNode *expr, GlobalConfig *cfg)
 {
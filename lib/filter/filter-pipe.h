@@ -44,5 +44,6 @@ typedef struct _LogFilterPipe
 } LogFilterPipe;
 
 LogPipe *log_filter_pipe_new(FilterExprNode *expr, GlobalConfig *cfg);
+FilterExprNode *log_filter_pipe_get_expr(LogPipe *s);
 
 #endif
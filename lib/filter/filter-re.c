@@ -59,6 +59,54 @@ filter_re_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
   return filter_re_eval_string(s, msg, self->value_handle, value, len);
 }
 
+/* "^literal$" regexps are equality tests too, as long as they contain no
+ * special characters */
+static gchar *
+_extract_anchored_literal(const gchar *pattern)
+{
+  gsize len = strlen(pattern);
+
+  if (len < 2 || pattern[0] != '^' || pattern[len - 1] != '$')
+    return NULL;
+
+  for (gsize i = 1; i < len - 1; i++)
+    {
+      if (strchr("\\^$.|?*+()[]{}", pattern[i]))
+        return NULL;
+    }
+  return g_strndup(pattern + 1, len - 2);
+}
+
+static gboolean
+filter_re_get_literals(FilterExprNode *s, NVHandle *handle, GPtrArray *literals)
+{
+  FilterRE *self = (FilterRE *) s;
+  const gchar *type = self->matcher_options.type;
+  gchar *literal;
+
+  if (!self->value_handle || !self->matcher || !type ||
+      (self->matcher_options.flags & (LMF_ICASE | LMF_NEWLINE | LMF_STORE_MATCHES | LMF_PREFIX | LMF_SUBSTRING)))
+    return FALSE;
+
+  if (strcmp(type, "string") == 0)
+    {
+      g_ptr_array_add(literals, g_strdup(self->matcher->pattern));
+    }
+  else if (strcmp(type, "pcre") == 0 && (literal = _extract_anchored_literal(self->matcher->pattern)))
+    {
+      /* '$' also matches before a trailing newline */
+      g_ptr_array_add(literals, g_strdup_printf("%s\n", literal));
+      g_ptr_array_add(literals, literal);
+    }
+  else
+    {
+      return FALSE;
+    }
+
+  *handle = self->value_handle;
+  return TRUE;
+}
+
 static void
 filter_re_free(FilterExprNode *s)
 {
@@ -77,6 +125,21 @@ filter_re_init(FilterExprNode *s, GlobalConfig *cfg)
     self->super.modify = TRUE;
 }
 
+/* used to merge the alternatives of an "or" expression, see filter-op.c */
+LogMatcher *
+filter_re_get_matcher(FilterExprNode *s, NVHandle *handle, const gchar **type)
+{
+  FilterRE *self = (FilterRE *) s;
+
+  if (s->init != filter_re_init || s->comp || !self->value_handle || !self->matcher ||
+      (self->matcher_options.flags & LMF_STORE_MATCHES))
+    return NULL;
+
+  *handle = self->value_handle;
+  *type = self->matcher_options.type;
+  return self->matcher;
+}
+
 gboolean
 filter_re_compile_pattern(FilterRE *self, GlobalConfig *cfg, const gchar *re, GError **error)
 {
@@ -92,6 +155,7 @@ filter_re_init_instance(FilterRE *self, NVHandle value_handle)
   self->value_handle = value_handle;
   self->super.init = filter_re_init;
   self->super.eval = filter_re_eval;
+  self->super.get_literals = filter_re_get_literals;
   self->super.free_fn = filter_re_free;
   self->super.type = "regexp";
   log_matcher_options_defaults(&self->matcher_options);
@@ -38,6 +38,7 @@ typedef struct _FilterRE
 
 typedef struct _FilterMatch FilterMatch;
 
+LogMatcher *filter_re_get_matcher(FilterExprNode *s, NVHandle *handle, const gchar **type);
 gboolean filter_re_compile_pattern(FilterRE *self, GlobalConfig *cfg, const gchar *re, GError **error);
 
 FilterRE *filter_re_new(NVHandle value_handle);
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include <criterion/criterion.h>
+
+#include "filter/filter-netmask-list.h"
+#include "gsockaddr.h"
+#include "apphook.h"
+
+#include <unistd.h>
+
+#define LIST_FILE "test_filters_netmask_list.list"
+
+static const gchar *networks =
+  "# comment\n"
+  "10.0.0.0/8\n"
+  "192.168.1.0/24\n"
+  "192.168.1.128/25\n"
+  "  172.16.5.4  \n"
+  "\n"
+  "2001:db8::/32\n"
+  "2001:db8:1::/48\n"
+  "fe80::1\n";
+
+static FilterExprNode *
+_create_filter(const gchar *contents, const gchar *property)
+{
+  cr_assert(g_file_set_contents(LIST_FILE, contents, -1, NULL));
+  FilterExprNode *filter = filter_netmask_list_new(LIST_FILE, property);
+  unlink(LIST_FILE);
+  return filter;
+}
+
+static gboolean
+_eval_with_value(FilterExprNode *filter, const gchar *value)
+{
+  LogMessage *msg = log_msg_new_empty();
+  gboolean result;
+
+  log_msg_set_value_by_name(msg, "ip", value, -1);
+  result = filter_expr_eval(filter, msg);
+  log_msg_unref(msg);
+  return result;
+}
+
+static gboolean
+_eval_with_saddr(FilterExprNode *filter, GSockAddr *saddr)
+{
+  LogMessage *msg = log_msg_new_empty();
+  gboolean result;
+
+  msg->saddr = saddr;
+  result = filter_expr_eval(filter, msg);
+  log_msg_unref(msg);
+  return result;
+}
+
+Test(filter_netmask_list, value_is_matched_against_networks)
+{
+  FilterExprNode *filter = _create_filter(networks, "ip");
+
+  cr_assert_not_null(filter);
+  cr_assert(_eval_with_value(filter, "10.1.2.3"));
+  cr_assert(_eval_with_value(filter, "192.168.1.1"));
+  cr_assert(_eval_with_value(filter, "192.168.1.200"));
+  cr_assert(_eval_with_value(filter, "172.16.5.4"));
+  cr_assert(_eval_with_value(filter, "2001:db8:ffff::1"));
+  cr_assert(_eval_with_value(filter, "fe80::1"));
+  cr_assert(_eval_with_value(filter, "::ffff:10.0.0.1"));
+
+  cr_assert_not(_eval_with_value(filter, "11.0.0.1"));
+  cr_assert_not(_eval_with_value(filter, "192.168.2.1"));
+  cr_assert_not(_eval_with_value(filter, "172.16.5.5"));
+  cr_assert_not(_eval_with_value(filter, "2001:db9::1"));
+  cr_assert_not(_eval_with_value(filter, "fe80::2"));
+  cr_assert_not(_eval_with_value(filter, "not an address"));
+  cr_assert_not(_eval_with_value(filter, ""));
+
+  filter_expr_unref(filter);
+}
+
+Test(filter_netmask_list, source_address_is_used_by_default)
+{
+  FilterExprNode *filter = _create_filter(networks, NULL);
+
+  cr_assert_not_null(filter);
+  cr_assert(_eval_with_saddr(filter, g_sockaddr_inet_new("10.2.3.4", 514)));
+  cr_assert_not(_eval_with_saddr(filter, g_sockaddr_inet_new("127.0.0.1", 514)));
+#if SYSLOG_NG_ENABLE_IPV6
+  cr_assert(_eval_with_saddr(filter, g_sockaddr_inet6_new("2001:db8::5", 514)));
+  cr_assert(_eval_with_saddr(filter, g_sockaddr_inet6_new("::ffff:192.168.1.5", 514)));
+  cr_assert_not(_eval_with_saddr(filter, g_sockaddr_inet6_new("::1", 514)));
+#endif
+
+  filter_expr_unref(filter);
+}
+
+Test(filter_netmask_list, zero_prefix_matches_everything)
+{
+  FilterExprNode *filter = _create_filter("10.0.0.0/8\n0.0.0.0/0\n", "ip");
+
+  cr_assert(_eval_with_value(filter, "1.2.3.4"));
+  cr_assert_not(_eval_with_value(filter, "::1"));
+
+  filter_expr_unref(filter);
+}
+
+Test(filter_netmask_list, invalid_networks_are_rejected)
+{
+  cr_assert_null(_create_filter("10.0.0.0/33\n", NULL));
+  cr_assert_null(_create_filter("2001:db8::/129\n", NULL));
+  cr_assert_null(_create_filter("10.0.0.0/x\n", NULL));
+  cr_assert_null(_create_filter("foo\n", NULL));
+  cr_assert_null(filter_netmask_list_new("/nonexistent/netmask.list", NULL));
+}
+
+static void
+setup(void)
+{
+  app_startup();
+}
+
+static void
+teardown(void)
+{
+  app_shutdown();
+}
+
+TestSuite(filter_netmask_list, .init = setup, .fini = teardown);
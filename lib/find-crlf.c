@@ -24,32 +24,35 @@
 #include "find-crlf.h"
 
 #include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#define FIND_CRLF_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* returns the first occurrence of c1, c2 or NUL in s, NULL if none of
+ * them is there */
+typedef const gchar *(*FindCharsFunc)(const gchar *s, gsize n, gchar c1, gchar c2);
+
 /**
- * This is an optimized version of finding either a CR or LF or NUL
- * character in a buffer.  It is used to find these line terminators in
- * syslog traffic.
- *
- * It uses an algorithm very similar to what there's in libc memchr/strchr.
+ * This is the portable implementation, it uses an algorithm very similar
+ * to what there's in libc memchr/strchr.
  **/
-gchar *
-find_cr_or_lf(gchar *s, gsize n)
+static const gchar *
+_find_chars_scalar(const gchar *s, gsize n, gchar c1, gchar c2)
 {
-  gchar *char_ptr;
-  gulong *longword_ptr;
-  gulong longword, magic_bits, cr_charmask, lf_charmask;
-  const char CR = '\r';
-  const char LF = '\n';
+  const gchar *char_ptr;
+  const gulong *longword_ptr;
+  gulong longword, magic_bits, c1_charmask, c2_charmask;
 
   /* align input to long boundary */
   for (char_ptr = s; n > 0 && ((gulong) char_ptr & (sizeof(longword) - 1)) != 0; ++char_ptr, n--)
     {
-      if (*char_ptr == CR || *char_ptr == LF)
+      if (*char_ptr == c1 || *char_ptr == c2 || *char_ptr == 0)
         return char_ptr;
-      else if (*char_ptr == 0)
-        return NULL;
     }
 
-  longword_ptr = (gulong *) char_ptr;
+  longword_ptr = (const gulong *) char_ptr;
 
 #if GLIB_SIZEOF_LONG == 8
   magic_bits = 0x7efefefefefefeffL;
@@ -58,42 +61,215 @@ find_cr_or_lf(gchar *s, gsize n)
 #else
 #error "unknown architecture"
 #endif
-  memset(&cr_charmask, CR, sizeof(cr_charmask));
-  memset(&lf_charmask, LF, sizeof(lf_charmask));
+  memset(&c1_charmask, c1, sizeof(c1_charmask));
+  memset(&c2_charmask, c2, sizeof(c2_charmask));
 
   while (n > sizeof(longword))
     {
       longword = *longword_ptr++;
       if ((((longword + magic_bits) ^ ~longword) & ~magic_bits) != 0 ||
-          ((((longword ^ cr_charmask) + magic_bits) ^ ~(longword ^ cr_charmask)) & ~magic_bits) != 0 ||
-          ((((longword ^ lf_charmask) + magic_bits) ^ ~(longword ^ lf_charmask)) & ~magic_bits) != 0)
+          ((((longword ^ c1_charmask) + magic_bits) ^ ~(longword ^ c1_charmask)) & ~magic_bits) != 0 ||
+          ((((longword ^ c2_charmask) + magic_bits) ^ ~(longword ^ c2_charmask)) & ~magic_bits) != 0)
         {
           gint i;
 
-          char_ptr = (gchar *) (longword_ptr - 1);
+          char_ptr = (const gchar *) (longword_ptr - 1);
 
           for (i = 0; i < sizeof(longword); i++)
             {
-              if (*char_ptr == CR || *char_ptr == LF)
+              if (*char_ptr == c1 || *char_ptr == c2 || *char_ptr == 0)
                 return char_ptr;
-              else if (*char_ptr == 0)
-                return NULL;
               char_ptr++;
             }
         }
       n -= sizeof(longword);
     }
 
-  char_ptr = (gchar *) longword_ptr;
+  char_ptr = (const gchar *) longword_ptr;
 
   while (n-- > 0)
     {
-      if (*char_ptr == CR || *char_ptr == LF)
+      if (*char_ptr == c1 || *char_ptr == c2 || *char_ptr == 0)
         return char_ptr;
-      else if (*char_ptr == 0)
-        return NULL;
       ++char_ptr;
     }
 
   return NULL;
 }
+
+#if FIND_CRLF_X86_SIMD
+
+/* SSE2 is part of the x86-64 baseline, no need to check for it */
+static const gchar *
+_find_chars_sse2(const gchar *s, gsize n, gchar c1, gchar c2)
+{
+  const __m128i c1_mask = _mm_set1_epi8(c1);
+  const __m128i c2_mask = _mm_set1_epi8(c2);
+  const __m128i nul_mask = _mm_setzero_si128();
+
+  while (n >= sizeof(__m128i))
+    {
+      __m128i chunk = _mm_loadu_si128((const __m128i *) s);
+      __m128i matches = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, c1_mask),
+                                                   _mm_cmpeq_epi8(chunk, c2_mask)),
+                                     _mm_cmpeq_epi8(chunk, nul_mask));
+      guint bits = _mm_movemask_epi8(matches);
+
+      if (bits)
+        return s + __builtin_ctz(bits);
+
+      s += sizeof(__m128i);
+      n -= sizeof(__m128i);
+    }
+
+  return _find_chars_scalar(s, n, c1, c2);
+}
+
+__attribute__((target("avx2")))
+static const gchar *
+_find_chars_avx2(const gchar *s, gsize n, gchar c1, gchar c2)
+{
+  const __m256i c1_mask = _mm256_set1_epi8(c1);
+  const __m256i c2_mask = _mm256_set1_epi8(c2);
+  const __m256i nul_mask = _mm256_setzero_si256();
+
+  while (n >= sizeof(__m256i))
+    {
+      __m256i chunk = _mm256_loadu_si256((const __m256i *) s);
+      __m256i matches = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, c1_mask),
+                                                        _mm256_cmpeq_epi8(chunk, c2_mask)),
+                                        _mm256_cmpeq_epi8(chunk, nul_mask));
+      guint bits = _mm256_movemask_epi8(matches);
+
+      if (bits)
+        return s + __builtin_ctz(bits);
+
+      s += sizeof(__m256i);
+      n -= sizeof(__m256i);
+    }
+
+  return _find_chars_sse2(s, n, c1, c2);
+}
+
+static gboolean
+_cpu_has_avx2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+static gboolean
+_always_supported(void)
+{
+  return TRUE;
+}
+
+/* in the order of preference */
+static struct
+{
+  const gchar *name;
+  FindCharsFunc func;
+  gboolean (*is_supported)(void);
+} implementations[] =
+{
+#if FIND_CRLF_X86_SIMD
+  { "avx2", _find_chars_avx2, _cpu_has_avx2 },
+  { "sse2", _find_chars_sse2, _always_supported },
+#endif
+  { "scalar", _find_chars_scalar, _always_supported },
+};
+
+static gint current_implementation = -1;
+
+static gint
+_select_implementation(void)
+{
+  gint i;
+
+  for (i = 0; i < G_N_ELEMENTS(implementations) - 1; i++)
+    {
+      if (implementations[i].is_supported())
+        break;
+    }
+  return i;
+}
+
+/* every thread comes up with the same choice, it doesn't matter which one
+ * stores it first */
+static inline FindCharsFunc
+_get_find_chars(void)
+{
+  gint impl = g_atomic_int_get(&current_implementation);
+
+  if (G_UNLIKELY(impl < 0))
+    {
+      impl = _select_implementation();
+      g_atomic_int_set(&current_implementation, impl);
+    }
+  return implementations[impl].func;
+}
+
+/**
+ * Selects the implementation used to scan the buffers, it is only
+ * meant for testing and benchmarking. NULL reverts to the one
+ * detected from the CPU.
+ **/
+gboolean
+find_crlf_set_implementation(const gchar *name)
+{
+  gint i;
+
+  if (!name)
+    {
+      g_atomic_int_set(&current_implementation, _select_implementation());
+      return TRUE;
+    }
+
+  for (i = 0; i < G_N_ELEMENTS(implementations); i++)
+    {
+      if (strcmp(implementations[i].name, name) == 0)
+        {
+          if (!implementations[i].is_supported())
+            return FALSE;
+          g_atomic_int_set(&current_implementation, i);
+          return TRUE;
+        }
+    }
+  return FALSE;
+}
+
+const gchar *
+find_crlf_get_implementation(void)
+{
+  _get_find_chars();
+  return implementations[g_atomic_int_get(&current_implementation)].name;
+}
+
+/**
+ * Find the first CR, LF or NUL character in a buffer.  It is used to find
+ * these line terminators in syslog traffic, NUL terminates the search
+ * (NULL is returned in that case).
+ *
+ * The buffer is scanned with SSE2/AVX2 instructions where the CPU
+ * supports them.
+ **/
+gchar *
+find_cr_or_lf(gchar *s, gsize n)
+{
+  const gchar *p = _get_find_chars()(s, n, '\r', '\n');
+
+  if (!p || *p == 0)
+    return NULL;
+  return (gchar *) p;
+}
+
+/**
+ * Find the first occurrence of either c or NUL in a buffer.
+ **/
+const gchar *
+find_char_or_nul(const gchar *s, gsize n, gchar c)
+{
+  return _get_find_chars()(s, n, c, c);
+}
@@ -27,5 +27,9 @@
 #include "syslog-ng.h"
 
 gchar *find_cr_or_lf(gchar *s, gsize n);
+const gchar *find_char_or_nul(const gchar *s, gsize n, gchar c);
+
+gboolean find_crlf_set_implementation(const gchar *name);
+const gchar *find_crlf_get_implementation(void);
 
 #endif
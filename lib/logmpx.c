@@ -23,7 +23,184 @@
  */
 
 #include "logmpx.h"
+#include "filter/filter-pipe.h"
+#include "str-utils.h"
 
+/* a NVHandle gets its own hash table only if at least this many branches
+ * could be dispatched using it */
+#define LOG_MULTIPLEXER_DISPATCH_MIN_BRANCHES 4
+#define LOG_MULTIPLEXER_MAX_DISPATCHERS 8
+
+typedef struct _LogMultiplexerDispatch
+{
+  NVHandle handle;
+  /* literal -> GArray of branch indices in ascending order */
+  GHashTable *branches;
+} LogMultiplexerDispatch;
+
+static void
+_branch_indices_free(gpointer s)
+{
+  g_array_free((GArray *) s, TRUE);
+}
+
+static LogMultiplexerDispatch *
+_dispatch_new(NVHandle handle)
+{
+  LogMultiplexerDispatch *self = g_new0(LogMultiplexerDispatch, 1);
+
+  self->handle = handle;
+  self->branches = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _branch_indices_free);
+  return self;
+}
+
+static void
+_dispatch_free(gpointer s)
+{
+  LogMultiplexerDispatch *self = (LogMultiplexerDispatch *) s;
+
+  g_hash_table_destroy(self->branches);
+  g_free(self);
+}
+
+static void
+_dispatch_add_branch(LogMultiplexerDispatch *self, const gchar *literal, gint branch_index)
+{
+  GArray *indices = g_hash_table_lookup(self->branches, literal);
+
+  if (!indices)
+    {
+      indices = g_array_new(FALSE, FALSE, sizeof(gint));
+      g_hash_table_insert(self->branches, g_strdup(literal), indices);
+    }
+
+  /* the same literal may be listed multiple times in a filter */
+  if (indices->len > 0 && g_array_index(indices, gint, indices->len - 1) == branch_index)
+    return;
+  g_array_append_val(indices, branch_index);
+}
+
+static GArray *
+_dispatch_lookup(LogMultiplexerDispatch *self, LogMessage *msg)
+{
+  const gchar *value;
+  gssize len = 0;
+
+  value = log_msg_get_value(msg, self->handle, &len);
+  APPEND_ZERO(value, value, len);
+  return g_hash_table_lookup(self->branches, value);
+}
+
+/* A branch can be skipped based on its literals if the first pipe doing
+ * anything with the message is a filter testing for equality.  Skipping it
+ * is equivalent to the filter dropping the message, except that the
+ * not_matched counters of the filter are not incremented. */
+static gboolean
+_get_branch_literals(LogPipe *branch_head, NVHandle *handle, GPtrArray *literals)
+{
+  LogPipe *p;
+
+  for (p = branch_head; p; p = p->pipe_next)
+    {
+      /* this would turn a dropped message into a matching one */
+      if (p->flags & PIF_DROP_UNMATCHED)
+        return FALSE;
+
+      if (p->queue)
+        {
+          FilterExprNode *expr = log_filter_pipe_get_expr(p);
+
+          return expr && filter_expr_get_literals(expr, handle, literals);
+        }
+    }
+  return FALSE;
+}
+
+static LogMultiplexerDispatch *
+_lookup_dispatcher(LogMultiplexer *self, NVHandle handle, GHashTable *branch_counts)
+{
+  LogMultiplexerDispatch *dispatch;
+  gint i;
+
+  for (i = 0; i < self->dispatchers->len; i++)
+    {
+      dispatch = g_ptr_array_index(self->dispatchers, i);
+      if (dispatch->handle == handle)
+        return dispatch;
+    }
+
+  if (GPOINTER_TO_INT(g_hash_table_lookup(branch_counts, GUINT_TO_POINTER(handle))) < LOG_MULTIPLEXER_DISPATCH_MIN_BRANCHES ||
+      self->dispatchers->len >= LOG_MULTIPLEXER_MAX_DISPATCHERS)
+    return NULL;
+
+  dispatch = _dispatch_new(handle);
+  g_ptr_array_add(self->dispatchers, dispatch);
+  return dispatch;
+}
+
+static void
+_free_dispatchers(LogMultiplexer *self)
+{
+  if (self->dispatchers)
+    g_ptr_array_free(self->dispatchers, TRUE);
+  if (self->undispatched_branches)
+    g_array_free(self->undispatched_branches, TRUE);
+  self->dispatchers = NULL;
+  self->undispatched_branches = NULL;
+}
+
+static void
+_build_dispatchers(LogMultiplexer *self)
+{
+  gint num_branches = self->next_hops->len;
+  NVHandle *handles = g_new0(NVHandle, num_branches);
+  GPtrArray **literals = g_new0(GPtrArray *, num_branches);
+  GHashTable *branch_counts = g_hash_table_new(g_direct_hash, g_direct_equal);
+  gint i, j;
+
+  for (i = 0; i < num_branches; i++)
+    {
+      LogPipe *branch_head = g_ptr_array_index(self->next_hops, i);
+
+      literals[i] = g_ptr_array_new_with_free_func(g_free);
+      if (_get_branch_literals(branch_head, &handles[i], literals[i]) && handles[i])
+        {
+          gpointer key = GUINT_TO_POINTER(handles[i]);
+          gint count = GPOINTER_TO_INT(g_hash_table_lookup(branch_counts, key));
+
+          g_hash_table_insert(branch_counts, key, GINT_TO_POINTER(count + 1));
+        }
+      else
+        {
+          handles[i] = 0;
+        }
+    }
+
+  self->dispatchers = g_ptr_array_new_with_free_func(_dispatch_free);
+  self->undispatched_branches = g_array_new(FALSE, FALSE, sizeof(gint));
+  for (i = 0; i < num_branches; i++)
+    {
+      LogMultiplexerDispatch *dispatch = handles[i] ? _lookup_dispatcher(self, handles[i], branch_counts) : NULL;
+
+      if (dispatch)
+        {
+          for (j = 0; j < literals[i]->len; j++)
+            _dispatch_add_branch(dispatch, g_ptr_array_index(literals[i], j), i);
+        }
+      else
+        {
+          g_array_append_val(self->undispatched_branches, i);
+        }
+      g_ptr_array_free(literals[i], TRUE);
+    }
+
+  if (self->dispatchers->len == 0)
+    _free_dispatchers(self);
+
+  g_hash_table_destroy(branch_counts);
+  g_free(literals);
+  g_free(handles);
+}
 
 void
 log_multiplexer_add_next_hop(LogMultiplexer *self, LogPipe *next_hop)
@@ -52,15 +229,101 @@ log_multiplexer_init(LogPipe *s)
           self->fallback_exists = TRUE;
         }
     }
+
+  _free_dispatchers(self);
+  _build_dispatchers(self);
   return TRUE;
 }
 
 static gboolean
-log_multiplexer_deinit(LogPipe *self)
+log_multiplexer_deinit(LogPipe *s)
 {
+  LogMultiplexer *self = (LogMultiplexer *) s;
+
+  _free_dispatchers(self);
   return TRUE;
 }
 
+/* returns TRUE if the message should not be delivered to further branches */
+static gboolean
+_queue_to_branch(LogPipe *next_hop, gint fallback, LogMessage *msg, LogPathOptions *local_options,
+                 gboolean *delivered)
+{
+  if (G_UNLIKELY(fallback == 0 && (next_hop->flags & PIF_BRANCH_FALLBACK) != 0))
+    {
+      return FALSE;
+    }
+  else if (G_UNLIKELY(fallback && (next_hop->flags & PIF_BRANCH_FALLBACK) == 0))
+    {
+      return FALSE;
+    }
+
+  *local_options->matched = TRUE;
+  log_msg_add_ack(msg, local_options);
+  log_pipe_queue(next_hop, log_msg_ref(msg), local_options);
+
+  if (*local_options->matched)
+    {
+      *delivered = TRUE;
+      if (G_UNLIKELY(next_hop->flags & PIF_BRANCH_FINAL))
+        return TRUE;
+    }
+  return FALSE;
+}
+
+static gint
+_lookup_candidate_branches(LogMultiplexer *self, LogMessage *msg, GArray **candidates)
+{
+  gint num_candidates = 0;
+  gint i;
+
+  candidates[num_candidates++] = self->undispatched_branches;
+  for (i = 0; i < self->dispatchers->len; i++)
+    {
+      GArray *indices = _dispatch_lookup(g_ptr_array_index(self->dispatchers, i), msg);
+
+      if (indices)
+        candidates[num_candidates++] = indices;
+    }
+  return num_candidates;
+}
+
+/* visit the union of the candidate lists in ascending branch order, just
+ * like the plain loop over next_hops would */
+static void
+_queue_to_candidate_branches(LogMultiplexer *self, GArray **candidates, gint num_candidates, gint fallback,
+                             LogMessage *msg, LogPathOptions *local_options, gboolean *delivered)
+{
+  guint cursors[LOG_MULTIPLEXER_MAX_DISPATCHERS + 1] = { 0 };
+
+  while (TRUE)
+    {
+      gint next_branch = -1;
+      gint next_list = -1;
+      gint i;
+
+      for (i = 0; i < num_candidates; i++)
+        {
+          if (cursors[i] < candidates[i]->len)
+            {
+              gint branch = g_array_index(candidates[i], gint, cursors[i]);
+
+              if (next_branch < 0 || branch < next_branch)
+                {
+                  next_branch = branch;
+                  next_list = i;
+                }
+            }
+        }
+      if (next_branch < 0)
+        break;
+      cursors[next_list]++;
+
+      if (_queue_to_branch(g_ptr_array_index(self->next_hops, next_branch), fallback, msg, local_options, delivered))
+        break;
+    }
+}
+
 static void
 log_multiplexer_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options)
 {
@@ -70,35 +333,30 @@ log_multiplexer_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_op
   gboolean matched;
   gboolean delivered = FALSE;
   gint fallback;
+  GArray *candidates[LOG_MULTIPLEXER_MAX_DISPATCHERS + 1];
+  gint num_candidates = 0;
+  /* the debugger wants to see every pipe the message would pass */
+  gboolean dispatch = self->dispatchers && !pipe_single_step_hook;
 
   local_options.matched = &matched;
   if (self->next_hops->len > 1)
     {
       log_msg_write_protect(msg);
     }
+  if (dispatch)
+    num_candidates = _lookup_candidate_branches(self, msg, candidates);
+
   for (fallback = 0; (fallback == 0) || (fallback == 1 && self->fallback_exists && !delivered); fallback++)
     {
-      for (i = 0; i < self->next_hops->len; i++)
+      if (dispatch)
         {
-          LogPipe *next_hop = g_ptr_array_index(self->next_hops, i);
-
-          if (G_UNLIKELY(fallback == 0 && (next_hop->flags & PIF_BRANCH_FALLBACK) != 0))
-            {
-              continue;
-            }
-          else if (G_UNLIKELY(fallback && (next_hop->flags & PIF_BRANCH_FALLBACK) == 0))
-            {
-              continue;
-            }
-
-          matched = TRUE;
-          log_msg_add_ack(msg, &local_options);
-          log_pipe_queue(next_hop, log_msg_ref(msg), &local_options);
-
-          if (matched)
+          _queue_to_candidate_branches(self, candidates, num_candidates, fallback, msg, &local_options, &delivered);
+        }
+      else
+        {
+          for (i = 0; i < self->next_hops->len; i++)
             {
-              delivered = TRUE;
-              if (G_UNLIKELY(next_hop->flags & PIF_BRANCH_FINAL))
+              if (_queue_to_branch(g_ptr_array_index(self->next_hops, i), fallback, msg, &local_options, &delivered))
                 break;
             }
         }
@@ -134,6 +392,7 @@ log_multiplexer_free(LogPipe *s)
 {
   LogMultiplexer *self = (LogMultiplexer *) s;
 
+  _free_dispatchers(self);
   g_ptr_array_free(self->next_hops, TRUE);
   log_pipe_free_method(s);
 }
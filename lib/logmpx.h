@@ -35,12 +35,22 @@
  *
  * This object is used for example for each source to send messages to all
  * log pipelines that refer to the source.
+ *
+ * When many branches start with a filter comparing the same name-value
+ * pair against literals (e.g. program("foo" type(string)) or in-list()),
+ * these branches are collected into a hash table keyed by the literal at
+ * init time, so that only the branches that can match are visited.
  **/
 typedef struct _LogMultiplexer
 {
   LogPipe super;
   GPtrArray *next_hops;
   gboolean fallback_exists;
+
+  /* LogMultiplexerDispatch instances, one for each dispatched NVHandle */
+  GPtrArray *dispatchers;
+  /* indices of branches not covered by dispatchers, in ascending order */
+  GArray *undispatched_branches;
 } LogMultiplexer;
 
 LogMultiplexer *log_multiplexer_new(GlobalConfig *cfg);
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+#include "logmsg/logmsg-allocator.h"
+#include "tls-support.h"
+#include "stats/stats-registry.h"
+#include "stats/stats-cluster-single.h"
+
+/*
+ * LogMessage allocator
+ *
+ * LogMessage instances (together with their preallocated queue nodes and
+ * the initial NVTable) are allocated as a single block, whose size varies
+ * with the message.  Allocating and freeing these blocks with malloc() at
+ * high message rates causes arena lock contention and fragmentation, so we
+ * keep them in power-of-two sized classes and recycle them:
+ *
+ *   - each thread has a free list for each class, allocations and frees
+ *     are served from these without any locking,
+ *
+ *   - messages are often allocated in a source thread and freed in a
+ *     destination thread, so blocks accumulating in a thread are moved to a
+ *     global depot in batches, and threads running out of blocks take a
+ *     batch from there.  The depot is protected by a lock, but it is only
+ *     taken once per batch,
+ *
+ *   - blocks not fitting into any of the classes, and all blocks allocated
+ *     by threads that did not call log_msg_allocator_thread_init(), are
+ *     allocated and freed with g_malloc()/g_free().
+ *
+ * Allocations served from the free lists count as hits, the ones that
+ * needed g_malloc() count as misses.
+ */
+
+#define LOG_MSG_ALLOCATOR_MIN_CLASS_BITS 9
+#define LOG_MSG_ALLOCATOR_MAX_CLASS_BITS 16
+#define LOG_MSG_ALLOCATOR_NUM_CLASSES (LOG_MSG_ALLOCATOR_MAX_CLASS_BITS - LOG_MSG_ALLOCATOR_MIN_CLASS_BITS + 1)
+
+/* the number of bytes moved between a thread and the depot at once */
+#define LOG_MSG_ALLOCATOR_BATCH_BYTES (64 * 1024)
+#define LOG_MSG_ALLOCATOR_DEPOT_MAX_BATCHES 64
+
+/* per-thread hit/miss counts are published in the stats after this many allocations */
+#define LOG_MSG_ALLOCATOR_STATS_FLUSH_PERIOD 1024
+
+typedef struct _FreeBlock FreeBlock;
+struct _FreeBlock
+{
+  FreeBlock *next;
+};
+
+typedef struct _FreeList
+{
+  FreeBlock *blocks;
+  gint count;
+} FreeList;
+
+typedef struct _Depot
+{
+  FreeBlock *batches[LOG_MSG_ALLOCATOR_DEPOT_MAX_BATCHES];
+  gint num_batches;
+} Depot;
+
+TLS_BLOCK_START
+{
+  gboolean msg_allocator_active;
+  FreeList msg_allocator_free_lists[LOG_MSG_ALLOCATOR_NUM_CLASSES];
+  gint msg_allocator_pending_hits;
+  gint msg_allocator_pending_misses;
+}
+TLS_BLOCK_END;
+
+#define msg_allocator_active          __tls_deref(msg_allocator_active)
+#define msg_allocator_free_lists      __tls_deref(msg_allocator_free_lists)
+#define msg_allocator_pending_hits    __tls_deref(msg_allocator_pending_hits)
+#define msg_allocator_pending_misses  __tls_deref(msg_allocator_pending_misses)
+
+G_LOCK_DEFINE_STATIC(msg_allocator_depot);
+static Depot msg_allocator_depots[LOG_MSG_ALLOCATOR_NUM_CLASSES];
+
+StatsCounterItem *stats_msg_allocator_hits;
+StatsCounterItem *stats_msg_allocator_misses;
+
+static inline guint8
+_get_class(gsize size)
+{
+  gint bits;
+
+  if (size > (1 << LOG_MSG_ALLOCATOR_MAX_CLASS_BITS))
+    return LOG_MSG_ALLOCATOR_NO_CLASS;
+
+  bits = size > 1 ? g_bit_storage(size - 1) : 0;
+  if (bits < LOG_MSG_ALLOCATOR_MIN_CLASS_BITS)
+    return 0;
+  return bits - LOG_MSG_ALLOCATOR_MIN_CLASS_BITS;
+}
+
+static inline gsize
+_get_class_size(guint8 alloc_class)
+{
+  return ((gsize) 1) << (alloc_class + LOG_MSG_ALLOCATOR_MIN_CLASS_BITS);
+}
+
+static inline gint
+_get_batch_size(guint8 alloc_class)
+{
+  return MAX(LOG_MSG_ALLOCATOR_BATCH_BYTES / _get_class_size(alloc_class), 4);
+}
+
+static void
+_free_blocks(FreeBlock *blocks)
+{
+  while (blocks)
+    {
+      FreeBlock *next = blocks->next;
+
+      g_free(blocks);
+      blocks = next;
+    }
+}
+
+/* detaches a batch from the head of the free list and moves it to the depot */
+static void
+_release_batch(guint8 alloc_class, FreeList *free_list)
+{
+  Depot *depot = &msg_allocator_depots[alloc_class];
+  gint batch_size = _get_batch_size(alloc_class);
+  FreeBlock *batch = free_list->blocks;
+  FreeBlock *last = batch;
+
+  for (gint i = 1; i < batch_size; i++)
+    last = last->next;
+  free_list->blocks = last->next;
+  free_list->count -= batch_size;
+  last->next = NULL;
+
+  G_LOCK(msg_allocator_depot);
+  if (depot->num_batches < LOG_MSG_ALLOCATOR_DEPOT_MAX_BATCHES)
+    {
+      depot->batches[depot->num_batches++] = batch;
+      batch = NULL;
+    }
+  G_UNLOCK(msg_allocator_depot);
+
+  _free_blocks(batch);
+}
+
+static void
+_acquire_batch(guint8 alloc_class, FreeList *free_list)
+{
+  Depot *depot = &msg_allocator_depots[alloc_class];
+  FreeBlock *batch = NULL;
+
+  G_LOCK(msg_allocator_depot);
+  if (depot->num_batches > 0)
+    batch = depot->batches[--depot->num_batches];
+  G_UNLOCK(msg_allocator_depot);
+
+  if (batch)
+    {
+      free_list->blocks = batch;
+      free_list->count = _get_batch_size(alloc_class);
+    }
+}
+
+static inline void
+_account_allocation(gboolean hit)
+{
+  if (hit)
+    msg_allocator_pending_hits++;
+  else
+    msg_allocator_pending_misses++;
+
+  if (msg_allocator_pending_hits + msg_allocator_pending_misses >= LOG_MSG_ALLOCATOR_STATS_FLUSH_PERIOD)
+    log_msg_allocator_flush_stats();
+}
+
+/*
+ * Allocates a block of at least @size bytes.  The actual size of the block
+ * is returned in @block_size, the caller is free to use all of it.
+ * @alloc_class has to be passed back to log_msg_allocator_free().
+ */
+gpointer
+log_msg_allocator_alloc(gsize size, gsize *block_size, guint8 *alloc_class)
+{
+  guint8 cls = _get_class(size);
+  FreeList *free_list;
+  FreeBlock *block;
+
+  if (!msg_allocator_active || cls == LOG_MSG_ALLOCATOR_NO_CLASS)
+    {
+      if (msg_allocator_active)
+        _account_allocation(FALSE);
+      *block_size = size;
+      *alloc_class = LOG_MSG_ALLOCATOR_NO_CLASS;
+      return g_malloc(size);
+    }
+
+  *block_size = _get_class_size(cls);
+  *alloc_class = cls;
+
+  free_list = &msg_allocator_free_lists[cls];
+  if (!free_list->blocks)
+    _acquire_batch(cls, free_list);
+
+  block = free_list->blocks;
+  if (!block)
+    {
+      _account_allocation(FALSE);
+      return g_malloc(*block_size);
+    }
+
+  free_list->blocks = block->next;
+  free_list->count--;
+  _account_allocation(TRUE);
+  return block;
+}
+
+void
+log_msg_allocator_free(gpointer block, guint8 alloc_class)
+{
+  FreeList *free_list;
+  FreeBlock *free_block = (FreeBlock *) block;
+
+  if (alloc_class == LOG_MSG_ALLOCATOR_NO_CLASS || !msg_allocator_active)
+    {
+      g_free(block);
+      return;
+    }
+
+  free_list = &msg_allocator_free_lists[alloc_class];
+  free_block->next = free_list->blocks;
+  free_list->blocks = free_block;
+  free_list->count++;
+
+  /* keep one batch around for the allocations of this thread, pass the rest on */
+  if (free_list->count >= 2 * _get_batch_size(alloc_class))
+    _release_batch(alloc_class, free_list);
+}
+
+void
+log_msg_allocator_flush_stats(void)
+{
+  stats_counter_add(stats_msg_allocator_hits, msg_allocator_pending_hits);
+  stats_counter_add(stats_msg_allocator_misses, msg_allocator_pending_misses);
+  msg_allocator_pending_hits = 0;
+  msg_allocator_pending_misses = 0;
+}
+
+void
+log_msg_allocator_thread_init(void)
+{
+  msg_allocator_active = TRUE;
+}
+
+void
+log_msg_allocator_thread_deinit(void)
+{
+  if (!msg_allocator_active)
+    return;
+
+  for (guint8 cls = 0; cls < LOG_MSG_ALLOCATOR_NUM_CLASSES; cls++)
+    {
+      FreeList *free_list = &msg_allocator_free_lists[cls];
+
+      while (free_list->count >= _get_batch_size(cls))
+        _release_batch(cls, free_list);
+      _free_blocks(free_list->blocks);
+      free_list->blocks = NULL;
+      free_list->count = 0;
+    }
+  log_msg_allocator_flush_stats();
+  msg_allocator_active = FALSE;
+}
+
+void
+log_msg_allocator_register_stats(void)
+{
+  StatsClusterKey sc_key;
+
+  stats_lock();
+  stats_cluster_single_key_set(&sc_key, SCS_GLOBAL, "msg_allocator_hits", NULL);
+  stats_register_counter(1, &sc_key, SC_TYPE_SINGLE_VALUE, &stats_msg_allocator_hits);
+  stats_cluster_single_key_set(&sc_key, SCS_GLOBAL, "msg_allocator_misses", NULL);
+  stats_register_counter(1, &sc_key, SC_TYPE_SINGLE_VALUE, &stats_msg_allocator_misses);
+  stats_unlock();
+}
+
+void
+log_msg_allocator_global_deinit(void)
+{
+  G_LOCK(msg_allocator_depot);
+  for (gint cls = 0; cls < LOG_MSG_ALLOCATOR_NUM_CLASSES; cls++)
+    {
+      Depot *depot = &msg_allocator_depots[cls];
+
+      while (depot->num_batches > 0)
+        _free_blocks(depot->batches[--depot->num_batches]);
+    }
+  G_UNLOCK(msg_allocator_depot);
+}
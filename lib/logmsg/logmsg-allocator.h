@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef LOGMSG_ALLOCATOR_H_INCLUDED
+#define LOGMSG_ALLOCATOR_H_INCLUDED
+
+#include "syslog-ng.h"
+#include "stats/stats-counter.h"
+
+/* returned as the allocation class of blocks that were not allocated from a slab */
+#define LOG_MSG_ALLOCATOR_NO_CLASS 0xFF
+
+gpointer log_msg_allocator_alloc(gsize size, gsize *block_size, guint8 *alloc_class);
+void log_msg_allocator_free(gpointer block, guint8 alloc_class);
+
+void log_msg_allocator_thread_init(void);
+void log_msg_allocator_thread_deinit(void);
+void log_msg_allocator_flush_stats(void);
+
+void log_msg_allocator_register_stats(void);
+void log_msg_allocator_global_deinit(void);
+
+/* accessed by the test program */
+extern StatsCounterItem *stats_msg_allocator_hits;
+extern StatsCounterItem *stats_msg_allocator_misses;
+
+#endif
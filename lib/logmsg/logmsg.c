@@ -29,6 +29,7 @@
 #include "logpipe.h"
 #include "timeutils.h"
 #include "logmsg/nvtable.h"
+#include "logmsg/logmsg-allocator.h"
 #include "stats/stats-registry.h"
 #include "stats/stats-cluster-single.h"
 #include "template/templates.h"
@@ -133,6 +134,8 @@ TLS_BLOCK_START
   gboolean logmsg_cached_abort;
   /* suspend flag in the current thread for acks */
   gboolean logmsg_cached_suspend;
+  /* moving average of the payload size of the messages freed by the current thread */
+  gint logmsg_payload_size_average;
 }
 TLS_BLOCK_END;
 
@@ -142,6 +145,7 @@ TLS_BLOCK_END;
 #define logmsg_cached_ack_needed    __tls_deref(logmsg_cached_ack_needed)
 #define logmsg_cached_abort         __tls_deref(logmsg_cached_abort)
 #define logmsg_cached_suspend       __tls_deref(logmsg_cached_suspend)
+#define logmsg_payload_size_average __tls_deref(logmsg_payload_size_average)
 
 #define LOGMSG_REFCACHE_SUSPEND_SHIFT                 31 /* number of bits to shift to get the SUSPEND flag */
 #define LOGMSG_REFCACHE_SUSPEND_MASK          0x80000000 /* bit mask to extract the SUSPEND flag */
@@ -204,6 +208,19 @@ NVRegistry *logmsg_registry;
 const char logmsg_sd_prefix[] = ".SDATA.";
 const gint logmsg_sd_prefix_len = sizeof(logmsg_sd_prefix) - 1;
 gint logmsg_queue_node_max = 1;
+
+#define LOGMSG_PAYLOAD_SIZE_HINT_MIN 256
+#define LOGMSG_PAYLOAD_SIZE_HINT_MAX (16 * 1024)
+#define LOGMSG_PAYLOAD_SIZE_HINT_WEIGHT 16
+#define LOGMSG_PAYLOAD_SIZE_HINT_ALIGN 256
+
+/* moving average of the payload size of the messages we've freed, used to
+ * size the payload of new messages, so that they don't need to grow it by
+ * reallocation.  Each thread keeps its own average and publishes it here
+ * rounded up, so this is only written when the rounded value changes.  It
+ * is updated from parallel threads without locking. */
+static gint logmsg_payload_size_hint = LOGMSG_PAYLOAD_SIZE_HINT_MIN;
+
 /* statistics */
 static StatsCounterItem *count_msg_clones;
 static StatsCounterItem *count_payload_reallocs;
@@ -1130,12 +1147,36 @@ log_msg_clear(LogMessage *self)
   self->flags |= LF_STATE_OWN_MASK;
 }
 
+static inline gsize
+log_msg_get_payload_size_hint(void)
+{
+  return (volatile gint) logmsg_payload_size_hint;
+}
+
+static inline void
+log_msg_update_payload_size_hint(NVTable *payload)
+{
+  gint average = logmsg_payload_size_average;
+  gint hint;
+
+  if (!average)
+    average = LOGMSG_PAYLOAD_SIZE_HINT_MIN;
+  average += ((gint) payload->used - average) / LOGMSG_PAYLOAD_SIZE_HINT_WEIGHT;
+  average = CLAMP(average, LOGMSG_PAYLOAD_SIZE_HINT_MIN, LOGMSG_PAYLOAD_SIZE_HINT_MAX);
+  logmsg_payload_size_average = average;
+
+  hint = (average + LOGMSG_PAYLOAD_SIZE_HINT_ALIGN - 1) & ~(LOGMSG_PAYLOAD_SIZE_HINT_ALIGN - 1);
+  if (hint != (volatile gint) logmsg_payload_size_hint)
+    logmsg_payload_size_hint = hint;
+}
+
 static inline LogMessage *
 log_msg_alloc(gsize payload_size)
 {
   LogMessage *msg;
   gsize payload_space = payload_size ? nv_table_get_alloc_size(LM_V_MAX, 16, payload_size) : 0;
-  gsize alloc_size, payload_ofs = 0;
+  gsize alloc_size, block_size, payload_ofs = 0;
+  guint8 alloc_class;
 
   /* NOTE: logmsg_node_max is updated from parallel threads without locking. */
   gint nodes = (volatile gint) logmsg_queue_node_max;
@@ -1148,15 +1189,17 @@ log_msg_alloc(gsize payload_size)
       payload_ofs = alloc_size;
       alloc_size += payload_space;
     }
-  msg = g_malloc(alloc_size);
+  msg = log_msg_allocator_alloc(alloc_size, &block_size, &alloc_class);
 
   memset(msg, 0, sizeof(LogMessage));
 
+  /* the allocator may round up the size, let the payload use the rest */
   if (payload_size)
-    msg->payload = nv_table_init_borrowed(((gchar *) msg) + payload_ofs, payload_space, LM_V_MAX);
+    msg->payload = nv_table_init_borrowed(((gchar *) msg) + payload_ofs, block_size - payload_ofs, LM_V_MAX);
 
   msg->num_nodes = nodes;
-  msg->allocated_bytes = alloc_size + payload_space;
+  msg->alloc_class = alloc_class;
+  msg->allocated_bytes = block_size;
   stats_counter_add(count_allocated_bytes, msg->allocated_bytes);
   return msg;
 }
@@ -1204,12 +1247,14 @@ log_msg_clone_cow(LogMessage *msg, const LogPathOptions *path_options)
 {
   LogMessage *self = log_msg_alloc(0);
   gsize allocated_bytes = self->allocated_bytes;
+  guint8 alloc_class = self->alloc_class;
 
   stats_counter_inc(count_msg_clones);
   log_msg_write_protect(msg);
 
   memcpy(self, msg, sizeof(*msg));
-  msg->allocated_bytes = allocated_bytes;
+  self->allocated_bytes = allocated_bytes;
+  self->alloc_class = alloc_class;
 
   msg_debug("Message was cloned",
             evt_tag_printf("original_msg", "%p", msg),
@@ -1252,7 +1297,7 @@ _determine_payload_size(gint length, MsgFormatOptions *parse_options)
   else
     payload_size = length * 2;
 
-  return MAX(payload_size, 256);
+  return MAX(payload_size, log_msg_get_payload_size_hint());
 }
 
 /**
@@ -1288,7 +1333,7 @@ log_msg_new(const gchar *msg, gint length,
 LogMessage *
 log_msg_new_empty(void)
 {
-  LogMessage *self = log_msg_alloc(256);
+  LogMessage *self = log_msg_alloc(log_msg_get_payload_size_hint());
 
   log_msg_init(self, NULL);
   return self;
@@ -1360,7 +1405,10 @@ static void
 log_msg_free(LogMessage *self)
 {
   if (log_msg_chk_flag(self, LF_STATE_OWN_PAYLOAD) && self->payload)
-    nv_table_unref(self->payload);
+    {
+      log_msg_update_payload_size_hint(self->payload);
+      nv_table_unref(self->payload);
+    }
   if (log_msg_chk_flag(self, LF_STATE_OWN_TAGS) && self->tags && self->num_tags > 0)
     g_free(self->tags);
 
@@ -1374,7 +1422,7 @@ log_msg_free(LogMessage *self)
 
   stats_counter_sub(count_allocated_bytes, self->allocated_bytes);
 
-  g_free(self);
+  log_msg_allocator_free(self, self->alloc_class);
 }
 
 /**
@@ -1807,6 +1855,18 @@ log_msg_global_init(void)
   log_msg_registry_init();
 }
 
+void
+log_msg_thread_init(void)
+{
+  log_msg_allocator_thread_init();
+}
+
+void
+log_msg_thread_deinit(void)
+{
+  log_msg_allocator_thread_deinit();
+}
+
 void
 log_msg_stats_global_init(void)
 {
@@ -1824,6 +1884,8 @@ log_msg_stats_global_init(void)
   stats_cluster_single_key_set(&sc_key, SCS_GLOBAL, "msg_allocated_bytes", NULL);
   stats_register_counter(1, &sc_key, SC_TYPE_SINGLE_VALUE, &count_allocated_bytes);
   stats_unlock();
+
+  log_msg_allocator_register_stats();
 }
 
 const gchar *
@@ -1836,6 +1898,7 @@ void
 log_msg_global_deinit(void)
 {
   log_msg_registry_deinit();
+  log_msg_allocator_global_deinit();
 }
 
 gint
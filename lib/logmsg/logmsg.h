@@ -203,6 +203,8 @@ struct _LogMessage
   guint8 num_nodes;
   guint8 cur_node;
   guint8 protect_cnt;
+  /* the size class the LogMessage was allocated from, see logmsg-allocator.c */
+  guint8 alloc_class;
 
   guint64 rcptid;
 
@@ -350,6 +352,8 @@ void log_msg_registry_init(void);
 void log_msg_registry_deinit(void);
 void log_msg_global_init(void);
 void log_msg_global_deinit(void);
+void log_msg_thread_init(void);
+void log_msg_thread_deinit(void);
 void log_msg_stats_global_init(void);
 void log_msg_registry_foreach(GHFunc func, gpointer user_data);
 
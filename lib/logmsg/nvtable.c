@@ -31,32 +31,140 @@ GStaticMutex nv_registry_lock = G_STATIC_MUTEX_INIT;
 
 const gchar *null_string = "";
 
+/*
+ * NVRegistryNameMap
+ *
+ * Names are looked up on every log_msg_set_value_by_name() call from all
+ * worker threads, while new names are registered rarely, so the name ->
+ * handle map is an insert-only open addressing hash table that can be read
+ * without taking nv_registry_lock:
+ *
+ *   - an entry is filled in first and its name pointer is published
+ *     last, so readers either see a complete entry or an empty slot,
+ *
+ *   - when the table becomes half full, a new one with twice the size is
+ *     built and published.  Readers may still use the old one, so it is
+ *     only freed together with the registry (its size is less than the
+ *     size of the current one).
+ *
+ * Readers that don't find a name take the lock and look it up again before
+ * registering it.  The map owns the names, the handle descriptors point to
+ * the same strings.
+ */
+typedef struct _NVRegistryNameMapEntry
+{
+  const gchar *name;
+  guint hash;
+  NVHandle handle;
+} NVRegistryNameMapEntry;
+
+struct _NVRegistryNameMap
+{
+  guint size;
+  guint used;
+  NVRegistryNameMapEntry entries[0];
+};
+
+#define NV_REGISTRY_NAME_MAP_INITIAL_SIZE (2 * NVHANDLE_DESC_ARRAY_INITIAL_SIZE)
+
+static NVRegistryNameMap *
+nv_registry_name_map_new(guint size)
+{
+  NVRegistryNameMap *self = g_malloc0(sizeof(NVRegistryNameMap) + size * sizeof(NVRegistryNameMapEntry));
+
+  self->size = size;
+  return self;
+}
+
+static NVRegistryNameMapEntry *
+nv_registry_name_map_find_entry(NVRegistryNameMap *self, const gchar *name, guint hash)
+{
+  guint mask = self->size - 1;
+  guint i;
+
+  for (i = hash & mask; ; i = (i + 1) & mask)
+    {
+      NVRegistryNameMapEntry *entry = &self->entries[i];
+      const gchar *entry_name = g_atomic_pointer_get(&entry->name);
+
+      if (!entry_name || (entry->hash == hash && strcmp(entry_name, name) == 0))
+        return entry;
+    }
+}
+
+static NVHandle
+nv_registry_name_map_lookup(NVRegistryNameMap *self, const gchar *name)
+{
+  NVRegistryNameMapEntry *entry = nv_registry_name_map_find_entry(self, name, g_str_hash(name));
+
+  if (!g_atomic_pointer_get(&entry->name))
+    return 0;
+  return g_atomic_int_get(&entry->handle);
+}
+
+/* stores name (taking ownership) or updates its handle, the table must have room for it */
+static void
+nv_registry_name_map_store(NVRegistryNameMap *self, gchar *name, guint hash, NVHandle handle)
+{
+  NVRegistryNameMapEntry *entry = nv_registry_name_map_find_entry(self, name, hash);
+
+  if (entry->name)
+    {
+      g_atomic_int_set(&entry->handle, handle);
+      g_free(name);
+      return;
+    }
+  entry->hash = hash;
+  entry->handle = handle;
+  g_atomic_pointer_set(&entry->name, name);
+  self->used++;
+}
+
+/* must be called with nv_registry_lock held */
+static void
+nv_registry_insert_name(NVRegistry *self, gchar *name, NVHandle handle)
+{
+  NVRegistryNameMap *name_map = self->name_map;
+
+  if ((name_map->used + 1) * 2 > name_map->size)
+    {
+      NVRegistryNameMap *new_map = nv_registry_name_map_new(name_map->size * 2);
+
+      for (guint i = 0; i < name_map->size; i++)
+        {
+          NVRegistryNameMapEntry *entry = &name_map->entries[i];
+
+          if (entry->name)
+            nv_registry_name_map_store(new_map, (gchar *) entry->name, entry->hash, entry->handle);
+        }
+      g_atomic_pointer_set(&self->name_map, new_map);
+      g_ptr_array_add(self->old_name_maps, name_map);
+      name_map = new_map;
+    }
+  nv_registry_name_map_store(name_map, name, g_str_hash(name), handle);
+}
+
 NVHandle
 nv_registry_get_handle(NVRegistry *self, const gchar *name)
 {
-  gpointer p;
-
-  p = g_hash_table_lookup(self->name_map, name);
-  if (p)
-    return GPOINTER_TO_UINT(p);
-  return 0;
+  return nv_registry_name_map_lookup(g_atomic_pointer_get(&self->name_map), name);
 }
 
 NVHandle
 nv_registry_alloc_handle(NVRegistry *self, const gchar *name)
 {
-  gpointer p;
   NVHandleDesc stored;
   gsize len;
-  NVHandle res = 0;
+  NVHandle res;
+
+  res = nv_registry_get_handle(self, name);
+  if (res)
+    return res;
 
   g_static_mutex_lock(&nv_registry_lock);
-  p = g_hash_table_lookup(self->name_map, name);
-  if (p)
-    {
-      res = GPOINTER_TO_UINT(p);
-      goto exit;
-    }
+  res = nv_registry_name_map_lookup(self->name_map, name);
+  if (res)
+    goto exit;
 
   len = strlen(name);
   if (len == 0)
@@ -85,8 +193,8 @@ nv_registry_alloc_handle(NVRegistry *self, const gchar *name)
   stored.name_len = len;
   stored.name = g_strdup(name);
   nvhandle_desc_array_append(self->names, &stored);
-  g_hash_table_insert(self->name_map, stored.name, GUINT_TO_POINTER(self->names->len));
   res = self->names->len;
+  nv_registry_insert_name(self, stored.name, res);
 exit:
   g_static_mutex_unlock(&nv_registry_lock);
   return res;
@@ -101,7 +209,7 @@ void
 nv_registry_add_alias(NVRegistry *self, NVHandle handle, const gchar *alias)
 {
   g_static_mutex_lock(&nv_registry_lock);
-  g_hash_table_insert(self->name_map, g_strdup(alias), GUINT_TO_POINTER((glong) handle));
+  nv_registry_insert_name(self, g_strdup(alias), handle);
   g_static_mutex_unlock(&nv_registry_lock);
 }
 
@@ -120,7 +228,16 @@ nv_registry_set_handle_flags(NVRegistry *self, NVHandle handle, guint16 flags)
 void
 nv_registry_foreach(NVRegistry *self, GHFunc callback, gpointer user_data)
 {
-  g_hash_table_foreach(self->name_map, callback, user_data);
+  NVRegistryNameMap *name_map = g_atomic_pointer_get(&self->name_map);
+
+  for (guint i = 0; i < name_map->size; i++)
+    {
+      NVRegistryNameMapEntry *entry = &name_map->entries[i];
+      const gchar *name = g_atomic_pointer_get(&entry->name);
+
+      if (name)
+        callback((gpointer) name, GUINT_TO_POINTER(g_atomic_int_get(&entry->handle)), user_data);
+    }
 }
 
 NVRegistry *
@@ -130,7 +247,8 @@ nv_registry_new(const gchar **static_names, guint32 nvhandle_max_value)
   gint i;
 
   self->nvhandle_max_value = nvhandle_max_value;
-  self->name_map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  self->name_map = nv_registry_name_map_new(NV_REGISTRY_NAME_MAP_INITIAL_SIZE);
+  self->old_name_maps = g_ptr_array_new_with_free_func(g_free);
   self->names = nvhandle_desc_array_new(NVHANDLE_DESC_ARRAY_INITIAL_SIZE);
   for (i = 0; static_names[i]; i++)
     {
@@ -143,7 +261,10 @@ void
 nv_registry_free(NVRegistry *self)
 {
   nvhandle_desc_array_free(self->names);
-  g_hash_table_destroy(self->name_map);
+  for (guint i = 0; i < self->name_map->size; i++)
+    g_free((gchar *) self->name_map->entries[i].name);
+  g_free(self->name_map);
+  g_ptr_array_free(self->old_name_maps, TRUE);
   g_free(self);
 }
 
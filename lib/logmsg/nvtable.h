@@ -30,6 +30,7 @@
 
 typedef struct _NVTable NVTable;
 typedef struct _NVRegistry NVRegistry;
+typedef struct _NVRegistryNameMap NVRegistryNameMap;
 typedef struct _NVIndexEntry NVIndexEntry;
 typedef struct _NVEntry NVEntry;
 typedef guint32 NVHandle;
@@ -60,7 +61,9 @@ struct _NVRegistry
   /* number of static names that are statically allocated in each payload */
   gint num_static_names;
   NVHandleDescArray *names;
-  GHashTable *name_map;
+  /* name -> handle map, lookups need no locking, see nvtable.c */
+  NVRegistryNameMap *name_map;
+  GPtrArray *old_name_maps;
   guint32 nvhandle_max_value;
 };
 
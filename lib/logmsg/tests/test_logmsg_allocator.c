@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include <criterion/criterion.h>
+
+#include "logmsg/logmsg-allocator.h"
+#include "logmsg/logmsg.h"
+#include "apphook.h"
+#include "stats/stats.h"
+
+#define NUM_BLOCKS 1000
+
+static gsize
+_get_hits(void)
+{
+  log_msg_allocator_flush_stats();
+  return stats_counter_get(stats_msg_allocator_hits);
+}
+
+static gsize
+_get_misses(void)
+{
+  log_msg_allocator_flush_stats();
+  return stats_counter_get(stats_msg_allocator_misses);
+}
+
+Test(logmsg_allocator, blocks_are_rounded_up_to_their_class)
+{
+  gsize block_size;
+  guint8 alloc_class;
+  gpointer block;
+
+  block = log_msg_allocator_alloc(1, &block_size, &alloc_class);
+  cr_assert_eq(block_size, 512);
+  log_msg_allocator_free(block, alloc_class);
+
+  block = log_msg_allocator_alloc(1000, &block_size, &alloc_class);
+  cr_assert_eq(block_size, 1024);
+  memset(block, 'x', block_size);
+  log_msg_allocator_free(block, alloc_class);
+
+  block = log_msg_allocator_alloc(65536, &block_size, &alloc_class);
+  cr_assert_eq(block_size, 65536);
+  log_msg_allocator_free(block, alloc_class);
+
+  block = log_msg_allocator_alloc(65537, &block_size, &alloc_class);
+  cr_assert_eq(block_size, 65537);
+  cr_assert_eq(alloc_class, LOG_MSG_ALLOCATOR_NO_CLASS);
+  log_msg_allocator_free(block, alloc_class);
+}
+
+Test(logmsg_allocator, freed_blocks_are_reused)
+{
+  gpointer blocks[NUM_BLOCKS];
+  gsize block_size, hits, misses;
+  guint8 alloc_class;
+
+  for (gint i = 0; i < NUM_BLOCKS; i++)
+    blocks[i] = log_msg_allocator_alloc(2000, &block_size, &alloc_class);
+  for (gint i = 0; i < NUM_BLOCKS; i++)
+    log_msg_allocator_free(blocks[i], alloc_class);
+
+  hits = _get_hits();
+  misses = _get_misses();
+  for (gint i = 0; i < NUM_BLOCKS; i++)
+    blocks[i] = log_msg_allocator_alloc(2000, &block_size, &alloc_class);
+  for (gint i = 0; i < NUM_BLOCKS; i++)
+    log_msg_allocator_free(blocks[i], alloc_class);
+
+  /* the blocks not kept by the thread go to the depot, which is large enough for them */
+  cr_assert_eq(_get_hits() - hits, NUM_BLOCKS);
+  cr_assert_eq(_get_misses(), misses);
+}
+
+static gpointer
+_free_blocks_thread(gpointer user_data)
+{
+  gpointer *blocks = (gpointer *) user_data;
+  gsize block_size;
+  guint8 alloc_class;
+
+  log_msg_allocator_thread_init();
+  /* get the alloc_class of the blocks */
+  log_msg_allocator_free(log_msg_allocator_alloc(3000, &block_size, &alloc_class), alloc_class);
+  for (gint i = 0; i < NUM_BLOCKS; i++)
+    log_msg_allocator_free(blocks[i], alloc_class);
+  log_msg_allocator_thread_deinit();
+  return NULL;
+}
+
+Test(logmsg_allocator, blocks_freed_by_other_threads_are_reused)
+{
+  gpointer blocks[NUM_BLOCKS];
+  gsize block_size, misses;
+  guint8 alloc_class;
+
+  for (gint i = 0; i < NUM_BLOCKS; i++)
+    blocks[i] = log_msg_allocator_alloc(3000, &block_size, &alloc_class);
+  g_thread_join(g_thread_create(_free_blocks_thread, blocks, TRUE, NULL));
+
+  misses = _get_misses();
+  for (gint i = 0; i < NUM_BLOCKS / 2; i++)
+    blocks[i] = log_msg_allocator_alloc(3000, &block_size, &alloc_class);
+  cr_assert_eq(_get_misses(), misses);
+  for (gint i = 0; i < NUM_BLOCKS / 2; i++)
+    log_msg_allocator_free(blocks[i], alloc_class);
+}
+
+Test(logmsg_allocator, messages_are_allocated_from_the_slabs)
+{
+  LogMessage *msg;
+  gsize hits;
+
+  log_msg_unref(log_msg_new_empty());
+
+  hits = _get_hits();
+  msg = log_msg_new_empty();
+  cr_assert_eq(_get_hits() - hits, 1);
+  cr_assert_neq(msg->alloc_class, LOG_MSG_ALLOCATOR_NO_CLASS);
+
+  /* the payload uses the space the allocator rounded up */
+  cr_assert_geq(msg->allocated_bytes, msg->payload->size);
+  log_msg_set_value(msg, LM_V_MESSAGE, "foobar", -1);
+  cr_assert_str_eq(log_msg_get_value(msg, LM_V_MESSAGE, NULL), "foobar");
+  log_msg_unref(msg);
+}
+
+static StatsOptions stats_options;
+
+static void
+setup(void)
+{
+  app_startup();
+
+  /* the allocator counters are only registered at stats level 1 */
+  stats_options_defaults(&stats_options);
+  stats_options.level = 1;
+  stats_reinit(&stats_options);
+  log_msg_allocator_register_stats();
+}
+
+static void
+teardown(void)
+{
+  app_shutdown();
+}
+
+TestSuite(logmsg_allocator, .init = setup, .fini = teardown);
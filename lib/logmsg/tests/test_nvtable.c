@@ -140,6 +140,73 @@ Test(nvtable, test_nv_registry)
   nv_registry_free(reg);
 }
 
+#define TEST_CONCURRENT_THREADS 8
+#define TEST_CONCURRENT_NAMES 5000
+
+static gpointer
+_alloc_handles_thread(gpointer user_data)
+{
+  NVRegistry *reg = ((gpointer *) user_data)[0];
+  NVHandle *handles = ((gpointer *) user_data)[1];
+  gchar name[16];
+
+  /* every thread registers the same names, in a different order */
+  for (gint i = 0; i < TEST_CONCURRENT_NAMES; i++)
+    {
+      gint n = (i * 7 + GPOINTER_TO_INT(((gpointer *) user_data)[2])) % TEST_CONCURRENT_NAMES;
+
+      g_snprintf(name, sizeof(name), "name%d", n);
+      handles[n] = nv_registry_alloc_handle(reg, name);
+    }
+  return NULL;
+}
+
+static void
+_count_names(gpointer key, gpointer value, gpointer user_data)
+{
+  (*(gint *) user_data)++;
+}
+
+Test(nvtable, test_nv_registry_concurrent_allocations)
+{
+  const gchar *builtins[] = { "BUILTIN1", NULL };
+  NVRegistry *reg = nv_registry_new(builtins, NVHANDLE_MAX_VALUE);
+  NVHandle handles[TEST_CONCURRENT_THREADS][TEST_CONCURRENT_NAMES];
+  gpointer args[TEST_CONCURRENT_THREADS][3];
+  GThread *threads[TEST_CONCURRENT_THREADS];
+  gint num_names = 0;
+
+  for (gint t = 0; t < TEST_CONCURRENT_THREADS; t++)
+    {
+      args[t][0] = reg;
+      args[t][1] = handles[t];
+      args[t][2] = GINT_TO_POINTER(t * 1000);
+      threads[t] = g_thread_create(_alloc_handles_thread, args[t], TRUE, NULL);
+    }
+  for (gint t = 0; t < TEST_CONCURRENT_THREADS; t++)
+    g_thread_join(threads[t]);
+
+  for (gint i = 0; i < TEST_CONCURRENT_NAMES; i++)
+    {
+      gchar name[16];
+
+      g_snprintf(name, sizeof(name), "name%d", i);
+      cr_assert_neq(handles[0][i], 0);
+      cr_assert_str_eq(nv_registry_get_handle_name(reg, handles[0][i], NULL), name);
+      cr_assert_eq(nv_registry_get_handle(reg, name), handles[0][i]);
+      for (gint t = 1; t < TEST_CONCURRENT_THREADS; t++)
+        cr_assert_eq(handles[t][i], handles[0][i], "handle mismatch for %s", name);
+    }
+  cr_assert_eq(reg->names->len, TEST_CONCURRENT_NAMES + 1);
+
+  nv_registry_add_alias(reg, handles[0][0], "alias0");
+  cr_assert_eq(nv_registry_get_handle(reg, "alias0"), handles[0][0]);
+  nv_registry_foreach(reg, _count_names, &num_names);
+  cr_assert_eq(num_names, TEST_CONCURRENT_NAMES + 2);
+
+  nv_registry_free(reg);
+}
+
 /*
  *  - NVTable direct values
  *    - set/get static NV entries
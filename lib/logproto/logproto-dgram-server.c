@@ -23,6 +23,9 @@
  */
 #include "logproto-dgram-server.h"
 #include "logproto-buffered-server.h"
+#include "messages.h"
+
+#include <errno.h>
 
 /* proto that reads the input in datagrams (e.g. the underlying transport
  * determines record sizes, such as UDP) */
@@ -48,6 +51,46 @@ log_proto_dgram_server_fetch_from_buffer(LogProtoBufferedServer *s, const guchar
   return TRUE;
 }
 
+static LogProtoPrepareAction
+log_proto_dgram_server_prepare(LogProtoServer *s, GIOCondition *cond, gint *timeout)
+{
+  /* datagrams already received by a batching transport would not wake up
+   * poll(), so make sure they get fetched */
+  if (log_transport_has_pending_datagrams(s->transport))
+    return LPPA_FORCE_SCHEDULE_FETCH;
+
+  return log_proto_buffered_server_prepare(s, cond, timeout);
+}
+
+/* zero-copy path: hand out datagrams right from the transport's buffers,
+ * used when no character set conversion is needed */
+static LogProtoStatus
+log_proto_dgram_server_fetch_datagram(LogProtoServer *s, const guchar **msg, gsize *msg_len, gboolean *may_read,
+                                      LogTransportAuxData *aux, Bookmark *bookmark)
+{
+  gssize rc;
+
+  if (!(*may_read))
+    return LPS_SUCCESS;
+
+  rc = log_transport_read_datagram(s->transport, msg, s->options->init_buffer_size, aux);
+  if (rc < 0)
+    {
+      *msg = NULL;
+      if (errno == EAGAIN)
+        return LPS_SUCCESS;
+
+      msg_error("I/O error occurred while reading",
+                evt_tag_int(EVT_TAG_FD, s->transport->fd),
+                evt_tag_error(EVT_TAG_OSERROR));
+      s->status = LPS_ERROR;
+      return LPS_ERROR;
+    }
+
+  *msg_len = rc;
+  return LPS_SUCCESS;
+}
+
 LogProtoServer *
 log_proto_dgram_server_new(LogTransport *transport, const LogProtoServerOptions *options)
 {
@@ -56,5 +99,8 @@ log_proto_dgram_server_new(LogTransport *transport, const LogProtoServerOptions
   log_proto_buffered_server_init(&self->super, transport, options);
   self->super.fetch_from_buffer = log_proto_dgram_server_fetch_from_buffer;
   self->super.stream_based = FALSE;
+  self->super.super.prepare = log_proto_dgram_server_prepare;
+  if (log_transport_supports_read_datagram(transport) && !options->encoding)
+    self->super.super.fetch = log_proto_dgram_server_fetch_datagram;
   return &self->super.super;
 }
@@ -26,6 +26,11 @@
 #include "proto_lib.h"
 #include "msg_parse_lib.h"
 #include "logproto/logproto-dgram-server.h"
+#include "transport/transport-socket.h"
+#include "fdhelpers.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
 
 /****************************************************************************************
  * LogProtoDGramServer
@@ -163,6 +168,51 @@ test_log_proto_dgram_server_eof_handling(void)
   log_proto_server_free(proto);
 }
 
+static void
+_send_datagram(gint fd, const gchar *datagram)
+{
+  assert_gint(send(fd, datagram, strlen(datagram), 0), strlen(datagram), "sending test datagram failed");
+}
+
+static void
+test_log_proto_dgram_server_batched_socket(void)
+{
+  LogProtoServer *proto;
+  gchar datagram[32];
+  gint fds[2];
+  gint i;
+
+  assert_gint(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds), 0, "socketpair() failed");
+  g_fd_set_nonblock(fds[0], TRUE);
+
+  proto_server_options.max_msg_size = 32;
+  proto = log_proto_dgram_server_new(log_transport_dgram_socket_new(fds[0]), get_inited_proto_server_options());
+
+  /* more than a single recvmmsg() call returns, so the ring is refilled in between */
+  for (i = 0; i < LOG_TRANSPORT_DGRAM_BATCH_SIZE + 2; i++)
+    {
+      g_snprintf(datagram, sizeof(datagram), "datagram %d", i);
+      _send_datagram(fds[1], datagram);
+    }
+  _send_datagram(fds[1], "0123456789ABCDEF0123456789ABCDEF-truncated");
+
+  for (i = 0; i < LOG_TRANSPORT_DGRAM_BATCH_SIZE + 2; i++)
+    {
+      g_snprintf(datagram, sizeof(datagram), "datagram %d", i);
+      assert_proto_server_fetch(proto, datagram, -1);
+    }
+  assert_proto_server_fetch(proto, "0123456789ABCDEF0123456789ABCDEF", -1);
+
+  /* drained, the transport reports EAGAIN */
+  assert_proto_server_fetch_single_read(proto, NULL, -1);
+
+  _send_datagram(fds[1], "after drained");
+  assert_proto_server_fetch(proto, "after drained", -1);
+
+  log_proto_server_free(proto);
+  close(fds[1]);
+}
+
 void
 test_log_proto_dgram_server(void)
 {
@@ -171,4 +221,5 @@ test_log_proto_dgram_server(void)
   PROTO_TESTCASE(test_log_proto_dgram_server_invalid_ucs4);
   PROTO_TESTCASE(test_log_proto_dgram_server_iso_8859_2);
   PROTO_TESTCASE(test_log_proto_dgram_server_eof_handling);
+  PROTO_TESTCASE(test_log_proto_dgram_server_batched_socket);
 }
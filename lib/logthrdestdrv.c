@@ -26,6 +26,10 @@
 #include "logthrdestdrv.h"
 #include "seqnum.h"
 #include "scratch-buffers.h"
+#include "timeutils.h"
+
+#include <string.h>
+
 
 #define MAX_RETRIES_OF_FAILED_INSERT_DEFAULT 3
 
@@ -37,6 +41,39 @@ log_threaded_dest_driver_set_max_retries(LogDriver *s, gint max_retries)
   self->retries.max = max_retries;
 }
 
+void
+log_threaded_dest_driver_set_batch_lines(LogDriver *s, gint batch_lines)
+{
+  LogThreadedDestDriver *self = (LogThreadedDestDriver *)s;
+
+  self->batch_lines = batch_lines;
+}
+
+void
+log_threaded_dest_driver_set_batch_timeout(LogDriver *s, gint batch_timeout)
+{
+  LogThreadedDestDriver *self = (LogThreadedDestDriver *)s;
+
+  self->batch_timeout = batch_timeout;
+}
+
+void
+log_threaded_dest_driver_set_num_workers(LogDriver *s, gint num_workers)
+{
+  LogThreadedDestDriver *self = (LogThreadedDestDriver *)s;
+
+  self->num_workers = num_workers;
+}
+
+void
+log_threaded_dest_driver_set_worker_partition_key_ref(LogDriver *s, LogTemplate *key)
+{
+  LogThreadedDestDriver *self = (LogThreadedDestDriver *)s;
+
+  log_template_unref(self->worker_partition_key);
+  self->worker_partition_key = key;
+}
+
 static gchar *
 _format_seqnum_persist_name(LogThreadedDestDriver *self)
 {
@@ -48,14 +85,48 @@ _format_seqnum_persist_name(LogThreadedDestDriver *self)
   return persist_name;
 }
 
+static gchar *
+_format_num_workers_persist_name(LogThreadedDestDriver *self)
+{
+  static gchar persist_name[256];
+
+  g_snprintf(persist_name, sizeof(persist_name), "%s.workers",
+             self->super.super.super.generate_persist_name((const LogPipe *)self));
+
+  return persist_name;
+}
+
+/* the first worker uses the queue persist name of the single-threaded
+ * implementation, so that queued messages survive the upgrade */
+static gchar *
+_format_queue_persist_name(LogThreadedDestDriver *self, gint worker_index)
+{
+  static gchar persist_name[1024];
+  const gchar *driver_persist_name = self->super.super.super.generate_persist_name((const LogPipe *)self);
+
+  if (worker_index == 0)
+    g_strlcpy(persist_name, driver_persist_name, sizeof(persist_name));
+  else
+    g_snprintf(persist_name, sizeof(persist_name), "%s.%d", driver_persist_name, worker_index);
+
+  return persist_name;
+}
+
+/*
+ * LogThreadedDestWorker
+ *
+ * Everything below runs in the thread of the worker, unless noted
+ * otherwise.
+ */
+
 static void
-_start_watches(LogThreadedDestDriver *self)
+_start_watches(LogThreadedDestWorker *self)
 {
   iv_task_register(&self->do_work);
 }
 
 static void
-_stop_watches(LogThreadedDestDriver *self)
+_stop_watches(LogThreadedDestWorker *self)
 {
   if (iv_task_registered(&self->do_work))
     {
@@ -69,6 +140,10 @@ _stop_watches(LogThreadedDestDriver *self)
     {
       iv_timer_unregister(&self->timer_throttle);
     }
+  if (iv_timer_registered(&self->timer_flush))
+    {
+      iv_timer_unregister(&self->timer_flush);
+    }
 }
 
 /* NOTE: runs in the worker thread in response to a wakeup event being
@@ -77,7 +152,7 @@ _stop_watches(LogThreadedDestDriver *self)
 static void
 _wakeup_event_callback(gpointer data)
 {
-  LogThreadedDestDriver *self = (LogThreadedDestDriver *)data;
+  LogThreadedDestWorker *self = (LogThreadedDestWorker *)data;
 
   if (!iv_task_registered(&self->do_work))
     {
@@ -91,7 +166,7 @@ _wakeup_event_callback(gpointer data)
 static void
 _shutdown_event_callback(gpointer data)
 {
-  LogThreadedDestDriver *self = (LogThreadedDestDriver *)data;
+  LogThreadedDestWorker *self = (LogThreadedDestWorker *)data;
 
   _stop_watches(self);
   iv_quit();
@@ -99,25 +174,25 @@ _shutdown_event_callback(gpointer data)
 
 /* NOTE: runs in the worker thread */
 static void
-_suspend(LogThreadedDestDriver *self)
+_suspend(LogThreadedDestWorker *self)
 {
   iv_validate_now();
   self->timer_reopen.expires  = iv_now;
-  self->timer_reopen.expires.tv_sec += self->time_reopen;
+  self->timer_reopen.expires.tv_sec += self->owner->time_reopen;
   iv_timer_register(&self->timer_reopen);
 }
 
 /* NOTE: runs in the worker thread */
 static void
-_connect(LogThreadedDestDriver *self)
+_connect(LogThreadedDestWorker *self)
 {
-  self->worker.connected = TRUE;
-  if (self->worker.connect)
+  self->connected = TRUE;
+  if (self->connect)
     {
-      self->worker.connected = self->worker.connect(self);
+      self->connected = self->connect(self);
     }
 
-  if (!self->worker.connected)
+  if (!self->connected)
     {
       log_queue_reset_parallel_push(self->queue);
       _suspend(self);
@@ -128,20 +203,35 @@ _connect(LogThreadedDestDriver *self)
     }
 }
 
+/* NOTE: runs in the worker thread. Rewinds both the current batch and the
+ * pending ones, the latter precede the current batch on the backlog */
+static void
+_rewind_all(LogThreadedDestWorker *self)
+{
+  log_queue_rewind_backlog(self->queue, self->batch_size + self->pending_size);
+  self->batch_size = 0;
+  self->pending_size = 0;
+}
+
 /* NOTE: runs in the worker thread */
 static void
-_disconnect(LogThreadedDestDriver *self)
+_disconnect(LogThreadedDestWorker *self)
 {
-  if (self->worker.disconnect)
+  if (self->disconnect)
     {
-      self->worker.disconnect(self);
+      self->disconnect(self);
     }
-  self->worker.connected = FALSE;
+  self->connected = FALSE;
+
+  /* disconnect() abandons the batches that are still pending, they are
+   * sent again once we are reconnected */
+  if (self->pending_size > 0)
+    _rewind_all(self);
 }
 
 /* NOTE: runs in the worker thread */
 static void
-_disconnect_and_suspend(LogThreadedDestDriver *self)
+_disconnect_and_suspend(LogThreadedDestWorker *self)
 {
   self->suspended = TRUE;
   _disconnect(self);
@@ -149,111 +239,327 @@ _disconnect_and_suspend(LogThreadedDestDriver *self)
   _suspend(self);
 }
 
+/* NOTE: runs in the worker thread. Messages take their sequence numbers
+ * with them once they are acked, either written or dropped */
+static void
+_ack_backlog(LogThreadedDestWorker *self, gint num_messages)
+{
+  step_sequence_number_atomic(&self->owner->shared_seq_num, num_messages);
+  log_queue_ack_backlog(self->queue, num_messages);
+}
+
+/* NOTE: runs in the worker thread. With multiple workers, the messages in
+ * flight in different workers may get the same number */
+static gint32
+_get_seq_num_of_last_inserted(LogThreadedDestWorker *self)
+{
+  return add_sequence_number(g_atomic_int_get(&self->owner->shared_seq_num),
+                             self->pending_size + self->batch_size - 1);
+}
+
 /* NOTE: runs in the worker thread */
-void
-_accept_message(LogThreadedDestDriver *self, LogMessage *msg)
+static void
+_accept_batch(LogThreadedDestWorker *self)
 {
-  self->retries.counter = 0;
-  step_sequence_number(&self->seq_num);
-  log_queue_ack_backlog(self->queue, 1);
-  log_msg_unref(msg);
+  self->retries_counter = 0;
+  stats_counter_add(self->owner->written_messages, self->batch_size);
+  _ack_backlog(self, self->batch_size);
+  self->batch_size = 0;
 }
 
 /* NOTE: runs in the worker thread */
-void
-_drop_message(LogThreadedDestDriver *self, LogMessage *msg)
+static void
+_drop_batch(LogThreadedDestWorker *self)
+{
+  self->retries_counter = 0;
+  stats_counter_add(self->owner->dropped_messages, self->batch_size);
+  _ack_backlog(self, self->batch_size);
+  self->batch_size = 0;
+}
+
+/* NOTE: runs in the worker thread */
+static void
+_rewind_batch(LogThreadedDestWorker *self)
 {
-  stats_counter_inc(self->dropped_messages);
-  _accept_message(self, msg);
+  log_queue_rewind_backlog(self->queue, self->batch_size);
+  self->batch_size = 0;
+}
+
+/* NOTE: runs in the worker thread. The result is applied to all messages
+ * of the current batch, e.g. everything that was inserted since the last
+ * ack/rewind. @msg is the message that was inserted last, or NULL if
+ * the result comes from flush(). */
+static void
+_process_result(LogThreadedDestWorker *self, worker_insert_result_t result, LogMessage *msg)
+{
+  LogThreadedDestDriver *owner = self->owner;
+
+  if (self->pending_size > 0 &&
+      result != WORKER_INSERT_RESULT_QUEUED && result != WORKER_INSERT_RESULT_PENDING)
+    {
+      /* the backlog can only be acked in order, so the result of the
+       * current batch can't be applied while earlier ones are pending */
+      _rewind_all(self);
+      _disconnect_and_suspend(self);
+      return;
+    }
+
+  switch (result)
+    {
+    case WORKER_INSERT_RESULT_DROP:
+      msg_error("Message(s) dropped while sending message to destination",
+                evt_tag_str("driver", owner->super.super.id),
+                evt_tag_int("worker_index", self->worker_index),
+                evt_tag_int("batch_size", self->batch_size));
+
+      _drop_batch(self);
+      _disconnect_and_suspend(self);
+      break;
+
+    case WORKER_INSERT_RESULT_ERROR:
+      self->retries_counter++;
+
+      if (self->retries_counter >= owner->retries.max)
+        {
+          if (msg && owner->messages.retry_over)
+            owner->messages.retry_over(owner, msg);
+
+          msg_error("Multiple failures while sending message(s) to destination, message(s) dropped",
+                    evt_tag_str("driver", owner->super.super.id),
+                    evt_tag_int("worker_index", self->worker_index),
+                    evt_tag_int("number_of_retries", owner->retries.max),
+                    evt_tag_int("batch_size", self->batch_size));
+
+          _drop_batch(self);
+        }
+      else
+        {
+          _rewind_batch(self);
+          _disconnect_and_suspend(self);
+        }
+      break;
+
+    case WORKER_INSERT_RESULT_NOT_CONNECTED:
+      _rewind_batch(self);
+      _disconnect_and_suspend(self);
+      break;
+
+    case WORKER_INSERT_RESULT_REWIND:
+      _rewind_batch(self);
+      break;
+
+    case WORKER_INSERT_RESULT_SUCCESS:
+      _accept_batch(self);
+      break;
+
+    case WORKER_INSERT_RESULT_QUEUED:
+      break;
+
+    case WORKER_INSERT_RESULT_PENDING:
+      self->pending_size += self->batch_size;
+      self->batch_size = 0;
+      break;
+
+    default:
+      break;
+    }
 }
 
 /* NOTE: runs in the worker thread */
+static void
+_ack_pending(LogThreadedDestWorker *self, gint num_messages, StatsCounterItem *counter)
+{
+  stats_counter_add(counter, num_messages);
+  _ack_backlog(self, num_messages);
+  self->pending_size -= num_messages;
+}
+
+/* NOTE: runs in the worker thread. Reports the outcome of the oldest
+ * @num_messages pending messages, see flush() in LogThreadedDestWorker.
+ * Unlike results returned by insert()/flush(), a failure that is not
+ * dropped rewinds all the pending batches, as later ones may not be
+ * acknowledged before this one. */
 void
-_rewind_message(LogThreadedDestDriver *self, LogMessage *msg)
+log_threaded_dest_worker_complete_pending(LogThreadedDestWorker *self, gint num_messages,
+                                          worker_insert_result_t result)
+{
+  LogThreadedDestDriver *owner = self->owner;
+
+  g_assert(num_messages <= self->pending_size);
+
+  switch (result)
+    {
+    case WORKER_INSERT_RESULT_SUCCESS:
+      self->retries_counter = 0;
+      _ack_pending(self, num_messages, owner->written_messages);
+      break;
+
+    case WORKER_INSERT_RESULT_DROP:
+      msg_error("Message(s) dropped while sending message to destination",
+                evt_tag_str("driver", owner->super.super.id),
+                evt_tag_int("worker_index", self->worker_index),
+                evt_tag_int("batch_size", num_messages));
+
+      /* unlike a synchronous DROP, this does not suspend the worker: the
+       * later batches are already on their way, and disconnecting would
+       * rewind and send them again, even if they are delivered
+       * successfully */
+      self->retries_counter = 0;
+      _ack_pending(self, num_messages, owner->dropped_messages);
+      break;
+
+    case WORKER_INSERT_RESULT_ERROR:
+      self->retries_counter++;
+
+      if (self->retries_counter >= owner->retries.max)
+        {
+          msg_error("Multiple failures while sending message(s) to destination, message(s) dropped",
+                    evt_tag_str("driver", owner->super.super.id),
+                    evt_tag_int("worker_index", self->worker_index),
+                    evt_tag_int("number_of_retries", owner->retries.max),
+                    evt_tag_int("batch_size", num_messages));
+
+          self->retries_counter = 0;
+          _ack_pending(self, num_messages, owner->dropped_messages);
+        }
+      else
+        {
+          _disconnect_and_suspend(self);
+        }
+      break;
+
+    default:
+      _disconnect_and_suspend(self);
+      break;
+    }
+}
+
+/* NOTE: runs in the worker thread, from flush(). Acks the oldest
+ * @num_messages messages of the current batch as written (SUCCESS) or
+ * dropped (DROP), without suspending the worker. */
+void
+log_threaded_dest_worker_complete_batch_head(LogThreadedDestWorker *self, gint num_messages,
+                                             worker_insert_result_t result)
+{
+  LogThreadedDestDriver *owner = self->owner;
+
+  /* pending batches precede the current one on the backlog */
+  g_assert(self->pending_size == 0);
+  g_assert(num_messages <= self->batch_size);
+
+  switch (result)
+    {
+    case WORKER_INSERT_RESULT_SUCCESS:
+      stats_counter_add(owner->written_messages, num_messages);
+      break;
+
+    case WORKER_INSERT_RESULT_DROP:
+      msg_error("Message(s) dropped while sending message to destination",
+                evt_tag_str("driver", owner->super.super.id),
+                evt_tag_int("worker_index", self->worker_index),
+                evt_tag_int("batch_size", num_messages));
+      stats_counter_add(owner->dropped_messages, num_messages);
+      break;
+
+    default:
+      g_assert_not_reached();
+    }
+
+  self->retries_counter = 0;
+  _ack_backlog(self, num_messages);
+  self->batch_size -= num_messages;
+}
+
+/* NOTE: runs in the worker thread */
+static void
+_perform_flush(LogThreadedDestWorker *self)
+{
+  if (!self->suspended && (self->batch_size > 0 || self->pending_size > 0) && self->flush)
+    {
+      msg_trace("Flushing batch",
+                evt_tag_str("driver", self->owner->super.super.id),
+                evt_tag_int("worker_index", self->worker_index),
+                evt_tag_int("batch_size", self->batch_size));
+
+      ScratchBuffersMarker mark;
+      scratch_buffers_mark(&mark);
+      worker_insert_result_t result = self->flush(self);
+      scratch_buffers_reclaim_marked(mark);
+
+      _process_result(self, result, NULL);
+    }
+
+  iv_validate_now();
+  self->last_flush_time = iv_now;
+}
+
+static inline gboolean
+_is_batch_full(LogThreadedDestWorker *self)
+{
+  return self->owner->batch_lines > 0 && self->batch_size >= self->owner->batch_lines;
+}
+
+/* NOTE: runs in the worker thread, decides whether a partial batch should
+ * be flushed right now or we should wait for batch_timeout to expire */
+static gboolean
+_should_flush_now(LogThreadedDestWorker *self)
 {
-  log_queue_rewind_backlog(self->queue, 1);
-  log_msg_unref(msg);
+  if (self->owner->batch_timeout <= 0)
+    return TRUE;
+
+  iv_validate_now();
+  return timespec_diff_msec(&iv_now, &self->last_flush_time) >= self->owner->batch_timeout;
+}
+
+/* NOTE: runs in the worker thread */
+static void
+_schedule_flush_on_batch_timeout(LogThreadedDestWorker *self)
+{
+  self->timer_flush.expires = self->last_flush_time;
+  timespec_add_msec(&self->timer_flush.expires, self->owner->batch_timeout);
+  iv_timer_register(&self->timer_flush);
 }
 
 /* NOTE: runs in the worker thread, whenever items on our queue are
  * available. It iterates all elements on the queue, however will terminate
  * if the mainloop requests that we exit. */
 static void
-_perform_inserts(LogThreadedDestDriver *self)
+_perform_inserts(LogThreadedDestWorker *self)
 {
+  LogThreadedDestDriver *owner = self->owner;
   LogMessage *msg;
   worker_insert_result_t result;
   LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
 
-  while (G_LIKELY(!self->under_termination) &&
+  while (G_LIKELY(!owner->under_termination) &&
          !self->suspended &&
          (msg = log_queue_pop_head(self->queue, &path_options)) != NULL)
     {
       msg_set_context(msg);
       log_msg_refcache_start_consumer(msg, &path_options);
 
+      self->batch_size++;
+      self->seq_num = _get_seq_num_of_last_inserted(self);
+
       ScratchBuffersMarker mark;
       scratch_buffers_mark(&mark);
-      result = self->worker.insert(self, msg);
+      result = self->insert(self, msg);
       scratch_buffers_reclaim_marked(mark);
 
-      switch (result)
-        {
-        case WORKER_INSERT_RESULT_DROP:
-          msg_error("Message dropped while sending message to destination",
-                    evt_tag_str("driver", self->super.super.id));
-
-          _drop_message(self, msg);
-          _disconnect_and_suspend(self);
-          break;
-
-        case WORKER_INSERT_RESULT_ERROR:
-          self->retries.counter++;
-
-          if (self->retries.counter >= self->retries.max)
-            {
-              if (self->messages.retry_over)
-                self->messages.retry_over(self, msg);
-
-              msg_error("Multiple failures while sending message to destination, message dropped",
-                        evt_tag_str("driver", self->super.super.id),
-                        evt_tag_int("number_of_retries", self->retries.max));
-
-              _drop_message(self, msg);
-            }
-          else
-            {
-              _rewind_message(self, msg);
-              _disconnect_and_suspend(self);
-            }
-          break;
-
-        case WORKER_INSERT_RESULT_NOT_CONNECTED:
-          _rewind_message(self, msg);
-          _disconnect_and_suspend(self);
-          break;
-
-        case WORKER_INSERT_RESULT_REWIND:
-          _rewind_message(self, msg);
-          break;
+      _process_result(self, result, msg);
 
-        case WORKER_INSERT_RESULT_SUCCESS:
-          stats_counter_inc(self->written_messages);
-          _accept_message(self, msg);
-          break;
-
-        default:
-          break;
-        }
+      if (_is_batch_full(self))
+        _perform_flush(self);
 
+      log_msg_unref(msg);
       msg_set_context(NULL);
       log_msg_refcache_stop();
     }
   if (!self->suspended)
     {
-      if (self->worker.worker_message_queue_empty)
+      if (self->worker_message_queue_empty)
         {
-          self->worker.worker_message_queue_empty(self);
+          self->worker_message_queue_empty(self);
         }
     }
 }
@@ -268,23 +574,23 @@ _perform_inserts(LogThreadedDestDriver *self)
 static void
 _message_became_available_callback(gpointer user_data)
 {
-  LogThreadedDestDriver *self = (LogThreadedDestDriver *) user_data;
+  LogThreadedDestWorker *self = (LogThreadedDestWorker *) user_data;
 
-  if (!self->under_termination)
+  if (!self->owner->under_termination)
     iv_event_post(&self->wake_up_event);
 }
 
 static void
 _perform_work(gpointer data)
 {
-  LogThreadedDestDriver *self = (LogThreadedDestDriver *)data;
+  LogThreadedDestWorker *self = (LogThreadedDestWorker *)data;
   gint timeout_msec = 0;
 
   self->suspended = FALSE;
   main_loop_worker_run_gc();
   _stop_watches(self);
 
-  if (!self->worker.connected)
+  if (!self->connected)
     {
       _connect(self);
     }
@@ -305,6 +611,22 @@ _perform_work(gpointer data)
       timespec_add_msec(&self->timer_throttle.expires, timeout_msec);
       iv_timer_register(&self->timer_throttle);
     }
+  else if (self->batch_size > 0)
+    {
+      /* the queue is empty, but we still have a partial batch that was
+       * not flushed yet: flush it now or wait for batch_timeout,
+       * whichever comes first, unless new messages arrive in the meanwhile */
+      if (_should_flush_now(self))
+        {
+          _perform_flush(self);
+          if (!self->suspended)
+            _start_watches(self);
+        }
+      else
+        {
+          _schedule_flush_on_batch_timeout(self);
+        }
+    }
 }
 
 /* these are events of the _worker_ thread and are not registered to the
@@ -321,11 +643,14 @@ _perform_work(gpointer data)
  *      - if no messages are on the queue: schedule
  *        _message_became_available_callback() to be called by the LogQueue.
  *
+ *      - if the queue became empty while a batch is still pending: flush
+ *        it, or start timer_flush if batch_timeout() has not elapsed yet.
+ *
  *      - if there's an error, disconnect go back to the #1 state above.
  *
  */
 static void
-_init_watches(LogThreadedDestDriver *self)
+_init_watches(LogThreadedDestWorker *self)
 {
   IV_EVENT_INIT(&self->wake_up_event);
   self->wake_up_event.cookie = self;
@@ -345,55 +670,213 @@ _init_watches(LogThreadedDestDriver *self)
   self->timer_throttle.cookie = self;
   self->timer_throttle.handler = _perform_work;
 
+  IV_TIMER_INIT(&self->timer_flush);
+  self->timer_flush.cookie = self;
+  self->timer_flush.handler = _perform_work;
+
   IV_TASK_INIT(&self->do_work);
   self->do_work.cookie = self;
   self->do_work.handler = _perform_work;
 }
 
+/* NOTE: runs in the worker thread, after the main loop of the thread has
+ * exited. Anything left in the batch that can't be delivered is rewound to
+ * the queue so that it is sent again after a reload */
+static void
+_perform_final_flush(LogThreadedDestWorker *self)
+{
+  if (self->connected)
+    _perform_flush(self);
+
+  _rewind_batch(self);
+}
+
 static void
 _worker_thread(gpointer arg)
 {
-  LogThreadedDestDriver *self = (LogThreadedDestDriver *)arg;
+  LogThreadedDestWorker *self = (LogThreadedDestWorker *)arg;
 
   iv_init();
 
   msg_debug("Worker thread started",
-            evt_tag_str("driver", self->super.super.id));
+            evt_tag_str("driver", self->owner->super.super.id),
+            evt_tag_int("worker_index", self->worker_index));
 
   log_queue_set_use_backlog(self->queue, TRUE);
 
   _init_watches(self);
 
-  if (self->worker.thread_init)
-    self->worker.thread_init(self);
+  if (self->thread_init)
+    self->thread_init(self);
+
+  iv_validate_now();
+  self->last_flush_time = iv_now;
 
   _start_watches(self);
   iv_main();
 
+  _perform_final_flush(self);
   _disconnect(self);
-  if (self->worker.thread_deinit)
-    self->worker.thread_deinit(self);
+  if (self->thread_deinit)
+    self->thread_deinit(self);
 
   msg_debug("Worker thread finished",
-            evt_tag_str("driver", self->super.super.id));
+            evt_tag_str("driver", self->owner->super.super.id),
+            evt_tag_int("worker_index", self->worker_index));
   iv_deinit();
 }
 
+/* NOTE: runs in the main thread */
 static void
 _request_worker_exit(gpointer s)
 {
-  LogThreadedDestDriver *self = (LogThreadedDestDriver *) s;
+  LogThreadedDestWorker *self = (LogThreadedDestWorker *) s;
 
-  self->under_termination = TRUE;
+  self->owner->under_termination = TRUE;
   iv_event_post(&self->shutdown_event);
 }
 
+/* NOTE: runs in the main thread */
 static void
-_start_worker_thread(LogThreadedDestDriver *self)
+_start_worker_thread(LogThreadedDestWorker *self)
 {
   main_loop_create_worker_thread(_worker_thread,
                                  _request_worker_exit,
-                                 self, &self->worker_options);
+                                 self, &self->owner->worker_options);
+}
+
+void
+log_threaded_dest_worker_init_instance(LogThreadedDestWorker *self, LogThreadedDestDriver *owner, gint worker_index)
+{
+  self->owner = owner;
+  self->worker_index = worker_index;
+  self->free_fn = log_threaded_dest_worker_free_method;
+}
+
+void
+log_threaded_dest_worker_free_method(LogThreadedDestWorker *self)
+{
+}
+
+void
+log_threaded_dest_worker_free(LogThreadedDestWorker *self)
+{
+  if (self->free_fn)
+    self->free_fn(self);
+  g_free(self);
+}
+
+/*
+ * Compatibility layer: drivers that don't implement construct_worker()
+ * keep their state in the driver and set the legacy callbacks in
+ * LogThreadedDestDriver->worker, which the embedded worker instance
+ * forwards to.
+ */
+
+static void
+_compat_thread_init(LogThreadedDestWorker *self)
+{
+  if (self->owner->worker.thread_init)
+    self->owner->worker.thread_init(self->owner);
+}
+
+static void
+_compat_thread_deinit(LogThreadedDestWorker *self)
+{
+  if (self->owner->worker.thread_deinit)
+    self->owner->worker.thread_deinit(self->owner);
+}
+
+static gboolean
+_compat_connect(LogThreadedDestWorker *self)
+{
+  if (self->owner->worker.connect)
+    return self->owner->worker.connect(self->owner);
+  return TRUE;
+}
+
+static void
+_compat_disconnect(LogThreadedDestWorker *self)
+{
+  if (self->owner->worker.disconnect)
+    self->owner->worker.disconnect(self->owner);
+}
+
+static worker_insert_result_t
+_compat_insert(LogThreadedDestWorker *self, LogMessage *msg)
+{
+  self->owner->seq_num = self->seq_num;
+  return self->owner->worker.insert(self->owner, msg);
+}
+
+static worker_insert_result_t
+_compat_flush(LogThreadedDestWorker *self)
+{
+  if (self->owner->worker.flush)
+    return self->owner->worker.flush(self->owner);
+  return WORKER_INSERT_RESULT_SUCCESS;
+}
+
+static void
+_compat_worker_message_queue_empty(LogThreadedDestWorker *self)
+{
+  if (self->owner->worker.worker_message_queue_empty)
+    self->owner->worker.worker_message_queue_empty(self->owner);
+}
+
+static LogThreadedDestWorker *
+_construct_compat_worker(LogThreadedDestDriver *self, gint worker_index)
+{
+  LogThreadedDestWorker *worker = &self->worker.instance;
+
+  g_assert(worker_index == 0);
+
+  memset(worker, 0, sizeof(*worker));
+  log_threaded_dest_worker_init_instance(worker, self, worker_index);
+  worker->thread_init = _compat_thread_init;
+  worker->thread_deinit = _compat_thread_deinit;
+  worker->connect = _compat_connect;
+  worker->disconnect = _compat_disconnect;
+  worker->insert = _compat_insert;
+  worker->flush = self->worker.flush ? _compat_flush : NULL;
+  worker->worker_message_queue_empty = _compat_worker_message_queue_empty;
+  worker->free_fn = NULL;
+  return worker;
+}
+
+static gboolean
+_is_compat_worker(LogThreadedDestDriver *self, LogThreadedDestWorker *worker)
+{
+  return worker == &self->worker.instance;
+}
+
+/*
+ * LogThreadedDestDriver
+ */
+
+/* NOTE: runs in the source thread */
+static LogThreadedDestWorker *
+_lookup_worker(LogThreadedDestDriver *self, LogMessage *msg)
+{
+  gint worker_index;
+
+  if (self->num_workers == 1)
+    return self->workers[0];
+
+  if (self->worker_partition_key)
+    {
+      ScratchBuffersMarker mark;
+      GString *key = scratch_buffers_alloc_and_mark(&mark);
+
+      log_template_format(self->worker_partition_key, msg, NULL, LTZ_SEND, 0, NULL, key);
+      worker_index = g_str_hash(key->str) % self->num_workers;
+      scratch_buffers_reclaim_marked(mark);
+    }
+  else
+    {
+      worker_index = ((guint) g_atomic_counter_exchange_and_add(&self->last_worker, 1)) % self->num_workers;
+    }
+  return self->workers[worker_index];
 }
 
 /* the feeding side of the driver, runs in the source thread and puts an
@@ -404,13 +887,16 @@ log_threaded_dest_driver_queue(LogPipe *s, LogMessage *msg,
                                const LogPathOptions *path_options)
 {
   LogThreadedDestDriver *self = (LogThreadedDestDriver *)s;
+  LogThreadedDestWorker *worker;
   LogPathOptions local_options;
 
   if (!path_options->flow_control_requested)
     path_options = log_msg_break_ack(msg, path_options, &local_options);
 
+  worker = _lookup_worker(self, msg);
+
   log_msg_add_ack(msg, path_options);
-  log_queue_push_tail(self->queue, log_msg_ref(msg), path_options);
+  log_queue_push_tail(worker->queue, log_msg_ref(msg), path_options);
 
   stats_counter_inc(self->processed_messages);
 
@@ -418,9 +904,9 @@ log_threaded_dest_driver_queue(LogPipe *s, LogMessage *msg,
 }
 
 static void
-_update_memory_usage_counter_when_fifo_is_used(LogThreadedDestDriver *self)
+_update_memory_usage_counter_when_fifo_is_used(LogThreadedDestDriver *self, LogQueue *queue)
 {
-  if (!g_strcmp0(self->queue->type, "FIFO") && self->memory_usage)
+  if (!g_strcmp0(queue->type, "FIFO") && self->memory_usage)
     {
       LogPipe *_pipe = &self->super.super.super;
       load_counter_from_persistent_storage(log_pipe_get_config(_pipe), self->memory_usage);
@@ -459,6 +945,106 @@ _unregister_stats(LogThreadedDestDriver *self)
   stats_unlock();
 }
 
+static void
+_destroy_workers(LogThreadedDestDriver *self)
+{
+  for (gint i = 0; self->workers && i < self->num_workers; i++)
+    {
+      LogThreadedDestWorker *worker = self->workers[i];
+
+      if (!worker)
+        continue;
+
+      if (!_is_compat_worker(self, worker))
+        log_threaded_dest_worker_free(worker);
+      self->workers[i] = NULL;
+    }
+  g_free(self->workers);
+  self->workers = NULL;
+}
+
+static gboolean
+_create_workers(LogThreadedDestDriver *self)
+{
+  if (!self->construct_worker && self->num_workers > 1)
+    {
+      msg_warning("WARNING: this destination does not support multiple workers, using a single worker thread",
+                  evt_tag_str("driver", self->super.super.id),
+                  evt_tag_int("workers", self->num_workers),
+                  log_pipe_location_tag(&self->super.super.super));
+      self->num_workers = 1;
+    }
+  if (self->num_workers < 1)
+    self->num_workers = 1;
+
+  self->workers = g_new0(LogThreadedDestWorker *, self->num_workers);
+  for (gint i = 0; i < self->num_workers; i++)
+    {
+      LogThreadedDestWorker *worker = self->construct_worker
+                                      ? self->construct_worker(self, i)
+                                      : _construct_compat_worker(self, i);
+
+      self->workers[i] = worker;
+      worker->queue = log_dest_driver_acquire_queue(&self->super, _format_queue_persist_name(self, i));
+      if (!worker->queue)
+        return FALSE;
+
+      log_queue_set_counters(worker->queue, self->queued_messages,
+                             self->dropped_messages, self->memory_usage);
+      _update_memory_usage_counter_when_fifo_is_used(self, worker->queue);
+    }
+  return TRUE;
+}
+
+/* NOTE: runs in the main thread */
+static gint
+_move_queue_contents_to_workers(LogThreadedDestDriver *self, LogQueue *queue)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg;
+  gint num_messages = 0;
+
+  log_queue_rewind_backlog_all(queue);
+  log_queue_set_use_backlog(queue, FALSE);
+  while ((msg = log_queue_pop_head_ignore_throttle(queue, &path_options)) != NULL)
+    {
+      LogThreadedDestWorker *worker = _lookup_worker(self, msg);
+
+      log_queue_push_tail(worker->queue, msg, &path_options);
+      num_messages++;
+    }
+  return num_messages;
+}
+
+/* if workers() was decreased since the last reload, the queues of the
+ * workers that no longer exist are kept in the persist config under their
+ * "%s.%d" names. Move their messages to the remaining workers, otherwise
+ * they would be lost. */
+static void
+_drain_orphaned_queues(LogThreadedDestDriver *self)
+{
+  GlobalConfig *cfg = log_pipe_get_config(&self->super.super.super);
+  gint last_num_workers = GPOINTER_TO_INT(cfg_persist_config_fetch(cfg,
+                                          _format_num_workers_persist_name(self)));
+
+  for (gint i = self->num_workers; i < last_num_workers; i++)
+    {
+      LogQueue *queue = cfg_persist_config_fetch(cfg, _format_queue_persist_name(self, i));
+
+      if (!queue)
+        continue;
+
+      gint num_messages = _move_queue_contents_to_workers(self, queue);
+      msg_warning("The number of workers was decreased, moving the queued messages of the removed worker to the remaining ones",
+                  evt_tag_str("driver", self->super.super.id),
+                  evt_tag_int("worker_index", i),
+                  evt_tag_int("workers", self->num_workers),
+                  evt_tag_int("messages", num_messages),
+                  log_pipe_location_tag(&self->super.super.super));
+      log_queue_unref(queue);
+    }
+}
+
 gboolean
 log_threaded_dest_driver_init_method(LogPipe *s)
 {
@@ -468,26 +1054,26 @@ log_threaded_dest_driver_init_method(LogPipe *s)
   if (cfg && self->time_reopen == -1)
     self->time_reopen = cfg->time_reopen;
 
-  self->queue = log_dest_driver_acquire_queue(
-                  &self->super, self->super.super.super.generate_persist_name((const LogPipe *)self));
+  self->under_termination = FALSE;
+
+  _register_stats(self);
 
-  if (self->queue == NULL)
+  if (!_create_workers(self))
     {
+      _destroy_workers(self);
+      _unregister_stats(self);
       return FALSE;
     }
+  _drain_orphaned_queues(self);
 
-  _register_stats(self);
-
-  log_queue_set_counters(self->queue, self->queued_messages,
-                         self->dropped_messages, self->memory_usage);
-  _update_memory_usage_counter_when_fifo_is_used(self);
+  self->shared_seq_num = GPOINTER_TO_INT(cfg_persist_config_fetch(cfg,
+                                                                  _format_seqnum_persist_name(self)));
+  if (!self->shared_seq_num)
+    init_sequence_number(&self->shared_seq_num);
+  self->seq_num = self->shared_seq_num;
 
-  self->seq_num = GPOINTER_TO_INT(cfg_persist_config_fetch(cfg,
-                                                           _format_seqnum_persist_name(self)));
-  if (!self->seq_num)
-    init_sequence_number(&self->seq_num);
-
-  _start_worker_thread(self);
+  for (gint i = 0; i < self->num_workers; i++)
+    _start_worker_thread(self->workers[i]);
 
   return TRUE;
 }
@@ -497,18 +1083,27 @@ log_threaded_dest_driver_deinit_method(LogPipe *s)
 {
   LogThreadedDestDriver *self = (LogThreadedDestDriver *)s;
 
-  log_queue_reset_parallel_push(self->queue);
+  for (gint i = 0; self->workers && i < self->num_workers; i++)
+    {
+      LogQueue *queue = self->workers[i]->queue;
 
-  log_queue_set_counters(self->queue, NULL, NULL, NULL);
+      log_queue_reset_parallel_push(queue);
+      log_queue_set_counters(queue, NULL, NULL, NULL);
+    }
 
   cfg_persist_config_add(log_pipe_get_config(s),
                          _format_seqnum_persist_name(self),
-                         GINT_TO_POINTER(self->seq_num), NULL, FALSE);
+                         GINT_TO_POINTER(self->shared_seq_num), NULL, FALSE);
+  cfg_persist_config_add(log_pipe_get_config(s),
+                         _format_num_workers_persist_name(self),
+                         GINT_TO_POINTER(self->num_workers), NULL, FALSE);
 
   save_counter_to_persistent_storage(log_pipe_get_config(s), self->memory_usage);
 
   _unregister_stats(self);
 
+  _destroy_workers(self);
+
   return log_dest_driver_deinit_method(s);
 }
 
@@ -518,6 +1113,7 @@ log_threaded_dest_driver_free(LogPipe *s)
 {
   LogThreadedDestDriver *self = (LogThreadedDestDriver *)s;
 
+  log_template_unref(self->worker_partition_key);
   log_dest_driver_free((LogPipe *)self);
 }
 
@@ -534,5 +1130,8 @@ log_threaded_dest_driver_init_instance(LogThreadedDestDriver *self, GlobalConfig
   self->super.super.super.free_fn = log_threaded_dest_driver_free;
   self->time_reopen = -1;
 
+  self->num_workers = 1;
   self->retries.max = MAX_RETRIES_OF_FAILED_INSERT_DEFAULT;
+  self->batch_lines = 0;
+  self->batch_timeout = 0;
 }
@@ -30,6 +30,7 @@
 #include "stats/stats-registry.h"
 #include "logqueue.h"
 #include "mainloop-worker.h"
+#include "template/templates.h"
 #include <iv.h>
 #include <iv_event.h>
 
@@ -39,20 +40,65 @@ typedef enum
   WORKER_INSERT_RESULT_ERROR,
   WORKER_INSERT_RESULT_REWIND,
   WORKER_INSERT_RESULT_SUCCESS,
-  WORKER_INSERT_RESULT_NOT_CONNECTED
+  WORKER_INSERT_RESULT_QUEUED,
+  WORKER_INSERT_RESULT_NOT_CONNECTED,
+  WORKER_INSERT_RESULT_PENDING
 } worker_insert_result_t;
 
 typedef struct _LogThreadedDestDriver LogThreadedDestDriver;
-typedef struct _LogThreadedDestWorker
+typedef struct _LogThreadedDestWorker LogThreadedDestWorker;
+
+/* A LogThreadedDestWorker consumes its own LogQueue in its own thread,
+ * using its own connection.  A driver runs workers(N) such instances, see
+ * the construct_worker() method below. */
+struct _LogThreadedDestWorker
 {
+  LogQueue *queue;
+  struct iv_task  do_work;
+  struct iv_event wake_up_event;
+  struct iv_event shutdown_event;
+  struct iv_timer timer_reopen;
+  struct iv_timer timer_throttle;
+  struct iv_timer timer_flush;
+
+  LogThreadedDestDriver *owner;
+  gint worker_index;
   gboolean connected;
-  void (*thread_init)(LogThreadedDestDriver *s);
-  void (*thread_deinit)(LogThreadedDestDriver *s);
-  worker_insert_result_t (*insert)(LogThreadedDestDriver *s, LogMessage *msg);
-  gboolean (*connect)(LogThreadedDestDriver *s);
-  void (*worker_message_queue_empty)(LogThreadedDestDriver *s);
-  void (*disconnect)(LogThreadedDestDriver *s);
-} LogThreadedDestWorker;
+  gboolean suspended;
+  gint retries_counter;
+  /* sequence number of the message being inserted, it is assigned from
+   * LogThreadedDestDriver->shared_seq_num by its position on the backlog,
+   * so a message that is retried keeps its number */
+  gint32 seq_num;
+
+  /* number of messages inserted but not yet acked/rewound */
+  gint batch_size;
+  /* number of messages in batches that flush() returned
+   * WORKER_INSERT_RESULT_PENDING for, these precede the current batch on
+   * the backlog */
+  gint pending_size;
+  struct timespec last_flush_time;
+
+  void (*thread_init)(LogThreadedDestWorker *s);
+  void (*thread_deinit)(LogThreadedDestWorker *s);
+  gboolean (*connect)(LogThreadedDestWorker *s);
+  void (*disconnect)(LogThreadedDestWorker *s);
+  worker_insert_result_t (*insert)(LogThreadedDestWorker *s, LogMessage *msg);
+  /* flush the messages that insert() returned WORKER_INSERT_RESULT_QUEUED
+   * for, the result applies to the whole batch.  Workers that deliver
+   * asynchronously return WORKER_INSERT_RESULT_PENDING and report the
+   * outcome later using log_threaded_dest_worker_complete_pending(), in
+   * the order the batches were flushed.  Pending batches are rewound when
+   * the worker is disconnected, so disconnect() has to abandon them.
+   * flush() is also called with an empty batch when the worker exits
+   * while batches are pending, to give it a chance to wait for them.
+   * Workers that get a result for each message of the batch may report
+   * the head of the batch using log_threaded_dest_worker_complete_batch_head(),
+   * the result returned then applies to the rest. */
+  worker_insert_result_t (*flush)(LogThreadedDestWorker *s);
+  void (*worker_message_queue_empty)(LogThreadedDestWorker *s);
+  void (*free_fn)(LogThreadedDestWorker *s);
+};
 
 struct _LogThreadedDestDriver
 {
@@ -64,13 +110,32 @@ struct _LogThreadedDestDriver
   StatsCounterItem *written_messages;
   StatsCounterItem *memory_usage;
 
-  gboolean suspended;
   gboolean under_termination;
   time_t time_reopen;
 
-  LogQueue *queue;
+  LogThreadedDestWorker **workers;
+  gint num_workers;
+  GAtomicCounter last_worker;
+  LogTemplate *worker_partition_key;
+
+  /* constructs the worker with the specified index, drivers that
+   * implement this can run with workers(N) where N > 1 */
+  LogThreadedDestWorker *(*construct_worker)(LogThreadedDestDriver *s, gint worker_index);
 
-  LogThreadedDestWorker worker;
+  /* this is a compatibility layer for drivers that keep their
+   * connection state in the driver instance, these always run a single
+   * worker, which is "instance" below */
+  struct
+  {
+    LogThreadedDestWorker instance;
+    void (*thread_init)(LogThreadedDestDriver *s);
+    void (*thread_deinit)(LogThreadedDestDriver *s);
+    worker_insert_result_t (*insert)(LogThreadedDestDriver *s, LogMessage *msg);
+    worker_insert_result_t (*flush)(LogThreadedDestDriver *s);
+    gboolean (*connect)(LogThreadedDestDriver *s);
+    void (*worker_message_queue_empty)(LogThreadedDestDriver *s);
+    void (*disconnect)(LogThreadedDestDriver *s);
+  } worker;
 
   struct
   {
@@ -82,22 +147,40 @@ struct _LogThreadedDestDriver
     gchar *(*stats_instance) (LogThreadedDestDriver *s);
   } format;
   gint stats_source;
+
+  /* sequence number of the message being inserted by the compatibility
+   * layer, see LogThreadedDestWorker->seq_num */
   gint32 seq_num;
+  /* sequence number of the next message to be acked or dropped, shared by
+   * all workers and stepped atomically */
+  gint32 shared_seq_num;
 
   struct
   {
-    gint counter;
     gint max;
   } retries;
 
+  gint batch_lines;
+  gint batch_timeout;
+
   WorkerOptions worker_options;
-  struct iv_event wake_up_event;
-  struct iv_event shutdown_event;
-  struct iv_timer timer_reopen;
-  struct iv_timer timer_throttle;
-  struct iv_task  do_work;
 };
 
+static inline LogThreadedDestDriver *
+log_threaded_dest_worker_get_owner(LogThreadedDestWorker *self)
+{
+  return self->owner;
+}
+
+void log_threaded_dest_worker_init_instance(LogThreadedDestWorker *self, LogThreadedDestDriver *owner,
+                                            gint worker_index);
+void log_threaded_dest_worker_free_method(LogThreadedDestWorker *self);
+void log_threaded_dest_worker_free(LogThreadedDestWorker *self);
+void log_threaded_dest_worker_complete_pending(LogThreadedDestWorker *self, gint num_messages,
+                                               worker_insert_result_t result);
+void log_threaded_dest_worker_complete_batch_head(LogThreadedDestWorker *self, gint num_messages,
+                                                  worker_insert_result_t result);
+
 gboolean log_threaded_dest_driver_deinit_method(LogPipe *s);
 gboolean log_threaded_dest_driver_init_method(LogPipe *s);
 
@@ -105,5 +188,9 @@ void log_threaded_dest_driver_init_instance(LogThreadedDestDriver *self, GlobalC
 void log_threaded_dest_driver_free(LogPipe *s);
 
 void log_threaded_dest_driver_set_max_retries(LogDriver *s, gint max_retries);
+void log_threaded_dest_driver_set_batch_lines(LogDriver *s, gint batch_lines);
+void log_threaded_dest_driver_set_batch_timeout(LogDriver *s, gint batch_timeout);
+void log_threaded_dest_driver_set_num_workers(LogDriver *s, gint num_workers);
+void log_threaded_dest_driver_set_worker_partition_key_ref(LogDriver *s, LogTemplate *key);
 
 #endif
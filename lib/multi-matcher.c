@@ -0,0 +1,609 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "multi-matcher.h"
+
+#include <string.h>
+
+/*
+ * The automaton works on ASCII case folded input, so that case
+ * insensitive patterns can share it with case sensitive ones.  This can
+ * only produce extra candidates, which are then rejected by the
+ * LogMatcher itself.
+ *
+ * The input bytes are mapped to equivalence classes first (all bytes not
+ * occurring in any of the literals share class 0), which keeps the
+ * transition table small even with thousands of states.
+ */
+
+typedef struct _MultiMatcherOutput
+{
+  gint32 pattern;
+  gint32 next;
+} MultiMatcherOutput;
+
+struct _MultiMatcher
+{
+  GPtrArray *matchers;
+  /* the literal of each matcher, or NULL */
+  GPtrArray *literals;
+  /* indices of matchers without a literal, these are always executed */
+  GArray *unfiltered;
+
+  guint8 byte_classes[256];
+  gint num_classes;
+  gint num_states;
+  /* num_states * num_classes entries, state 0 is the root */
+  gint32 *transitions;
+  /* index into outputs for each state or -1 */
+  gint32 *output_heads;
+  /* the next state on the failure chain that has outputs, or 0 */
+  gint32 *output_links;
+  GArray *outputs;
+};
+
+/* literal extraction */
+
+static gboolean
+_skip_class(const gchar **p)
+{
+  const gchar *q = *p + 1;
+
+  if (*q == '^')
+    q++;
+  /* a leading ']' is a literal */
+  if (*q == ']')
+    q++;
+  while (*q && *q != ']')
+    {
+      if (*q == '\\')
+        {
+          if (!q[1])
+            return FALSE;
+          q += 2;
+        }
+      else if (q[0] == '[' && q[1] == ':')
+        {
+          const gchar *end = strstr(q + 2, ":]");
+
+          if (!end)
+            return FALSE;
+          q = end + 2;
+        }
+      else
+        {
+          q++;
+        }
+    }
+  if (!*q)
+    return FALSE;
+  *p = q + 1;
+  return TRUE;
+}
+
+static gboolean
+_skip_group(const gchar **p)
+{
+  const gchar *q = *p;
+  gint depth = 0;
+
+  while (*q)
+    {
+      if (*q == '\\')
+        {
+          /* \Q...\E could hide parens */
+          if (!q[1] || q[1] == 'Q')
+            return FALSE;
+          q += 2;
+          continue;
+        }
+      if (*q == '[')
+        {
+          if (!_skip_class(&q))
+            return FALSE;
+          continue;
+        }
+      if (*q == '(')
+        {
+          depth++;
+        }
+      else if (*q == ')')
+        {
+          depth--;
+          if (depth == 0)
+            {
+              *p = q + 1;
+              return TRUE;
+            }
+        }
+      q++;
+    }
+  return FALSE;
+}
+
+/* returns the literal character of an escape sequence, 0 for single
+ * character escapes that are not literals (like \d) and -1 for anything
+ * else */
+static gint
+_parse_escape(const gchar **p)
+{
+  gchar c = **p;
+
+  if (!c)
+    return -1;
+
+  (*p)++;
+  if (!g_ascii_isalnum(c))
+    return (guchar) c;
+
+  switch (c)
+    {
+    case 'n':
+      return '\n';
+    case 't':
+      return '\t';
+    case 'r':
+      return '\r';
+    case 'f':
+      return '\f';
+    case 'e':
+      return 0x1b;
+    case 'a':
+      return 0x07;
+    default:
+      if (strchr("dDwWsSbBAzZGhHvVRX", c))
+        return 0;
+      return -1;
+    }
+}
+
+/* returns the minimum repetition count of the quantifier at *p and skips
+ * it, or -1 if there is no quantifier there */
+static gint
+_skip_quantifier(const gchar **p)
+{
+  const gchar *q = *p;
+  gint min;
+
+  switch (*q)
+    {
+    case '*':
+    case '?':
+      min = 0;
+      q++;
+      break;
+    case '+':
+      min = 1;
+      q++;
+      break;
+    case '{':
+      q++;
+      /* anything else than {n}, {n,} and {n,m} is a literal */
+      if (!g_ascii_isdigit(*q))
+        return -1;
+      min = 0;
+      while (g_ascii_isdigit(*q))
+        min = min * 10 + (*q++ - '0');
+      if (*q == ',')
+        {
+          q++;
+          while (g_ascii_isdigit(*q))
+            q++;
+        }
+      if (*q != '}')
+        return -1;
+      q++;
+      break;
+    default:
+      return -1;
+    }
+
+  /* lazy and possessive quantifiers */
+  if (*q == '?' || *q == '+')
+    q++;
+  *p = q;
+  return min;
+}
+
+static void
+_end_run(GString *run, GString *best)
+{
+  if (run->len > best->len)
+    g_string_assign(best, run->str);
+  g_string_truncate(run, 0);
+}
+
+/* Finds the longest literal that any matching string has to contain.  The
+ * parser is conservative, it gives up on constructs it doesn't fully
+ * understand (alternations, options, lookarounds, backreferences, etc). */
+static gchar *
+_extract_pcre_literal(const gchar *pattern)
+{
+  GString *run = g_string_sized_new(32);
+  GString *best = g_string_sized_new(32);
+  const gchar *p = pattern;
+  gboolean success = FALSE;
+
+  while (*p)
+    {
+      gint c;
+
+      switch (*p)
+        {
+        case '|':
+          goto exit;
+        case '(':
+          if (p[1] == '?' || !_skip_group(&p))
+            goto exit;
+          c = -1;
+          break;
+        case '[':
+          if (!_skip_class(&p))
+            goto exit;
+          c = -1;
+          break;
+        case '\\':
+          p++;
+          c = _parse_escape(&p);
+          if (c < 0)
+            goto exit;
+          if (c == 0)
+            c = -1;
+          break;
+        case '.':
+        case '^':
+        case '$':
+          p++;
+          c = -1;
+          break;
+        case '*':
+        case '+':
+        case '?':
+          goto exit;
+        default:
+          c = (guchar) *p++;
+          break;
+        }
+
+      gint min = _skip_quantifier(&p);
+
+      if (c < 0 || min == 0)
+        {
+          /* the quantifier may apply to a complete multibyte character */
+          if (c >= 0x80)
+            {
+              while (run->len > 0 && (guchar) run->str[run->len - 1] >= 0x80)
+                g_string_truncate(run, run->len - 1);
+            }
+          _end_run(run, best);
+          continue;
+        }
+
+      g_string_append_c(run, c);
+      if (min > 0)
+        _end_run(run, best);
+    }
+  _end_run(run, best);
+  success = TRUE;
+
+exit:
+  g_string_free(run, TRUE);
+  if (!success || best->len == 0)
+    {
+      g_string_free(best, TRUE);
+      return NULL;
+    }
+  return g_string_free(best, FALSE);
+}
+
+static gchar *
+_extract_glob_literal(const gchar *pattern)
+{
+  const gchar *best = NULL;
+  gsize best_len = 0;
+  const gchar *p = pattern;
+
+  while (*p)
+    {
+      gsize len = strcspn(p, "*?");
+
+      if (len > best_len)
+        {
+          best = p;
+          best_len = len;
+        }
+      p += len;
+      if (*p)
+        p++;
+    }
+  return best ? g_strndup(best, best_len) : NULL;
+}
+
+gchar *
+multi_matcher_extract_literal(const gchar *pattern, const gchar *type, gint flags)
+{
+  gchar *literal = NULL;
+
+  if (strcmp(type, "string") == 0)
+    literal = pattern[0] ? g_strdup(pattern) : NULL;
+  else if (strcmp(type, "glob") == 0)
+    literal = _extract_glob_literal(pattern);
+  else if (strcmp(type, "pcre") == 0)
+    {
+      /* caseless unicode matching folds some non-ASCII characters to ASCII */
+      if ((flags & (LMF_ICASE | LMF_UTF8)) != (LMF_ICASE | LMF_UTF8))
+        literal = _extract_pcre_literal(pattern);
+    }
+
+  if (literal && (flags & LMF_ICASE))
+    {
+      /* the automaton only folds ASCII characters */
+      for (const gchar *p = literal; *p; p++)
+        {
+          if ((guchar) *p >= 0x80)
+            {
+              g_free(literal);
+              return NULL;
+            }
+        }
+    }
+  return literal;
+}
+
+/* automaton */
+
+static gint32
+_add_state(MultiMatcher *self, GArray *transitions, GArray *output_heads)
+{
+  gint32 no_output = -1;
+
+  g_array_set_size(transitions, transitions->len + self->num_classes);
+  g_array_append_val(output_heads, no_output);
+  return self->num_states++;
+}
+
+static void
+_assign_byte_classes(MultiMatcher *self)
+{
+  gint i;
+
+  memset(self->byte_classes, 0, sizeof(self->byte_classes));
+  self->num_classes = 1;
+  for (i = 0; i < self->literals->len; i++)
+    {
+      const guchar *literal = g_ptr_array_index(self->literals, i);
+
+      for (; literal && *literal; literal++)
+        {
+          guchar c = g_ascii_tolower(*literal);
+
+          if (self->byte_classes[c] == 0)
+            self->byte_classes[c] = self->num_classes++;
+        }
+    }
+  for (i = 'A'; i <= 'Z'; i++)
+    self->byte_classes[i] = self->byte_classes[g_ascii_tolower(i)];
+}
+
+static void
+_build_trie(MultiMatcher *self, GArray *transitions, GArray *output_heads)
+{
+  gint32 i;
+
+  _add_state(self, transitions, output_heads);
+  for (i = 0; i < self->literals->len; i++)
+    {
+      const guchar *literal = g_ptr_array_index(self->literals, i);
+      gint32 state = 0;
+
+      if (!literal)
+        continue;
+
+      for (; *literal; literal++)
+        {
+          gint cls = self->byte_classes[*literal];
+          gint32 next = g_array_index(transitions, gint32, state * self->num_classes + cls);
+
+          /* no edge ever points back to the root, so 0 means a missing edge here */
+          if (next == 0)
+            {
+              next = _add_state(self, transitions, output_heads);
+              g_array_index(transitions, gint32, state * self->num_classes + cls) = next;
+            }
+          state = next;
+        }
+
+      MultiMatcherOutput output = { .pattern = i, .next = g_array_index(output_heads, gint32, state) };
+      g_array_index(output_heads, gint32, state) = self->outputs->len;
+      g_array_append_val(self->outputs, output);
+    }
+}
+
+/* turns the trie into a DFA by following failure links breadth first */
+static void
+_build_failure_links(MultiMatcher *self)
+{
+  gint32 *fail = g_new0(gint32, self->num_states);
+  gint32 *queue = g_new(gint32, self->num_states);
+  gint head = 0, tail = 0;
+  gint cls;
+
+  self->output_links = g_new0(gint32, self->num_states);
+  for (cls = 0; cls < self->num_classes; cls++)
+    {
+      gint32 child = self->transitions[cls];
+
+      if (child)
+        queue[tail++] = child;
+    }
+
+  while (head < tail)
+    {
+      gint32 state = queue[head++];
+      gint32 *row = &self->transitions[state * self->num_classes];
+      gint32 *fail_row = &self->transitions[fail[state] * self->num_classes];
+
+      for (cls = 0; cls < self->num_classes; cls++)
+        {
+          gint32 child = row[cls];
+
+          if (child)
+            {
+              fail[child] = fail_row[cls];
+              self->output_links[child] = self->output_heads[fail[child]] >= 0
+                                          ? fail[child]
+                                          : self->output_links[fail[child]];
+              queue[tail++] = child;
+            }
+          else
+            {
+              row[cls] = fail_row[cls];
+            }
+        }
+    }
+
+  g_free(queue);
+  g_free(fail);
+}
+
+void
+multi_matcher_compile(MultiMatcher *self)
+{
+  GArray *transitions = g_array_new(FALSE, TRUE, sizeof(gint32));
+  GArray *output_heads = g_array_new(FALSE, FALSE, sizeof(gint32));
+
+  g_free(self->transitions);
+  g_free(self->output_heads);
+  g_free(self->output_links);
+  g_array_set_size(self->outputs, 0);
+  self->num_states = 0;
+
+  _assign_byte_classes(self);
+  _build_trie(self, transitions, output_heads);
+  self->transitions = (gint32 *) g_array_free(transitions, FALSE);
+  self->output_heads = (gint32 *) g_array_free(output_heads, FALSE);
+  _build_failure_links(self);
+}
+
+static inline gboolean
+_try_matcher(MultiMatcher *self, gint32 pattern, guint8 *tried, LogMessage *msg, gint value_handle,
+             const gchar *value, gssize value_len)
+{
+  if (tried[pattern >> 3] & (1 << (pattern & 7)))
+    return FALSE;
+  tried[pattern >> 3] |= 1 << (pattern & 7);
+
+  return log_matcher_match(g_ptr_array_index(self->matchers, pattern), msg, value_handle, value, value_len);
+}
+
+gboolean
+multi_matcher_match(MultiMatcher *self, LogMessage *msg, gint value_handle, const gchar *value, gssize value_len)
+{
+  gsize tried_size = (self->matchers->len + 7) / 8;
+  guint8 *tried = g_alloca(tried_size);
+  gint32 state = 0;
+  gssize i;
+
+  g_assert(self->transitions);
+
+  if (value_len < 0)
+    value_len = strlen(value);
+
+  memset(tried, 0, tried_size);
+  for (i = 0; i < value_len; i++)
+    {
+      state = self->transitions[state * self->num_classes + self->byte_classes[(guchar) value[i]]];
+
+      gint32 output_state = self->output_heads[state] >= 0 ? state : self->output_links[state];
+      while (output_state)
+        {
+          gint32 o;
+
+          for (o = self->output_heads[output_state]; o >= 0; o = g_array_index(self->outputs, MultiMatcherOutput, o).next)
+            {
+              gint32 pattern = g_array_index(self->outputs, MultiMatcherOutput, o).pattern;
+
+              if (_try_matcher(self, pattern, tried, msg, value_handle, value, value_len))
+                return TRUE;
+            }
+          output_state = self->output_links[output_state];
+        }
+    }
+
+  for (i = 0; i < self->unfiltered->len; i++)
+    {
+      if (_try_matcher(self, g_array_index(self->unfiltered, gint32, i), tried, msg, value_handle, value, value_len))
+        return TRUE;
+    }
+  return FALSE;
+}
+
+void
+multi_matcher_add(MultiMatcher *self, LogMatcher *matcher, const gchar *type)
+{
+  gint32 index = self->matchers->len;
+  gchar *literal = multi_matcher_extract_literal(matcher->pattern, type, matcher->flags);
+
+  g_ptr_array_add(self->matchers, log_matcher_ref(matcher));
+  g_ptr_array_add(self->literals, literal ? g_ascii_strdown(literal, -1) : NULL);
+  if (!literal)
+    g_array_append_val(self->unfiltered, index);
+  g_free(literal);
+}
+
+gint
+multi_matcher_get_size(MultiMatcher *self)
+{
+  return self->matchers->len;
+}
+
+gint
+multi_matcher_get_prefiltered_size(MultiMatcher *self)
+{
+  return self->matchers->len - self->unfiltered->len;
+}
+
+MultiMatcher *
+multi_matcher_new(void)
+{
+  MultiMatcher *self = g_new0(MultiMatcher, 1);
+
+  self->matchers = g_ptr_array_new_with_free_func((GDestroyNotify) log_matcher_unref);
+  self->literals = g_ptr_array_new_with_free_func(g_free);
+  self->unfiltered = g_array_new(FALSE, FALSE, sizeof(gint32));
+  self->outputs = g_array_new(FALSE, FALSE, sizeof(MultiMatcherOutput));
+  return self;
+}
+
+void
+multi_matcher_free(MultiMatcher *self)
+{
+  g_ptr_array_free(self->matchers, TRUE);
+  g_ptr_array_free(self->literals, TRUE);
+  g_array_free(self->unfiltered, TRUE);
+  g_array_free(self->outputs, TRUE);
+  g_free(self->transitions);
+  g_free(self->output_heads);
+  g_free(self->output_links);
+  g_free(self);
+}
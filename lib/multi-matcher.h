@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef MULTI_MATCHER_H_INCLUDED
+#define MULTI_MATCHER_H_INCLUDED
+
+#include "logmatcher.h"
+
+/*
+ * MultiMatcher checks whether any of a set of LogMatcher instances matches
+ * a value.
+ *
+ * A literal substring that is required for a match is extracted from each
+ * pattern, and all of these literals are searched for in a single pass
+ * using an Aho-Corasick automaton.  The (much more expensive) LogMatcher
+ * is only executed for patterns whose literal occurs in the value, and
+ * for those patterns where no such literal could be found.
+ */
+typedef struct _MultiMatcher MultiMatcher;
+
+MultiMatcher *multi_matcher_new(void);
+void multi_matcher_add(MultiMatcher *self, LogMatcher *matcher, const gchar *type);
+void multi_matcher_compile(MultiMatcher *self);
+gboolean multi_matcher_match(MultiMatcher *self, LogMessage *msg, gint value_handle,
+                             const gchar *value, gssize value_len);
+gint multi_matcher_get_size(MultiMatcher *self);
+gint multi_matcher_get_prefiltered_size(MultiMatcher *self);
+void multi_matcher_free(MultiMatcher *self);
+
+/* exported for the unit tests */
+gchar *multi_matcher_extract_literal(const gchar *pattern, const gchar *type, gint flags);
+
+#endif
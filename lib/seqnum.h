@@ -40,5 +40,25 @@ step_sequence_number(gint32 *seqnum)
     *seqnum = 1;
 }
 
+/* returns the sequence number @n steps after @seqnum */
+static inline gint32
+add_sequence_number(gint32 seqnum, gint n)
+{
+  return ((gint64) seqnum - 1 + n) % G_MAXINT32 + 1;
+}
+
+/* steps @seqnum by @n atomically */
+static inline void
+step_sequence_number_atomic(gint32 *seqnum, gint n)
+{
+  gint32 old_value;
+
+  do
+    {
+      old_value = g_atomic_int_get(seqnum);
+    }
+  while (!g_atomic_int_compare_and_exchange(seqnum, old_value, add_sequence_number(old_value, n)));
+}
+
 
 #endif
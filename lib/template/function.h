@@ -65,8 +65,10 @@ struct _LogTemplateFunction
   gboolean (*prepare)(LogTemplateFunction *self, gpointer state, LogTemplate *parent, gint argc, gchar *argv[],
                       GError **error);
 
-  /* evaluate arguments, storing argument buffers in arg_bufs in case it
-   * makes sense to reuse those buffers */
+  /* evaluate arguments, appending argument buffers to args->bufs.  The
+   * array is empty on entry and is private to the current call, buffers
+   * should be allocated using scratch_buffers_alloc(), they are
+   * reclaimed once the call returns */
   void (*eval)(LogTemplateFunction *self, gpointer state, const LogTemplateInvokeArgs *args);
 
   /* call the function */
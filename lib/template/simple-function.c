@@ -24,6 +24,7 @@
 
 #include "template/simple-function.h"
 #include "template/templates.h"
+#include "scratch-buffers.h"
 
 void
 log_template_append_format_recursive(LogTemplate *self, const LogTemplateInvokeArgs *args, GString *result)
@@ -70,15 +71,10 @@ tf_simple_func_eval(LogTemplateFunction *self, gpointer s, const LogTemplateInvo
 
   for (i = 0; i < state->argc; i++)
     {
-      GString **arg;
+      GString *arg = scratch_buffers_alloc();
 
-      if (args->bufs->len <= i)
-        g_ptr_array_add(args->bufs, g_string_sized_new(256));
-
-      arg = (GString **) &g_ptr_array_index(args->bufs, i);
-      g_string_truncate(*arg, 0);
-
-      log_template_append_format_recursive(state->argv[i], args, *arg);
+      log_template_append_format_recursive(state->argv[i], args, arg);
+      g_ptr_array_add(args->bufs, arg);
     }
 }
 
@@ -27,6 +27,52 @@
 #include "template/macros.h"
 #include "template/escaping.h"
 #include "cfg.h"
+#include "scratch-buffers.h"
+#include "tls-support.h"
+
+/*
+ * Argument buffers for template function calls.
+ *
+ * Each thread has its own stack of argument arrays, one for every nesting
+ * level of template function calls (e.g. $(if) within $(format-json)),
+ * so evaluating a template function needs no locking even if the same
+ * LogTemplate instance is shared between threads. The GString instances
+ * in these arrays are scratch buffers, reclaimed as soon as the function
+ * call returns.
+ */
+TLS_BLOCK_START
+{
+  GPtrArray *template_func_args_stack;
+  gint template_func_args_depth;
+}
+TLS_BLOCK_END;
+
+#define template_func_args_stack  __tls_deref(template_func_args_stack)
+#define template_func_args_depth  __tls_deref(template_func_args_depth)
+
+static GPtrArray *
+_push_func_args(void)
+{
+  GPtrArray *bufs;
+
+  if (!template_func_args_stack)
+    template_func_args_stack = g_ptr_array_new();
+
+  if (template_func_args_depth >= template_func_args_stack->len)
+    g_ptr_array_add(template_func_args_stack, g_ptr_array_sized_new(8));
+
+  bufs = (GPtrArray *) g_ptr_array_index(template_func_args_stack, template_func_args_depth);
+  g_ptr_array_set_size(bufs, 0);
+  template_func_args_depth++;
+  return bufs;
+}
+
+static void
+_pop_func_args(void)
+{
+  g_assert(template_func_args_depth > 0);
+  template_func_args_depth--;
+}
 
 static void
 log_template_reset_compiled(LogTemplate *self)
@@ -132,34 +178,31 @@ log_template_append_format_with_context(LogTemplate *self, LogMessage **messages
         }
         case LTE_FUNC:
         {
-          g_static_mutex_lock(&self->arg_lock);
-          if (!self->arg_bufs)
-            self->arg_bufs = g_ptr_array_sized_new(0);
-
-          if (1)
-            {
-              LogTemplateInvokeArgs args =
-              {
-                self->arg_bufs,
-                e->msg_ref ? &messages[msg_ndx] : messages,
-                e->msg_ref ? 1 : num_messages,
-                opts,
-                tz,
-                seq_num,
-                context_id
-              };
-
-
-              /* if a function call is called with an msg_ref, we only
-               * pass that given logmsg to argument resolution, otherwise
-               * we pass the whole set so the arguments can individually
-               * specify which message they want to resolve from
-               */
-              if (e->func.ops->eval)
-                e->func.ops->eval(e->func.ops, e->func.state, &args);
-              e->func.ops->call(e->func.ops, e->func.state, &args, result);
-            }
-          g_static_mutex_unlock(&self->arg_lock);
+          ScratchBuffersMarker mark;
+          LogTemplateInvokeArgs args =
+          {
+            _push_func_args(),
+            e->msg_ref ? &messages[msg_ndx] : messages,
+            e->msg_ref ? 1 : num_messages,
+            opts,
+            tz,
+            seq_num,
+            context_id
+          };
+
+          scratch_buffers_mark(&mark);
+
+          /* if a function call is called with an msg_ref, we only
+           * pass that given logmsg to argument resolution, otherwise
+           * we pass the whole set so the arguments can individually
+           * specify which message they want to resolve from
+           */
+          if (e->func.ops->eval)
+            e->func.ops->eval(e->func.ops, e->func.state, &args);
+          e->func.ops->call(e->func.ops, e->func.state, &args, result);
+
+          scratch_buffers_reclaim_marked(mark);
+          _pop_func_args();
           break;
         }
         default:
@@ -232,25 +275,15 @@ log_template_new(GlobalConfig *cfg, const gchar *name)
   log_template_set_name(self, name);
   self->ref_cnt = 1;
   self->cfg = cfg;
-  g_static_mutex_init(&self->arg_lock);
   return self;
 }
 
 static void
 log_template_free(LogTemplate *self)
 {
-  if (self->arg_bufs)
-    {
-      gint i;
-
-      for (i = 0; i < self->arg_bufs->len; i++)
-        g_string_free(g_ptr_array_index(self->arg_bufs, i), TRUE);
-      g_ptr_array_free(self->arg_bufs, TRUE);
-    }
   log_template_reset_compiled(self);
   g_free(self->name);
   g_free(self->template);
-  g_static_mutex_free(&self->arg_lock);
   g_free(self);
 }
 
@@ -340,9 +373,25 @@ log_template_global_init(void)
 void
 log_template_global_deinit(void)
 {
+  log_template_thread_deinit();
   log_macros_global_deinit();
 }
 
+void
+log_template_thread_deinit(void)
+{
+  gint i;
+
+  if (!template_func_args_stack)
+    return;
+
+  for (i = 0; i < template_func_args_stack->len; i++)
+    g_ptr_array_free(g_ptr_array_index(template_func_args_stack, i), TRUE);
+  g_ptr_array_free(template_func_args_stack, TRUE);
+  template_func_args_stack = NULL;
+  template_func_args_depth = 0;
+}
+
 gboolean
 log_template_on_error_parse(const gchar *strictness, gint *out)
 {
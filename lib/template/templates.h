@@ -63,8 +63,6 @@ typedef struct _LogTemplate
   gboolean escape;
   gboolean def_inline;
   GlobalConfig *cfg;
-  GStaticMutex arg_lock;
-  GPtrArray *arg_bufs;
   TypeHint type_hint;
 } LogTemplate;
 
@@ -114,6 +112,7 @@ void log_template_options_defaults(LogTemplateOptions *options);
 
 void log_template_global_init(void);
 void log_template_global_deinit(void);
+void log_template_thread_deinit(void);
 
 gboolean log_template_on_error_parse(const gchar *on_error, gint *out);
 void log_template_options_set_on_error(LogTemplateOptions *options, gint on_error);
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include <criterion/criterion.h>
+
+#include "logmpx.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "filter/filter-pipe.h"
+#include "filter/filter-re.h"
+
+#define NUM_BRANCHES 8
+
+typedef struct _RecordingPipe
+{
+  LogPipe super;
+  gint branch_index;
+} RecordingPipe;
+
+static GArray *delivered_branches;
+
+static void
+_recording_pipe_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options)
+{
+  RecordingPipe *self = (RecordingPipe *) s;
+
+  g_array_append_val(delivered_branches, self->branch_index);
+  log_pipe_forward_msg(s, msg, path_options);
+}
+
+static LogPipe *
+_recording_pipe_new(gint branch_index)
+{
+  RecordingPipe *self = g_new0(RecordingPipe, 1);
+
+  log_pipe_init_instance(&self->super, configuration);
+  self->super.queue = _recording_pipe_queue;
+  self->branch_index = branch_index;
+  return &self->super;
+}
+
+static FilterExprNode *
+_program_filter_new(const gchar *pattern, const gchar *type)
+{
+  FilterRE *f = filter_re_new(LM_V_PROGRAM);
+
+  cr_assert(log_matcher_options_set_type(&f->matcher_options, type));
+  cr_assert(filter_re_compile_pattern(f, configuration, pattern, NULL));
+  return &f->super;
+}
+
+/* branch_head -> filter (optional) -> recording pipe */
+static LogPipe *
+_create_branch(LogMultiplexer *mpx, gint branch_index, FilterExprNode *expr, guint32 flags)
+{
+  LogPipe *branch_head = log_pipe_new(configuration);
+  LogPipe *p = branch_head;
+
+  if (expr)
+    {
+      p = log_pipe_append(p, log_filter_pipe_new(expr, configuration));
+    }
+  log_pipe_append(p, _recording_pipe_new(branch_index));
+  branch_head->flags |= flags;
+
+  log_multiplexer_add_next_hop(mpx, branch_head);
+  return branch_head;
+}
+
+static void
+_init_branches(LogMultiplexer *mpx)
+{
+  for (gint i = 0; i < mpx->next_hops->len; i++)
+    {
+      LogPipe *p;
+
+      for (p = g_ptr_array_index(mpx->next_hops, i); p; p = p->pipe_next)
+        cr_assert(log_pipe_init(p));
+    }
+  cr_assert(log_pipe_init(&mpx->super));
+}
+
+static void
+_free_branches(LogMultiplexer *mpx)
+{
+  for (gint i = 0; i < mpx->next_hops->len; i++)
+    {
+      LogPipe *p, *next;
+
+      for (p = g_ptr_array_index(mpx->next_hops, i); p; p = next)
+        {
+          next = p->pipe_next;
+          log_pipe_deinit(p);
+          log_pipe_unref(p);
+        }
+    }
+  log_pipe_deinit(&mpx->super);
+  log_pipe_unref(&mpx->super);
+}
+
+static void
+_queue_and_assert_delivered(LogMultiplexer *mpx, const gchar *program, const gint *expected, gint num_expected)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg = log_msg_new_empty();
+
+  log_msg_set_value(msg, LM_V_PROGRAM, program, -1);
+  g_array_set_size(delivered_branches, 0);
+  log_pipe_queue(&mpx->super, msg, &path_options);
+
+  cr_assert_eq(delivered_branches->len, num_expected,
+               "unexpected number of deliveries for program %s: %d", program, delivered_branches->len);
+  for (gint i = 0; i < num_expected; i++)
+    cr_assert_eq(g_array_index(delivered_branches, gint, i), expected[i],
+                 "unexpected delivery order for program %s", program);
+}
+
+static void
+setup(void)
+{
+  app_startup();
+  configuration = cfg_new_snippet();
+  cr_assert(cfg_init(configuration));
+  delivered_branches = g_array_new(FALSE, FALSE, sizeof(gint));
+}
+
+static void
+teardown(void)
+{
+  g_array_free(delivered_branches, TRUE);
+  cfg_free(configuration);
+  app_shutdown();
+}
+
+TestSuite(logmpx, .init = setup, .fini = teardown);
+
+Test(logmpx, literal_filters_are_dispatched_in_branch_order)
+{
+  LogMultiplexer *mpx = log_multiplexer_new(configuration);
+  gchar *program;
+
+  for (gint i = 0; i < NUM_BRANCHES; i++)
+    {
+      program = g_strdup_printf("prg%d", i % 4);
+      _create_branch(mpx, i, _program_filter_new(program, "string"), 0);
+      g_free(program);
+    }
+  /* not dispatchable, must be visited in order */
+  _create_branch(mpx, NUM_BRANCHES, _program_filter_new("prg", "pcre"), 0);
+  _create_branch(mpx, NUM_BRANCHES + 1, NULL, 0);
+  _init_branches(mpx);
+
+  cr_assert_not_null(mpx->dispatchers);
+  cr_assert_eq(mpx->undispatched_branches->len, 2);
+
+  _queue_and_assert_delivered(mpx, "prg1", (gint []) { 1, 5, 8, 9 }, 4);
+  _queue_and_assert_delivered(mpx, "prg3", (gint []) { 3, 7, 8, 9 }, 4);
+  _queue_and_assert_delivered(mpx, "foo", (gint []) { 9 }, 1);
+
+  _free_branches(mpx);
+}
+
+Test(logmpx, anchored_pcre_and_final_flag_are_honoured)
+{
+  LogMultiplexer *mpx = log_multiplexer_new(configuration);
+
+  _create_branch(mpx, 0, _program_filter_new("^foo$", "pcre"), 0);
+  _create_branch(mpx, 1, _program_filter_new("^bar$", "pcre"), PIF_BRANCH_FINAL);
+  _create_branch(mpx, 2, _program_filter_new("foo", "string"), PIF_BRANCH_FINAL);
+  _create_branch(mpx, 3, _program_filter_new("bar", "string"), 0);
+  _create_branch(mpx, 4, _program_filter_new("foo", "string"), 0);
+  _create_branch(mpx, 5, NULL, PIF_BRANCH_FALLBACK);
+  _init_branches(mpx);
+
+  cr_assert_not_null(mpx->dispatchers);
+
+  _queue_and_assert_delivered(mpx, "foo", (gint []) { 0, 2 }, 2);
+  _queue_and_assert_delivered(mpx, "foo\n", (gint []) { 0 }, 1);
+  _queue_and_assert_delivered(mpx, "bar", (gint []) { 1 }, 1);
+  _queue_and_assert_delivered(mpx, "baz", (gint []) { 5 }, 1);
+
+  _free_branches(mpx);
+}
+
+Test(logmpx, few_literal_filters_are_not_dispatched)
+{
+  LogMultiplexer *mpx = log_multiplexer_new(configuration);
+
+  _create_branch(mpx, 0, _program_filter_new("foo", "string"), 0);
+  _create_branch(mpx, 1, _program_filter_new("bar", "string"), 0);
+  _create_branch(mpx, 2, _program_filter_new("foo", "string"), PIF_DROP_UNMATCHED);
+  _init_branches(mpx);
+
+  cr_assert_null(mpx->dispatchers);
+
+  _queue_and_assert_delivered(mpx, "foo", (gint []) { 0, 2 }, 2);
+
+  _free_branches(mpx);
+}
@@ -0,0 +1,643 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+/* the worker is driven from the test thread, using the static functions
+ * of the worker thread */
+#include "logthrdestdrv.c"
+#include "logqueue-fifo.h"
+#include "apphook.h"
+#include "cfg.h"
+
+#include <criterion/criterion.h>
+#include <iv.h>
+
+typedef struct
+{
+  LogThreadedDestDriver super;
+
+  worker_insert_result_t insert_result;
+  /* insert() returns insert_failure for the insert_failure_at-th message */
+  gint insert_failure_at;
+  worker_insert_result_t insert_failure;
+  worker_insert_result_t flush_result;
+  /* acked by the next flush using log_threaded_dest_worker_complete_batch_head() */
+  gint flush_head_written;
+  gint flush_head_dropped;
+  /* flush() reports all pending messages as written, as if it waited for them */
+  gboolean flush_completes_pending;
+
+  gint insert_counter;
+  gint flush_counter;
+  gint last_flush_size;
+  gint disconnect_counter;
+  gint32 inserted_seq_nums[16];
+} TestThreadedDestDriver;
+
+static GlobalConfig *cfg;
+static TestThreadedDestDriver *dd;
+static LogThreadedDestWorker *worker;
+static StatsCounterItem written_messages;
+static StatsCounterItem dropped_messages;
+static gint acked_messages;
+
+static worker_insert_result_t
+_insert(LogThreadedDestWorker *s, LogMessage *msg)
+{
+  TestThreadedDestDriver *owner = (TestThreadedDestDriver *) log_threaded_dest_worker_get_owner(s);
+
+  owner->insert_counter++;
+  if (owner->insert_counter <= (gint) G_N_ELEMENTS(owner->inserted_seq_nums))
+    owner->inserted_seq_nums[owner->insert_counter - 1] = s->seq_num;
+  if (owner->insert_counter == owner->insert_failure_at)
+    return owner->insert_failure;
+  return owner->insert_result;
+}
+
+static worker_insert_result_t
+_flush(LogThreadedDestWorker *s)
+{
+  TestThreadedDestDriver *owner = (TestThreadedDestDriver *) log_threaded_dest_worker_get_owner(s);
+
+  owner->flush_counter++;
+  owner->last_flush_size = s->batch_size;
+
+  if (owner->flush_head_written)
+    log_threaded_dest_worker_complete_batch_head(s, owner->flush_head_written, WORKER_INSERT_RESULT_SUCCESS);
+  if (owner->flush_head_dropped)
+    log_threaded_dest_worker_complete_batch_head(s, owner->flush_head_dropped, WORKER_INSERT_RESULT_DROP);
+  owner->flush_head_written = owner->flush_head_dropped = 0;
+
+  if (owner->flush_completes_pending && s->pending_size > 0)
+    log_threaded_dest_worker_complete_pending(s, s->pending_size, WORKER_INSERT_RESULT_SUCCESS);
+
+  return owner->flush_result;
+}
+
+static void
+_test_disconnect(LogThreadedDestWorker *s)
+{
+  TestThreadedDestDriver *owner = (TestThreadedDestDriver *) log_threaded_dest_worker_get_owner(s);
+
+  owner->disconnect_counter++;
+}
+
+static gchar *
+_format_stats_instance(LogThreadedDestDriver *s)
+{
+  return "test_threaded_dd";
+}
+
+static const gchar *
+_generate_persist_name(const LogPipe *s)
+{
+  return "test_threaded_dd";
+}
+
+static LogThreadedDestWorker *_create_worker(LogThreadedDestDriver *owner, gint worker_index);
+
+static TestThreadedDestDriver *
+test_threaded_dd_new(GlobalConfig *config)
+{
+  TestThreadedDestDriver *self = g_new0(TestThreadedDestDriver, 1);
+
+  log_threaded_dest_driver_init_instance(&self->super, config);
+  self->super.super.super.id = g_strdup("test_threaded_dd");
+  self->super.super.super.super.generate_persist_name = _generate_persist_name;
+  self->super.format.stats_instance = _format_stats_instance;
+  self->super.construct_worker = _create_worker;
+  self->super.time_reopen = 60;
+  self->super.written_messages = &written_messages;
+  self->super.dropped_messages = &dropped_messages;
+
+  init_sequence_number(&self->super.shared_seq_num);
+
+  self->insert_result = WORKER_INSERT_RESULT_SUCCESS;
+  self->flush_result = WORKER_INSERT_RESULT_SUCCESS;
+  return self;
+}
+
+static void
+_test_ack(LogMessage *msg, AckType ack_type)
+{
+  acked_messages++;
+}
+
+static void
+_feed_messages_to_queue(LogQueue *queue, gint n)
+{
+  for (gint i = 0; i < n; i++)
+    {
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      LogMessage *msg = log_msg_new_empty();
+
+      path_options.ack_needed = TRUE;
+      path_options.flow_control_requested = TRUE;
+      log_msg_add_ack(msg, &path_options);
+      msg->ack_func = _test_ack;
+      log_queue_push_tail(queue, msg, &path_options);
+    }
+}
+
+static void
+_feed_messages(gint n)
+{
+  _feed_messages_to_queue(worker->queue, n);
+}
+
+static LogThreadedDestWorker *
+_create_worker(LogThreadedDestDriver *owner, gint worker_index)
+{
+  LogThreadedDestWorker *self = g_new0(LogThreadedDestWorker, 1);
+
+  log_threaded_dest_worker_init_instance(self, owner, worker_index);
+  self->insert = _insert;
+  self->flush = _flush;
+  self->disconnect = _test_disconnect;
+  return self;
+}
+
+static void
+_start_worker(LogThreadedDestWorker *self)
+{
+  self->queue = log_queue_fifo_new(1000, NULL);
+  log_queue_set_use_backlog(self->queue, TRUE);
+  self->connected = TRUE;
+  _init_watches(self);
+  iv_validate_now();
+  self->last_flush_time = iv_now;
+}
+
+static void
+_stop_worker(LogThreadedDestWorker *self)
+{
+  _stop_watches(self);
+  iv_event_unregister(&self->wake_up_event);
+  iv_event_unregister(&self->shutdown_event);
+  log_queue_unref(self->queue);
+  log_threaded_dest_worker_free(self);
+}
+
+static void
+setup(void)
+{
+  app_startup();
+  cfg = cfg_new_snippet();
+
+  memset(&written_messages, 0, sizeof(written_messages));
+  memset(&dropped_messages, 0, sizeof(dropped_messages));
+  acked_messages = 0;
+
+  dd = test_threaded_dd_new(cfg);
+  worker = _create_worker(&dd->super, 0);
+  _start_worker(worker);
+}
+
+static void
+teardown(void)
+{
+  _stop_worker(worker);
+  log_pipe_unref(&dd->super.super.super.super);
+  cfg_free(cfg);
+  app_shutdown();
+}
+
+TestSuite(logthrdestdrv, .init = setup, .fini = teardown);
+
+Test(logthrdestdrv, test_inserts_without_batching_are_acked_one_by_one)
+{
+  _feed_messages(5);
+  _perform_inserts(worker);
+
+  cr_assert_eq(dd->insert_counter, 5);
+  cr_assert_eq(dd->flush_counter, 0);
+  cr_assert_eq(acked_messages, 5);
+  cr_assert_eq(stats_counter_get(&written_messages), 5);
+  cr_assert_eq(worker->batch_size, 0);
+}
+
+Test(logthrdestdrv, test_queued_messages_are_flushed_when_batch_lines_is_reached)
+{
+  dd->super.batch_lines = 5;
+  dd->insert_result = WORKER_INSERT_RESULT_QUEUED;
+
+  _feed_messages(12);
+  _perform_inserts(worker);
+
+  cr_assert_eq(dd->insert_counter, 12);
+  cr_assert_eq(dd->flush_counter, 2);
+  cr_assert_eq(dd->last_flush_size, 5);
+  cr_assert_eq(acked_messages, 10);
+  cr_assert_eq(stats_counter_get(&written_messages), 10);
+  cr_assert_eq(worker->batch_size, 2, "the partial batch is not flushed while inserting");
+
+  /* the queue is empty, without batch-timeout() the partial batch is flushed right away */
+  _perform_work(worker);
+
+  cr_assert_eq(dd->flush_counter, 3);
+  cr_assert_eq(dd->last_flush_size, 2);
+  cr_assert_eq(acked_messages, 12);
+  cr_assert_eq(worker->batch_size, 0);
+}
+
+Test(logthrdestdrv, test_partial_batch_is_flushed_when_batch_timeout_expires)
+{
+  dd->super.batch_lines = 10;
+  dd->super.batch_timeout = 1000;
+  dd->insert_result = WORKER_INSERT_RESULT_QUEUED;
+
+  _feed_messages(3);
+  _perform_inserts(worker);
+  _perform_work(worker);
+
+  cr_assert_eq(dd->flush_counter, 0);
+  cr_assert_eq(acked_messages, 0);
+  cr_assert(iv_timer_registered(&worker->timer_flush), "batch-timeout() should be waited for");
+
+  /* as if batch-timeout() had elapsed since the last flush */
+  worker->last_flush_time.tv_sec -= 2;
+  _perform_work(worker);
+
+  cr_assert_eq(dd->flush_counter, 1);
+  cr_assert_eq(dd->last_flush_size, 3);
+  cr_assert_eq(acked_messages, 3);
+  cr_assert_eq(worker->batch_size, 0);
+}
+
+Test(logthrdestdrv, test_complete_batch_head_acks_the_head_and_the_result_applies_to_the_rest)
+{
+  dd->super.batch_lines = 5;
+  dd->insert_result = WORKER_INSERT_RESULT_QUEUED;
+  dd->flush_head_written = 2;
+  dd->flush_head_dropped = 1;
+  dd->flush_result = WORKER_INSERT_RESULT_REWIND;
+
+  _feed_messages(5);
+  _perform_inserts(worker);
+
+  cr_assert_eq(dd->flush_counter, 1);
+  cr_assert_eq(acked_messages, 3);
+  cr_assert_eq(stats_counter_get(&written_messages), 2);
+  cr_assert_eq(stats_counter_get(&dropped_messages), 1);
+
+  /* the rewound tail of the batch is inserted again right away */
+  cr_assert_eq(dd->insert_counter, 7);
+  cr_assert_eq(worker->batch_size, 2);
+  cr_assert_eq(log_queue_get_length(worker->queue), 0);
+}
+
+Test(logthrdestdrv, test_error_rewinds_the_batch_and_suspends_the_worker)
+{
+  dd->super.batch_lines = 10;
+  dd->insert_result = WORKER_INSERT_RESULT_QUEUED;
+  dd->insert_failure_at = 3;
+  dd->insert_failure = WORKER_INSERT_RESULT_ERROR;
+
+  _feed_messages(5);
+  _perform_inserts(worker);
+
+  cr_assert_eq(dd->insert_counter, 3, "the worker should stop inserting once suspended");
+  cr_assert_eq(acked_messages, 0);
+  cr_assert_eq(log_queue_get_length(worker->queue), 5, "the whole batch should be rewound");
+  cr_assert_eq(worker->batch_size, 0);
+  cr_assert_eq(worker->retries_counter, 1);
+  cr_assert_not(worker->connected);
+  cr_assert(iv_timer_registered(&worker->timer_reopen));
+}
+
+Test(logthrdestdrv, test_error_drops_the_batch_after_max_retries)
+{
+  log_threaded_dest_driver_set_max_retries(&dd->super.super.super, 1);
+  dd->insert_result = WORKER_INSERT_RESULT_ERROR;
+
+  _feed_messages(3);
+  _perform_inserts(worker);
+
+  cr_assert_eq(dd->insert_counter, 3);
+  cr_assert_eq(acked_messages, 3);
+  cr_assert_eq(stats_counter_get(&dropped_messages), 3);
+  cr_assert_eq(stats_counter_get(&written_messages), 0);
+  cr_assert(worker->connected);
+}
+
+Test(logthrdestdrv, test_not_connected_rewinds_the_batch_without_counting_a_retry)
+{
+  dd->super.batch_lines = 10;
+  dd->insert_result = WORKER_INSERT_RESULT_QUEUED;
+  dd->insert_failure_at = 3;
+  dd->insert_failure = WORKER_INSERT_RESULT_NOT_CONNECTED;
+
+  _feed_messages(5);
+  _perform_inserts(worker);
+
+  cr_assert_eq(dd->insert_counter, 3);
+  cr_assert_eq(acked_messages, 0);
+  cr_assert_eq(log_queue_get_length(worker->queue), 5);
+  cr_assert_eq(worker->retries_counter, 0);
+  cr_assert_not(worker->connected);
+  cr_assert(iv_timer_registered(&worker->timer_reopen));
+}
+
+Test(logthrdestdrv, test_flush_error_rewinds_the_whole_batch)
+{
+  dd->super.batch_lines = 4;
+  dd->insert_result = WORKER_INSERT_RESULT_QUEUED;
+  dd->flush_result = WORKER_INSERT_RESULT_ERROR;
+
+  _feed_messages(6);
+  _perform_inserts(worker);
+
+  cr_assert_eq(dd->flush_counter, 1);
+  cr_assert_eq(acked_messages, 0);
+  cr_assert_eq(log_queue_get_length(worker->queue), 6);
+  cr_assert_not(worker->connected);
+}
+
+/* flushes batches of 2 that are delivered asynchronously, leaving
+ * @num_pending messages pending and @num_queued in the current batch */
+static void
+_send_pending_batches(gint num_pending, gint num_queued)
+{
+  dd->super.batch_lines = 2;
+  dd->insert_result = WORKER_INSERT_RESULT_QUEUED;
+  dd->flush_result = WORKER_INSERT_RESULT_PENDING;
+
+  _feed_messages(num_pending + num_queued);
+  _perform_inserts(worker);
+
+  cr_assert_eq(dd->flush_counter, num_pending / 2);
+  cr_assert_eq(worker->pending_size, num_pending);
+  cr_assert_eq(worker->batch_size, num_queued);
+  cr_assert_eq(acked_messages, 0);
+}
+
+Test(logthrdestdrv, test_pending_batches_are_acked_in_order_as_they_complete)
+{
+  _send_pending_batches(6, 0);
+
+  log_threaded_dest_worker_complete_pending(worker, 2, WORKER_INSERT_RESULT_SUCCESS);
+  cr_assert_eq(acked_messages, 2);
+  cr_assert_eq(worker->pending_size, 4);
+
+  log_threaded_dest_worker_complete_pending(worker, 4, WORKER_INSERT_RESULT_SUCCESS);
+  cr_assert_eq(acked_messages, 6);
+  cr_assert_eq(stats_counter_get(&written_messages), 6);
+  cr_assert_eq(worker->pending_size, 0);
+  cr_assert(worker->connected);
+}
+
+Test(logthrdestdrv, test_dropped_pending_batch_does_not_abandon_the_later_ones)
+{
+  _send_pending_batches(4, 0);
+
+  log_threaded_dest_worker_complete_pending(worker, 2, WORKER_INSERT_RESULT_DROP);
+
+  cr_assert_eq(acked_messages, 2);
+  cr_assert_eq(stats_counter_get(&dropped_messages), 2);
+  cr_assert_eq(worker->pending_size, 2);
+  cr_assert(worker->connected);
+  cr_assert_eq(dd->disconnect_counter, 0);
+}
+
+Test(logthrdestdrv, test_pending_error_rewinds_all_pending_batches_and_the_current_one)
+{
+  _send_pending_batches(6, 1);
+
+  log_threaded_dest_worker_complete_pending(worker, 2, WORKER_INSERT_RESULT_ERROR);
+
+  cr_assert_eq(acked_messages, 0);
+  cr_assert_eq(log_queue_get_length(worker->queue), 7);
+  cr_assert_eq(worker->pending_size, 0);
+  cr_assert_eq(worker->batch_size, 0);
+  cr_assert_eq(worker->retries_counter, 1);
+  cr_assert_eq(dd->disconnect_counter, 1);
+  cr_assert_not(worker->connected);
+  cr_assert(iv_timer_registered(&worker->timer_reopen));
+}
+
+Test(logthrdestdrv, test_pending_error_drops_the_batch_after_max_retries)
+{
+  log_threaded_dest_driver_set_max_retries(&dd->super.super.super, 1);
+  _send_pending_batches(4, 0);
+
+  log_threaded_dest_worker_complete_pending(worker, 2, WORKER_INSERT_RESULT_ERROR);
+
+  cr_assert_eq(acked_messages, 2);
+  cr_assert_eq(stats_counter_get(&dropped_messages), 2);
+  cr_assert_eq(worker->pending_size, 2, "the later batches should stay pending");
+  cr_assert_eq(worker->retries_counter, 0);
+  cr_assert(worker->connected);
+
+  log_threaded_dest_worker_complete_pending(worker, 2, WORKER_INSERT_RESULT_SUCCESS);
+  cr_assert_eq(acked_messages, 4);
+  cr_assert_eq(stats_counter_get(&written_messages), 2);
+}
+
+Test(logthrdestdrv, test_disconnect_rewinds_pending_messages)
+{
+  _send_pending_batches(4, 1);
+
+  _disconnect(worker);
+
+  cr_assert_eq(dd->disconnect_counter, 1);
+  cr_assert_eq(acked_messages, 0);
+  cr_assert_eq(log_queue_get_length(worker->queue), 5);
+  cr_assert_eq(worker->pending_size, 0);
+  cr_assert_eq(worker->batch_size, 0);
+}
+
+Test(logthrdestdrv, test_synchronous_result_while_batches_are_pending_rewinds_all)
+{
+  _send_pending_batches(4, 0);
+
+  /* the result of this batch can't be acked before the pending ones */
+  dd->flush_result = WORKER_INSERT_RESULT_SUCCESS;
+  _feed_messages(2);
+  _perform_inserts(worker);
+
+  cr_assert_eq(acked_messages, 0);
+  cr_assert_eq(log_queue_get_length(worker->queue), 6);
+  cr_assert_eq(worker->pending_size, 0);
+  cr_assert_not(worker->connected);
+}
+
+Test(logthrdestdrv, test_final_flush_waits_for_pending_messages)
+{
+  _send_pending_batches(4, 0);
+
+  dd->flush_completes_pending = TRUE;
+  dd->flush_result = WORKER_INSERT_RESULT_SUCCESS;
+  _perform_final_flush(worker);
+
+  cr_assert_eq(dd->flush_counter, 3, "flush() should be called even though the batch is empty");
+  cr_assert_eq(dd->last_flush_size, 0);
+  cr_assert_eq(acked_messages, 4);
+  cr_assert_eq(stats_counter_get(&written_messages), 4);
+  cr_assert_eq(worker->pending_size, 0);
+  cr_assert_eq(log_queue_get_length(worker->queue), 0);
+}
+
+Test(logthrdestdrv, test_messages_still_pending_on_exit_are_rewound)
+{
+  _send_pending_batches(4, 0);
+
+  _perform_final_flush(worker);
+  _disconnect(worker);
+
+  cr_assert_eq(acked_messages, 0);
+  cr_assert_eq(worker->pending_size, 0);
+  cr_assert_eq(log_queue_get_length(worker->queue), 4, "the pending messages should be sent again after a reload");
+}
+
+static void
+_assert_inserted_seq_nums(const gint32 *expected, gint num_inserts)
+{
+  cr_assert_eq(dd->insert_counter, num_inserts);
+  for (gint i = 0; i < num_inserts; i++)
+    cr_assert_eq(dd->inserted_seq_nums[i], expected[i], "unexpected $SEQNUM at insert #%d: %d, expected: %d",
+                 i, dd->inserted_seq_nums[i], expected[i]);
+}
+
+/* as if the worker reconnected after time-reopen() */
+static void
+_resume_worker(void)
+{
+  _stop_watches(worker);
+  worker->suspended = FALSE;
+  worker->connected = TRUE;
+}
+
+Test(logthrdestdrv, test_retried_message_keeps_its_seqnum)
+{
+  dd->insert_failure_at = 2;
+  dd->insert_failure = WORKER_INSERT_RESULT_ERROR;
+
+  _feed_messages(3);
+  _perform_inserts(worker);
+  _resume_worker();
+  _perform_inserts(worker);
+
+  const gint32 expected[] = { 1, 2, 2, 3 };
+  _assert_inserted_seq_nums(expected, G_N_ELEMENTS(expected));
+  cr_assert_eq(dd->super.shared_seq_num, 4);
+}
+
+Test(logthrdestdrv, test_rewound_pending_messages_keep_their_seqnum)
+{
+  _send_pending_batches(4, 0);
+
+  log_threaded_dest_worker_complete_pending(worker, 2, WORKER_INSERT_RESULT_SUCCESS);
+  log_threaded_dest_worker_complete_pending(worker, 2, WORKER_INSERT_RESULT_ERROR);
+  _resume_worker();
+  dd->flush_result = WORKER_INSERT_RESULT_SUCCESS;
+  _perform_inserts(worker);
+
+  const gint32 expected[] = { 1, 2, 3, 4, 3, 4 };
+  _assert_inserted_seq_nums(expected, G_N_ELEMENTS(expected));
+  cr_assert_eq(acked_messages, 4);
+  cr_assert_eq(dd->super.shared_seq_num, 5);
+}
+
+static LogMessage *
+_create_message_with_host(const gchar *host)
+{
+  LogMessage *msg = log_msg_new_empty();
+
+  log_msg_set_value(msg, LM_V_HOST, host, -1);
+  return msg;
+}
+
+Test(logthrdestdrv, test_workers_have_their_own_queues)
+{
+  dd->super.num_workers = 3;
+  cr_assert(_create_workers(&dd->super));
+
+  cr_assert_str_eq(dd->super.workers[0]->queue->persist_name, "test_threaded_dd",
+                   "the first worker should keep the queue of the single threaded implementation");
+  cr_assert_str_eq(dd->super.workers[1]->queue->persist_name, "test_threaded_dd.1");
+  cr_assert_str_eq(dd->super.workers[2]->queue->persist_name, "test_threaded_dd.2");
+  cr_assert_neq(dd->super.workers[1]->queue, dd->super.workers[2]->queue);
+
+  _destroy_workers(&dd->super);
+}
+
+Test(logthrdestdrv, test_messages_are_dispatched_to_workers_in_round_robin)
+{
+  dd->super.num_workers = 3;
+  cr_assert(_create_workers(&dd->super));
+
+  for (gint i = 0; i < 6; i++)
+    {
+      LogMessage *msg = log_msg_new_empty();
+
+      cr_assert_eq(_lookup_worker(&dd->super, msg), dd->super.workers[i % 3]);
+      log_msg_unref(msg);
+    }
+
+  _destroy_workers(&dd->super);
+}
+
+Test(logthrdestdrv, test_messages_with_the_same_partition_key_are_dispatched_to_the_same_worker)
+{
+  LogTemplate *key = log_template_new(cfg, NULL);
+
+  cr_assert(log_template_compile(key, "$HOST", NULL));
+  log_threaded_dest_driver_set_worker_partition_key_ref(&dd->super.super.super, key);
+  dd->super.num_workers = 4;
+  cr_assert(_create_workers(&dd->super));
+
+  LogMessage *msg = _create_message_with_host("host1");
+  LogThreadedDestWorker *host1_worker = _lookup_worker(&dd->super, msg);
+  log_msg_unref(msg);
+
+  for (gint i = 0; i < 5; i++)
+    {
+      msg = _create_message_with_host("host1");
+      cr_assert_eq(_lookup_worker(&dd->super, msg), host1_worker);
+      log_msg_unref(msg);
+    }
+
+  _destroy_workers(&dd->super);
+}
+
+Test(logthrdestdrv, test_queues_of_removed_workers_are_moved_to_the_remaining_workers)
+{
+  cfg->persist = persist_config_new();
+
+  LogQueue *orphaned_queue = log_queue_fifo_new(1000, "test_threaded_dd.2");
+  _feed_messages_to_queue(orphaned_queue, 5);
+  cfg_persist_config_add(cfg, "test_threaded_dd.2", orphaned_queue, (GDestroyNotify) log_queue_unref, FALSE);
+  cfg_persist_config_add(cfg, "test_threaded_dd.workers", GINT_TO_POINTER(3), NULL, FALSE);
+
+  dd->super.num_workers = 2;
+  cr_assert(_create_workers(&dd->super));
+  _drain_orphaned_queues(&dd->super);
+
+  cr_assert_eq(log_queue_get_length(dd->super.workers[0]->queue), 3);
+  cr_assert_eq(log_queue_get_length(dd->super.workers[1]->queue), 2);
+  cr_assert_null(cfg_persist_config_fetch(cfg, "test_threaded_dd.2"));
+  cr_assert_eq(acked_messages, 0, "moved messages should not be acked");
+
+  _destroy_workers(&dd->super);
+  persist_config_free(cfg->persist);
+  cfg->persist = NULL;
+}
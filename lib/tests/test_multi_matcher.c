@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include <criterion/criterion.h>
+
+#include "multi-matcher.h"
+#include "filter/filter-op.h"
+#include "filter/filter-re.h"
+#include "apphook.h"
+#include "cfg.h"
+
+#include <string.h>
+
+static void
+assert_literal(const gchar *pattern, const gchar *type, gint flags, const gchar *expected)
+{
+  gchar *literal = multi_matcher_extract_literal(pattern, type, flags);
+
+  if (expected)
+    cr_assert(literal && strcmp(literal, expected) == 0,
+              "unexpected literal for pattern %s: %s", pattern, literal);
+  else
+    cr_assert_null(literal, "no literal expected for pattern %s, got %s", pattern, literal);
+  g_free(literal);
+}
+
+Test(multi_matcher, pcre_literal_extraction)
+{
+  assert_literal("foobar", "pcre", 0, "foobar");
+  assert_literal("^foo.*barbaz$", "pcre", 0, "barbaz");
+  assert_literal("failed password for (invalid user )?\\w+", "pcre", 0, "failed password for ");
+  assert_literal("ab?cd", "pcre", 0, "cd");
+  assert_literal("abc+de", "pcre", 0, "abc");
+  assert_literal("ab{0,2}cd", "pcre", 0, "cd");
+  assert_literal("ab{2}cd", "pcre", 0, "ab");
+  assert_literal("a{foo}", "pcre", 0, "a{foo}");
+  assert_literal("x[a-z]+yy\\.zz", "pcre", 0, "yy.zz");
+  assert_literal("[]|]+foo", "pcre", 0, "foo");
+  assert_literal("\\d+ errors", "pcre", 0, " errors");
+  assert_literal("tab\\there", "pcre", 0, "tab\there");
+
+  assert_literal("foo|bar", "pcre", 0, NULL);
+  assert_literal("(?i)foo", "pcre", 0, NULL);
+  assert_literal("(a|b)cd", "pcre", 0, "cd");
+  assert_literal("foo\\x41", "pcre", 0, NULL);
+  assert_literal("(foo)\\1", "pcre", 0, NULL);
+  assert_literal(".*", "pcre", 0, NULL);
+  assert_literal("\xc3\xa9?abc", "pcre", LMF_UTF8, "abc");
+  assert_literal("foo", "pcre", LMF_ICASE | LMF_UTF8, NULL);
+}
+
+Test(multi_matcher, other_literal_extraction)
+{
+  assert_literal("foo", "string", 0, "foo");
+  assert_literal("", "string", 0, NULL);
+  assert_literal("\xc3\xa9t\xc3\xa9", "string", LMF_ICASE, NULL);
+  assert_literal("*foo?barbaz*", "glob", 0, "barbaz");
+  assert_literal("*", "glob", 0, NULL);
+}
+
+static LogMatcher *
+_create_matcher(const gchar *pattern, const gchar *type, gint flags)
+{
+  LogMatcherOptions options;
+  LogMatcher *matcher;
+
+  log_matcher_options_defaults(&options);
+  cr_assert(log_matcher_options_set_type(&options, type));
+  options.flags = flags | LMF_MATCH_ONLY;
+  matcher = log_matcher_new(configuration, &options);
+  cr_assert(log_matcher_compile(matcher, pattern, NULL));
+  log_matcher_options_destroy(&options);
+  return matcher;
+}
+
+typedef struct _TestPattern
+{
+  const gchar *pattern;
+  const gchar *type;
+  gint flags;
+} TestPattern;
+
+static TestPattern test_patterns[] =
+{
+  { "failed password for (invalid user )?\\w+", "pcre", 0 },
+  { "session opened", "string", LMF_SUBSTRING },
+  { "^kernel: .*segfault", "pcre", 0 },
+  { "ERROR", "pcre", LMF_ICASE },
+  { "sudo", "string", LMF_PREFIX },
+  { "*denied*", "glob", 0 },
+  { "[0-9]+\\.[0-9]+\\.[0-9]+\\.[0-9]+", "pcre", 0 },
+  { "shell|bash", "pcre", 0 },
+  { "rootkit", "string", LMF_SUBSTRING | LMF_ICASE },
+  { "ab", "string", LMF_SUBSTRING },
+  { "abc", "string", LMF_SUBSTRING },
+  { "bcd", "string", LMF_SUBSTRING },
+};
+
+static const gchar *test_values[] =
+{
+  "Failed password for root from 10.0.0.1",
+  "failed password for invalid user admin",
+  "pam_unix: session opened for user root",
+  "kernel: foo[123]: segfault at 0",
+  "error: something went wrong",
+  "disk ErRoR",
+  "sudo: root : TTY=pts/0",
+  "not sudo",
+  "permission denied",
+  "connected to 192.168.1.1",
+  "/bin/bash",
+  "RootKit detected",
+  "xbcx",
+  "zabcd",
+  "nothing to see here",
+  "",
+};
+
+Test(multi_matcher, results_match_individual_matchers)
+{
+  gint num_patterns = G_N_ELEMENTS(test_patterns);
+
+  /* try each subset of consecutive patterns, so that each value gets matched by different combinations */
+  for (gint first = 0; first < num_patterns; first++)
+    {
+      for (gint last = first; last < num_patterns; last++)
+        {
+          MultiMatcher *multi_matcher = multi_matcher_new();
+          GPtrArray *matchers = g_ptr_array_new_with_free_func((GDestroyNotify) log_matcher_unref);
+
+          for (gint i = first; i <= last; i++)
+            {
+              LogMatcher *matcher = _create_matcher(test_patterns[i].pattern, test_patterns[i].type, test_patterns[i].flags);
+
+              multi_matcher_add(multi_matcher, matcher, test_patterns[i].type);
+              g_ptr_array_add(matchers, matcher);
+            }
+          multi_matcher_compile(multi_matcher);
+
+          for (gint v = 0; v < G_N_ELEMENTS(test_values); v++)
+            {
+              LogMessage *msg = log_msg_new_empty();
+              const gchar *value = test_values[v];
+              gboolean expected = FALSE;
+
+              for (gint i = 0; i < matchers->len && !expected; i++)
+                expected = log_matcher_match(g_ptr_array_index(matchers, i), msg, LM_V_MESSAGE, value, strlen(value));
+
+              cr_assert_eq(multi_matcher_match(multi_matcher, msg, LM_V_MESSAGE, value, -1), expected,
+                           "MultiMatcher result differs, value: %s, patterns: %d-%d", value, first, last);
+              log_msg_unref(msg);
+            }
+
+          g_ptr_array_free(matchers, TRUE);
+          multi_matcher_free(multi_matcher);
+        }
+    }
+}
+
+Test(multi_matcher, prefiltered_size)
+{
+  MultiMatcher *multi_matcher = multi_matcher_new();
+
+  for (gint i = 0; i < G_N_ELEMENTS(test_patterns); i++)
+    {
+      LogMatcher *matcher = _create_matcher(test_patterns[i].pattern, test_patterns[i].type, test_patterns[i].flags);
+
+      multi_matcher_add(multi_matcher, matcher, test_patterns[i].type);
+      log_matcher_unref(matcher);
+    }
+  multi_matcher_compile(multi_matcher);
+
+  cr_assert_eq(multi_matcher_get_size(multi_matcher), G_N_ELEMENTS(test_patterns));
+  /* the alternation has no literal */
+  cr_assert_eq(multi_matcher_get_prefiltered_size(multi_matcher), G_N_ELEMENTS(test_patterns) - 1);
+  multi_matcher_free(multi_matcher);
+}
+
+static FilterExprNode *
+_create_regexp_filter(const gchar *pattern, gint flags)
+{
+  FilterRE *filter = filter_re_new(LM_V_MESSAGE);
+
+  filter->matcher_options.flags |= flags;
+  cr_assert(log_matcher_options_set_type(&filter->matcher_options, "pcre"));
+  cr_assert(filter_re_compile_pattern(filter, configuration, pattern, NULL));
+  return &filter->super;
+}
+
+/* enough alternatives on the same value to be merged */
+static FilterExprNode *
+_create_or_expression(FilterExprNode *first)
+{
+  FilterExprNode *expr = first;
+
+  for (gint i = 0; i < 8; i++)
+    {
+      gchar pattern[32];
+
+      g_snprintf(pattern, sizeof(pattern), "pattern%d", i);
+      expr = fop_or_new(expr, _create_regexp_filter(pattern, 0));
+    }
+  filter_expr_init(expr, configuration);
+  return expr;
+}
+
+static gboolean
+_eval_or_expression(FilterExprNode *expr, LogMessage *msg, const gchar *value)
+{
+  log_msg_set_value(msg, LM_V_MESSAGE, value, -1);
+  return filter_expr_eval(expr, msg);
+}
+
+static void
+setup(void)
+{
+  app_startup();
+  configuration = cfg_new_snippet();
+}
+
+static void
+teardown(void)
+{
+  cfg_free(configuration);
+  app_shutdown();
+}
+
+TestSuite(multi_matcher, .init = setup, .fini = teardown);
+
+Test(multi_matcher, or_expression_of_regexps)
+{
+  FilterExprNode *expr = _create_or_expression(_create_regexp_filter("^first", 0));
+  LogMessage *msg = log_msg_new_empty();
+
+  cr_assert(_eval_or_expression(expr, msg, "first value"));
+  cr_assert(_eval_or_expression(expr, msg, "foo pattern7 bar"));
+  cr_assert_not(_eval_or_expression(expr, msg, "foo pattern bar"));
+
+  log_msg_unref(msg);
+  filter_expr_unref(expr);
+}
+
+Test(multi_matcher, or_expression_keeps_the_order_of_modifying_operands)
+{
+  FilterExprNode *expr = _create_or_expression(_create_regexp_filter("(pattern\\d)", LMF_STORE_MATCHES));
+  LogMessage *msg = log_msg_new_empty();
+
+  cr_assert(_eval_or_expression(expr, msg, "foo pattern3 bar"));
+  cr_assert_str_eq(log_msg_get_value_by_name(msg, "1", NULL), "pattern3",
+                   "the operand with store-matches should be evaluated first");
+
+  log_msg_unref(msg);
+  filter_expr_unref(expr);
+}
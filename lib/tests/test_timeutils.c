@@ -64,3 +64,13 @@ Test(msgparse, test_bsd_year_calculation_near_to_end_of_the_year)
   tm->tm_mon = 11;
   cr_assert_eq(tm->tm_year + 1, determine_year_for_month(0, tm));
 }
+
+Test(timeutils, test_timespec_diff_msec)
+{
+  struct timespec t1 = { .tv_sec = 10, .tv_nsec = 500000000 };
+  struct timespec t2 = { .tv_sec = 9, .tv_nsec = 750000000 };
+
+  cr_assert_eq(timespec_diff_msec(&t1, &t2), 750);
+  cr_assert_eq(timespec_diff_msec(&t2, &t1), -750);
+  cr_assert_eq(timespec_diff_msec(&t1, &t1), 0);
+}
@@ -77,6 +77,17 @@ typedef struct _TimeCache
   struct tm tm;
 } TimeCache;
 
+/* the transition last used by this thread for a ZoneInfo, valid in [start, end) */
+typedef struct _ZoneOffsetCache
+{
+  guint zone_id;
+  gint64 start;
+  gint64 end;
+  gint32 gmtoffset;
+} ZoneOffsetCache;
+
+#define ZONE_OFFSET_CACHE_SIZE 4
+
 static const gchar *
 get_time_zone_basedir(void)
 {
@@ -100,6 +111,7 @@ TLS_BLOCK_START
   TimeCache gm_time_cache[64];
   struct tm mktime_prev_tm;
   time_t mktime_prev_time;
+  ZoneOffsetCache zone_offset_cache[ZONE_OFFSET_CACHE_SIZE];
 }
 TLS_BLOCK_END;
 
@@ -109,6 +121,7 @@ TLS_BLOCK_END;
 #define gm_time_cache        __tls_deref(gm_time_cache)
 #define mktime_prev_tm       __tls_deref(mktime_prev_tm)
 #define mktime_prev_time     __tls_deref(mktime_prev_time)
+#define zone_offset_cache    __tls_deref(zone_offset_cache)
 
 #if !defined(SYSLOG_NG_HAVE_LOCALTIME_R) || !defined(SYSLOG_NG_HAVE_GMTIME_R)
 static GStaticMutex localtime_lock = G_STATIC_MUTEX_INIT;
@@ -361,6 +374,12 @@ timespec_diff_nsec(struct timespec *t1, struct timespec *t2)
   return (glong)((t1->tv_sec - t2->tv_sec) * 1e9) + (t1->tv_nsec - t2->tv_nsec);
 }
 
+glong
+timespec_diff_msec(const struct timespec *t1, const struct timespec *t2)
+{
+  return (glong)((t1->tv_sec - t2->tv_sec) * 1000) + (t1->tv_nsec - t2->tv_nsec) / 1000000;
+}
+
 /* Determine (guess) the year for the month.
  *
  * It can be used for BSD logs, where year is missing.
@@ -428,12 +447,26 @@ typedef struct _Transition
  *
  * This object represents the contents of a single zic-created
  * zoneinfo file.
+ *
+ * ZoneInfo is shared between threads and is read-only once parsed.  To
+ * find the transition for a timestamp quickly, the time range covered by
+ * the transitions is split into roughly one year long buckets, and
+ * bucket_index[n] is the index of the transition in effect when bucket n
+ * starts.  The transition is then looked up with a binary search within
+ * the bucket, which usually contains only a couple of transitions.
  */
+#define ZONE_INFO_BUCKET_BITS 25
+#define ZONE_INFO_MAX_BUCKETS 65536
+
 struct _ZoneInfo
 {
   Transition *transitions;
   gint64 timecnt;
-  gint32 last_transitions_index;
+  /* identifies this instance in the per-thread zone_offset_cache */
+  guint id;
+  gint64 buckets_start;
+  gint32 num_buckets;
+  gint32 *bucket_index;
 };
 
 struct _TimeZoneInfo
@@ -529,20 +562,66 @@ readchar(unsigned char **input)
 static ZoneInfo *
 zone_info_new(gint64 timecnt)
 {
+  static gint next_id = 0;
   ZoneInfo *self = g_new0(ZoneInfo,  1);
 
   self->transitions = g_new0(Transition, timecnt);
   self->timecnt = timecnt;
-  self->last_transitions_index = -1;
+  /* 0 marks an unused cache entry */
+  do
+    self->id = (guint) g_atomic_int_add(&next_id, 1) + 1;
+  while (self->id == 0);
   return self;
 }
 
+/* index of the last transition at or before timestamp, within [lo, hi] */
+static gint32
+zone_info_search_transition(ZoneInfo *self, gint64 timestamp, gint32 lo, gint32 hi)
+{
+  while (lo < hi)
+    {
+      gint32 mid = lo + (hi - lo + 1) / 2;
+
+      if (self->transitions[mid].time <= timestamp)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+  return lo;
+}
+
+static void
+zone_info_build_buckets(ZoneInfo *self)
+{
+  gint64 num_buckets;
+  gint32 i;
+
+  if (self->timecnt < 2)
+    return;
+
+  /* a bogus file could span a huge range, stick to the plain binary search then */
+  num_buckets = ((self->transitions[self->timecnt - 1].time - self->transitions[0].time) >> ZONE_INFO_BUCKET_BITS) + 1;
+  if (num_buckets > ZONE_INFO_MAX_BUCKETS)
+    return;
+
+  self->buckets_start = self->transitions[0].time;
+  self->num_buckets = num_buckets;
+  self->bucket_index = g_new(gint32, self->num_buckets);
+  for (i = 0; i < self->num_buckets; i++)
+    {
+      gint64 bucket_start = self->buckets_start + ((gint64) i << ZONE_INFO_BUCKET_BITS);
+
+      self->bucket_index[i] = zone_info_search_transition(self, bucket_start, 0, self->timecnt - 1);
+    }
+}
+
 static void
 zone_info_free(ZoneInfo *self)
 {
   if (!self)
     return;
 
+  g_free(self->bucket_index);
   g_free(self->transitions);
   g_free(self);
 }
@@ -793,32 +872,45 @@ error:
   return info;
 }
 
+static gint32
+zone_info_find_transition(ZoneInfo *self, gint64 timestamp)
+{
+  gint64 bucket;
+
+  if (timestamp < self->transitions[0].time)
+    return 0;
+
+  if (!self->bucket_index)
+    return zone_info_search_transition(self, timestamp, 0, self->timecnt - 1);
+
+  bucket = (timestamp - self->buckets_start) >> ZONE_INFO_BUCKET_BITS;
+  if (bucket >= self->num_buckets)
+    return self->timecnt - 1;
+
+  return zone_info_search_transition(self, timestamp, self->bucket_index[bucket],
+                                     bucket + 1 < self->num_buckets ? self->bucket_index[bucket + 1] : self->timecnt - 1);
+}
+
 static gint64
 zone_info_get_offset(ZoneInfo *self, gint64 timestamp)
 {
-  gint32 i = 0;
+  ZoneOffsetCache *cache;
+  gint32 i;
 
-  if (self->transitions == NULL)
+  if (self->transitions == NULL || self->timecnt == 0)
     return 0;
 
-  if (self->last_transitions_index != -1 &&
-      self->last_transitions_index < (self->timecnt - 1) &&
-      self->transitions[self->last_transitions_index].time < timestamp &&
-      self->transitions[self->last_transitions_index + 1].time > timestamp)
-    {
-      return  self->transitions[ self->last_transitions_index ].gmtoffset;
-    }
-  else
-    {
-      for (i = 0; i < (self->timecnt - 1); i++)
-        if (self->transitions[i].time < timestamp &&
-            self->transitions[i+1].time > timestamp)
-          break;
+  cache = &zone_offset_cache[self->id % ZONE_OFFSET_CACHE_SIZE];
+  if (cache->zone_id == self->id && cache->start <= timestamp && timestamp < cache->end)
+    return cache->gmtoffset;
 
-      self->last_transitions_index  = i;
-    }
+  i = zone_info_find_transition(self, timestamp);
 
-  return self->transitions[self->last_transitions_index].gmtoffset;
+  cache->zone_id = self->id;
+  cache->start = i == 0 ? G_MININT64 : self->transitions[i].time;
+  cache->end = i + 1 < self->timecnt ? self->transitions[i + 1].time : G_MAXINT64;
+  cache->gmtoffset = self->transitions[i].gmtoffset;
+  return cache->gmtoffset;
 }
 
 static gboolean
@@ -859,10 +951,14 @@ zone_info_read(const gchar *zonename, ZoneInfo **zone, ZoneInfo **zone64)
 
   msg_debug("Processing the time zone file (32bit part)", evt_tag_str("filename", filename));
   *zone = zone_info_parser(&buff, FALSE, &version);
+  if (*zone)
+    zone_info_build_buckets(*zone);
   if (version == 2)
     {
       msg_debug("Processing the time zone file (64bit part)", evt_tag_str("filename", filename));
       *zone64 = zone_info_parser(&buff, TRUE, &version);
+      if (*zone64)
+        zone_info_build_buckets(*zone64);
     }
 
   g_mapped_file_unref(file_map);
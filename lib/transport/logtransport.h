@@ -37,6 +37,12 @@ struct _LogTransport
   const gchar *name;
   gssize (*read)(LogTransport *self, gpointer buf, gsize count, LogTransportAuxData *aux);
   gssize (*write)(LogTransport *self, const gpointer buf, gsize count);
+
+  /* optional: datagram transports that receive into buffers of their own
+   * can hand out the next datagram without copying it.  The returned
+   * pointer remains valid until the next read on the transport. */
+  gssize (*read_datagram)(LogTransport *self, const guchar **buf, gsize max_len, LogTransportAuxData *aux);
+  gboolean (*has_pending_datagrams)(LogTransport *self);
   void (*free_fn)(LogTransport *self);
 };
 
@@ -52,6 +58,26 @@ log_transport_read(LogTransport *self, gpointer buf, gsize count, LogTransportAu
   return self->read(self, buf, count, aux);
 }
 
+static inline gboolean
+log_transport_supports_read_datagram(LogTransport *self)
+{
+  return self->read_datagram != NULL;
+}
+
+static inline gssize
+log_transport_read_datagram(LogTransport *self, const guchar **buf, gsize max_len, LogTransportAuxData *aux)
+{
+  return self->read_datagram(self, buf, max_len, aux);
+}
+
+static inline gboolean
+log_transport_has_pending_datagrams(LogTransport *self)
+{
+  if (!self->has_pending_datagrams)
+    return FALSE;
+  return self->has_pending_datagrams(self);
+}
+
 void log_transport_init_instance(LogTransport *s, gint fd);
 void log_transport_free_method(LogTransport *s);
 void log_transport_free(LogTransport *s);
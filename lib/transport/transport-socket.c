@@ -24,6 +24,7 @@
 #include "transport-socket.h"
 
 #include <errno.h>
+#include <string.h>
 #include <unistd.h>
 
 static gssize
@@ -86,6 +87,195 @@ log_transport_dgram_socket_init_instance(LogTransportSocket *self, gint fd)
   self->super.write = log_transport_dgram_socket_write_method;
 }
 
+#if SYSLOG_NG_HAVE_RECVMMSG
+
+/* Batched datagram transport: it pulls in up to batch_size datagrams
+ * using a single recvmmsg() call into a preallocated ring of buffers,
+ * then serves subsequent reads from the ring.  read_datagram() hands out
+ * pointers into the ring, so LogProtoDGramServer can process datagrams
+ * without copying them into its own buffer.
+ */
+typedef struct _LogTransportDGramSocket LogTransportDGramSocket;
+struct _LogTransportDGramSocket
+{
+  LogTransportSocket super;
+  gint batch_size;
+  gsize slot_size;
+  guchar *buffers;
+  struct mmsghdr *msgs;
+  struct iovec *iov;
+  struct sockaddr_storage *addrs;
+
+  /* datagrams in the ring are [pos, count) */
+  gint pos;
+  gint count;
+};
+
+static void
+_dgram_socket_free_ring(LogTransportDGramSocket *self)
+{
+  g_free(self->buffers);
+  g_free(self->msgs);
+  g_free(self->iov);
+  g_free(self->addrs);
+  self->buffers = NULL;
+  self->msgs = NULL;
+  self->iov = NULL;
+  self->addrs = NULL;
+  self->slot_size = 0;
+  self->pos = self->count = 0;
+}
+
+static void
+_dgram_socket_alloc_ring(LogTransportDGramSocket *self, gsize slot_size)
+{
+  _dgram_socket_free_ring(self);
+
+  self->slot_size = slot_size;
+  self->buffers = g_malloc(self->batch_size * slot_size);
+  self->msgs = g_new0(struct mmsghdr, self->batch_size);
+  self->iov = g_new0(struct iovec, self->batch_size);
+  self->addrs = g_new0(struct sockaddr_storage, self->batch_size);
+}
+
+static gint
+_dgram_socket_fill_ring(LogTransportDGramSocket *self)
+{
+  gint rc;
+
+  for (gint i = 0; i < self->batch_size; i++)
+    {
+      self->iov[i].iov_base = self->buffers + i * self->slot_size;
+      self->iov[i].iov_len = self->slot_size;
+
+      memset(&self->msgs[i].msg_hdr, 0, sizeof(self->msgs[i].msg_hdr));
+      self->msgs[i].msg_hdr.msg_iov = &self->iov[i];
+      self->msgs[i].msg_hdr.msg_iovlen = 1;
+      self->msgs[i].msg_hdr.msg_name = &self->addrs[i];
+      self->msgs[i].msg_hdr.msg_namelen = sizeof(self->addrs[i]);
+      self->msgs[i].msg_len = 0;
+    }
+
+  /* MSG_WAITFORONE: don't block once the first datagram has arrived,
+   * even if the socket was left in blocking mode */
+  do
+    {
+      rc = recvmmsg(self->super.super.fd, self->msgs, self->batch_size, MSG_WAITFORONE, NULL);
+    }
+  while (rc == -1 && errno == EINTR);
+
+  if (rc < 0)
+    return rc;
+
+  self->pos = 0;
+  self->count = rc;
+  return rc;
+}
+
+/* returns the index of the next datagram in the ring, refilling it as needed */
+static gint
+_dgram_socket_next_slot(LogTransportDGramSocket *self, gsize slot_size)
+{
+  /* never drop already received datagrams, grow the ring once it is drained */
+  if (self->slot_size < slot_size && self->pos >= self->count)
+    _dgram_socket_alloc_ring(self, slot_size);
+
+  while (1)
+    {
+      if (self->pos >= self->count)
+        {
+          gint rc = _dgram_socket_fill_ring(self);
+
+          if (rc < 0)
+            return -1;
+          if (rc == 0)
+            {
+              errno = EAGAIN;
+              return -1;
+            }
+        }
+
+      /* DGRAM sockets should never return EOF, zero length datagrams are skipped */
+      if (self->msgs[self->pos].msg_len > 0)
+        return self->pos++;
+      self->pos++;
+    }
+}
+
+static void
+_dgram_socket_set_peer_addr(LogTransportDGramSocket *self, gint slot, LogTransportAuxData *aux)
+{
+  socklen_t salen = self->msgs[slot].msg_hdr.msg_namelen;
+
+  if (salen && aux)
+    log_transport_aux_data_set_peer_addr_ref(aux, g_sockaddr_new((struct sockaddr *) &self->addrs[slot], salen));
+}
+
+static gssize
+log_transport_dgram_socket_read_datagram_method(LogTransport *s, const guchar **buf, gsize max_len,
+                                                LogTransportAuxData *aux)
+{
+  LogTransportDGramSocket *self = (LogTransportDGramSocket *) s;
+  gint slot = _dgram_socket_next_slot(self, max_len);
+
+  if (slot < 0)
+    return -1;
+
+  _dgram_socket_set_peer_addr(self, slot, aux);
+  *buf = self->buffers + slot * self->slot_size;
+  return MIN(self->msgs[slot].msg_len, max_len);
+}
+
+static gssize
+log_transport_dgram_socket_read_batched_method(LogTransport *s, gpointer buf, gsize buflen, LogTransportAuxData *aux)
+{
+  LogTransportDGramSocket *self = (LogTransportDGramSocket *) s;
+  const guchar *datagram;
+  gssize rc;
+
+  rc = log_transport_dgram_socket_read_datagram_method(s, &datagram, MAX(buflen, self->slot_size), aux);
+  if (rc < 0)
+    return rc;
+
+  /* truncate, just like recvfrom() would */
+  rc = MIN(rc, buflen);
+  memcpy(buf, datagram, rc);
+  return rc;
+}
+
+static gboolean
+log_transport_dgram_socket_has_pending_datagrams_method(LogTransport *s)
+{
+  LogTransportDGramSocket *self = (LogTransportDGramSocket *) s;
+
+  return self->pos < self->count;
+}
+
+static void
+log_transport_dgram_socket_free_method(LogTransport *s)
+{
+  LogTransportDGramSocket *self = (LogTransportDGramSocket *) s;
+
+  _dgram_socket_free_ring(self);
+  log_transport_free_method(s);
+}
+
+LogTransport *
+log_transport_dgram_socket_new(gint fd)
+{
+  LogTransportDGramSocket *self = g_new0(LogTransportDGramSocket, 1);
+
+  log_transport_dgram_socket_init_instance(&self->super, fd);
+  self->super.super.read = log_transport_dgram_socket_read_batched_method;
+  self->super.super.read_datagram = log_transport_dgram_socket_read_datagram_method;
+  self->super.super.has_pending_datagrams = log_transport_dgram_socket_has_pending_datagrams_method;
+  self->super.super.free_fn = log_transport_dgram_socket_free_method;
+  self->batch_size = LOG_TRANSPORT_DGRAM_BATCH_SIZE;
+  return &self->super.super;
+}
+
+#else
+
 LogTransport *
 log_transport_dgram_socket_new(gint fd)
 {
@@ -95,6 +285,8 @@ log_transport_dgram_socket_new(gint fd)
   return &self->super;
 }
 
+#endif
+
 static gssize
 log_transport_stream_socket_read_method(LogTransport *s, gpointer buf, gsize buflen, LogTransportAuxData *aux)
 {
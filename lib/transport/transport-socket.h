@@ -33,6 +33,9 @@ struct _LogTransportSocket
   LogTransport super;
 };
 
+/* maximum number of datagrams received by a single recvmmsg() call */
+#define LOG_TRANSPORT_DGRAM_BATCH_SIZE 16
+
 void log_transport_dgram_socket_init_instance(LogTransportSocket *self, gint fd);
 LogTransport *log_transport_dgram_socket_new(gint fd);
 
@@ -32,7 +32,10 @@
 #include "add-contextual-data-filter-selector.h"
 #include "template/templates.h"
 #include "context-info-db.h"
+#include "compiled-context-info-db.h"
 #include "pathutils.h"
+#include "mainloop-worker.h"
+#include "control/control-commands.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -48,6 +51,15 @@ typedef struct AddContextualData
   gboolean ignore_case;
 } AddContextualData;
 
+#define CONTEXTUAL_DATA_RELOAD_COMMAND "CONTEXTUAL_DATA_RELOAD"
+
+/*
+ * Initialized parsers using compiled databases, these databases can be
+ * replaced through the control socket without a configuration reload.
+ * Only accessed from the main thread.
+ */
+static GList *compiled_db_parsers;
+
 void
 add_contextual_data_set_filename(LogParser *p, const gchar *filename)
 {
@@ -113,10 +125,10 @@ _is_default_selector_set(const AddContextualData *self)
 }
 
 static void
-_add_context_data_to_message(gpointer pmsg, const ContextualDataRecord *record)
+_add_context_data_to_message(gpointer pmsg, NVHandle handle, const gchar *value, gsize value_len)
 {
   LogMessage *msg = (LogMessage *) pmsg;
-  log_msg_set_value_by_name(msg, record->name->str, record->value->str, (gssize)record->value->len);
+  log_msg_set_value(msg, handle, value, (gssize) value_len);
 }
 
 static gboolean
@@ -136,9 +148,9 @@ _process(LogParser *s, LogMessage **pmsg,
     selector = self->default_selector;
 
   if (selector)
-    context_info_db_foreach_record(self->context_info_db, selector,
-                                   _add_context_data_to_message,
-                                   (gpointer) msg);
+    context_info_db_foreach_value(self->context_info_db, selector,
+                                  _add_context_data_to_message,
+                                  (gpointer) msg);
 
   g_free(resolved_selector);
 
@@ -177,6 +189,7 @@ _free(LogPipe *s)
 {
   AddContextualData *self = (AddContextualData *) s;
 
+  compiled_db_parsers = g_list_remove(compiled_db_parsers, self);
   context_info_db_unref(self->context_info_db);
   g_free(self->filename);
   g_free(self->prefix);
@@ -199,24 +212,48 @@ _complete_relative_path_with_config_path(const gchar *filename)
                      filename, NULL);
 }
 
+static gchar *
+_get_data_file_path(const gchar *filename)
+{
+  if (_is_relative_path(filename))
+    return _complete_relative_path_with_config_path(filename);
+
+  return g_strdup(filename);
+}
+
 static FILE *
 _open_data_file(const gchar *filename)
 {
-  FILE *f = NULL;
+  gchar *path = _get_data_file_path(filename);
+  FILE *f = fopen(path, "r");
 
-  if (_is_relative_path(filename))
-    {
-      gchar *absolute_path =
-        _complete_relative_path_with_config_path(filename);
-      f = fopen(absolute_path, "r");
-      g_free(absolute_path);
-    }
-  else
+  g_free(path);
+  return f;
+}
+
+static gboolean
+_is_compiled_database(const gchar *filename)
+{
+  return g_strcmp0(get_filename_extension(filename), COMPILED_CONTEXT_INFO_DB_EXTENSION) == 0;
+}
+
+static gboolean
+_load_compiled_context_info_db(AddContextualData *self, ContextInfoDB *context_info_db)
+{
+  GError *error = NULL;
+  gchar *path = _get_data_file_path(self->filename);
+  gboolean success = context_info_db_import_compiled(context_info_db, path, self->prefix, &error);
+
+  if (!success)
     {
-      f = fopen(filename, "r");
+      msg_error("Error loading compiled add_contextual_data database",
+                evt_tag_str("filename", path),
+                evt_tag_str("error", error->message));
+      g_clear_error(&error);
     }
 
-  return f;
+  g_free(path);
+  return success;
 }
 
 static ContextualDataRecordScanner *
@@ -241,6 +278,9 @@ _get_scanner(AddContextualData *self)
 static gboolean
 _load_context_info_db(AddContextualData *self)
 {
+  if (_is_compiled_database(self->filename))
+    return _load_compiled_context_info_db(self, self->context_info_db);
+
   ContextualDataRecordScanner *scanner = _get_scanner(self);
 
   if (!scanner)
@@ -269,13 +309,19 @@ _load_context_info_db(AddContextualData *self)
   return TRUE;
 }
 
-static gboolean
-_init_context_info_db(AddContextualData *self)
+static void
+_setup_context_info_db(AddContextualData *self, ContextInfoDB *context_info_db)
 {
   if (self->selector && add_contextual_data_selector_is_ordering_required(self->selector))
-    context_info_db_enable_ordering(self->context_info_db);
+    context_info_db_enable_ordering(context_info_db);
 
-  context_info_db_set_ignore_case(self->context_info_db, self->ignore_case);
+  context_info_db_set_ignore_case(context_info_db, self->ignore_case);
+}
+
+static gboolean
+_init_context_info_db(AddContextualData *self)
+{
+  _setup_context_info_db(self, self->context_info_db);
   if (!context_info_db_is_loaded(self->context_info_db))
     context_info_db_init(self->context_info_db);
 
@@ -300,6 +346,105 @@ _init_selector(AddContextualData *self)
   return add_contextual_data_selector_init(self->selector, context_info_db_ordered_selectors(self->context_info_db));
 }
 
+static gboolean
+_matches_reloaded_filename(AddContextualData *self, const gchar *filename)
+{
+  gchar *path;
+  gboolean matches;
+
+  if (!filename)
+    return TRUE;
+
+  path = _get_data_file_path(self->filename);
+  matches = strcmp(self->filename, filename) == 0 || strcmp(path, filename) == 0;
+  g_free(path);
+
+  return matches;
+}
+
+/* runs when all the worker threads are stopped, so no message is being processed */
+static void
+_swap_context_info_dbs(gpointer user_data)
+{
+  GHashTable *replacements = (GHashTable *) user_data;
+
+  for (GList *l = compiled_db_parsers; l; l = l->next)
+    {
+      AddContextualData *self = (AddContextualData *) l->data;
+      ContextInfoDB *new_db = g_hash_table_lookup(replacements, self->context_info_db);
+
+      if (new_db)
+        _replace_context_info_db(&self->context_info_db, new_db);
+    }
+
+  msg_notice("Compiled add_contextual_data databases reloaded");
+  g_hash_table_unref(replacements);
+}
+
+/*
+ * CONTEXTUAL_DATA_RELOAD [filename]
+ *
+ * Loads the compiled databases again (only the ones at @filename, if
+ * specified), and replaces them in the running parsers.  Parsers sharing a
+ * database (e.g. clones) get the same new instance.  Nothing is replaced if
+ * any of the databases fail to load.
+ */
+static GString *
+_reload_compiled_context_info_dbs(GString *command, gpointer user_data)
+{
+  GHashTable *replacements = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                                   (GDestroyNotify) context_info_db_unref,
+                                                   (GDestroyNotify) context_info_db_unref);
+  const gchar *filename = NULL;
+  GString *result = g_string_new(NULL);
+
+  if (command->len > strlen(CONTEXTUAL_DATA_RELOAD_COMMAND) + 1)
+    filename = command->str + strlen(CONTEXTUAL_DATA_RELOAD_COMMAND) + 1;
+
+  for (GList *l = compiled_db_parsers; l; l = l->next)
+    {
+      AddContextualData *self = (AddContextualData *) l->data;
+      ContextInfoDB *new_db;
+
+      if (!_matches_reloaded_filename(self, filename) || g_hash_table_lookup(replacements, self->context_info_db))
+        continue;
+
+      new_db = context_info_db_new();
+      _setup_context_info_db(self, new_db);
+      if (!_load_compiled_context_info_db(self, new_db))
+        {
+          context_info_db_unref(new_db);
+          g_hash_table_unref(replacements);
+          g_string_printf(result, "error: failed to load %s, no databases were reloaded", self->filename);
+          return result;
+        }
+      g_hash_table_insert(replacements, context_info_db_ref(self->context_info_db), new_db);
+    }
+
+  if (g_hash_table_size(replacements) == 0)
+    {
+      g_hash_table_unref(replacements);
+      g_string_assign(result, "error: no add_contextual_data parser uses the specified compiled database");
+      return result;
+    }
+
+  g_string_printf(result, "OK Reload of %u compiled add_contextual_data database(s) initiated",
+                  g_hash_table_size(replacements));
+  main_loop_worker_sync_call(_swap_context_info_dbs, replacements);
+  return result;
+}
+
+static void
+_register_compiled_db_parser(AddContextualData *self)
+{
+  if (!g_list_find_custom(get_control_command_list(), CONTEXTUAL_DATA_RELOAD_COMMAND,
+                          (GCompareFunc) control_command_start_with_command))
+    control_register_command(CONTEXTUAL_DATA_RELOAD_COMMAND, NULL, _reload_compiled_context_info_dbs, NULL);
+
+  if (!g_list_find(compiled_db_parsers, self))
+    compiled_db_parsers = g_list_prepend(compiled_db_parsers, self);
+}
+
 static gboolean
 _init(LogPipe *s)
 {
@@ -312,9 +457,21 @@ _init(LogPipe *s)
   if (!log_parser_init_method(s))
     return FALSE;
 
+  if (_is_compiled_database(self->filename))
+    _register_compiled_db_parser(self);
+
   return TRUE;
 }
 
+static gboolean
+_deinit(LogPipe *s)
+{
+  AddContextualData *self = (AddContextualData *)s;
+
+  compiled_db_parsers = g_list_remove(compiled_db_parsers, self);
+  return log_parser_deinit_method(s);
+}
+
 LogParser *
 add_contextual_data_parser_new(GlobalConfig *cfg)
 {
@@ -329,6 +486,7 @@ add_contextual_data_parser_new(GlobalConfig *cfg)
   self->super.super.clone = _clone;
   self->super.super.free_fn = _free;
   self->super.super.init = _init;
+  self->super.super.deinit = _deinit;
   self->default_selector = NULL;
   self->prefix = NULL;
 
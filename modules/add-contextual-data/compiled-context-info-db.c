@@ -0,0 +1,572 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "compiled-context-info-db.h"
+#include "logmsg/logmsg.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Compiled ContextInfoDB
+ *
+ * A compiled database is produced from a CSV file in advance (see
+ * ctxdbtool) and is mapped into memory as is, so loading it does not
+ * depend on its size, and the pages are shared between every parser and
+ * configuration using the same file.
+ *
+ * The file starts with a CompiledHeader, followed by these tables, each
+ * of them aligned to 4 bytes:
+ *
+ *   - selectors: CompiledSelector entries, in the order of their first
+ *     appearance in the CSV file,
+ *
+ *   - lookup: the indexes of the selectors, sorted case insensitively
+ *     first (see _selector_cmp()), so both case sensitive and case
+ *     insensitive lookups can use binary search,
+ *
+ *   - records: CompiledRecord entries, the records of a selector are
+ *     stored next to each other,
+ *
+ *   - names: the offsets of the distinct names used by the records.  The
+ *     names are stored without the prefix, which is added when they are
+ *     resolved to NVHandles during load,
+ *
+ *   - strings: NUL terminated strings, each distinct string is stored
+ *     once.
+ *
+ * Offsets within the strings table are relative to its start, all numbers
+ * are in host byte order.
+ */
+
+#define COMPILED_CONTEXT_INFO_DB_MAGIC "SNGCTXDB"
+#define COMPILED_CONTEXT_INFO_DB_VERSION 1
+#define COMPILED_CONTEXT_INFO_DB_BYTE_ORDER 0x01020304
+
+typedef struct _CompiledHeader
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 byte_order;
+  guint32 num_selectors;
+  guint32 num_records;
+  guint32 num_names;
+  guint32 selectors_ofs;
+  guint32 lookup_ofs;
+  guint32 records_ofs;
+  guint32 names_ofs;
+  guint32 strings_ofs;
+  guint32 strings_len;
+} CompiledHeader;
+
+typedef struct _CompiledSelector
+{
+  guint32 selector;
+  guint32 first_record;
+  guint32 num_records;
+} CompiledSelector;
+
+typedef struct _CompiledRecord
+{
+  guint32 name;
+  guint32 value;
+  guint32 value_len;
+} CompiledRecord;
+
+struct _CompiledContextInfoDB
+{
+  gpointer map;
+  gsize map_len;
+  const CompiledHeader *header;
+  const CompiledSelector *selectors;
+  const guint32 *lookup;
+  const CompiledRecord *records;
+  const guint32 *names;
+  const gchar *strings;
+  NVHandle *name_handles;
+};
+
+typedef struct _WriterSelector
+{
+  guint32 selector;
+  GArray *records;
+} WriterSelector;
+
+struct _CompiledContextInfoDBWriter
+{
+  GString *strings;
+  GHashTable *string_offsets;
+  GArray *selectors;
+  GHashTable *selector_indexes;
+  GArray *names;
+  GHashTable *name_indexes;
+  guint64 num_records;
+};
+
+GQuark
+compiled_context_info_db_error_quark(void)
+{
+  return g_quark_from_static_string("compiled-context-info-db-error-quark");
+}
+
+/* selectors that only differ in case are adjacent in this order */
+static gint
+_selector_cmp(const gchar *a, const gchar *b)
+{
+  gint result = g_ascii_strcasecmp(a, b);
+
+  return result != 0 ? result : strcmp(a, b);
+}
+
+static gboolean
+_table_fits(CompiledContextInfoDB *self, guint32 ofs, guint32 count, gsize entry_size)
+{
+  return (ofs % sizeof(guint32)) == 0 && (guint64) ofs + (guint64) count * entry_size <= self->map_len;
+}
+
+static gboolean
+_validate_header(CompiledContextInfoDB *self, GError **error)
+{
+  const CompiledHeader *header = self->header;
+
+  if (memcmp(header->magic, COMPILED_CONTEXT_INFO_DB_MAGIC, sizeof(header->magic)) != 0)
+    {
+      g_set_error(error, COMPILED_CONTEXT_INFO_DB_ERROR, COMPILED_CONTEXT_INFO_DB_ERROR_FAILED,
+                  "Not a compiled add-contextual-data database");
+      return FALSE;
+    }
+
+  if (header->byte_order != COMPILED_CONTEXT_INFO_DB_BYTE_ORDER ||
+      header->version != COMPILED_CONTEXT_INFO_DB_VERSION)
+    {
+      g_set_error(error, COMPILED_CONTEXT_INFO_DB_ERROR, COMPILED_CONTEXT_INFO_DB_ERROR_FAILED,
+                  "Unsupported database version or byte order, version=%u", header->version);
+      return FALSE;
+    }
+
+  if (!_table_fits(self, header->selectors_ofs, header->num_selectors, sizeof(CompiledSelector)) ||
+      !_table_fits(self, header->lookup_ofs, header->num_selectors, sizeof(guint32)) ||
+      !_table_fits(self, header->records_ofs, header->num_records, sizeof(CompiledRecord)) ||
+      !_table_fits(self, header->names_ofs, header->num_names, sizeof(guint32)) ||
+      (guint64) header->strings_ofs + header->strings_len > self->map_len ||
+      header->strings_len == 0 ||
+      ((const gchar *) self->map)[header->strings_ofs + header->strings_len - 1] != '\0')
+    {
+      g_set_error(error, COMPILED_CONTEXT_INFO_DB_ERROR, COMPILED_CONTEXT_INFO_DB_ERROR_FAILED,
+                  "Database file is truncated or corrupt");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* makes sure that lookups can not point outside of the file, whatever it contains */
+static gboolean
+_validate_tables(CompiledContextInfoDB *self, GError **error)
+{
+  const CompiledHeader *header = self->header;
+
+  for (guint32 i = 0; i < header->num_selectors; i++)
+    {
+      const CompiledSelector *selector = &self->selectors[i];
+
+      if (selector->selector >= header->strings_len ||
+          selector->first_record > header->num_records ||
+          selector->num_records > header->num_records - selector->first_record ||
+          self->lookup[i] >= header->num_selectors)
+        goto error;
+    }
+
+  for (guint32 i = 0; i < header->num_records; i++)
+    {
+      const CompiledRecord *record = &self->records[i];
+
+      if (record->name >= header->num_names ||
+          record->value >= header->strings_len ||
+          record->value_len >= header->strings_len - record->value)
+        goto error;
+    }
+
+  for (guint32 i = 0; i < header->num_names; i++)
+    {
+      if (self->names[i] >= header->strings_len)
+        goto error;
+    }
+  return TRUE;
+
+error:
+  g_set_error(error, COMPILED_CONTEXT_INFO_DB_ERROR, COMPILED_CONTEXT_INFO_DB_ERROR_FAILED,
+              "Database file is corrupt");
+  return FALSE;
+}
+
+static void
+_resolve_names(CompiledContextInfoDB *self, const gchar *name_prefix)
+{
+  GString *name = g_string_new(name_prefix);
+  gsize prefix_len = name->len;
+
+  self->name_handles = g_new(NVHandle, self->header->num_names);
+  for (guint32 i = 0; i < self->header->num_names; i++)
+    {
+      g_string_truncate(name, prefix_len);
+      g_string_append(name, self->strings + self->names[i]);
+      self->name_handles[i] = log_msg_get_value_handle(name->str);
+    }
+  g_string_free(name, TRUE);
+}
+
+CompiledContextInfoDB *
+compiled_context_info_db_open(const gchar *filename, const gchar *name_prefix, GError **error)
+{
+  CompiledContextInfoDB *self;
+  struct stat st;
+  gint fd;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0)
+    {
+      g_set_error(error, COMPILED_CONTEXT_INFO_DB_ERROR, COMPILED_CONTEXT_INFO_DB_ERROR_FAILED,
+                  "Error opening database file: %s", g_strerror(errno));
+      if (fd >= 0)
+        close(fd);
+      return NULL;
+    }
+
+  if (st.st_size < (off_t) sizeof(CompiledHeader))
+    {
+      g_set_error(error, COMPILED_CONTEXT_INFO_DB_ERROR, COMPILED_CONTEXT_INFO_DB_ERROR_FAILED,
+                  "Not a compiled add-contextual-data database");
+      close(fd);
+      return NULL;
+    }
+
+  self = g_new0(CompiledContextInfoDB, 1);
+  self->map_len = st.st_size;
+  self->map = mmap(NULL, self->map_len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (self->map == MAP_FAILED)
+    {
+      g_set_error(error, COMPILED_CONTEXT_INFO_DB_ERROR, COMPILED_CONTEXT_INFO_DB_ERROR_FAILED,
+                  "Error mapping database file: %s", g_strerror(errno));
+      self->map = NULL;
+      compiled_context_info_db_free(self);
+      return NULL;
+    }
+
+  self->header = (const CompiledHeader *) self->map;
+  if (!_validate_header(self, error))
+    {
+      compiled_context_info_db_free(self);
+      return NULL;
+    }
+
+  self->selectors = (const CompiledSelector *) ((const gchar *) self->map + self->header->selectors_ofs);
+  self->lookup = (const guint32 *) ((const gchar *) self->map + self->header->lookup_ofs);
+  self->records = (const CompiledRecord *) ((const gchar *) self->map + self->header->records_ofs);
+  self->names = (const guint32 *) ((const gchar *) self->map + self->header->names_ofs);
+  self->strings = (const gchar *) self->map + self->header->strings_ofs;
+
+  if (!_validate_tables(self, error))
+    {
+      compiled_context_info_db_free(self);
+      return NULL;
+    }
+
+  _resolve_names(self, name_prefix);
+  return self;
+}
+
+void
+compiled_context_info_db_free(CompiledContextInfoDB *self)
+{
+  if (self->map)
+    munmap(self->map, self->map_len);
+  g_free(self->name_handles);
+  g_free(self);
+}
+
+static inline const gchar *
+_get_selector_at(CompiledContextInfoDB *self, guint32 pos)
+{
+  return self->strings + self->selectors[self->lookup[pos]].selector;
+}
+
+/* finds the range of lookup positions matching @selector */
+static void
+_lookup(CompiledContextInfoDB *self, const gchar *selector, gboolean ignore_case, guint32 *start, guint32 *end)
+{
+  guint32 num_selectors = self->header->num_selectors;
+  guint32 lo = 0, hi = num_selectors;
+
+  while (lo < hi)
+    {
+      guint32 mid = lo + (hi - lo) / 2;
+      const gchar *current = _get_selector_at(self, mid);
+      gint result = ignore_case ? g_ascii_strcasecmp(current, selector) : _selector_cmp(current, selector);
+
+      if (result < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  *start = lo;
+  if (ignore_case)
+    {
+      while (lo < num_selectors && g_ascii_strcasecmp(_get_selector_at(self, lo), selector) == 0)
+        lo++;
+    }
+  else if (lo < num_selectors && strcmp(_get_selector_at(self, lo), selector) == 0)
+    {
+      lo++;
+    }
+  *end = lo;
+}
+
+gsize
+compiled_context_info_db_number_of_records(CompiledContextInfoDB *self, const gchar *selector, gboolean ignore_case)
+{
+  guint32 start, end;
+  gsize n = 0;
+
+  if (!selector)
+    return 0;
+
+  _lookup(self, selector, ignore_case, &start, &end);
+  for (guint32 pos = start; pos < end; pos++)
+    n += self->selectors[self->lookup[pos]].num_records;
+  return n;
+}
+
+void
+compiled_context_info_db_foreach_value(CompiledContextInfoDB *self, const gchar *selector, gboolean ignore_case,
+                                       COMPILED_CONTEXT_INFO_CB callback, gpointer arg)
+{
+  guint32 start, end;
+
+  if (!selector)
+    return;
+
+  _lookup(self, selector, ignore_case, &start, &end);
+  for (guint32 pos = start; pos < end; pos++)
+    {
+      const CompiledSelector *compiled_selector = &self->selectors[self->lookup[pos]];
+      const CompiledRecord *record = &self->records[compiled_selector->first_record];
+      const CompiledRecord *records_end = record + compiled_selector->num_records;
+
+      for (; record < records_end; record++)
+        callback(arg, self->name_handles[record->name], self->strings + record->value, record->value_len);
+    }
+}
+
+/* returns the selectors in the order they appeared in the source file, the strings belong to @self */
+GList *
+compiled_context_info_db_get_selectors(CompiledContextInfoDB *self)
+{
+  GList *selectors = NULL;
+
+  for (guint32 i = self->header->num_selectors; i > 0; i--)
+    selectors = g_list_prepend(selectors, (gpointer) (self->strings + self->selectors[i - 1].selector));
+  return selectors;
+}
+
+static guint32
+_writer_intern_string(CompiledContextInfoDBWriter *self, const gchar *str)
+{
+  gpointer ofs;
+  guint32 new_ofs;
+
+  if (g_hash_table_lookup_extended(self->string_offsets, str, NULL, &ofs))
+    return GPOINTER_TO_UINT(ofs);
+
+  new_ofs = self->strings->len;
+  g_string_append_len(self->strings, str, strlen(str) + 1);
+  g_hash_table_insert(self->string_offsets, g_strdup(str), GUINT_TO_POINTER(new_ofs));
+  return new_ofs;
+}
+
+static guint32
+_writer_get_name(CompiledContextInfoDBWriter *self, const gchar *name)
+{
+  gpointer index;
+  guint32 name_ofs;
+
+  if (g_hash_table_lookup_extended(self->name_indexes, name, NULL, &index))
+    return GPOINTER_TO_UINT(index);
+
+  name_ofs = _writer_intern_string(self, name);
+  g_array_append_val(self->names, name_ofs);
+  g_hash_table_insert(self->name_indexes, g_strdup(name), GUINT_TO_POINTER(self->names->len - 1));
+  return self->names->len - 1;
+}
+
+static WriterSelector *
+_writer_get_selector(CompiledContextInfoDBWriter *self, const gchar *selector)
+{
+  WriterSelector new_selector;
+  gpointer index;
+
+  if (g_hash_table_lookup_extended(self->selector_indexes, selector, NULL, &index))
+    return &g_array_index(self->selectors, WriterSelector, GPOINTER_TO_UINT(index));
+
+  new_selector.selector = _writer_intern_string(self, selector);
+  new_selector.records = g_array_new(FALSE, FALSE, sizeof(CompiledRecord));
+  g_array_append_val(self->selectors, new_selector);
+  g_hash_table_insert(self->selector_indexes, g_strdup(selector), GUINT_TO_POINTER(self->selectors->len - 1));
+  return &g_array_index(self->selectors, WriterSelector, self->selectors->len - 1);
+}
+
+CompiledContextInfoDBWriter *
+compiled_context_info_db_writer_new(void)
+{
+  CompiledContextInfoDBWriter *self = g_new0(CompiledContextInfoDBWriter, 1);
+
+  self->strings = g_string_sized_new(4096);
+  self->string_offsets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  self->selectors = g_array_new(FALSE, FALSE, sizeof(WriterSelector));
+  self->selector_indexes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  self->names = g_array_new(FALSE, FALSE, sizeof(guint32));
+  self->name_indexes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  /* the strings table is never empty, so its last byte is always a NUL */
+  _writer_intern_string(self, "");
+  return self;
+}
+
+void
+compiled_context_info_db_writer_add(CompiledContextInfoDBWriter *self, const gchar *selector,
+                                    const gchar *name, const gchar *value)
+{
+  WriterSelector *writer_selector = _writer_get_selector(self, selector);
+  CompiledRecord record;
+
+  record.name = _writer_get_name(self, name);
+  record.value = _writer_intern_string(self, value);
+  record.value_len = strlen(value);
+  g_array_append_val(writer_selector->records, record);
+  self->num_records++;
+}
+
+static gint
+_writer_lookup_cmp(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  CompiledContextInfoDBWriter *self = (CompiledContextInfoDBWriter *) user_data;
+  const WriterSelector *selector_a = &g_array_index(self->selectors, WriterSelector, *(const guint32 *) a);
+  const WriterSelector *selector_b = &g_array_index(self->selectors, WriterSelector, *(const guint32 *) b);
+
+  return _selector_cmp(self->strings->str + selector_a->selector, self->strings->str + selector_b->selector);
+}
+
+gboolean
+compiled_context_info_db_writer_save(CompiledContextInfoDBWriter *self, const gchar *filename, GError **error)
+{
+  CompiledHeader header;
+  GByteArray *contents;
+  GArray *lookup;
+  guint64 file_size;
+  guint32 first_record = 0;
+  gboolean success;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, COMPILED_CONTEXT_INFO_DB_MAGIC, sizeof(header.magic));
+  header.version = COMPILED_CONTEXT_INFO_DB_VERSION;
+  header.byte_order = COMPILED_CONTEXT_INFO_DB_BYTE_ORDER;
+  header.num_selectors = self->selectors->len;
+  header.num_records = self->num_records;
+  header.num_names = self->names->len;
+
+  file_size = sizeof(header) +
+              (guint64) self->selectors->len * (sizeof(CompiledSelector) + sizeof(guint32)) +
+              self->num_records * sizeof(CompiledRecord) +
+              (guint64) self->names->len * sizeof(guint32) +
+              self->strings->len;
+  if (file_size >= G_MAXUINT32)
+    {
+      g_set_error(error, COMPILED_CONTEXT_INFO_DB_ERROR, COMPILED_CONTEXT_INFO_DB_ERROR_FAILED,
+                  "Database too large, compiled databases are limited to 4GB");
+      return FALSE;
+    }
+
+  header.selectors_ofs = sizeof(header);
+  header.lookup_ofs = header.selectors_ofs + header.num_selectors * sizeof(CompiledSelector);
+  header.records_ofs = header.lookup_ofs + header.num_selectors * sizeof(guint32);
+  header.names_ofs = header.records_ofs + header.num_records * sizeof(CompiledRecord);
+  header.strings_ofs = header.names_ofs + header.num_names * sizeof(guint32);
+  header.strings_len = self->strings->len;
+
+  lookup = g_array_sized_new(FALSE, FALSE, sizeof(guint32), self->selectors->len);
+  for (guint32 i = 0; i < self->selectors->len; i++)
+    g_array_append_val(lookup, i);
+  g_array_sort_with_data(lookup, _writer_lookup_cmp, self);
+
+  contents = g_byte_array_sized_new(file_size);
+  g_byte_array_append(contents, (const guint8 *) &header, sizeof(header));
+  for (guint32 i = 0; i < self->selectors->len; i++)
+    {
+      WriterSelector *writer_selector = &g_array_index(self->selectors, WriterSelector, i);
+      CompiledSelector compiled_selector =
+      {
+        .selector = writer_selector->selector,
+        .first_record = first_record,
+        .num_records = writer_selector->records->len,
+      };
+
+      g_byte_array_append(contents, (const guint8 *) &compiled_selector, sizeof(compiled_selector));
+      first_record += writer_selector->records->len;
+    }
+  g_byte_array_append(contents, (const guint8 *) lookup->data, lookup->len * sizeof(guint32));
+  for (guint32 i = 0; i < self->selectors->len; i++)
+    {
+      GArray *records = g_array_index(self->selectors, WriterSelector, i).records;
+
+      g_byte_array_append(contents, (const guint8 *) records->data, records->len * sizeof(CompiledRecord));
+    }
+  g_byte_array_append(contents, (const guint8 *) self->names->data, self->names->len * sizeof(guint32));
+  g_byte_array_append(contents, (const guint8 *) self->strings->str, self->strings->len);
+  g_assert(contents->len == file_size);
+
+  /* the file is replaced atomically, running instances keep using the old one until they are reloaded */
+  success = g_file_set_contents(filename, (const gchar *) contents->data, contents->len, error);
+
+  g_byte_array_free(contents, TRUE);
+  g_array_free(lookup, TRUE);
+  return success;
+}
+
+void
+compiled_context_info_db_writer_free(CompiledContextInfoDBWriter *self)
+{
+  for (guint32 i = 0; i < self->selectors->len; i++)
+    g_array_free(g_array_index(self->selectors, WriterSelector, i).records, TRUE);
+  g_array_free(self->selectors, TRUE);
+  g_hash_table_unref(self->selector_indexes);
+  g_array_free(self->names, TRUE);
+  g_hash_table_unref(self->name_indexes);
+  g_hash_table_unref(self->string_offsets);
+  g_string_free(self->strings, TRUE);
+  g_free(self);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef COMPILED_CONTEXT_INFO_DB_H_INCLUDED
+#define COMPILED_CONTEXT_INFO_DB_H_INCLUDED
+
+#include "syslog-ng.h"
+#include "logmsg/nvtable.h"
+
+#define COMPILED_CONTEXT_INFO_DB_EXTENSION "ctxdb"
+
+#define COMPILED_CONTEXT_INFO_DB_ERROR compiled_context_info_db_error_quark()
+
+GQuark compiled_context_info_db_error_quark(void);
+
+typedef enum
+{
+  COMPILED_CONTEXT_INFO_DB_ERROR_FAILED,
+} CompiledContextInfoDBError;
+
+typedef struct _CompiledContextInfoDB CompiledContextInfoDB;
+typedef struct _CompiledContextInfoDBWriter CompiledContextInfoDBWriter;
+
+typedef void (*COMPILED_CONTEXT_INFO_CB) (gpointer arg, NVHandle handle,
+                                          const gchar *value, gsize value_len);
+
+CompiledContextInfoDB *compiled_context_info_db_open(const gchar *filename, const gchar *name_prefix,
+                                                     GError **error);
+void compiled_context_info_db_free(CompiledContextInfoDB *self);
+
+gsize compiled_context_info_db_number_of_records(CompiledContextInfoDB *self, const gchar *selector,
+                                                 gboolean ignore_case);
+void compiled_context_info_db_foreach_value(CompiledContextInfoDB *self, const gchar *selector,
+                                            gboolean ignore_case,
+                                            COMPILED_CONTEXT_INFO_CB callback, gpointer arg);
+GList *compiled_context_info_db_get_selectors(CompiledContextInfoDB *self);
+
+CompiledContextInfoDBWriter *compiled_context_info_db_writer_new(void);
+void compiled_context_info_db_writer_add(CompiledContextInfoDBWriter *self, const gchar *selector,
+                                         const gchar *name, const gchar *value);
+gboolean compiled_context_info_db_writer_save(CompiledContextInfoDBWriter *self, const gchar *filename,
+                                              GError **error);
+void compiled_context_info_db_writer_free(CompiledContextInfoDBWriter *self);
+
+#endif
@@ -21,6 +21,8 @@
  */
 
 #include "context-info-db.h"
+#include "compiled-context-info-db.h"
+#include "logmsg/logmsg.h"
 #include "atomic.h"
 #include "messages.h"
 #include <string.h>
@@ -36,6 +38,8 @@ struct _ContextInfoDB
   gboolean is_ordering_enabled;
   GList *ordered_selectors;
   gboolean ignore_case;
+  /* set instead of data and index if the database was loaded from a compiled file */
+  CompiledContextInfoDB *compiled;
 };
 
 typedef struct _element_range
@@ -201,9 +205,23 @@ _free_array(GArray *array)
   g_array_free(array, TRUE);
 }
 
+static void
+_free_compiled(ContextInfoDB *self)
+{
+  compiled_context_info_db_free(self->compiled);
+  self->compiled = NULL;
+  g_list_free(self->ordered_selectors);
+  self->ordered_selectors = NULL;
+  self->is_data_indexed = FALSE;
+}
+
 static void
 _free(ContextInfoDB *self)
 {
+  if (self->compiled)
+    {
+      _free_compiled(self);
+    }
   if (self->index)
     {
       g_hash_table_unref(self->index);
@@ -257,6 +275,12 @@ _get_range_of_records(ContextInfoDB *self, const gchar *selector)
 void
 context_info_db_purge(ContextInfoDB *self)
 {
+  if (self->compiled)
+    {
+      _free_compiled(self);
+      return;
+    }
+
   g_hash_table_remove_all(self->index);
   if (self->data->len > 0)
     self->data = g_array_remove_range(self->data, 0, self->data->len);
@@ -277,6 +301,8 @@ context_info_db_insert(ContextInfoDB *self,
                        const ContextualDataRecord *record)
 {
   g_array_append_val(self->data, *record);
+  g_array_index(self->data, ContextualDataRecord, self->data->len - 1).value_handle =
+    log_msg_get_value_handle(record->name->str);
   self->is_data_indexed = FALSE;
   if (self->is_ordering_enabled && !g_list_find_custom(self->ordered_selectors, record->selector->str, _g_strcmp))
     self->ordered_selectors = g_list_append(self->ordered_selectors, record->selector->str);
@@ -288,6 +314,9 @@ context_info_db_contains(ContextInfoDB *self, const gchar *selector)
   if (!selector)
     return FALSE;
 
+  if (self->compiled)
+    return compiled_context_info_db_number_of_records(self->compiled, selector, self->ignore_case) > 0;
+
   _ensure_indexed_db(self);
   return (_get_range_of_records(self, selector) != NULL);
 }
@@ -296,6 +325,9 @@ gsize
 context_info_db_number_of_records(ContextInfoDB *self,
                                   const gchar *selector)
 {
+  if (self->compiled)
+    return compiled_context_info_db_number_of_records(self->compiled, selector, self->ignore_case);
+
   _ensure_indexed_db(self);
 
   gsize n = 0;
@@ -307,10 +339,42 @@ context_info_db_number_of_records(ContextInfoDB *self,
   return n;
 }
 
+typedef struct _ForeachRecordArgs
+{
+  ADD_CONTEXT_INFO_CB callback;
+  gpointer arg;
+  const gchar *selector;
+} ForeachRecordArgs;
+
+static void
+_call_record_callback(gpointer arg, NVHandle handle, const gchar *value, gsize value_len)
+{
+  ForeachRecordArgs *args = (ForeachRecordArgs *) arg;
+  ContextualDataRecord record =
+  {
+    .selector = g_string_new(args->selector),
+    .name = g_string_new(log_msg_get_value_name(handle, NULL)),
+    .value = g_string_new_len(value, value_len),
+    .value_handle = handle,
+  };
+
+  args->callback(args->arg, &record);
+  contextual_data_record_clean(&record);
+}
+
 void
 context_info_db_foreach_record(ContextInfoDB *self, const gchar *selector,
                                ADD_CONTEXT_INFO_CB callback, gpointer arg)
 {
+  if (self->compiled)
+    {
+      ForeachRecordArgs args = { callback, arg, selector };
+
+      compiled_context_info_db_foreach_value(self->compiled, selector, self->ignore_case,
+                                             _call_record_callback, &args);
+      return;
+    }
+
   _ensure_indexed_db(self);
 
   element_range *record_range = _get_range_of_records(self, selector);
@@ -327,6 +391,36 @@ context_info_db_foreach_record(ContextInfoDB *self, const gchar *selector,
     }
 }
 
+/*
+ * Calls @callback with the NVHandle and the value of each record of
+ * @selector, without copying anything.  This is what message processing
+ * uses, names are resolved when the records are loaded.
+ */
+void
+context_info_db_foreach_value(ContextInfoDB *self, const gchar *selector,
+                              ADD_CONTEXT_VALUE_CB callback, gpointer arg)
+{
+  if (self->compiled)
+    {
+      compiled_context_info_db_foreach_value(self->compiled, selector, self->ignore_case, callback, arg);
+      return;
+    }
+
+  _ensure_indexed_db(self);
+
+  element_range *record_range = _get_range_of_records(self, selector);
+
+  if (!record_range)
+    return;
+
+  for (gsize i = record_range->offset;
+       i < record_range->offset + record_range->length; ++i)
+    {
+      ContextualDataRecord *record = &g_array_index(self->data, ContextualDataRecord, i);
+      callback(arg, record->value_handle, record->value->str, record->value->len);
+    }
+}
+
 gboolean
 context_info_db_is_indexed(const ContextInfoDB *self)
 {
@@ -336,12 +430,15 @@ context_info_db_is_indexed(const ContextInfoDB *self)
 gboolean
 context_info_db_is_loaded(const ContextInfoDB *self)
 {
-  return (self->data != NULL && self->data->len > 0);
+  return self->compiled != NULL || (self->data != NULL && self->data->len > 0);
 }
 
 GList *
 context_info_db_get_selectors(ContextInfoDB *self)
 {
+  if (self->compiled)
+    return compiled_context_info_db_get_selectors(self->compiled);
+
   _ensure_indexed_db(self);
   return g_hash_table_get_keys(self->index);
 }
@@ -392,3 +489,27 @@ context_info_db_import(ContextInfoDB *self, FILE *fp,
 
   return TRUE;
 }
+
+/*
+ * Loads a database compiled by ctxdbtool.  Unlike import(), this maps the
+ * file into memory instead of parsing it, @name_prefix is prepended to the
+ * names in the file.
+ */
+gboolean
+context_info_db_import_compiled(ContextInfoDB *self, const gchar *filename,
+                                const gchar *name_prefix, GError **error)
+{
+  CompiledContextInfoDB *compiled = compiled_context_info_db_open(filename, name_prefix, error);
+
+  if (!compiled)
+    return FALSE;
+
+  if (self->compiled)
+    _free_compiled(self);
+  self->compiled = compiled;
+  self->is_data_indexed = TRUE;
+  if (self->is_ordering_enabled)
+    self->ordered_selectors = compiled_context_info_db_get_selectors(compiled);
+
+  return TRUE;
+}
@@ -31,6 +31,8 @@ typedef struct _ContextInfoDB ContextInfoDB;
 
 typedef void (*ADD_CONTEXT_INFO_CB) (gpointer arg,
                                      const ContextualDataRecord *record);
+typedef void (*ADD_CONTEXT_VALUE_CB) (gpointer arg, NVHandle handle,
+                                      const gchar *value, gsize value_len);
 
 void context_info_db_enable_ordering(ContextInfoDB *self);
 GList *context_info_db_ordered_selectors(ContextInfoDB *self);
@@ -61,9 +63,16 @@ void context_info_db_foreach_record(ContextInfoDB *self,
                                     ADD_CONTEXT_INFO_CB callback,
                                     gpointer arg);
 
+void context_info_db_foreach_value(ContextInfoDB *self,
+                                   const gchar *selector,
+                                   ADD_CONTEXT_VALUE_CB callback,
+                                   gpointer arg);
+
 GList *context_info_db_get_selectors(ContextInfoDB *self);
 
 gboolean context_info_db_import(ContextInfoDB *self, FILE *fp,
                                 ContextualDataRecordScanner *scanner);
+gboolean context_info_db_import_compiled(ContextInfoDB *self, const gchar *filename,
+                                         const gchar *name_prefix, GError **error);
 
 #endif
@@ -45,6 +45,7 @@ contextual_data_record_init(ContextualDataRecord *record)
   record->selector = NULL;
   record->name = NULL;
   record->value = NULL;
+  record->value_handle = 0;
 }
 
 void
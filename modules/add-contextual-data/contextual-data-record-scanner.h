@@ -24,6 +24,7 @@
 #define CONTEXTUAL_DATA_RECORD_SCANNER_H_INCLUDED
 
 #include "syslog-ng.h"
+#include "logmsg/nvtable.h"
 
 typedef struct _ContextualDataRecordScanner ContextualDataRecordScanner;
 
@@ -32,6 +33,7 @@ typedef struct _ContextualDataRecord
   GString *selector;
   GString *name;
   GString *value;
+  NVHandle value_handle;
 } ContextualDataRecord;
 
 struct _ContextualDataRecordScanner
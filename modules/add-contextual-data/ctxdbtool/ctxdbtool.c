@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "syslog-ng.h"
+#include "messages.h"
+#include "logmsg/logmsg.h"
+#include "compiled-context-info-db.h"
+#include "contextual-data-record-scanner.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <locale.h>
+
+static gchar *input_file = NULL;
+static gchar *output_file = NULL;
+
+static GOptionEntry compile_options[] =
+{
+  {
+    "input", 'i', 0, G_OPTION_ARG_STRING, &input_file,
+    "Name of the CSV file to compile", "<file>"
+  },
+  {
+    "output", 'o', 0, G_OPTION_ARG_STRING, &output_file,
+    "Name of the compiled database, replaced atomically if it exists", "<file>"
+  },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL }
+};
+
+static void
+_truncate_eol(gchar *line, gssize line_len)
+{
+  if (line_len >= 2 && line[line_len - 2] == '\r' && line[line_len - 1] == '\n')
+    line[line_len - 2] = '\0';
+  else if (line_len >= 1 && line[line_len - 1] == '\n')
+    line[line_len - 1] = '\0';
+}
+
+static gboolean
+_read_csv_file(CompiledContextInfoDBWriter *writer, FILE *fp)
+{
+  ContextualDataRecordScanner *scanner = create_contextual_data_record_scanner_by_type("csv");
+  gchar *line_buf = NULL;
+  size_t line_buf_len = 0;
+  gssize line_len;
+  gint line_number = 0;
+  gboolean success = TRUE;
+
+  while ((line_len = getline(&line_buf, &line_buf_len, fp)) != -1)
+    {
+      ContextualDataRecord *record;
+
+      line_number++;
+      _truncate_eol(line_buf, line_len);
+      record = contextual_data_record_scanner_get_next(scanner, line_buf);
+      if (!record)
+        {
+          fprintf(stderr, "Error parsing CSV record; line='%d', record='%s'\n", line_number, line_buf);
+          success = FALSE;
+          break;
+        }
+
+      compiled_context_info_db_writer_add(writer, record->selector->str, record->name->str, record->value->str);
+      contextual_data_record_clean(record);
+    }
+
+  g_free(line_buf);
+  contextual_data_record_scanner_free(scanner);
+  return success;
+}
+
+static gint
+ctxdbtool_compile(int argc, char *argv[])
+{
+  CompiledContextInfoDBWriter *writer;
+  GError *error = NULL;
+  FILE *fp;
+  gint ret = 0;
+
+  if (!input_file || !output_file)
+    {
+      fprintf(stderr, "Both --input and --output must be specified\n");
+      return 1;
+    }
+
+  fp = fopen(input_file, "r");
+  if (!fp)
+    {
+      fprintf(stderr, "Error opening CSV file; file='%s', error='%s'\n", input_file, g_strerror(errno));
+      return 1;
+    }
+
+  writer = compiled_context_info_db_writer_new();
+  if (!_read_csv_file(writer, fp))
+    {
+      ret = 1;
+    }
+  else if (!compiled_context_info_db_writer_save(writer, output_file, &error))
+    {
+      fprintf(stderr, "Error writing compiled database; file='%s', error='%s'\n", output_file, error->message);
+      g_clear_error(&error);
+      ret = 1;
+    }
+
+  compiled_context_info_db_writer_free(writer);
+  fclose(fp);
+  return ret;
+}
+
+static gchar *dump_file = NULL;
+
+static GOptionEntry dump_options[] =
+{
+  {
+    "database", 'd', 0, G_OPTION_ARG_STRING, &dump_file,
+    "Name of the compiled database to dump", "<file>"
+  },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL }
+};
+
+static void
+_print_csv_field(const gchar *value, gsize value_len)
+{
+  putchar('"');
+  for (gsize i = 0; i < value_len; i++)
+    {
+      if (value[i] == '"')
+        putchar('"');
+      putchar(value[i]);
+    }
+  putchar('"');
+}
+
+static void
+_dump_record(gpointer arg, NVHandle handle, const gchar *value, gsize value_len)
+{
+  const gchar *selector = (const gchar *) arg;
+  const gchar *name = log_msg_get_value_name(handle, NULL);
+
+  _print_csv_field(selector, strlen(selector));
+  putchar(',');
+  _print_csv_field(name, strlen(name));
+  putchar(',');
+  _print_csv_field(value, value_len);
+  putchar('\n');
+}
+
+static gint
+ctxdbtool_dump(int argc, char *argv[])
+{
+  CompiledContextInfoDB *db;
+  GError *error = NULL;
+  GList *selectors;
+
+  if (!dump_file)
+    {
+      fprintf(stderr, "The --database option must be specified\n");
+      return 1;
+    }
+
+  db = compiled_context_info_db_open(dump_file, NULL, &error);
+  if (!db)
+    {
+      fprintf(stderr, "Error opening compiled database; file='%s', error='%s'\n", dump_file, error->message);
+      g_clear_error(&error);
+      return 1;
+    }
+
+  /* the same selector may appear in several records, but only once in this list */
+  selectors = compiled_context_info_db_get_selectors(db);
+  for (GList *l = selectors; l; l = l->next)
+    compiled_context_info_db_foreach_value(db, l->data, FALSE, _dump_record, l->data);
+
+  g_list_free(selectors);
+  compiled_context_info_db_free(db);
+  return 0;
+}
+
+static GOptionEntry ctxdbtool_options[] =
+{
+  {
+    "debug",     0, 0, G_OPTION_ARG_NONE, &debug_flag,
+    "Enable debug/diagnostic messages on stderr", NULL
+  },
+  {
+    "verbose",   'v', 0, G_OPTION_ARG_NONE, &verbose_flag,
+    "Enable verbose messages on stderr", NULL
+  },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL }
+};
+
+static struct
+{
+  const gchar *mode;
+  const GOptionEntry *options;
+  const gchar *description;
+  gint (*main)(gint argc, gchar *argv[]);
+} modes[] =
+{
+  { "compile", compile_options, "Compile a CSV file for add-contextual-data()", ctxdbtool_compile },
+  { "dump", dump_options, "Dump a compiled database in CSV format", ctxdbtool_dump },
+  { NULL, NULL },
+};
+
+static void
+usage(void)
+{
+  gint mode;
+
+  fprintf(stderr, "Syntax: ctxdbtool <command> [options]\nPossible commands are:\n");
+  for (mode = 0; modes[mode].mode; mode++)
+    {
+      fprintf(stderr, "    %-12s %s\n", modes[mode].mode, modes[mode].description);
+    }
+  exit(1);
+}
+
+static const gchar *
+ctxdbtool_mode(int *argc, char **argv[])
+{
+  gint i;
+  const gchar *mode;
+
+  for (i = 1; i < (*argc); i++)
+    {
+      if ((*argv)[i][0] != '-')
+        {
+          mode = (*argv)[i];
+          memmove(&(*argv)[i], &(*argv)[i+1], ((*argc) - i) * sizeof(gchar *));
+          (*argc)--;
+          return mode;
+        }
+    }
+  return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  const gchar *mode_string;
+  GOptionContext *ctx;
+  gint mode, ret = 0;
+  GError *error = NULL;
+
+  mode_string = ctxdbtool_mode(&argc, &argv);
+  if (!mode_string)
+    {
+      usage();
+    }
+
+  ctx = NULL;
+  for (mode = 0; modes[mode].mode; mode++)
+    {
+      if (strcmp(modes[mode].mode, mode_string) == 0)
+        {
+          ctx = g_option_context_new(mode_string);
+          g_option_context_set_summary(ctx, modes[mode].description);
+          g_option_context_add_main_entries(ctx, modes[mode].options, NULL);
+          g_option_context_add_main_entries(ctx, ctxdbtool_options, NULL);
+          break;
+        }
+    }
+  if (!ctx)
+    {
+      fprintf(stderr, "Unknown command\n");
+      usage();
+    }
+
+  setlocale(LC_ALL, "");
+
+  if (!g_option_context_parse(ctx, &argc, &argv, &error))
+    {
+      fprintf(stderr, "Error parsing command line arguments: %s\n", error ? error->message : "Invalid arguments");
+      g_clear_error(&error);
+      g_option_context_free(ctx);
+      return 1;
+    }
+  g_option_context_free(ctx);
+
+  msg_init(TRUE);
+  log_msg_global_init();
+
+  ret = modes[mode].main(argc, argv);
+
+  log_msg_global_deinit();
+  msg_deinit();
+  return ret;
+}
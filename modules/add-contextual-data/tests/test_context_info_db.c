@@ -21,11 +21,14 @@
  */
 
 #include "context-info-db.h"
+#include "compiled-context-info-db.h"
+#include "logmsg/logmsg.h"
 #include "apphook.h"
 #include <criterion/criterion.h>
 #include <criterion/parameterized.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
@@ -538,3 +541,154 @@ Test(add_contextual_data, test_selected_nvpairs_when_ignore_case_on)
   context_info_db_free(db);
   contextual_data_record_scanner_free(scanner);
 }
+
+static gchar *
+_compile_records(const gchar *records[][3], gsize number_of_records)
+{
+  CompiledContextInfoDBWriter *writer = compiled_context_info_db_writer_new();
+  gchar *filename;
+  gint fd;
+
+  fd = g_file_open_tmp("test_context_info_db-XXXXXX.ctxdb", &filename, NULL);
+  cr_assert(fd >= 0);
+  close(fd);
+
+  for (gsize i = 0; i < number_of_records; i++)
+    compiled_context_info_db_writer_add(writer, records[i][0], records[i][1], records[i][2]);
+  cr_assert(compiled_context_info_db_writer_save(writer, filename, NULL));
+  compiled_context_info_db_writer_free(writer);
+
+  return filename;
+}
+
+static ContextInfoDB *
+_load_compiled_context_info_db(const gchar *records[][3], gsize number_of_records,
+                               const gchar *prefix, gboolean ignore_case)
+{
+  ContextInfoDB *db = context_info_db_new();
+  gchar *filename = _compile_records(records, number_of_records);
+
+  context_info_db_enable_ordering(db);
+  context_info_db_set_ignore_case(db, ignore_case);
+  cr_assert(context_info_db_import_compiled(db, filename, prefix, NULL));
+
+  /* the mapping remains valid */
+  unlink(filename);
+  g_free(filename);
+  return db;
+}
+
+typedef struct _TestValueStore
+{
+  NVHandle handles[8];
+  const gchar *values[8];
+  gint ctr;
+} TestValueStore;
+
+static void
+_foreach_get_values(gpointer arg, NVHandle handle, const gchar *value, gsize value_len)
+{
+  TestValueStore *store = (TestValueStore *) arg;
+
+  cr_assert_eq(strlen(value), value_len);
+  store->handles[store->ctr] = handle;
+  store->values[store->ctr] = value;
+  store->ctr++;
+}
+
+static void
+_assert_prefixed_record(gpointer arg, const ContextualDataRecord *record)
+{
+  cr_assert(g_str_has_prefix(record->name->str, ".prefix."), "name=%s", record->name->str);
+  cr_assert_eq(record->value_handle, log_msg_get_value_handle(record->name->str));
+  (*(gint *) arg)++;
+}
+
+Test(add_contextual_data, test_compiled_db_lookup)
+{
+  const gchar *records[][3] =
+  {
+    { "selector1", "name1", "value1" },
+    { "selector2", "name2", "value2" },
+    { "selector1", "name1.1", "value1.1" },
+  };
+  ContextInfoDB *db = _load_compiled_context_info_db(records, ARRAY_SIZE(records), ".prefix.", FALSE);
+  TestValueStore store = { .ctr = 0 };
+  gint ctr = 0;
+
+  cr_assert(context_info_db_is_loaded(db));
+  cr_assert(context_info_db_is_indexed(db));
+  cr_assert(context_info_db_contains(db, "selector1"));
+  cr_assert(context_info_db_contains(db, "selector2"));
+  cr_assert_not(context_info_db_contains(db, "SELECTOR1"));
+  cr_assert_not(context_info_db_contains(db, "selector"));
+  cr_assert_eq(context_info_db_number_of_records(db, "selector1"), 2);
+
+  context_info_db_foreach_value(db, "selector1", _foreach_get_values, &store);
+  cr_assert_eq(store.ctr, 2);
+  cr_assert_eq(store.handles[0], log_msg_get_value_handle(".prefix.name1"));
+  cr_assert_str_eq(store.values[0], "value1");
+  cr_assert_eq(store.handles[1], log_msg_get_value_handle(".prefix.name1.1"));
+  cr_assert_str_eq(store.values[1], "value1.1");
+
+  context_info_db_foreach_record(db, "selector2", _assert_prefixed_record, &ctr);
+  cr_assert_eq(ctr, 1);
+
+  context_info_db_unref(db);
+}
+
+Test(add_contextual_data, test_compiled_db_ignore_case)
+{
+  const gchar *records[][3] =
+  {
+    { "selector", "name1", "value1" },
+    { "SeLeCtOr", "name2", "value2" },
+    { "another", "name3", "value3" },
+  };
+  ContextInfoDB *db = _load_compiled_context_info_db(records, ARRAY_SIZE(records), NULL, TRUE);
+
+  cr_assert_eq(context_info_db_number_of_records(db, "SELECTOR"), 2);
+  cr_assert_eq(context_info_db_number_of_records(db, "selector"), 2);
+  cr_assert_eq(context_info_db_number_of_records(db, "ANOTHER"), 1);
+  cr_assert_not(context_info_db_contains(db, "selecto"));
+
+  context_info_db_unref(db);
+}
+
+Test(add_contextual_data, test_compiled_db_keeps_the_order_of_selectors)
+{
+  const gchar *records[][3] =
+  {
+    { "selector-b", "name1", "value1" },
+    { "selector-a", "name2", "value2" },
+    { "selector-b", "name3", "value3" },
+  };
+  ContextInfoDB *db = _load_compiled_context_info_db(records, ARRAY_SIZE(records), NULL, FALSE);
+  GList *ordered_selectors = context_info_db_ordered_selectors(db);
+
+  cr_assert_eq(g_list_length(ordered_selectors), 2);
+  cr_assert_str_eq((const gchar *) ordered_selectors->data, "selector-b");
+  cr_assert_str_eq((const gchar *) ordered_selectors->next->data, "selector-a");
+
+  context_info_db_unref(db);
+}
+
+Test(add_contextual_data, test_compiled_db_rejects_invalid_file)
+{
+  const gchar csv_content[] = "selector,name,value\n";
+  ContextInfoDB *db = context_info_db_new();
+  GError *error = NULL;
+  gchar *filename;
+
+  cr_assert(g_file_open_tmp("test_context_info_db-XXXXXX.ctxdb", &filename, NULL) >= 0);
+  cr_assert(g_file_set_contents(filename, csv_content, -1, NULL));
+
+  cr_assert_not(context_info_db_import_compiled(db, filename, NULL, &error));
+  cr_assert_not_null(error);
+  cr_assert_not(context_info_db_is_loaded(db));
+
+  g_clear_error(&error);
+  unlink(filename);
+  g_free(filename);
+  context_info_db_unref(db);
+}
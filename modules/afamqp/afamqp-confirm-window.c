@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "afamqp-confirm-window.h"
+
+#include <string.h>
+
+/*
+ * Messages are published without waiting for the broker, and are kept on
+ * the backlog as pending until the broker confirms them. As the backlog
+ * can only be acked in order, confirms are reported to
+ * LogThreadedDestWorker in the order of the delivery tags, even if the
+ * broker sends them out of order.
+ */
+
+static inline guint8 *
+_get_state(AMQPConfirmWindow *self, guint64 delivery_tag)
+{
+  return &self->states[(delivery_tag - 1) % self->size];
+}
+
+void
+afamqp_confirm_window_reset(AMQPConfirmWindow *self)
+{
+  self->last_published_tag = 0;
+  self->last_reported_tag = 0;
+  if (self->states)
+    memset(self->states, AFAMQP_CONFIRM_WAITING, self->size);
+}
+
+/* returns FALSE if @delivery_tag is not waiting for a confirm */
+gboolean
+afamqp_confirm_window_record(AMQPConfirmWindow *self, guint64 delivery_tag, gboolean multiple, guint8 state)
+{
+  guint64 tag;
+
+  if (delivery_tag <= self->last_reported_tag || delivery_tag > self->last_published_tag)
+    return FALSE;
+
+  for (tag = multiple ? self->last_reported_tag + 1 : delivery_tag; tag <= delivery_tag; tag++)
+    {
+      guint8 *confirm_state = _get_state(self, tag);
+
+      if (*confirm_state == AFAMQP_CONFIRM_WAITING)
+        *confirm_state = state;
+    }
+  return TRUE;
+}
+
+/* Reports the confirmed head of the window to @worker, a nack is reported
+ * as an error to be retried.  Returns FALSE if that made @worker
+ * disconnect, which resets the window. */
+gboolean
+afamqp_confirm_window_report(AMQPConfirmWindow *self, LogThreadedDestWorker *worker)
+{
+  while (self->last_reported_tag < self->last_published_tag)
+    {
+      guint8 state = *_get_state(self, self->last_reported_tag + 1);
+      worker_insert_result_t result;
+      gint num_messages = 0;
+
+      if (state == AFAMQP_CONFIRM_WAITING)
+        break;
+
+      while (self->last_reported_tag < self->last_published_tag &&
+             *_get_state(self, self->last_reported_tag + 1) == state)
+        {
+          *_get_state(self, self->last_reported_tag + 1) = AFAMQP_CONFIRM_WAITING;
+          self->last_reported_tag++;
+          num_messages++;
+        }
+
+      result = (state == AFAMQP_CONFIRM_ACK) ? WORKER_INSERT_RESULT_SUCCESS : WORKER_INSERT_RESULT_ERROR;
+      log_threaded_dest_worker_complete_pending(worker, num_messages, result);
+      if (self->last_reported_tag == 0)
+        return FALSE;
+    }
+  return TRUE;
+}
+
+void
+afamqp_confirm_window_init(AMQPConfirmWindow *self, gint size)
+{
+  self->size = size;
+  self->states = g_new0(guint8, size);
+  afamqp_confirm_window_reset(self);
+}
+
+void
+afamqp_confirm_window_deinit(AMQPConfirmWindow *self)
+{
+  g_free(self->states);
+  self->states = NULL;
+  self->size = 0;
+  afamqp_confirm_window_reset(self);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef AFAMQP_CONFIRM_WINDOW_H_INCLUDED
+#define AFAMQP_CONFIRM_WINDOW_H_INCLUDED
+
+#include "syslog-ng.h"
+#include "logthrdestdrv.h"
+
+enum
+{
+  AFAMQP_CONFIRM_WAITING = 0,
+  AFAMQP_CONFIRM_ACK,
+  AFAMQP_CONFIRM_NACK,
+};
+
+/* the publisher confirm state of the messages published on a channel,
+ * delivery tags are numbered from 1 on each new channel */
+typedef struct _AMQPConfirmWindow
+{
+  guint64 last_published_tag;
+  guint64 last_reported_tag;
+  gint size;
+  /* indexed by delivery tag modulo size */
+  guint8 *states;
+} AMQPConfirmWindow;
+
+static inline guint64
+afamqp_confirm_window_get_num_unconfirmed(const AMQPConfirmWindow *self)
+{
+  return self->last_published_tag - self->last_reported_tag;
+}
+
+static inline void
+afamqp_confirm_window_publish(AMQPConfirmWindow *self)
+{
+  self->last_published_tag++;
+}
+
+void afamqp_confirm_window_reset(AMQPConfirmWindow *self);
+gboolean afamqp_confirm_window_record(AMQPConfirmWindow *self, guint64 delivery_tag, gboolean multiple,
+                                      guint8 state);
+gboolean afamqp_confirm_window_report(AMQPConfirmWindow *self, LogThreadedDestWorker *worker);
+
+void afamqp_confirm_window_init(AMQPConfirmWindow *self, gint size);
+void afamqp_confirm_window_deinit(AMQPConfirmWindow *self);
+
+#endif
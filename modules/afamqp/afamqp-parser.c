@@ -40,6 +40,8 @@ static CfgLexerKeyword afamqp_keywords[] =
   { "exchange_type",    KW_EXCHANGE_TYPE },
   { "routing_key",    KW_ROUTING_KEY },
   { "persistent",   KW_PERSISTENT },
+  { "publisher_confirms", KW_PUBLISHER_CONFIRMS },
+  { "confirm_window",     KW_CONFIRM_WINDOW },
   { "username",     KW_USERNAME },
   { "password",     KW_PASSWORD },
   { "log_fifo_size",    KW_LOG_FIFO_SIZE  },
@@ -32,11 +32,18 @@
 #include "scratch-buffers.h"
 #include "plugin-types.h"
 #include "logthrdestdrv.h"
+#include "timeutils.h"
+#include "afamqp-confirm-window.h"
 
 #include <amqp.h>
 #include <amqp_framing.h>
 #include <amqp_tcp_socket.h>
 #include <amqp_ssl_socket.h>
+#include <iv.h>
+
+/* how often the confirms of the last messages are checked when the queue
+ * is drained, in msec */
+#define AFAMQP_CONFIRM_POLL_INTERVAL 100
 
 typedef struct
 {
@@ -50,6 +57,8 @@ typedef struct
 
   gboolean declare;
   gint persistent;
+  gboolean publisher_confirms;
+  gint confirm_window;
 
   gchar *vhost;
   gchar *host;
@@ -72,6 +81,10 @@ typedef struct
   gchar *key_file;
   gchar *cert_file;
   gboolean peer_verify;
+
+  /* Writer-only publisher confirm state */
+  AMQPConfirmWindow confirms;
+  struct iv_timer confirm_timer;
 } AMQPDestDriver;
 
 /*
@@ -177,6 +190,22 @@ afamqp_dd_set_persistent(LogDriver *s, gboolean persistent)
     self->persistent = 1;
 }
 
+void
+afamqp_dd_set_publisher_confirms(LogDriver *d, gboolean publisher_confirms)
+{
+  AMQPDestDriver *self = (AMQPDestDriver *) d;
+
+  self->publisher_confirms = publisher_confirms;
+}
+
+void
+afamqp_dd_set_confirm_window(LogDriver *d, gint confirm_window)
+{
+  AMQPDestDriver *self = (AMQPDestDriver *) d;
+
+  self->confirm_window = confirm_window;
+}
+
 void
 afamqp_dd_set_value_pairs(LogDriver *d, ValuePairs *vp)
 {
@@ -263,6 +292,20 @@ afamqp_dd_format_persist_name(const LogPipe *s)
   return persist_name;
 }
 
+static inline guint64
+_get_num_unconfirmed(AMQPDestDriver *self)
+{
+  return afamqp_confirm_window_get_num_unconfirmed(&self->confirms);
+}
+
+static void
+_reset_confirms(AMQPDestDriver *self)
+{
+  if (iv_timer_registered(&self->confirm_timer))
+    iv_timer_unregister(&self->confirm_timer);
+  afamqp_confirm_window_reset(&self->confirms);
+}
+
 static inline void
 _amqp_connection_deinit(AMQPDestDriver *self)
 {
@@ -287,6 +330,9 @@ afamqp_dd_disconnect(LogThreadedDestDriver *s)
     {
       _amqp_connection_disconnect(self);
     }
+
+  /* LogThreadedDestWorker rewinds the messages that were not confirmed */
+  _reset_confirms(self);
 }
 
 static gboolean
@@ -423,6 +469,12 @@ afamqp_dd_connect(AMQPDestDriver *self, gboolean reconnect)
         {
           return TRUE;
         }
+      else if (_get_num_unconfirmed(self) > 0)
+        {
+          /* the confirms of the old channel would never arrive, let
+           * LogThreadedDestWorker disconnect us and rewind them */
+          return FALSE;
+        }
       else
         {
           _amqp_connection_disconnect(self);
@@ -473,6 +525,17 @@ afamqp_dd_connect(AMQPDestDriver *self, gboolean reconnect)
         }
     }
 
+  if (self->publisher_confirms)
+    {
+      amqp_confirm_select(self->conn, 1);
+      ret = amqp_get_rpc_reply(self->conn);
+      if (!afamqp_is_ok(self, "Error enabling AMQP publisher confirms", ret))
+        {
+          goto exception_amqp_dd_connect_failed_exchange;
+        }
+      _reset_confirms(self);
+    }
+
   msg_debug ("Connecting to AMQP succeeded",
              evt_tag_str("driver", self->super.super.super.id));
 
@@ -580,6 +643,121 @@ afamqp_worker_publish(AMQPDestDriver *self, LogMessage *msg)
   return success;
 }
 
+/*
+ * Publisher confirms, see afamqp-confirm-window.c
+ */
+
+static void
+_record_confirm(AMQPDestDriver *self, guint64 delivery_tag, gboolean multiple, guint8 state)
+{
+  if (!afamqp_confirm_window_record(&self->confirms, delivery_tag, multiple, state))
+    msg_debug("Ignoring AMQP publisher confirm of an unknown delivery tag",
+              evt_tag_str("driver", self->super.super.super.id),
+              evt_tag_printf("delivery_tag", "%" G_GUINT64_FORMAT, delivery_tag));
+}
+
+static gboolean
+_process_frame(AMQPDestDriver *self, amqp_frame_t *frame)
+{
+  if (frame->frame_type != AMQP_FRAME_METHOD)
+    return TRUE;
+
+  switch (frame->payload.method.id)
+    {
+    case AMQP_BASIC_ACK_METHOD:
+    {
+      amqp_basic_ack_t *m = (amqp_basic_ack_t *) frame->payload.method.decoded;
+      _record_confirm(self, m->delivery_tag, m->multiple, AFAMQP_CONFIRM_ACK);
+      return TRUE;
+    }
+    case AMQP_BASIC_NACK_METHOD:
+    {
+      amqp_basic_nack_t *m = (amqp_basic_nack_t *) frame->payload.method.decoded;
+      msg_error("AMQP broker rejected message(s)",
+                evt_tag_str("driver", self->super.super.super.id),
+                evt_tag_printf("delivery_tag", "%" G_GUINT64_FORMAT, (guint64) m->delivery_tag),
+                evt_tag_int("multiple", m->multiple));
+      _record_confirm(self, m->delivery_tag, m->multiple, AFAMQP_CONFIRM_NACK);
+      return TRUE;
+    }
+    case AMQP_CHANNEL_CLOSE_METHOD:
+    case AMQP_CONNECTION_CLOSE_METHOD:
+    {
+      amqp_rpc_reply_t reply;
+
+      reply.reply_type = AMQP_RESPONSE_SERVER_EXCEPTION;
+      reply.reply = frame->payload.method;
+      afamqp_is_ok(self, "Error while waiting for AMQP publisher confirms", reply);
+      return FALSE;
+    }
+    default:
+      return TRUE;
+    }
+}
+
+/* Processes confirms until at most @max_unconfirmed messages are waiting
+ * for one. Unless @block is set, only the frames that have already
+ * arrived are processed. Returns WORKER_INSERT_RESULT_REWIND if a nack
+ * disconnected us, the messages are rewound already in that case. */
+static worker_insert_result_t
+_wait_for_confirms(AMQPDestDriver *self, guint64 max_unconfirmed, gboolean block)
+{
+  worker_insert_result_t result = WORKER_INSERT_RESULT_SUCCESS;
+
+  while (_get_num_unconfirmed(self) > max_unconfirmed)
+    {
+      amqp_frame_t frame;
+      struct timeval timeout = { block ? self->super.time_reopen : 0, 0 };
+      gint ret = amqp_simple_wait_frame_noblock(self->conn, &frame, &timeout);
+
+      if (ret == AMQP_STATUS_TIMEOUT && !block)
+        break;
+
+      if (ret != AMQP_STATUS_OK)
+        {
+          msg_error("Error while waiting for AMQP publisher confirms",
+                    evt_tag_str("driver", self->super.super.super.id),
+                    evt_tag_str("error", amqp_error_string2(ret)),
+                    evt_tag_printf("unconfirmed", "%" G_GUINT64_FORMAT, _get_num_unconfirmed(self)),
+                    evt_tag_int("time_reopen", self->super.time_reopen));
+          result = WORKER_INSERT_RESULT_NOT_CONNECTED;
+          break;
+        }
+
+      if (!_process_frame(self, &frame))
+        {
+          result = WORKER_INSERT_RESULT_NOT_CONNECTED;
+          break;
+        }
+
+      if (!afamqp_confirm_window_report(&self->confirms, &self->super.worker.instance))
+        {
+          result = WORKER_INSERT_RESULT_REWIND;
+          break;
+        }
+    }
+
+  if (self->conn)
+    amqp_maybe_release_buffers(self->conn);
+  return result;
+}
+
+/* confirms are processed before publishing the next message, so that the
+ * message itself is not reported before insert() returns it as pending */
+static worker_insert_result_t
+_make_room_in_confirm_window(AMQPDestDriver *self)
+{
+  worker_insert_result_t result = WORKER_INSERT_RESULT_SUCCESS;
+
+  if (_get_num_unconfirmed(self) >= self->confirm_window / 2)
+    result = _wait_for_confirms(self, 0, FALSE);
+
+  if (result == WORKER_INSERT_RESULT_SUCCESS && _get_num_unconfirmed(self) >= self->confirm_window)
+    result = _wait_for_confirms(self, self->confirm_window - 1, TRUE);
+
+  return result;
+}
+
 static worker_insert_result_t
 afamqp_worker_insert(LogThreadedDestDriver *s, LogMessage *msg)
 {
@@ -588,12 +766,83 @@ afamqp_worker_insert(LogThreadedDestDriver *s, LogMessage *msg)
   if (!afamqp_dd_connect(self, TRUE))
     return WORKER_INSERT_RESULT_NOT_CONNECTED;
 
+  if (self->publisher_confirms)
+    {
+      worker_insert_result_t result = _make_room_in_confirm_window(self);
+
+      if (result != WORKER_INSERT_RESULT_SUCCESS)
+        return result;
+    }
+
   if (!afamqp_worker_publish (self, msg))
     return WORKER_INSERT_RESULT_ERROR;
 
+  if (self->publisher_confirms)
+    {
+      afamqp_confirm_window_publish(&self->confirms);
+      return WORKER_INSERT_RESULT_PENDING;
+    }
+
   return WORKER_INSERT_RESULT_SUCCESS;
 }
 
+/* only called with pending messages, e.g. when exiting while confirms are
+ * outstanding */
+static worker_insert_result_t
+afamqp_worker_flush(LogThreadedDestDriver *s)
+{
+  AMQPDestDriver *self = (AMQPDestDriver *)s;
+
+  if (!self->conn)
+    return WORKER_INSERT_RESULT_NOT_CONNECTED;
+
+  return _wait_for_confirms(self, 0, TRUE);
+}
+
+/* the queue is drained, so there is nothing to pipeline the confirms
+ * with: instead of keeping the messages on the backlog until the next
+ * message arrives, the confirms that arrived are processed, and the rest
+ * are checked for periodically.  This never blocks the worker thread, so
+ * new messages are published meanwhile. */
+static void
+_poll_confirms(AMQPDestDriver *self)
+{
+  if (iv_timer_registered(&self->confirm_timer))
+    iv_timer_unregister(&self->confirm_timer);
+
+  if (!self->conn || _get_num_unconfirmed(self) == 0)
+    return;
+
+  worker_insert_result_t result = _wait_for_confirms(self, 0, FALSE);
+
+  if (result == WORKER_INSERT_RESULT_NOT_CONNECTED)
+    {
+      log_threaded_dest_worker_complete_pending(&self->super.worker.instance, _get_num_unconfirmed(self),
+                                                WORKER_INSERT_RESULT_NOT_CONNECTED);
+      return;
+    }
+
+  if (result == WORKER_INSERT_RESULT_SUCCESS && _get_num_unconfirmed(self) > 0)
+    {
+      iv_validate_now();
+      self->confirm_timer.expires = iv_now;
+      timespec_add_msec(&self->confirm_timer.expires, AFAMQP_CONFIRM_POLL_INTERVAL);
+      iv_timer_register(&self->confirm_timer);
+    }
+}
+
+static void
+_confirm_timer_expired(gpointer s)
+{
+  _poll_confirms((AMQPDestDriver *) s);
+}
+
+static void
+afamqp_worker_message_queue_empty(LogThreadedDestDriver *s)
+{
+  _poll_confirms((AMQPDestDriver *) s);
+}
+
 static void
 afamqp_worker_thread_init(LogThreadedDestDriver *d)
 {
@@ -602,6 +851,15 @@ afamqp_worker_thread_init(LogThreadedDestDriver *d)
   afamqp_dd_connect(self, FALSE);
 }
 
+static void
+afamqp_worker_thread_deinit(LogThreadedDestDriver *d)
+{
+  AMQPDestDriver *self = (AMQPDestDriver *)d;
+
+  if (iv_timer_registered(&self->confirm_timer))
+    iv_timer_unregister(&self->confirm_timer);
+}
+
 /*
  * Main thread
  */
@@ -624,6 +882,10 @@ afamqp_dd_init(LogPipe *s)
 
   log_template_options_init(&self->template_options, cfg);
 
+  afamqp_confirm_window_deinit(&self->confirms);
+  if (self->publisher_confirms)
+    afamqp_confirm_window_init(&self->confirms, self->confirm_window);
+
   msg_verbose("Initializing AMQP destination",
               evt_tag_str("vhost", self->vhost),
               evt_tag_str("host", self->host),
@@ -654,6 +916,7 @@ afamqp_dd_free(LogPipe *d)
   g_free(self->ca_file);
   g_free(self->key_file);
   g_free(self->cert_file);
+  afamqp_confirm_window_deinit(&self->confirms);
 
   log_threaded_dest_driver_free(d);
 }
@@ -681,9 +944,12 @@ afamqp_dd_new(GlobalConfig *cfg)
   self->super.super.super.super.generate_persist_name = afamqp_dd_format_persist_name;
 
   self->super.worker.thread_init = afamqp_worker_thread_init;
+  self->super.worker.thread_deinit = afamqp_worker_thread_deinit;
   self->super.worker.connect = afamqp_dd_worker_connect;
   self->super.worker.disconnect = afamqp_dd_disconnect;
   self->super.worker.insert = afamqp_worker_insert;
+  self->super.worker.flush = afamqp_worker_flush;
+  self->super.worker.worker_message_queue_empty = afamqp_worker_message_queue_empty;
 
   self->super.format.stats_instance = afamqp_dd_format_stats_instance;
   self->super.stats_source = SCS_AMQP;
@@ -698,10 +964,16 @@ afamqp_dd_new(GlobalConfig *cfg)
   afamqp_dd_set_routing_key((LogDriver *) self, "");
   afamqp_dd_set_persistent((LogDriver *) self, TRUE);
   afamqp_dd_set_exchange_declare((LogDriver *) self, FALSE);
+  afamqp_dd_set_publisher_confirms((LogDriver *) self, FALSE);
+  afamqp_dd_set_confirm_window((LogDriver *) self, 1000);
 
   self->max_entries = 256;
   self->entries = g_new(amqp_table_entry_t, self->max_entries);
 
+  IV_TIMER_INIT(&self->confirm_timer);
+  self->confirm_timer.cookie = self;
+  self->confirm_timer.handler = _confirm_timer_expired;
+
   log_template_options_defaults(&self->template_options);
   afamqp_dd_set_value_pairs(&self->super.super.super, value_pairs_new_default(cfg));
   afamqp_dd_set_peer_verify((LogDriver *) self, TRUE);
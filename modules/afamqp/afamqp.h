@@ -39,6 +39,8 @@ void afamqp_dd_set_vhost(LogDriver *d, const gchar *vhost);
 void afamqp_dd_set_routing_key(LogDriver *d, const gchar *routing_key);
 void afamqp_dd_set_body(LogDriver *d, const gchar *body);
 void afamqp_dd_set_persistent(LogDriver *d, gboolean persistent);
+void afamqp_dd_set_publisher_confirms(LogDriver *d, gboolean publisher_confirms);
+void afamqp_dd_set_confirm_window(LogDriver *d, gint confirm_window);
 void afamqp_dd_set_user(LogDriver *d, const gchar *user);
 void afamqp_dd_set_password(LogDriver *d, const gchar *password);
 void afamqp_dd_set_value_pairs(LogDriver *d, ValuePairs *vp);
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "afamqp-confirm-window.h"
+#include "logqueue-fifo.h"
+#include "apphook.h"
+#include "cfg.h"
+
+#include <criterion/criterion.h>
+#include <iv.h>
+
+#define WINDOW_SIZE 8
+
+static GlobalConfig *cfg;
+static LogThreadedDestDriver *dd;
+static LogThreadedDestWorker *worker;
+static StatsCounterItem written_messages;
+static StatsCounterItem dropped_messages;
+static gint acked_messages;
+static AMQPConfirmWindow window;
+
+static void
+_test_ack(LogMessage *msg, AckType ack_type)
+{
+  acked_messages++;
+}
+
+/* as if insert() published the messages and returned PENDING */
+static void
+_publish_messages(gint n)
+{
+  for (gint i = 0; i < n; i++)
+    {
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      LogMessage *msg = log_msg_new_empty();
+
+      path_options.ack_needed = TRUE;
+      path_options.flow_control_requested = TRUE;
+      log_msg_add_ack(msg, &path_options);
+      msg->ack_func = _test_ack;
+      log_queue_push_tail(worker->queue, msg, &path_options);
+
+      msg = log_queue_pop_head(worker->queue, &path_options);
+      cr_assert(msg != NULL);
+      log_msg_unref(msg);
+      afamqp_confirm_window_publish(&window);
+    }
+  worker->pending_size += n;
+}
+
+static void
+_confirm(guint64 delivery_tag, gboolean multiple, guint8 state)
+{
+  cr_assert(afamqp_confirm_window_record(&window, delivery_tag, multiple, state),
+            "delivery tag %" G_GUINT64_FORMAT " should be waiting for a confirm", delivery_tag);
+}
+
+/* the confirms of the old channel would never arrive, as in afamqp */
+static void
+_disconnect(LogThreadedDestWorker *s)
+{
+  afamqp_confirm_window_reset(&window);
+}
+
+static void
+_reopen(gpointer s)
+{
+}
+
+static void
+setup(void)
+{
+  app_startup();
+  cfg = cfg_new_snippet();
+
+  memset(&written_messages, 0, sizeof(written_messages));
+  memset(&dropped_messages, 0, sizeof(dropped_messages));
+  acked_messages = 0;
+
+  dd = g_new0(LogThreadedDestDriver, 1);
+  log_threaded_dest_driver_init_instance(dd, cfg);
+  dd->super.super.id = g_strdup("test_amqp");
+  dd->written_messages = &written_messages;
+  dd->dropped_messages = &dropped_messages;
+  dd->time_reopen = 60;
+  dd->retries.max = 3;
+
+  worker = g_new0(LogThreadedDestWorker, 1);
+  log_threaded_dest_worker_init_instance(worker, dd, 0);
+  worker->disconnect = _disconnect;
+  worker->queue = log_queue_fifo_new(1000, NULL);
+  log_queue_set_use_backlog(worker->queue, TRUE);
+  IV_TIMER_INIT(&worker->timer_reopen);
+  worker->timer_reopen.handler = _reopen;
+
+  afamqp_confirm_window_init(&window, WINDOW_SIZE);
+}
+
+static void
+teardown(void)
+{
+  afamqp_confirm_window_deinit(&window);
+
+  if (iv_timer_registered(&worker->timer_reopen))
+    iv_timer_unregister(&worker->timer_reopen);
+  log_queue_unref(worker->queue);
+  log_threaded_dest_worker_free(worker);
+  log_pipe_unref(&dd->super.super.super);
+  cfg_free(cfg);
+  app_shutdown();
+}
+
+TestSuite(confirm_window, .init = setup, .fini = teardown);
+
+Test(confirm_window, test_in_order_confirms_are_reported)
+{
+  _publish_messages(3);
+
+  _confirm(1, FALSE, AFAMQP_CONFIRM_ACK);
+  cr_assert(afamqp_confirm_window_report(&window, worker));
+  cr_assert_eq(acked_messages, 1);
+  cr_assert_eq(afamqp_confirm_window_get_num_unconfirmed(&window), 2);
+
+  _confirm(2, FALSE, AFAMQP_CONFIRM_ACK);
+  _confirm(3, FALSE, AFAMQP_CONFIRM_ACK);
+  cr_assert(afamqp_confirm_window_report(&window, worker));
+  cr_assert_eq(acked_messages, 3);
+  cr_assert_eq(stats_counter_get(&written_messages), 3);
+  cr_assert_eq(worker->pending_size, 0);
+  cr_assert_eq(afamqp_confirm_window_get_num_unconfirmed(&window), 0);
+}
+
+Test(confirm_window, test_out_of_order_confirms_wait_for_the_head)
+{
+  _publish_messages(3);
+
+  _confirm(3, FALSE, AFAMQP_CONFIRM_ACK);
+  cr_assert(afamqp_confirm_window_report(&window, worker));
+  cr_assert_eq(acked_messages, 0, "the backlog can only be acked in order");
+
+  _confirm(1, FALSE, AFAMQP_CONFIRM_ACK);
+  cr_assert(afamqp_confirm_window_report(&window, worker));
+  cr_assert_eq(acked_messages, 1);
+
+  _confirm(2, FALSE, AFAMQP_CONFIRM_ACK);
+  cr_assert(afamqp_confirm_window_report(&window, worker));
+  cr_assert_eq(acked_messages, 3);
+  cr_assert_eq(afamqp_confirm_window_get_num_unconfirmed(&window), 0);
+}
+
+Test(confirm_window, test_multiple_confirms_everything_up_to_the_delivery_tag)
+{
+  _publish_messages(4);
+
+  _confirm(3, TRUE, AFAMQP_CONFIRM_ACK);
+  cr_assert(afamqp_confirm_window_report(&window, worker));
+  cr_assert_eq(acked_messages, 3);
+  cr_assert_eq(afamqp_confirm_window_get_num_unconfirmed(&window), 1);
+  cr_assert_eq(worker->pending_size, 1);
+}
+
+Test(confirm_window, test_unknown_delivery_tags_are_ignored)
+{
+  _publish_messages(2);
+
+  cr_assert_not(afamqp_confirm_window_record(&window, 3, FALSE, AFAMQP_CONFIRM_ACK), "not published yet");
+
+  _confirm(1, FALSE, AFAMQP_CONFIRM_ACK);
+  cr_assert(afamqp_confirm_window_report(&window, worker));
+  cr_assert_not(afamqp_confirm_window_record(&window, 1, FALSE, AFAMQP_CONFIRM_NACK), "reported already");
+
+  cr_assert_eq(acked_messages, 1);
+  cr_assert_eq(afamqp_confirm_window_get_num_unconfirmed(&window), 1);
+}
+
+Test(confirm_window, test_nack_is_retried)
+{
+  _publish_messages(3);
+
+  _confirm(1, FALSE, AFAMQP_CONFIRM_ACK);
+  _confirm(2, FALSE, AFAMQP_CONFIRM_NACK);
+  _confirm(3, FALSE, AFAMQP_CONFIRM_ACK);
+  cr_assert_not(afamqp_confirm_window_report(&window, worker), "the nack should disconnect the worker");
+
+  cr_assert_eq(acked_messages, 1);
+  cr_assert_eq(stats_counter_get(&dropped_messages), 0);
+  cr_assert_eq(worker->retries_counter, 1);
+  cr_assert_eq(worker->pending_size, 0);
+  cr_assert_eq(log_queue_get_length(worker->queue), 2, "the nacked message and the ones after it should be rewound");
+  cr_assert_eq(afamqp_confirm_window_get_num_unconfirmed(&window), 0);
+}
+
+Test(confirm_window, test_nack_is_dropped_after_the_last_retry)
+{
+  dd->retries.max = 1;
+  _publish_messages(2);
+
+  _confirm(1, FALSE, AFAMQP_CONFIRM_NACK);
+  _confirm(2, FALSE, AFAMQP_CONFIRM_ACK);
+  cr_assert(afamqp_confirm_window_report(&window, worker));
+
+  cr_assert_eq(acked_messages, 2);
+  cr_assert_eq(stats_counter_get(&dropped_messages), 1);
+  cr_assert_eq(stats_counter_get(&written_messages), 1);
+}
+
+Test(confirm_window, test_delivery_tags_wrap_around_the_window)
+{
+  /* 1..6 are confirmed in reverse order */
+  _publish_messages(6);
+  for (guint64 tag = 6; tag >= 1; tag--)
+    _confirm(tag, FALSE, AFAMQP_CONFIRM_ACK);
+  cr_assert(afamqp_confirm_window_report(&window, worker));
+  cr_assert_eq(acked_messages, 6);
+
+  /* 7..12 use the slots of 7, 8, 1, 2, 3 and 4, which must not remember
+   * the confirms of their previous delivery tags */
+  _publish_messages(6);
+  _confirm(12, FALSE, AFAMQP_CONFIRM_ACK);
+  cr_assert(afamqp_confirm_window_report(&window, worker));
+  cr_assert_eq(acked_messages, 6);
+
+  _confirm(11, TRUE, AFAMQP_CONFIRM_ACK);
+  cr_assert(afamqp_confirm_window_report(&window, worker));
+  cr_assert_eq(acked_messages, 12);
+  cr_assert_eq(stats_counter_get(&written_messages), 12);
+  cr_assert_eq(afamqp_confirm_window_get_num_unconfirmed(&window), 0);
+}
@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "afmongodb-bulk.h"
+#include "messages.h"
+
+#include <string.h>
+
+/*
+ * The messages of a batch in bulk mode, along with the outcome of their
+ * documents.
+ *
+ * The backlog can only be acknowledged in order, so after a bulk write
+ * with per document errors only the head of the batch up to the first
+ * document that failed with a transient error is completed, the rest of
+ * the batch is rewound by LogThreadedDestWorker and retried according to
+ * retries() and time-reopen().  The outcome of the messages of the
+ * rewound part that were written or dropped already is remembered, so
+ * that their documents are not sent again when they come back at the
+ * head of the next batch.  As a disk-queue reads the rewound messages
+ * again, they are matched by their position in the batch, not by the
+ * LogMessage instance.
+ */
+
+typedef struct _MongoDBBulkEntry
+{
+  bson_t *doc;
+  /* QUEUED until the document is written or dropped */
+  worker_insert_result_t result;
+} MongoDBBulkEntry;
+
+struct _MongoDBBulk
+{
+  GArray *entries;
+  /* indexes into entries of the documents of the last bulk write */
+  GArray *sent;
+  /* worker_insert_result_t of the rewound messages, indexed by their
+   * position in the next batch, QUEUED if the message is to be written */
+  GArray *completed;
+};
+
+static void
+_add_entry(MongoDBBulk *self, bson_t *doc, worker_insert_result_t result)
+{
+  MongoDBBulkEntry entry = { .doc = doc, .result = result };
+
+  g_array_append_val(self->entries, entry);
+}
+
+static MongoDBBulkEntry *
+_get_sent_entry(MongoDBBulk *self, guint index)
+{
+  return &g_array_index(self->entries, MongoDBBulkEntry, g_array_index(self->sent, guint, index));
+}
+
+/* returns TRUE if the next message of the batch was completed in an
+ * earlier batch and has been added without a document */
+gboolean
+mongodb_bulk_add_completed(MongoDBBulk *self)
+{
+  guint position = self->entries->len;
+
+  if (position >= self->completed->len)
+    return FALSE;
+
+  worker_insert_result_t result = g_array_index(self->completed, worker_insert_result_t, position);
+  if (result == WORKER_INSERT_RESULT_QUEUED)
+    return FALSE;
+
+  _add_entry(self, NULL, result);
+  return TRUE;
+}
+
+/* @doc is NULL if the message could not be formatted, the message is
+ * dropped when the batch is completed */
+void
+mongodb_bulk_add(MongoDBBulk *self, const bson_t *doc)
+{
+  if (doc)
+    _add_entry(self, bson_copy(doc), WORKER_INSERT_RESULT_QUEUED);
+  else
+    _add_entry(self, NULL, WORKER_INSERT_RESULT_DROP);
+}
+
+/* adds the documents to be written to @bulk, returns their number */
+guint
+mongodb_bulk_prepare(MongoDBBulk *self, mongoc_bulk_operation_t *bulk)
+{
+  g_array_set_size(self->sent, 0);
+
+  for (guint i = 0; i < self->entries->len; i++)
+    {
+      MongoDBBulkEntry *entry = &g_array_index(self->entries, MongoDBBulkEntry, i);
+
+      if (entry->result != WORKER_INSERT_RESULT_QUEUED)
+        continue;
+
+      mongoc_bulk_operation_insert(bulk, entry->doc);
+      g_array_append_val(self->sent, i);
+    }
+  return self->sent->len;
+}
+
+void
+mongodb_bulk_set_written(MongoDBBulk *self)
+{
+  for (guint i = 0; i < self->sent->len; i++)
+    _get_sent_entry(self, i)->result = WORKER_INSERT_RESULT_SUCCESS;
+}
+
+/* the error codes of the retryable writes specification */
+static gboolean
+_is_transient_write_error(gint32 code)
+{
+  switch (code)
+    {
+    case 6:     /* HostUnreachable */
+    case 7:     /* HostNotFound */
+    case 89:    /* NetworkTimeout */
+    case 91:    /* ShutdownInProgress */
+    case 189:   /* PrimarySteppedDown */
+    case 262:   /* ExceededTimeLimit */
+    case 9001:  /* SocketException */
+    case 10107: /* NotMaster */
+    case 11600: /* InterruptedAtShutdown */
+    case 11602: /* InterruptedDueToReplStateChange */
+    case 13435: /* NotMasterNoSlaveOk */
+    case 13436: /* NotMasterOrSecondary */
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+static gboolean
+_parse_write_error(const bson_iter_t *write_error, gint64 *index, gint32 *code, const gchar **errmsg)
+{
+  bson_iter_t iter;
+
+  if (!BSON_ITER_HOLDS_DOCUMENT(write_error) || !bson_iter_recurse(write_error, &iter))
+    return FALSE;
+
+  *index = -1;
+  *code = 0;
+  *errmsg = "";
+  while (bson_iter_next(&iter))
+    {
+      const gchar *key = bson_iter_key(&iter);
+
+      if (strcmp(key, "index") == 0)
+        *index = bson_iter_as_int64(&iter);
+      else if (strcmp(key, "code") == 0)
+        *code = (gint32) bson_iter_as_int64(&iter);
+      else if (strcmp(key, "errmsg") == 0 && BSON_ITER_HOLDS_UTF8(&iter))
+        *errmsg = bson_iter_utf8(&iter, NULL);
+    }
+  return *index >= 0;
+}
+
+/* Processes the writeErrors array of the reply of an unordered bulk
+ * write: documents that failed with a transient error remain to be
+ * written, the ones that failed for any other reason (e.g. duplicate key,
+ * validation) are dropped, the rest are written.  Returns FALSE if the
+ * reply has no per document errors, e.g. the whole command failed. */
+gboolean
+mongodb_bulk_process_write_errors(MongoDBBulk *self, const bson_t *reply, const gchar *driver_id)
+{
+  bson_iter_t iter, write_error;
+
+  if (!bson_iter_init_find(&iter, reply, "writeErrors") ||
+      !BSON_ITER_HOLDS_ARRAY(&iter) ||
+      !bson_iter_recurse(&iter, &write_error))
+    return FALSE;
+
+  mongodb_bulk_set_written(self);
+  while (bson_iter_next(&write_error))
+    {
+      gint64 index;
+      gint32 code;
+      const gchar *errmsg;
+
+      if (!_parse_write_error(&write_error, &index, &code, &errmsg) || index >= self->sent->len)
+        continue;
+
+      MongoDBBulkEntry *entry = _get_sent_entry(self, index);
+
+      if (_is_transient_write_error(code))
+        {
+          entry->result = WORKER_INSERT_RESULT_QUEUED;
+          continue;
+        }
+
+      msg_error("Failed to insert document into MongoDB, dropping message",
+                evt_tag_int("code", code),
+                evt_tag_str("reason", errmsg),
+                evt_tag_str("driver", driver_id));
+      entry->result = WORKER_INSERT_RESULT_DROP;
+    }
+  return TRUE;
+}
+
+/* the rewound tail of the batch starting at @first comes back at the
+ * head of the next batch, followed by the remembered messages that did
+ * not fit into this one */
+static void
+_remember_completed(MongoDBBulk *self, guint first)
+{
+  GArray *completed = g_array_new(FALSE, FALSE, sizeof(worker_insert_result_t));
+
+  for (guint i = first; i < self->entries->len; i++)
+    g_array_append_val(completed, g_array_index(self->entries, MongoDBBulkEntry, i).result);
+  for (guint i = self->entries->len; i < self->completed->len; i++)
+    g_array_append_val(completed, g_array_index(self->completed, worker_insert_result_t, i));
+
+  while (completed->len > 0 &&
+         g_array_index(completed, worker_insert_result_t, completed->len - 1) == WORKER_INSERT_RESULT_QUEUED)
+    g_array_set_size(completed, completed->len - 1);
+
+  g_array_free(self->completed, TRUE);
+  self->completed = completed;
+}
+
+/* Completes the head of the batch up to the first document that is still
+ * to be written and clears the bulk.  Returns FALSE if some of the batch
+ * is left for LogThreadedDestWorker to rewind. */
+gboolean
+mongodb_bulk_complete(MongoDBBulk *self, LogThreadedDestWorker *worker)
+{
+  guint i = 0;
+
+  while (i < self->entries->len)
+    {
+      MongoDBBulkEntry *entry = &g_array_index(self->entries, MongoDBBulkEntry, i);
+      guint num_messages = 1;
+
+      if (entry->result == WORKER_INSERT_RESULT_QUEUED)
+        break;
+
+      while (i + num_messages < self->entries->len &&
+             g_array_index(self->entries, MongoDBBulkEntry, i + num_messages).result == entry->result)
+        num_messages++;
+
+      log_threaded_dest_worker_complete_batch_head(worker, num_messages, entry->result);
+      i += num_messages;
+    }
+
+  gboolean batch_completed = (i == self->entries->len);
+
+  _remember_completed(self, i);
+  mongodb_bulk_clear(self);
+  return batch_completed;
+}
+
+/* the rewound messages are not coming back, e.g. LogThreadedDestWorker
+ * drops them after retries() */
+void
+mongodb_bulk_forget_completed(MongoDBBulk *self)
+{
+  g_array_set_size(self->completed, 0);
+}
+
+void
+mongodb_bulk_clear(MongoDBBulk *self)
+{
+  for (guint i = 0; i < self->entries->len; i++)
+    {
+      MongoDBBulkEntry *entry = &g_array_index(self->entries, MongoDBBulkEntry, i);
+
+      if (entry->doc)
+        bson_destroy(entry->doc);
+    }
+  g_array_set_size(self->entries, 0);
+  g_array_set_size(self->sent, 0);
+}
+
+MongoDBBulk *
+mongodb_bulk_new(void)
+{
+  MongoDBBulk *self = g_new0(MongoDBBulk, 1);
+
+  self->entries = g_array_new(FALSE, FALSE, sizeof(MongoDBBulkEntry));
+  self->sent = g_array_new(FALSE, FALSE, sizeof(guint));
+  self->completed = g_array_new(FALSE, FALSE, sizeof(worker_insert_result_t));
+  return self;
+}
+
+void
+mongodb_bulk_free(MongoDBBulk *self)
+{
+  mongodb_bulk_clear(self);
+  g_array_free(self->completed, TRUE);
+  g_array_free(self->entries, TRUE);
+  g_array_free(self->sent, TRUE);
+  g_free(self);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef AFMONGODB_BULK_H_INCLUDED
+#define AFMONGODB_BULK_H_INCLUDED
+
+#include "syslog-ng.h"
+#include "mongoc.h"
+#include "logthrdestdrv.h"
+
+typedef struct _MongoDBBulk MongoDBBulk;
+
+MongoDBBulk *mongodb_bulk_new(void);
+void mongodb_bulk_free(MongoDBBulk *self);
+
+gboolean mongodb_bulk_add_completed(MongoDBBulk *self);
+void mongodb_bulk_add(MongoDBBulk *self, const bson_t *doc);
+guint mongodb_bulk_prepare(MongoDBBulk *self, mongoc_bulk_operation_t *bulk);
+void mongodb_bulk_set_written(MongoDBBulk *self);
+gboolean mongodb_bulk_process_write_errors(MongoDBBulk *self, const bson_t *reply, const gchar *driver_id);
+gboolean mongodb_bulk_complete(MongoDBBulk *self, LogThreadedDestWorker *worker);
+void mongodb_bulk_forget_completed(MongoDBBulk *self);
+void mongodb_bulk_clear(MongoDBBulk *self);
+
+#endif
@@ -26,6 +26,7 @@
 #include "syslog-ng.h"
 #include "mongoc.h"
 #include "logthrdestdrv.h"
+#include "afmongodb-bulk.h"
 #include "string-list.h"
 #include "value-pairs/value-pairs.h"
 
@@ -70,6 +71,9 @@ typedef struct _MongoDBDestDriver
 
   GString *current_value;
   bson_t *bson;
+
+  /* the current batch in bulk mode */
+  MongoDBBulk *bulk;
 } MongoDBDestDriver;
 
 #endif
@@ -33,6 +33,7 @@
 #include "plugin-types.h"
 
 #include <time.h>
+#include <string.h>
 
 #include "afmongodb-private.h"
 #if SYSLOG_NG_ENABLE_LEGACY_MONGODB_OPTIONS
@@ -371,16 +372,12 @@ _worker_retry_over_message(LogThreadedDestDriver *s, LogMessage *msg)
                                 LTZ_SEND, &self->template_options));
 }
 
-static worker_insert_result_t
-_worker_insert(LogThreadedDestDriver *s, LogMessage *msg)
+static gboolean
+_format_document(MongoDBDestDriver *self, LogMessage *msg)
 {
-  MongoDBDestDriver *self = (MongoDBDestDriver *)s;
   gboolean success;
   gboolean drop_silently = self->template_options.on_error & ON_ERROR_SILENT;
 
-  if (!_connect(self, TRUE))
-    return WORKER_INSERT_RESULT_NOT_CONNECTED;
-
   bson_reinit(self->bson);
 
   success = value_pairs_walk(self->vp,
@@ -401,13 +398,26 @@ _worker_insert(LogThreadedDestDriver *s, LogMessage *msg)
                                         LTZ_SEND, &self->template_options),
                     evt_tag_str("driver", self->super.super.super.id));
         }
-      return WORKER_INSERT_RESULT_DROP;
+      return FALSE;
     }
 
   msg_debug("Outgoing message to MongoDB destination",
             evt_tag_value_pairs("message", self->vp, msg, self->super.seq_num, LTZ_SEND,
                                 &self->template_options),
             evt_tag_str("driver", self->super.super.super.id));
+  return TRUE;
+}
+
+static worker_insert_result_t
+_insert_single_document(MongoDBDestDriver *self, LogMessage *msg)
+{
+  gboolean success;
+
+  if (!_connect(self, TRUE))
+    return WORKER_INSERT_RESULT_NOT_CONNECTED;
+
+  if (!_format_document(self, msg))
+    return WORKER_INSERT_RESULT_DROP;
 
   bson_error_t error;
   success = mongoc_collection_insert(self->coll_obj, MONGOC_INSERT_NONE,
@@ -435,6 +445,121 @@ _worker_insert(LogThreadedDestDriver *s, LogMessage *msg)
   return WORKER_INSERT_RESULT_SUCCESS;
 }
 
+/*
+ * Bulk mode
+ *
+ * With batch-lines() (or its alias bulk-size()) set, the documents of a
+ * batch are sent using a single unordered bulk write.  The server reports
+ * errors for each document: the ones that failed for a reason other than
+ * a transient error (e.g. duplicate key, validation) are dropped.  If any
+ * document failed with a transient error (e.g. a primary step down), the
+ * batch is retried by LogThreadedDestWorker, see afmongodb-bulk.c.
+ */
+
+static gboolean
+_is_bulk_enabled(MongoDBDestDriver *self)
+{
+  return self->super.batch_lines > 0;
+}
+
+static worker_insert_result_t
+_add_document_to_bulk(MongoDBDestDriver *self, LogMessage *msg)
+{
+  if (mongodb_bulk_add_completed(self->bulk))
+    return WORKER_INSERT_RESULT_QUEUED;
+
+  /* dropping here would drop the whole batch, the message is accounted
+   * for when the batch is flushed */
+  if (!_format_document(self, msg))
+    mongodb_bulk_add(self->bulk, NULL);
+  else
+    mongodb_bulk_add(self->bulk, self->bson);
+
+  return WORKER_INSERT_RESULT_QUEUED;
+}
+
+static worker_insert_result_t
+_map_bulk_error_to_result(MongoDBDestDriver *self, const bson_error_t *error)
+{
+  msg_error("Failed to execute bulk insert into MongoDB",
+            evt_tag_int("time_reopen", self->super.time_reopen),
+            evt_tag_str("reason", error->message),
+            evt_tag_str("driver", self->super.super.super.id));
+
+  if (error->domain == MONGOC_ERROR_STREAM)
+    return WORKER_INSERT_RESULT_NOT_CONNECTED;
+  return WORKER_INSERT_RESULT_ERROR;
+}
+
+static worker_insert_result_t
+_execute_bulk(MongoDBDestDriver *self)
+{
+  mongoc_bulk_operation_t *bulk = mongoc_collection_create_bulk_operation(self->coll_obj, FALSE, NULL);
+  worker_insert_result_t result = WORKER_INSERT_RESULT_SUCCESS;
+  bson_error_t error;
+  bson_t reply;
+
+  if (mongodb_bulk_prepare(self->bulk, bulk) == 0)
+    {
+      mongoc_bulk_operation_destroy(bulk);
+      return result;
+    }
+
+  if (mongoc_bulk_operation_execute(bulk, &reply, &error))
+    mongodb_bulk_set_written(self->bulk);
+  else if (!mongodb_bulk_process_write_errors(self->bulk, &reply, self->super.super.super.id))
+    result = _map_bulk_error_to_result(self, &error);
+
+  bson_destroy(&reply);
+  mongoc_bulk_operation_destroy(bulk);
+  return result;
+}
+
+/* LogThreadedDestWorker drops the batch instead of rewinding it, if this
+ * error is the last one retries() allows */
+static gboolean
+_is_last_retry(MongoDBDestDriver *self)
+{
+  return self->super.worker.instance.retries_counter + 1 >= self->super.retries.max;
+}
+
+static worker_insert_result_t
+_worker_flush(LogThreadedDestDriver *s)
+{
+  MongoDBDestDriver *self = (MongoDBDestDriver *)s;
+  worker_insert_result_t result;
+
+  if (!_connect(self, TRUE))
+    result = WORKER_INSERT_RESULT_NOT_CONNECTED;
+  else
+    result = _execute_bulk(self);
+
+  if (!mongodb_bulk_complete(self->bulk, &self->super.worker.instance) &&
+      result == WORKER_INSERT_RESULT_SUCCESS)
+    {
+      msg_error("Temporary failure while inserting documents into MongoDB, retrying",
+                evt_tag_int("time_reopen", self->super.time_reopen),
+                evt_tag_str("driver", self->super.super.super.id));
+      result = WORKER_INSERT_RESULT_ERROR;
+    }
+
+  if (result == WORKER_INSERT_RESULT_ERROR && _is_last_retry(self))
+    mongodb_bulk_forget_completed(self->bulk);
+
+  return result;
+}
+
+static worker_insert_result_t
+_worker_insert(LogThreadedDestDriver *s, LogMessage *msg)
+{
+  MongoDBDestDriver *self = (MongoDBDestDriver *)s;
+
+  if (_is_bulk_enabled(self))
+    return _add_document_to_bulk(self, msg);
+
+  return _insert_single_document(self, msg);
+}
+
 gboolean
 afmongodb_dd_private_uri_init(LogDriver *d)
 {
@@ -485,6 +610,7 @@ _worker_thread_init(LogThreadedDestDriver *d)
   self->current_value = g_string_sized_new(256);
 
   self->bson = bson_sized_new(4096);
+  self->bulk = mongodb_bulk_new();
 }
 
 static void
@@ -500,6 +626,9 @@ _worker_thread_deinit(LogThreadedDestDriver *d)
 
   bson_destroy(self->bson);
   self->bson = NULL;
+
+  mongodb_bulk_free(self->bulk);
+  self->bulk = NULL;
 }
 
 /*
@@ -584,6 +713,7 @@ afmongodb_dd_new(GlobalConfig *cfg)
   self->super.worker.thread_deinit = _worker_thread_deinit;
   self->super.worker.disconnect = _worker_disconnect;
   self->super.worker.insert = _worker_insert;
+  self->super.worker.flush = _worker_flush;
   self->super.format.stats_instance = _format_stats_instance;
   self->super.stats_source = SCS_MONGODB;
   self->super.messages.retry_over = _worker_retry_over_message;
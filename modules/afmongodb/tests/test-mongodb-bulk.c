@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "afmongodb-bulk.h"
+#include "logqueue-fifo.h"
+#include "apphook.h"
+#include "cfg.h"
+
+#include <criterion/criterion.h>
+
+#define NOT_MASTER "10107"
+#define DUPLICATE_KEY "11000"
+
+static GlobalConfig *cfg;
+static LogThreadedDestDriver *dd;
+static LogThreadedDestWorker *worker;
+static StatsCounterItem written_messages;
+static StatsCounterItem dropped_messages;
+static GPtrArray *acked_messages;
+
+/* the bulk operation is never executed, no connection is made */
+static mongoc_client_t *client;
+static mongoc_collection_t *collection;
+static MongoDBBulk *bulk;
+
+static void
+_test_ack(LogMessage *msg, AckType ack_type)
+{
+  g_ptr_array_add(acked_messages, msg);
+}
+
+static void
+_feed_messages(gint n)
+{
+  for (gint i = 0; i < n; i++)
+    {
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      LogMessage *msg = log_msg_new_empty();
+
+      path_options.ack_needed = TRUE;
+      path_options.flow_control_requested = TRUE;
+      log_msg_add_ack(msg, &path_options);
+      msg->ack_func = _test_ack;
+      log_queue_push_tail(worker->queue, msg, &path_options);
+    }
+}
+
+/* as LogThreadedDestWorker does while inserting a batch */
+static LogMessage *
+_pop_message(void)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg = log_queue_pop_head(worker->queue, &path_options);
+
+  cr_assert(msg != NULL);
+  worker->batch_size++;
+  /* the backlog keeps a reference */
+  log_msg_unref(msg);
+  return msg;
+}
+
+static LogMessage *
+_add_message(void)
+{
+  LogMessage *msg = _pop_message();
+  bson_t *doc = bson_new();
+
+  cr_assert_not(mongodb_bulk_add_completed(bulk));
+  mongodb_bulk_add(bulk, doc);
+  bson_destroy(doc);
+  return msg;
+}
+
+static guint
+_prepare(void)
+{
+  mongoc_bulk_operation_t *operation = mongoc_collection_create_bulk_operation(collection, FALSE, NULL);
+  guint num_documents = mongodb_bulk_prepare(bulk, operation);
+
+  mongoc_bulk_operation_destroy(operation);
+  return num_documents;
+}
+
+static gboolean
+_process_reply(const gchar *json)
+{
+  bson_error_t error;
+  bson_t *reply = bson_new_from_json((const uint8_t *) json, -1, &error);
+
+  cr_assert(reply != NULL, "invalid reply: %s", error.message);
+  gboolean result = mongodb_bulk_process_write_errors(bulk, reply, "test_mongodb");
+  bson_destroy(reply);
+  return result;
+}
+
+/* as LogThreadedDestWorker does when flush() returns with an error */
+static void
+_rewind_batch(void)
+{
+  log_queue_rewind_backlog(worker->queue, worker->batch_size);
+  worker->batch_size = 0;
+}
+
+static void
+setup(void)
+{
+  app_startup();
+  cfg = cfg_new_snippet();
+
+  memset(&written_messages, 0, sizeof(written_messages));
+  memset(&dropped_messages, 0, sizeof(dropped_messages));
+  acked_messages = g_ptr_array_new();
+
+  dd = g_new0(LogThreadedDestDriver, 1);
+  log_threaded_dest_driver_init_instance(dd, cfg);
+  dd->super.super.id = g_strdup("test_mongodb");
+  dd->written_messages = &written_messages;
+  dd->dropped_messages = &dropped_messages;
+
+  worker = g_new0(LogThreadedDestWorker, 1);
+  log_threaded_dest_worker_init_instance(worker, dd, 0);
+  worker->queue = log_queue_fifo_new(1000, NULL);
+  log_queue_set_use_backlog(worker->queue, TRUE);
+
+  mongoc_init();
+  client = mongoc_client_new("mongodb://127.0.0.1:27017/syslog");
+  collection = mongoc_client_get_collection(client, "syslog", "messages");
+  bulk = mongodb_bulk_new();
+}
+
+static void
+teardown(void)
+{
+  mongodb_bulk_free(bulk);
+  mongoc_collection_destroy(collection);
+  mongoc_client_destroy(client);
+  mongoc_cleanup();
+
+  log_queue_unref(worker->queue);
+  log_threaded_dest_worker_free(worker);
+  log_pipe_unref(&dd->super.super.super);
+  g_ptr_array_free(acked_messages, TRUE);
+  cfg_free(cfg);
+  app_shutdown();
+}
+
+TestSuite(mongodb_bulk, .init = setup, .fini = teardown);
+
+Test(mongodb_bulk, test_written_batch_is_completed)
+{
+  _feed_messages(3);
+  for (gint i = 0; i < 3; i++)
+    _add_message();
+
+  cr_assert_eq(_prepare(), 3);
+  mongodb_bulk_set_written(bulk);
+
+  cr_assert(mongodb_bulk_complete(bulk, worker));
+  cr_assert_eq(acked_messages->len, 3);
+  cr_assert_eq(stats_counter_get(&written_messages), 3);
+  cr_assert_eq(worker->batch_size, 0);
+}
+
+Test(mongodb_bulk, test_unformattable_messages_are_dropped_in_order)
+{
+  _feed_messages(3);
+  LogMessage *first = _add_message();
+  LogMessage *unformattable = _pop_message();
+  mongodb_bulk_add(bulk, NULL);
+  LogMessage *last = _add_message();
+
+  cr_assert_eq(_prepare(), 2, "the unformattable message should not be sent");
+  mongodb_bulk_set_written(bulk);
+
+  cr_assert(mongodb_bulk_complete(bulk, worker));
+  cr_assert_eq(stats_counter_get(&written_messages), 2);
+  cr_assert_eq(stats_counter_get(&dropped_messages), 1);
+  cr_assert_eq(acked_messages->len, 3);
+  cr_assert_eq(g_ptr_array_index(acked_messages, 0), first);
+  cr_assert_eq(g_ptr_array_index(acked_messages, 1), unformattable);
+  cr_assert_eq(g_ptr_array_index(acked_messages, 2), last);
+}
+
+Test(mongodb_bulk, test_permanent_write_error_drops_the_document_only)
+{
+  _feed_messages(3);
+  for (gint i = 0; i < 3; i++)
+    _add_message();
+  cr_assert_eq(_prepare(), 3);
+
+  cr_assert(_process_reply("{\"writeErrors\": [{\"index\": 1, \"code\": " DUPLICATE_KEY ", \"errmsg\": \"duplicate\"}]}"));
+
+  cr_assert(mongodb_bulk_complete(bulk, worker));
+  cr_assert_eq(stats_counter_get(&written_messages), 2);
+  cr_assert_eq(stats_counter_get(&dropped_messages), 1);
+  cr_assert_eq(worker->batch_size, 0);
+}
+
+Test(mongodb_bulk, test_failed_command_leaves_the_batch_to_the_worker)
+{
+  _feed_messages(3);
+  for (gint i = 0; i < 3; i++)
+    _add_message();
+  cr_assert_eq(_prepare(), 3);
+
+  cr_assert_not(_process_reply("{\"nInserted\": 0}"), "a reply without writeErrors is a failure of the whole command");
+
+  cr_assert_not(mongodb_bulk_complete(bulk, worker));
+  cr_assert_eq(acked_messages->len, 0);
+  cr_assert_eq(worker->batch_size, 3);
+}
+
+Test(mongodb_bulk, test_transient_write_error_is_retried_without_sending_completed_documents_again)
+{
+  _feed_messages(4);
+  LogMessage *written = _add_message();
+  for (gint i = 0; i < 3; i++)
+    _add_message();
+  cr_assert_eq(_prepare(), 4);
+
+  cr_assert(_process_reply("{\"writeErrors\": ["
+                           "{\"index\": 1, \"code\": " NOT_MASTER ", \"errmsg\": \"not master\"},"
+                           "{\"index\": 3, \"code\": " DUPLICATE_KEY ", \"errmsg\": \"duplicate\"}]}"));
+
+  cr_assert_not(mongodb_bulk_complete(bulk, worker));
+  cr_assert_eq(acked_messages->len, 1, "only the head of the batch before the transient failure can be acked");
+  cr_assert_eq(g_ptr_array_index(acked_messages, 0), written);
+  cr_assert_eq(worker->batch_size, 3);
+
+  _rewind_batch();
+
+  LogMessage *retried = _add_message();
+  _pop_message();
+  cr_assert(mongodb_bulk_add_completed(bulk), "the written document should not be sent again");
+  _pop_message();
+  cr_assert(mongodb_bulk_add_completed(bulk), "the dropped document should not be sent again");
+
+  cr_assert_eq(_prepare(), 1);
+  mongodb_bulk_set_written(bulk);
+
+  cr_assert(mongodb_bulk_complete(bulk, worker));
+  cr_assert_eq(acked_messages->len, 4);
+  cr_assert_eq(g_ptr_array_index(acked_messages, 1), retried);
+  cr_assert_eq(stats_counter_get(&written_messages), 3);
+  cr_assert_eq(stats_counter_get(&dropped_messages), 1);
+  cr_assert_eq(worker->batch_size, 0);
+}
+
+Test(mongodb_bulk, test_completed_messages_are_forgotten_if_they_do_not_come_back)
+{
+  _feed_messages(4);
+  _add_message();
+  _add_message();
+  cr_assert_eq(_prepare(), 2);
+  cr_assert(_process_reply("{\"writeErrors\": [{\"index\": 0, \"code\": " NOT_MASTER ", \"errmsg\": \"not master\"}]}"));
+  cr_assert_not(mongodb_bulk_complete(bulk, worker));
+
+  /* as if the batch was dropped after retries() */
+  mongodb_bulk_forget_completed(bulk);
+  log_queue_ack_backlog(worker->queue, worker->batch_size);
+  worker->batch_size = 0;
+
+  _add_message();
+  _pop_message();
+  cr_assert_not(mongodb_bulk_add_completed(bulk), "a new message in the position of a written one should be sent");
+}
+
+/* a reliable disk-queue reads the rewound messages again, so the retried
+ * batch consists of new LogMessage instances */
+Test(mongodb_bulk, test_rewound_messages_are_recognized_when_read_again)
+{
+  _feed_messages(3);
+  for (gint i = 0; i < 3; i++)
+    _add_message();
+  cr_assert_eq(_prepare(), 3);
+  cr_assert(_process_reply("{\"writeErrors\": [{\"index\": 0, \"code\": " NOT_MASTER ", \"errmsg\": \"not master\"}]}"));
+  cr_assert_not(mongodb_bulk_complete(bulk, worker));
+  cr_assert_eq(acked_messages->len, 0);
+
+  /* replace the rewound messages with copies */
+  _rewind_batch();
+  for (gint i = 0; i < 3; i++)
+    {
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      LogMessage *msg = log_queue_pop_head(worker->queue, &path_options);
+
+      log_queue_ack_backlog(worker->queue, 1);
+      log_msg_unref(msg);
+    }
+  g_ptr_array_set_size(acked_messages, 0);
+  _feed_messages(3);
+
+  _add_message();
+  _pop_message();
+  cr_assert(mongodb_bulk_add_completed(bulk), "the written document should not be sent again");
+  _pop_message();
+  cr_assert(mongodb_bulk_add_completed(bulk), "the written document should not be sent again");
+
+  cr_assert_eq(_prepare(), 1);
+  mongodb_bulk_set_written(bulk);
+  cr_assert(mongodb_bulk_complete(bulk, worker));
+  cr_assert_eq(acked_messages->len, 3);
+  cr_assert_eq(stats_counter_get(&written_messages), 3);
+}
+
+Test(mongodb_bulk, test_completed_messages_beyond_a_shorter_batch_are_kept)
+{
+  _feed_messages(3);
+  for (gint i = 0; i < 3; i++)
+    _add_message();
+  cr_assert_eq(_prepare(), 3);
+  cr_assert(_process_reply("{\"writeErrors\": [{\"index\": 0, \"code\": " NOT_MASTER ", \"errmsg\": \"not master\"}]}"));
+  cr_assert_not(mongodb_bulk_complete(bulk, worker));
+  _rewind_batch();
+
+  /* only the first message makes it into the next batch, and it fails again */
+  _add_message();
+  cr_assert_eq(_prepare(), 1);
+  cr_assert(_process_reply("{\"writeErrors\": [{\"index\": 0, \"code\": " NOT_MASTER ", \"errmsg\": \"not master\"}]}"));
+  cr_assert_not(mongodb_bulk_complete(bulk, worker));
+  _rewind_batch();
+
+  _add_message();
+  _pop_message();
+  cr_assert(mongodb_bulk_add_completed(bulk));
+  _pop_message();
+  cr_assert(mongodb_bulk_add_completed(bulk));
+  cr_assert_eq(_prepare(), 1);
+}
@@ -66,6 +66,7 @@ static CfgLexerKeyword afsocket_keywords[] =
   { "ip_ttl",             KW_IP_TTL },
   { "ip_tos",             KW_IP_TOS },
   { "ip_freebind",        KW_IP_FREEBIND },
+  { "so_reuseport",       KW_SO_REUSEPORT },
   { "so_broadcast",       KW_SO_BROADCAST },
   { "so_rcvbuf",          KW_SO_RCVBUF },
   { "so_sndbuf",          KW_SO_SNDBUF },
@@ -80,6 +81,7 @@ static CfgLexerKeyword afsocket_keywords[] =
   { "ip_protocol",        KW_IP_PROTOCOL },
   { "max_connections",    KW_MAX_CONNECTIONS },
   { "listen_backlog",     KW_LISTEN_BACKLOG },
+  { "listeners",          KW_LISTENERS },
   { "keep_alive",         KW_KEEP_ALIVE },
   { "systemd_syslog",     KW_SYSTEMD_SYSLOG  },
   { "failover_servers",   KW_FAILOVER_SERVERS },
@@ -48,6 +48,12 @@ typedef struct _AFSocketSourceConnection
   GSockAddr *peer_addr;
 } AFSocketSourceConnection;
 
+struct _AFSocketSourceListener
+{
+  struct iv_fd listen_fd;
+  AFSocketSourceDriver *owner;
+};
+
 static void afsocket_sd_close_connection(AFSocketSourceDriver *self, AFSocketSourceConnection *sc);
 
 static gchar *
@@ -268,6 +274,14 @@ afsocket_sd_set_listen_backlog(LogDriver *s, gint listen_backlog)
   self->listen_backlog = listen_backlog;
 }
 
+void
+afsocket_sd_set_listeners(LogDriver *s, gint listeners)
+{
+  AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
+
+  self->num_listeners = listeners;
+}
+
 static const gchar *
 afsocket_sd_format_name(const LogPipe *s)
 {
@@ -292,12 +306,16 @@ afsocket_sd_format_name(const LogPipe *s)
 }
 
 static const gchar *
-afsocket_sd_format_listener_name(const AFSocketSourceDriver *self)
+afsocket_sd_format_listener_name(const AFSocketSourceDriver *self, gint index)
 {
   static gchar persist_name[1024];
 
-  g_snprintf(persist_name, sizeof(persist_name), "%s.listen_fd",
-             afsocket_sd_format_name((const LogPipe *)self));
+  if (index == 0)
+    g_snprintf(persist_name, sizeof(persist_name), "%s.listen_fd",
+               afsocket_sd_format_name((const LogPipe *)self));
+  else
+    g_snprintf(persist_name, sizeof(persist_name), "%s.listen_fd.%d",
+               afsocket_sd_format_name((const LogPipe *)self), index);
 
   return persist_name;
 }
@@ -340,7 +358,8 @@ afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_add
 
 #endif
 
-  if (self->num_connections >= self->max_connections)
+  /* the "connections" of a dgram source are its listeners, they are not limited by max-connections() */
+  if (self->transport_mapper->sock_type == SOCK_STREAM && self->num_connections >= self->max_connections)
     {
       msg_error("Number of allowed concurrent connections reached, rejecting connection",
                 evt_tag_str("client", g_sockaddr_format(client_addr, buf, sizeof(buf), GSA_FULL)),
@@ -374,7 +393,8 @@ afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_add
 static void
 afsocket_sd_accept(gpointer s)
 {
-  AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
+  AFSocketSourceListener *listener = (AFSocketSourceListener *) s;
+  AFSocketSourceDriver *self = listener->owner;
   GSockAddr *peer_addr;
   gchar buf1[256], buf2[256];
   gint new_fd;
@@ -385,7 +405,7 @@ afsocket_sd_accept(gpointer s)
     {
       GIOStatus status;
 
-      status = g_accept(self->fd, &new_fd, &peer_addr);
+      status = g_accept(listener->listen_fd.fd, &new_fd, &peer_addr);
       if (status == G_IO_STATUS_AGAIN)
         {
           /* no more connections to accept */
@@ -453,18 +473,44 @@ afsocket_sd_close_connection(AFSocketSourceDriver *self, AFSocketSourceConnectio
 static void
 afsocket_sd_start_watches(AFSocketSourceDriver *self)
 {
-  IV_FD_INIT(&self->listen_fd);
-  self->listen_fd.fd = self->fd;
-  self->listen_fd.cookie = self;
-  self->listen_fd.handler_in = afsocket_sd_accept;
-  iv_fd_register(&self->listen_fd);
+  for (gint i = 0; i < self->num_open_listeners; i++)
+    iv_fd_register(&self->listeners[i].listen_fd);
 }
 
 static void
 afsocket_sd_stop_watches(AFSocketSourceDriver *self)
 {
-  if (iv_fd_registered (&self->listen_fd))
-    iv_fd_unregister(&self->listen_fd);
+  for (gint i = 0; i < self->num_open_listeners; i++)
+    {
+      if (iv_fd_registered(&self->listeners[i].listen_fd))
+        iv_fd_unregister(&self->listeners[i].listen_fd);
+    }
+}
+
+static void
+afsocket_sd_add_listener(AFSocketSourceDriver *self, gint fd)
+{
+  AFSocketSourceListener *listener = &self->listeners[self->num_open_listeners++];
+
+  IV_FD_INIT(&listener->listen_fd);
+  listener->listen_fd.fd = fd;
+  listener->listen_fd.cookie = listener;
+  listener->listen_fd.handler_in = afsocket_sd_accept;
+  listener->owner = self;
+}
+
+static void
+afsocket_sd_close_listeners(AFSocketSourceDriver *self)
+{
+  for (gint i = 0; i < self->num_open_listeners; i++)
+    {
+      msg_verbose("Closing listener fd",
+                  evt_tag_int("fd", self->listeners[i].listen_fd.fd));
+      close(self->listeners[i].listen_fd.fd);
+    }
+  g_free(self->listeners);
+  self->listeners = NULL;
+  self->num_open_listeners = 0;
 }
 
 static gboolean
@@ -555,19 +601,51 @@ _finalize_init(gpointer arg)
 {
   AFSocketSourceDriver *self = (AFSocketSourceDriver *)arg;
   /* set up listening source */
-  if (listen(self->fd, self->listen_backlog) < 0)
+  for (gint i = 0; i < self->num_open_listeners; i++)
     {
-      msg_error("Error during listen()",
-                evt_tag_error(EVT_TAG_OSERROR));
-      close(self->fd);
-      self->fd = -1;
-      return FALSE;
+      if (listen(self->listeners[i].listen_fd.fd, self->listen_backlog) < 0)
+        {
+          msg_error("Error during listen()",
+                    evt_tag_error(EVT_TAG_OSERROR));
+          afsocket_sd_close_listeners(self);
+          return FALSE;
+        }
     }
 
   afsocket_sd_start_watches(self);
   char buf[256];
   msg_info("Accepting connections",
-           evt_tag_str("addr", g_sockaddr_format(self->bind_addr, buf, sizeof(buf), GSA_FULL)));
+           evt_tag_str("addr", g_sockaddr_format(self->bind_addr, buf, sizeof(buf), GSA_FULL)),
+           evt_tag_int("listeners", self->num_open_listeners));
+  return TRUE;
+}
+
+/*
+ * Opens the index-th listening socket, the first one may come from the
+ * runtime environment (e.g. systemd), in which case *acquired is set to
+ * TRUE, and no further sockets should be opened.
+ */
+static gboolean
+_sd_open_listening_socket(AFSocketSourceDriver *self, gint index, gint *sock, gboolean *acquired)
+{
+  *sock = -1;
+  *acquired = FALSE;
+  if (index == 0)
+    {
+      if (!afsocket_sd_acquire_socket(self, sock))
+        return FALSE;
+      *acquired = (*sock != -1);
+    }
+
+  if (*sock == -1
+      && !transport_mapper_open_socket(self->transport_mapper, self->socket_options, self->bind_addr, AFSOCKET_DIR_RECV,
+                                       sock))
+    return FALSE;
+
+  if (*acquired && self->num_listeners > 1)
+    msg_warning("WARNING: the listening socket was acquired from the environment, listeners() is ignored",
+                evt_tag_str("id", self->super.super.id),
+                evt_tag_int("listeners", self->num_listeners));
   return TRUE;
 }
 
@@ -575,48 +653,72 @@ static gboolean
 _sd_open_stream(AFSocketSourceDriver *self)
 {
   GlobalConfig *cfg = log_pipe_get_config(&self->super.super.super);
-  gint sock = -1;
-  if (self->connections_kept_alive_across_reloads)
+
+  self->listeners = g_new0(AFSocketSourceListener, self->num_listeners);
+  for (gint i = 0; i < self->num_listeners; i++)
     {
-      /* NOTE: this assumes that fd 0 will never be used for listening fds,
-       * main.c opens fd 0 so this assumption can hold */
-      sock = GPOINTER_TO_UINT(
-               cfg_persist_config_fetch(cfg, afsocket_sd_format_listener_name(self))) -
-             1;
+      gint sock = -1;
+      gboolean acquired = FALSE;
+
+      if (self->connections_kept_alive_across_reloads)
+        {
+          /* NOTE: this assumes that fd 0 will never be used for listening fds,
+           * main.c opens fd 0 so this assumption can hold */
+          sock = GPOINTER_TO_UINT(
+                   cfg_persist_config_fetch(cfg, afsocket_sd_format_listener_name(self, i))) -
+                 1;
+        }
+
+      if (sock == -1 && !_sd_open_listening_socket(self, i, &sock, &acquired))
+        {
+          afsocket_sd_close_listeners(self);
+          return self->super.super.optional;
+        }
+      afsocket_sd_add_listener(self, sock);
+      if (acquired)
+        break;
     }
+  return transport_mapper_async_init(self->transport_mapper, _finalize_init, self);
+}
 
-  if (sock == -1)
+/* listeners() was decreased since the last reload, close the kept-alive
+ * dgram connections that are not needed anymore */
+static void
+_sd_close_extra_dgram_listeners(AFSocketSourceDriver *self)
+{
+  while (g_list_length(self->connections) > self->num_listeners)
     {
-      if (!afsocket_sd_acquire_socket(self, &sock))
-        return self->super.super.optional;
-      if (sock == -1
-          && !transport_mapper_open_socket(self->transport_mapper, self->socket_options, self->bind_addr, AFSOCKET_DIR_RECV,
-                                           &sock))
-        return self->super.super.optional;
+      AFSocketSourceConnection *sc = (AFSocketSourceConnection *) g_list_last(self->connections)->data;
+
+      log_reader_close_proto(sc->reader);
+      self->connections = g_list_remove(self->connections, sc);
+      afsocket_sd_kill_connection(sc);
+      self->num_connections--;
     }
-  self->fd = sock;
-  return transport_mapper_async_init(self->transport_mapper, _finalize_init, self);
 }
 
 static gboolean
 _sd_open_dgram(AFSocketSourceDriver *self)
 {
-  gint sock = -1;
-  if (!self->connections)
+  _sd_close_extra_dgram_listeners(self);
+
+  /* each listening socket of a dgram source is a connection with its own
+   * LogReader, kept-alive connections are reused across reloads */
+  for (gint i = g_list_length(self->connections); i < self->num_listeners; i++)
     {
-      if (!afsocket_sd_acquire_socket(self, &sock))
-        return self->super.super.optional;
-      if (sock == -1
-          && !transport_mapper_open_socket(self->transport_mapper, self->socket_options, self->bind_addr, AFSOCKET_DIR_RECV,
-                                           &sock))
+      gint sock = -1;
+      gboolean acquired = FALSE;
+
+      if (!_sd_open_listening_socket(self, i, &sock, &acquired))
         return self->super.super.optional;
+
+      if (!afsocket_sd_process_connection(self, NULL, self->bind_addr, sock))
+        return FALSE;
+      if (acquired)
+        break;
     }
-  self->fd = -1;
 
-  /* we either have self->connections != NULL, or sock contains a new fd */
-  if (self->connections || afsocket_sd_process_connection(self, NULL, self->bind_addr, sock))
-    return transport_mapper_init(self->transport_mapper);
-  return FALSE;
+  return transport_mapper_init(self->transport_mapper);
 }
 
 static gboolean
@@ -675,17 +777,19 @@ afsocket_sd_save_listener(AFSocketSourceDriver *self)
       afsocket_sd_stop_watches(self);
       if (!self->connections_kept_alive_across_reloads)
         {
-          msg_verbose("Closing listener fd",
-                      evt_tag_int("fd", self->fd));
-          close(self->fd);
+          afsocket_sd_close_listeners(self);
         }
       else
         {
           /* NOTE: the fd is incremented by one when added to persistent config
            * as persist config cannot store NULL */
 
-          cfg_persist_config_add(cfg, afsocket_sd_format_listener_name(self),
-                                 GUINT_TO_POINTER(self->fd + 1), afsocket_sd_close_fd, FALSE);
+          for (gint i = 0; i < self->num_open_listeners; i++)
+            cfg_persist_config_add(cfg, afsocket_sd_format_listener_name(self, i),
+                                   GUINT_TO_POINTER(self->listeners[i].listen_fd.fd + 1), afsocket_sd_close_fd, FALSE);
+          g_free(self->listeners);
+          self->listeners = NULL;
+          self->num_open_listeners = 0;
         }
     }
 }
@@ -767,6 +871,7 @@ afsocket_sd_init_instance(AFSocketSourceDriver *self,
   self->transport_mapper = transport_mapper;
   self->max_connections = 10;
   self->listen_backlog = 255;
+  self->num_listeners = 1;
   self->connections_kept_alive_across_reloads = TRUE;
   log_reader_options_defaults(&self->reader_options);
   self->reader_options.super.stats_level = STATS_LEVEL1;
@@ -35,6 +35,7 @@
 #define AFSOCKET_WNDSIZE_INITED      0x10000
 
 typedef struct _AFSocketSourceDriver AFSocketSourceDriver;
+typedef struct _AFSocketSourceListener AFSocketSourceListener;
 
 struct _AFSocketSourceDriver
 {
@@ -43,8 +44,11 @@ struct _AFSocketSourceDriver
           connections_kept_alive_across_reloads:1,
           require_tls:1,
           window_size_initialized:1;
-  struct iv_fd listen_fd;
-  gint fd;
+  /* listening sockets of stream based drivers, more than one when
+   * listeners() is used with so-reuseport() */
+  AFSocketSourceListener *listeners;
+  gint num_open_listeners;
+  gint num_listeners;
   LogReaderOptions reader_options;
   LogProtoServerFactory *proto_factory;
   GSockAddr *bind_addr;
@@ -74,6 +78,7 @@ struct _AFSocketSourceDriver
 void afsocket_sd_set_keep_alive(LogDriver *self, gint enable);
 void afsocket_sd_set_max_connections(LogDriver *self, gint max_connections);
 void afsocket_sd_set_listen_backlog(LogDriver *self, gint listen_backlog);
+void afsocket_sd_set_listeners(LogDriver *self, gint listeners);
 
 static inline gboolean
 afsocket_sd_acquire_socket(AFSocketSourceDriver *s, gint *fd)
@@ -49,6 +49,20 @@ socket_options_inet_setup_socket(SocketOptions *s, gint fd, GSockAddr *addr, AFS
   if (!socket_options_setup_socket_method(s, fd, addr, dir))
     return FALSE;
 
+  if (self->so_reuseport && (dir & AFSOCKET_DIR_RECV))
+    {
+#ifdef SO_REUSEPORT
+      if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+        {
+          msg_error("Error setting SO_REUSEPORT on the listening socket",
+                    evt_tag_error(EVT_TAG_OSERROR));
+          return FALSE;
+        }
+#else
+      msg_error("so-reuseport() is set but no SO_REUSEPORT setsockopt on this platform");
+      return FALSE;
+#endif
+    }
   if (self->tcp_keepalive_time > 0)
     {
 #ifdef TCP_KEEPIDLE
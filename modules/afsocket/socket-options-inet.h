@@ -32,6 +32,7 @@ typedef struct _SocketOptionsInet
   gint ip_ttl;
   gint ip_tos;
   gboolean ip_freebind;
+  gboolean so_reuseport;
   gint tcp_keepalive_time;
   gint tcp_keepalive_intvl;
   gint tcp_keepalive_probes;
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "afinet-source.h"
+#include "socket-options-inet.h"
+#include "cfg.h"
+#include "cfg-grammar.h"
+#include "apphook.h"
+#include "plugin.h"
+#include "gsockaddr.h"
+#include "config_parse_lib.h"
+
+#include <criterion/criterion.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TEST_PORT "47514"
+
+static void
+_init(void)
+{
+  app_startup();
+  configuration = cfg_new_snippet();
+  cr_assert(cfg_load_module(configuration, "afsocket"));
+  cr_assert(cfg_load_module(configuration, "syslogformat"));
+}
+
+static void
+_deinit(void)
+{
+  cfg_deinit(configuration);
+  cfg_free(configuration);
+  app_shutdown();
+}
+
+static AFInetSourceDriver *
+_parse_source(const gchar *source)
+{
+  gchar *raw_config = g_strdup_printf("source s_test { %s; }; log { source(s_test); };", source);
+
+  cr_assert(parse_config(raw_config, LL_CONTEXT_ROOT, NULL, NULL), "Parsing the given configuration failed: %s",
+            raw_config);
+  g_free(raw_config);
+
+  LogExprNode *expr_node = cfg_tree_get_object(&configuration->tree, ENC_SOURCE, "s_test");
+  cr_assert(expr_node != NULL);
+  AFInetSourceDriver *driver = (AFInetSourceDriver *) expr_node->children->children->object;
+  cr_assert(driver != NULL);
+  return driver;
+}
+
+TestSuite(afinet_source, .init = _init, .fini = _deinit);
+
+Test(afinet_source, test_listeners_and_so_reuseport_are_parsed)
+{
+  AFInetSourceDriver *driver = _parse_source("udp(ip(127.0.0.1) port(" TEST_PORT ") so-reuseport(yes) listeners(4))");
+  SocketOptionsInet *socket_options = (SocketOptionsInet *) driver->super.socket_options;
+
+  cr_assert_eq(driver->super.num_listeners, 4);
+  cr_assert(socket_options->so_reuseport);
+}
+
+Test(afinet_source, test_listeners_default_to_a_single_socket_without_so_reuseport)
+{
+  AFInetSourceDriver *driver = _parse_source("udp(ip(127.0.0.1) port(" TEST_PORT "))");
+  SocketOptionsInet *socket_options = (SocketOptionsInet *) driver->super.socket_options;
+
+  cr_assert_eq(driver->super.num_listeners, 1);
+  cr_assert_not(socket_options->so_reuseport);
+}
+
+Test(afinet_source, test_multiple_listeners_require_so_reuseport)
+{
+  _parse_source("udp(ip(127.0.0.1) port(" TEST_PORT ") listeners(2))");
+
+  cr_assert_not(cfg_init(configuration));
+}
+
+/* without SO_REUSEPORT only the first socket could bind the port, so
+ * having all listeners open means the option was applied to each of them */
+Test(afinet_source, test_dgram_listeners_bind_the_same_port)
+{
+  AFInetSourceDriver *driver = _parse_source("udp(ip(127.0.0.1) port(" TEST_PORT ") so-reuseport(yes) listeners(3))");
+
+  cr_assert(cfg_init(configuration), "Config initialization failed");
+  cr_assert_eq(g_list_length(driver->super.connections), 3,
+               "each dgram listener should be a connection with its own reader");
+}
+
+Test(afinet_source, test_reload_with_less_dgram_listeners_closes_the_extra_ones)
+{
+  AFInetSourceDriver *driver = _parse_source("udp(ip(127.0.0.1) port(" TEST_PORT ") so-reuseport(yes) listeners(3))");
+
+  cr_assert(cfg_init(configuration), "Config initialization failed");
+  cr_assert_eq(g_list_length(driver->super.connections), 3);
+
+  /* reload, as the main loop does: the connections are kept alive in the
+   * persist config of the old configuration */
+  GlobalConfig *old_config = configuration;
+  old_config->persist = persist_config_new();
+  cfg_deinit(old_config);
+
+  configuration = cfg_new_snippet();
+  cr_assert(cfg_load_module(configuration, "afsocket"));
+  cr_assert(cfg_load_module(configuration, "syslogformat"));
+  cfg_persist_config_move(old_config, configuration);
+
+  driver = _parse_source("udp(ip(127.0.0.1) port(" TEST_PORT ") so-reuseport(yes) listeners(1))");
+  cr_assert(cfg_init(configuration), "Config initialization failed");
+  cfg_free(old_config);
+  cr_assert_eq(g_list_length(driver->super.connections), 1);
+  cr_assert_eq(driver->super.num_connections, 1);
+
+  persist_config_free(configuration->persist);
+  configuration->persist = NULL;
+}
+
+Test(afinet_source, test_stream_listeners_bind_the_same_port)
+{
+  AFInetSourceDriver *driver = _parse_source("tcp(ip(127.0.0.1) port(" TEST_PORT ") so-reuseport(yes) listeners(2))");
+
+  cr_assert(cfg_init(configuration), "Config initialization failed");
+  cr_assert_eq(driver->super.num_open_listeners, 2);
+}
+
+Test(afinet_source, test_so_reuseport_is_set_on_receiving_sockets)
+{
+  SocketOptionsInet *socket_options = socket_options_inet_new_instance();
+  GSockAddr *addr = g_sockaddr_inet_new("127.0.0.1", 0);
+  gint fd = socket(AF_INET, SOCK_DGRAM, 0);
+  gint value = 0;
+  socklen_t value_len = sizeof(value);
+
+  socket_options->so_reuseport = TRUE;
+  cr_assert(socket_options_setup_socket(&socket_options->super, fd, addr, AFSOCKET_DIR_RECV));
+  cr_assert_eq(getsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &value, &value_len), 0);
+  cr_assert_neq(value, 0);
+
+  close(fd);
+  g_sockaddr_unref(addr);
+  socket_options_free(&socket_options->super);
+}
@@ -271,6 +271,13 @@ afsql_dd_run_query(AFSqlDestDriver *self, const gchar *query, gboolean silent, d
   return TRUE;
 }
 
+static void
+afsql_dd_discard_batch(AFSqlDestDriver *self)
+{
+  g_string_truncate(self->batch_insert, 0);
+  self->batch_rows = 0;
+}
+
 /**
  * afsql_dd_handle_transaction_error:
  *
@@ -283,6 +290,32 @@ afsql_dd_handle_transaction_error(AFSqlDestDriver *self)
 {
   log_queue_rewind_backlog_all(self->queue);
   self->flush_lines_queued = 0;
+  afsql_dd_discard_batch(self);
+}
+
+/**
+ * afsql_dd_flush_batch:
+ *
+ * Run the pending multi-row INSERT statement. If it fails, the rows of the
+ * rewound transaction are inserted one by one, so that a single bad row
+ * is retried and dropped on its own instead of failing every batch.
+ *
+ * NOTE: This function can only be called from the database thread.
+ **/
+static gboolean
+afsql_dd_flush_batch(AFSqlDestDriver *self)
+{
+  gboolean success;
+
+  if (self->batch_rows == 0)
+    return TRUE;
+
+  success = afsql_dd_run_query(self, self->batch_insert->str, FALSE, NULL);
+  if (!success)
+    self->batch_fallback_rows = self->flush_lines;
+
+  afsql_dd_discard_batch(self);
+  return success;
 }
 
 /**
@@ -300,7 +333,7 @@ afsql_dd_commit_transaction(AFSqlDestDriver *self)
   if (!self->transaction_active)
     return TRUE;
 
-  success = afsql_dd_run_query(self, "COMMIT", FALSE, NULL);
+  success = afsql_dd_flush_batch(self) && afsql_dd_run_query(self, "COMMIT", FALSE, NULL);
   if (success)
     {
       log_queue_ack_backlog(self->queue, self->flush_lines_queued);
@@ -351,6 +384,7 @@ afsql_dd_rollback_transaction(AFSqlDestDriver *self)
     return TRUE;
 
   self->transaction_active = FALSE;
+  afsql_dd_discard_batch(self);
 
   return afsql_dd_run_query(self, "ROLLBACK", FALSE, NULL);
 }
@@ -793,14 +827,12 @@ afsql_dd_ensure_accessible_database_table(AFSqlDestDriver *self, LogMessage *msg
   return table;
 }
 
-static GString *
-afsql_dd_build_insert_command(AFSqlDestDriver *self, LogMessage *msg, GString *table)
+static void
+afsql_dd_append_insert_header(AFSqlDestDriver *self, GString *table, GString *insert_command)
 {
-  GString *insert_command = g_string_sized_new(256);
-  GString *value = g_string_sized_new(512);
   gint i, j;
 
-  g_string_printf(insert_command, "INSERT INTO %s (", table->str);
+  g_string_append_printf(insert_command, "INSERT INTO %s (", table->str);
 
   for (i = 0; i < self->fields_len; i++)
     {
@@ -817,7 +849,15 @@ afsql_dd_build_insert_command(AFSqlDestDriver *self, LogMessage *msg, GString *t
         }
     }
 
-  g_string_append(insert_command, ") VALUES (");
+  g_string_append(insert_command, ") VALUES ");
+}
+
+static void
+afsql_dd_append_insert_values(AFSqlDestDriver *self, LogMessage *msg, GString *insert_command, GString *value)
+{
+  gint i, j;
+
+  g_string_append_c(insert_command, '(');
 
   for (i = 0; i < self->fields_len; i++)
     {
@@ -852,13 +892,67 @@ afsql_dd_build_insert_command(AFSqlDestDriver *self, LogMessage *msg, GString *t
         }
     }
 
-  g_string_append(insert_command, ")");
+  g_string_append_c(insert_command, ')');
+}
+
+static GString *
+afsql_dd_build_insert_command(AFSqlDestDriver *self, LogMessage *msg, GString *table)
+{
+  GString *insert_command = g_string_sized_new(256);
+  GString *value = g_string_sized_new(512);
+
+  afsql_dd_append_insert_header(self, table, insert_command);
+  afsql_dd_append_insert_values(self, msg, insert_command, value);
 
   g_string_free(value, TRUE);
 
   return insert_command;
 }
 
+static inline gboolean
+afsql_dd_is_batching_active(const AFSqlDestDriver *self)
+{
+  return (self->flags & AFSQL_DDF_MULTI_ROW_INSERTS) && self->batch_fallback_rows == 0;
+}
+
+/**
+ * afsql_dd_add_row_to_batch:
+ *
+ * Append the row of a message to the pending multi-row INSERT statement.
+ * The statement is run when the transaction is committed, when it reaches
+ * batch_max_rows or when the next row goes to a different table.
+ *
+ * NOTE: This function can only be called from the database thread.
+ **/
+static gboolean
+afsql_dd_add_row_to_batch(AFSqlDestDriver *self, LogMessage *msg, GString *table)
+{
+  if (self->batch_rows > 0 &&
+      (self->batch_rows >= self->batch_max_rows || strcmp(self->batch_table->str, table->str) != 0))
+    {
+      if (!afsql_dd_flush_batch(self))
+        {
+          afsql_dd_handle_transaction_error(self);
+          afsql_dd_rollback_transaction(self);
+          return FALSE;
+        }
+    }
+
+  if (self->batch_rows == 0)
+    {
+      g_string_assign(self->batch_table, table->str);
+      afsql_dd_append_insert_header(self, table, self->batch_insert);
+    }
+  else
+    {
+      g_string_append(self->batch_insert, ", ");
+    }
+
+  afsql_dd_append_insert_values(self, msg, self->batch_insert, self->batch_value);
+  self->batch_rows++;
+  return TRUE;
+}
+
 static inline gboolean
 afsql_dd_is_transaction_handling_enabled(const AFSqlDestDriver *self)
 {
@@ -964,8 +1058,18 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
       goto out;
     }
 
-  insert_command = afsql_dd_build_insert_command(self, msg, table);
-  success = afsql_dd_run_query(self, insert_command->str, FALSE, NULL);
+  if (afsql_dd_is_batching_active(self))
+    {
+      success = afsql_dd_add_row_to_batch(self, msg, table);
+    }
+  else
+    {
+      if (self->batch_fallback_rows > 0)
+        self->batch_fallback_rows--;
+
+      insert_command = afsql_dd_build_insert_command(self, msg, table);
+      success = afsql_dd_run_query(self, insert_command->str, FALSE, NULL);
+    }
 
   if (success && self->flush_lines_queued != -1)
     {
@@ -975,10 +1079,6 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
         {
           /* Assuming that in case of error, the queue is rewound by afsql_dd_commit_transaction() */
           afsql_dd_rollback_transaction(self);
-
-          g_string_free(insert_command, TRUE);
-          msg_set_context(NULL);
-
           success = FALSE;
         }
     }
@@ -1309,6 +1409,30 @@ afsql_dd_init(LogPipe *s)
   if ((self->flags & AFSQL_DDF_EXPLICIT_COMMITS) && (self->flush_lines > 0 || self->flush_timeout > 0))
     self->flush_lines_queued = 0;
 
+  if (self->flags & AFSQL_DDF_MULTI_ROW_INSERTS)
+    {
+      if (!(self->flags & AFSQL_DDF_EXPLICIT_COMMITS) || self->flush_lines < 2)
+        {
+          msg_warning("WARNING: flags(multi-row-inserts) requires flags(explicit-commits) and flush-lines() greater than 1, inserting rows one by one",
+                      evt_tag_str("type", self->type),
+                      evt_tag_int("flush_lines", self->flush_lines));
+          self->flags &= ~AFSQL_DDF_MULTI_ROW_INSERTS;
+        }
+      else if (strcmp(self->type, s_oracle) == 0)
+        {
+          msg_warning("WARNING: flags(multi-row-inserts) was skipped because Oracle does not support multi-row INSERT statements",
+                      evt_tag_str("type", self->type));
+          self->flags &= ~AFSQL_DDF_MULTI_ROW_INSERTS;
+        }
+      else
+        {
+          self->batch_max_rows = self->flush_lines;
+          /* SQL Server accepts at most 1000 rows in a VALUES list */
+          if (strcmp(self->type, s_freetds) == 0)
+            self->batch_max_rows = MIN(self->batch_max_rows, 1000);
+        }
+    }
+
   if (!dbi_initialized)
     {
       errno = 0;
@@ -1423,6 +1547,9 @@ afsql_dd_free(LogPipe *s)
   g_hash_table_destroy(self->syslogng_conform_tables);
   g_hash_table_destroy(self->dbd_options);
   g_hash_table_destroy(self->dbd_options_numeric);
+  g_string_free(self->batch_insert, TRUE);
+  g_string_free(self->batch_table, TRUE);
+  g_string_free(self->batch_value, TRUE);
   if (self->session_statements)
     string_list_free(self->session_statements);
   g_mutex_free(self->db_thread_mutex);
@@ -1467,6 +1594,10 @@ afsql_dd_new(GlobalConfig *cfg)
   self->dbd_options = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
   self->dbd_options_numeric = g_hash_table_new_full(g_str_hash, g_int_equal, g_free, NULL);
 
+  self->batch_insert = g_string_sized_new(4096);
+  self->batch_table = g_string_sized_new(32);
+  self->batch_value = g_string_sized_new(512);
+
   log_template_options_defaults(&self->template_options);
 
   self->db_thread_wakeup_cond = g_cond_new();
@@ -1483,6 +1614,8 @@ afsql_dd_lookup_flag(const gchar *flag)
     return AFSQL_DDF_EXPLICIT_COMMITS;
   else if (strcmp(flag, "dont-create-tables") == 0)
     return AFSQL_DDF_DONT_CREATE_TABLES;
+  else if (strcmp(flag, "multi-row-inserts") == 0)
+    return AFSQL_DDF_MULTI_ROW_INSERTS;
   else
     msg_warning("Unknown SQL flag",
                 evt_tag_str("flag", flag));
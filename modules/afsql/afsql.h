@@ -46,6 +46,7 @@ enum
 {
   AFSQL_DDF_EXPLICIT_COMMITS = 0x0001,
   AFSQL_DDF_DONT_CREATE_TABLES = 0x0002,
+  AFSQL_DDF_MULTI_ROW_INSERTS = 0x0004,
 };
 
 typedef struct _AFSqlField
@@ -118,6 +119,14 @@ typedef struct _AFSqlDestDriver
   guint32 failed_message_counter;
   WorkerOptions worker_options;
   gboolean transaction_active;
+  /* multi-row INSERT statement being built, see afsql_dd_add_row_to_batch() */
+  GString *batch_insert;
+  GString *batch_table;
+  GString *batch_value;
+  gint batch_rows;
+  gint batch_max_rows;
+  /* number of rows to insert one by one after a failed multi-row INSERT */
+  gint batch_fallback_rows;
 } AFSqlDestDriver;
 
 
@@ -21,6 +21,8 @@
  *
  */
 
+#include "scratch-buffers.h"
+
 typedef gboolean (*AggregateFunc)(gpointer, gint64);
 
 static gboolean
@@ -134,24 +136,16 @@ tf_num_mod(LogMessage *msg, gint argc, GString *argv[], GString *result)
 TEMPLATE_FUNCTION_SIMPLE(tf_num_mod);
 
 
-static GString *
-_get_gstring_scratch_buffer(const LogTemplateInvokeArgs *args,
-                            gsize initial_capacity)
-{
-  if (args->bufs->len == 0)
-    g_ptr_array_add(args->bufs, g_string_sized_new(initial_capacity));
-
-  return (GString *) g_ptr_array_index(args->bufs, 0);
-}
-
 static gboolean
 _tf_num_parse_arg_with_message(const TFSimpleFuncState *state,
                                LogMessage *message,
                                const LogTemplateInvokeArgs *args,
                                gint64 *number)
 {
-  GString *formatted_template = _get_gstring_scratch_buffer(args, 64);
+  ScratchBuffersMarker mark;
+  GString *formatted_template = scratch_buffers_alloc_and_mark(&mark);
   gint on_error = args->opts->on_error;
+  gboolean success = TRUE;
 
   log_template_format(state->argv[0], message, args->opts, args->tz,
                       args->seq_num, args->context_id, formatted_template);
@@ -161,10 +155,11 @@ _tf_num_parse_arg_with_message(const TFSimpleFuncState *state,
       if (!(on_error & ON_ERROR_SILENT))
         msg_error("Parsing failed, template function's argument is not a number",
                   evt_tag_str("arg", formatted_template->str));
-      return FALSE;
+      success = FALSE;
     }
 
-  return TRUE;
+  scratch_buffers_reclaim_marked(mark);
+  return success;
 }
 
 static gboolean
@@ -27,16 +27,60 @@
 #include "messages.h"
 #include "str-utils.h"
 #include "filter/filter-expr.h"
+#include "atomic-gssize.h"
 #include <iv.h>
 
-typedef struct _GroupingBy
+/* number of independently locked partitions of the grouping-by() state */
+#define GROUPING_BY_STATE_SHARDS 16
+
+typedef struct _GroupingBy GroupingBy;
+
+/*
+ * The grouping-by() state is partitioned into shards by the hash of the
+ * correllation key, each shard having its own lock and timer wheel, so
+ * that messages belonging to unrelated contexts can be aggregated in
+ * parallel.
+ *
+ * Contexts that are closed (either because trigger() evaluated to TRUE or
+ * because they timed out) are removed from their shard while its lock is
+ * held, but having() is evaluated and the synthetic message is emitted only
+ * after the lock is released.  The current time is stored in GroupingBy
+ * and the timer wheel of a shard is moved forward to that value whenever
+ * the shard is locked.
+ */
+typedef struct _GroupingByShard
 {
-  StatefulParser super;
   GStaticMutex lock;
-  struct iv_timer tick;
+  GroupingBy *owner;
+  CorrellationState *correllation;
   TimerWheel *timer_wheel;
+
+  /* contexts closed while the lock is held, emitted by the caller once the
+   * lock is released.  Only valid with the shard lock held. */
+  GPtrArray *closed_contexts;
+} GroupingByShard;
+
+/* the part of the state that is kept across reloads.  Timers belong to
+ * the timer wheels of a GroupingBy instance, the contexts are rescheduled
+ * by the new instance, relative to the saved current time. */
+typedef struct _GroupingByPersistState
+{
+  CorrellationState *correllation[GROUPING_BY_STATE_SHARDS];
+  guint64 now;
+} GroupingByPersistState;
+
+struct _GroupingBy
+{
+  StatefulParser super;
+  GroupingByShard shards[GROUPING_BY_STATE_SHARDS];
+  GroupingByPersistState *persist_state;
+
+  /* protects last_tick and updates of now */
+  GStaticMutex time_lock;
+  atomic_gssize now;
   GTimeVal last_tick;
-  CorrellationState *correllation;
+
+  struct iv_timer tick;
   LogTemplate *key_template;
   gint timeout;
   CorrellationScope scope;
@@ -44,7 +88,7 @@ typedef struct _GroupingBy
   FilterExprNode *trigger_condition_expr;
   FilterExprNode *where_condition_expr;
   FilterExprNode *having_condition_expr;
-} GroupingBy;
+};
 
 static NVHandle context_id_handle = 0;
 
@@ -107,11 +151,54 @@ grouping_by_set_synthetic_message(LogParser *s, SyntheticMessage *message)
   self->synthetic_message = message;
 }
 
-/* NOTE: lock should be acquired for writing before calling this function. */
-void
-grouping_by_set_time(GroupingBy *self, const LogStamp *ls)
+static inline guint64
+_get_time(GroupingBy *self)
+{
+  return (guint64) atomic_gssize_get(&self->now);
+}
+
+static inline GroupingByShard *
+_get_shard(GroupingBy *self, CorrellationKey *key)
+{
+  return &self->shards[correllation_key_hash(key) % GROUPING_BY_STATE_SHARDS];
+}
+
+/* NOTE: moving the timer wheel forward may expire contexts, these are
+ * collected in closed_contexts and should be emitted using
+ * _emit_closed_contexts() after the lock is released. */
+static void
+_lock_shard(GroupingBy *self, GroupingByShard *shard, GPtrArray *closed_contexts)
+{
+  g_static_mutex_lock(&shard->lock);
+  shard->closed_contexts = closed_contexts;
+  timer_wheel_set_time(shard->timer_wheel, _get_time(self));
+}
+
+static void
+_unlock_shard(GroupingByShard *shard)
+{
+  shard->closed_contexts = NULL;
+  g_static_mutex_unlock(&shard->lock);
+}
+
+static void
+_advance_shards(GroupingBy *self, GPtrArray *closed_contexts)
+{
+  for (gint i = 0; i < GROUPING_BY_STATE_SHARDS; i++)
+    {
+      _lock_shard(self, &self->shards[i], closed_contexts);
+      _unlock_shard(&self->shards[i]);
+    }
+}
+
+static void _emit_closed_contexts(GroupingBy *self, GPtrArray *closed_contexts);
+
+/* NOTE: must be called without shard locks held. */
+static void
+_advance_time_based_on_message(GroupingBy *self, const LogStamp *ls, GPtrArray *closed_contexts)
 {
   GTimeVal now;
+  gboolean advanced = FALSE;
   gchar buf[256];
 
   /* clamp the current time between the timestamp of the current message
@@ -119,19 +206,32 @@ grouping_by_set_time(GroupingBy *self, const LogStamp *ls)
    * that incorrect clocks do not skew the current time know by the
    * correllation engine too much. */
 
+  g_static_mutex_lock(&self->time_lock);
   cached_g_current_time(&now);
   self->last_tick = now;
 
   if (ls->tv_sec < now.tv_sec)
     now.tv_sec = ls->tv_sec;
 
-  timer_wheel_set_time(self->timer_wheel, now.tv_sec);
-  msg_debug("Advancing grouping-by() current time because of an incoming message",
-            evt_tag_long("utc", timer_wheel_get_time(self->timer_wheel)),
-            evt_tag_str("location",
-                        log_expr_node_format_location(self->super.super.super.expr_node,
-                                                      buf, sizeof(buf))));
+  /* time is not allowed to go backwards */
+  if (now.tv_sec > _get_time(self))
+    {
+      atomic_gssize_set(&self->now, now.tv_sec);
+      advanced = TRUE;
+    }
+  g_static_mutex_unlock(&self->time_lock);
 
+  /* the time advances at most once per second, move all shards forward,
+   * so that contexts in idle shards expire in time too */
+  if (advanced)
+    {
+      _advance_shards(self, closed_contexts);
+      msg_debug("Advancing grouping-by() current time because of an incoming message",
+                evt_tag_long("utc", _get_time(self)),
+                evt_tag_str("location",
+                            log_expr_node_format_location(self->super.super.super.expr_node,
+                                                          buf, sizeof(buf))));
+    }
 }
 
 /*
@@ -147,9 +247,10 @@ _grouping_by_timer_tick(GroupingBy *self)
 {
   GTimeVal now;
   glong diff;
+  gboolean advanced = FALSE;
   gchar buf[256];
 
-  g_static_mutex_lock(&self->lock);
+  g_static_mutex_lock(&self->time_lock);
   cached_g_current_time(&now);
   diff = g_time_val_diff(&now, &self->last_tick);
 
@@ -157,12 +258,8 @@ _grouping_by_timer_tick(GroupingBy *self)
     {
       glong diff_sec = (glong)(diff / 1e6);
 
-      timer_wheel_set_time(self->timer_wheel, timer_wheel_get_time(self->timer_wheel) + diff_sec);
-      msg_debug("Advancing grouping-by() current time because of timer tick",
-                evt_tag_long("utc", timer_wheel_get_time(self->timer_wheel)),
-                evt_tag_str("location",
-                            log_expr_node_format_location(self->super.super.super.expr_node,
-                                                          buf, sizeof(buf))));
+      atomic_gssize_set(&self->now, _get_time(self) + diff_sec);
+      advanced = TRUE;
       /* update last_tick, take the fraction of the seconds not calculated into this update into account */
 
       self->last_tick = now;
@@ -176,7 +273,20 @@ _grouping_by_timer_tick(GroupingBy *self)
        */
       self->last_tick = now;
     }
-  g_static_mutex_unlock(&self->lock);
+  g_static_mutex_unlock(&self->time_lock);
+
+  if (advanced)
+    {
+      GPtrArray *closed_contexts = g_ptr_array_new();
+
+      msg_debug("Advancing grouping-by() current time because of timer tick",
+                evt_tag_long("utc", _get_time(self)),
+                evt_tag_str("location",
+                            log_expr_node_format_location(self->super.super.super.expr_node,
+                                                          buf, sizeof(buf))));
+      _advance_shards(self, closed_contexts);
+      _emit_closed_contexts(self, closed_contexts);
+    }
 }
 
 static void
@@ -243,11 +353,35 @@ grouping_by_emit_synthetic(GroupingBy *self, CorrellationContext *context)
     }
 }
 
+/* NOTE: the shard lock must be held.  The context is only removed from the
+ * state here, having() is evaluated by _emit_closed_contexts() once the
+ * lock is released. */
+static void
+_close_context(GroupingByShard *shard, CorrellationContext *context)
+{
+  g_ptr_array_add(shard->closed_contexts, correllation_context_ref(context));
+  g_hash_table_remove(shard->correllation->state, &context->key);
+}
+
+static void
+_emit_closed_contexts(GroupingBy *self, GPtrArray *closed_contexts)
+{
+  for (guint i = 0; i < closed_contexts->len; i++)
+    {
+      CorrellationContext *context = (CorrellationContext *) g_ptr_array_index(closed_contexts, i);
+
+      grouping_by_emit_synthetic(self, context);
+      correllation_context_unref(context);
+    }
+  g_ptr_array_free(closed_contexts, TRUE);
+}
+
 static void
 grouping_by_expire_entry(TimerWheel *wheel, guint64 now, gpointer user_data)
 {
   CorrellationContext *context = user_data;
-  GroupingBy *self = (GroupingBy *) timer_wheel_get_associated_data(wheel);
+  GroupingByShard *shard = (GroupingByShard *) timer_wheel_get_associated_data(wheel);
+  GroupingBy *self = shard->owner;
   gchar buf[256];
 
   msg_debug("Expiring grouping-by() correllation context",
@@ -256,8 +390,7 @@ grouping_by_expire_entry(TimerWheel *wheel, guint64 now, gpointer user_data)
             evt_tag_str("location",
                         log_expr_node_format_location(self->super.super.super.expr_node,
                                                       buf, sizeof(buf))));
-  grouping_by_emit_synthetic(self, context);
-  g_hash_table_remove(self->correllation->state, &context->key);
+  _close_context(shard, context);
 
   /* correllation_context_free is automatically called when returning from
      this function by the timerwheel code as a destroy notify
@@ -274,89 +407,141 @@ grouping_by_format_persist_name(GroupingBy *self)
   return persist_name;
 }
 
+static GroupingByPersistState *
+_persist_state_new(void)
+{
+  GroupingByPersistState *self = g_new0(GroupingByPersistState, 1);
+
+  for (gint i = 0; i < GROUPING_BY_STATE_SHARDS; i++)
+    self->correllation[i] = correllation_state_new();
+  return self;
+}
+
+static void
+_persist_state_free(GroupingByPersistState *self)
+{
+  for (gint i = 0; i < GROUPING_BY_STATE_SHARDS; i++)
+    correllation_state_free(self->correllation[i]);
+  g_free(self);
+}
+
+/* NOTE: called from init(), the contexts restored from the persisted state
+ * get a full timeout() in the timer wheel of the new instance */
+static void
+_schedule_restored_contexts(GroupingBy *self, GroupingByShard *shard)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  timer_wheel_set_time(shard->timer_wheel, _get_time(self));
+  g_hash_table_iter_init(&iter, shard->correllation->state);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+      CorrellationContext *context = (CorrellationContext *) value;
+
+      context->timer = timer_wheel_add_timer(shard->timer_wheel, self->timeout, grouping_by_expire_entry,
+                                             correllation_context_ref(context), (GDestroyNotify) correllation_context_unref);
+    }
+}
+
+/* NOTE: called from deinit(), the timer wheel goes away with this instance */
+static void
+_unschedule_contexts(GroupingByShard *shard)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init(&iter, shard->correllation->state);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+      CorrellationContext *context = (CorrellationContext *) value;
+
+      if (context->timer)
+        timer_wheel_del_timer(shard->timer_wheel, context->timer);
+      context->timer = NULL;
+    }
+}
+
 static gboolean
 _perform_groupby(GroupingBy *self, LogMessage *msg)
 {
   GString *buffer = g_string_sized_new(32);
+  GPtrArray *closed_contexts = g_ptr_array_new();
   CorrellationContext *context = NULL;
+  GroupingByShard *shard;
+  CorrellationKey key;
   gchar buf[256];
 
-  g_static_mutex_lock(&self->lock);
-  grouping_by_set_time(self, &msg->timestamps[LM_TS_STAMP]);
-  if (self->key_template)
-    {
-      CorrellationKey key;
+  _advance_time_based_on_message(self, &msg->timestamps[LM_TS_STAMP], closed_contexts);
 
-      log_template_format(self->key_template, msg, NULL, LTZ_LOCAL, 0, NULL, buffer);
-      log_msg_set_value(msg, context_id_handle, buffer->str, -1);
+  /* the key only depends on the message, format it before taking the lock */
+  log_template_format(self->key_template, msg, NULL, LTZ_LOCAL, 0, NULL, buffer);
+  log_msg_set_value(msg, context_id_handle, buffer->str, -1);
+  correllation_key_setup(&key, self->scope, msg, buffer->str);
 
-      correllation_key_setup(&key, self->scope, msg, buffer->str);
-      context = g_hash_table_lookup(self->correllation->state, &key);
-      if (!context)
-        {
-          msg_debug("Correllation context lookup failure, starting a new context",
-                    evt_tag_str("key", buffer->str),
-                    evt_tag_int("timeout", self->timeout),
-                    evt_tag_int("expiration", timer_wheel_get_time(self->timer_wheel) + self->timeout),
-                    evt_tag_str("location",
-                                log_expr_node_format_location(self->super.super.super.expr_node,
-                                                              buf, sizeof(buf))));
-          context = correllation_context_new(&key);
-          g_hash_table_insert(self->correllation->state, &context->key, context);
-          g_string_steal(buffer);
-        }
-      else
-        {
-          msg_debug("Correllation context lookup successful",
-                    evt_tag_str("key", buffer->str),
-                    evt_tag_int("timeout", self->timeout),
-                    evt_tag_int("expiration", timer_wheel_get_time(self->timer_wheel) + self->timeout),
-                    evt_tag_int("num_messages", context->messages->len),
-                    evt_tag_str("location",
-                                log_expr_node_format_location(self->super.super.super.expr_node,
-                                                              buf, sizeof(buf))));
-        }
+  shard = _get_shard(self, &key);
+  _lock_shard(self, shard, closed_contexts);
+  context = g_hash_table_lookup(shard->correllation->state, &key);
+  if (!context)
+    {
+      msg_debug("Correllation context lookup failure, starting a new context",
+                evt_tag_str("key", buffer->str),
+                evt_tag_int("timeout", self->timeout),
+                evt_tag_int("expiration", timer_wheel_get_time(shard->timer_wheel) + self->timeout),
+                evt_tag_str("location",
+                            log_expr_node_format_location(self->super.super.super.expr_node,
+                                                          buf, sizeof(buf))));
+      context = correllation_context_new(&key);
+      g_hash_table_insert(shard->correllation->state, &context->key, context);
+      g_string_steal(buffer);
+    }
+  else
+    {
+      msg_debug("Correllation context lookup successful",
+                evt_tag_str("key", buffer->str),
+                evt_tag_int("timeout", self->timeout),
+                evt_tag_int("expiration", timer_wheel_get_time(shard->timer_wheel) + self->timeout),
+                evt_tag_int("num_messages", context->messages->len),
+                evt_tag_str("location",
+                            log_expr_node_format_location(self->super.super.super.expr_node,
+                                                          buf, sizeof(buf))));
+    }
 
-      g_ptr_array_add(context->messages, log_msg_ref(msg));
+  g_ptr_array_add(context->messages, log_msg_ref(msg));
 
-      if (_evaluate_trigger(self, context))
+  /* trigger() is evaluated with the lock held, as closing the context has
+   * to be atomic with adding the message to it */
+  if (_evaluate_trigger(self, context))
+    {
+      msg_verbose("Correllation trigger() met, closing state",
+                  evt_tag_str("key", context->key.session_id),
+                  evt_tag_int("timeout", self->timeout),
+                  evt_tag_int("num_messages", context->messages->len),
+                  evt_tag_str("location",
+                              log_expr_node_format_location(self->super.super.super.expr_node,
+                                                            buf, sizeof(buf))));
+      /* close down state */
+      if (context->timer)
+        timer_wheel_del_timer(shard->timer_wheel, context->timer);
+      _close_context(shard, context);
+    }
+  else
+    {
+      if (context->timer)
         {
-          msg_verbose("Correllation trigger() met, closing state",
-                      evt_tag_str("key", context->key.session_id),
-                      evt_tag_int("timeout", self->timeout),
-                      evt_tag_int("num_messages", context->messages->len),
-                      evt_tag_str("location",
-                                  log_expr_node_format_location(self->super.super.super.expr_node,
-                                                                buf, sizeof(buf))));
-          /* close down state */
-          if (context->timer)
-            timer_wheel_del_timer(self->timer_wheel, context->timer);
-          grouping_by_expire_entry(self->timer_wheel, timer_wheel_get_time(self->timer_wheel), context);
+          timer_wheel_mod_timer(shard->timer_wheel, context->timer, self->timeout);
         }
       else
         {
-
-          if (context->timer)
-            {
-              timer_wheel_mod_timer(self->timer_wheel, context->timer, self->timeout);
-            }
-          else
-            {
-              context->timer = timer_wheel_add_timer(self->timer_wheel, self->timeout, grouping_by_expire_entry,
-                                                     correllation_context_ref(context), (GDestroyNotify) correllation_context_unref);
-            }
+          context->timer = timer_wheel_add_timer(shard->timer_wheel, self->timeout, grouping_by_expire_entry,
+                                                 correllation_context_ref(context), (GDestroyNotify) correllation_context_unref);
         }
     }
-  else
-    {
-      context = NULL;
-    }
-
-  g_static_mutex_unlock(&self->lock);
+  _unlock_shard(shard);
 
-  if (context)
-    log_msg_write_protect(msg);
+  log_msg_write_protect(msg);
 
+  _emit_closed_contexts(self, closed_contexts);
   g_string_free(buffer, TRUE);
   return TRUE;
 }
@@ -406,11 +591,18 @@ grouping_by_init(LogPipe *s)
       return FALSE;
     }
 
-  self->correllation = cfg_persist_config_fetch(cfg, grouping_by_format_persist_name(self));
-  if (!self->correllation)
+  self->persist_state = cfg_persist_config_fetch(cfg, grouping_by_format_persist_name(self));
+  if (!self->persist_state)
+    {
+      self->persist_state = _persist_state_new();
+    }
+  atomic_gssize_set(&self->now, self->persist_state->now);
+  for (gint i = 0; i < GROUPING_BY_STATE_SHARDS; i++)
     {
-      self->correllation = correllation_state_new();
+      self->shards[i].correllation = self->persist_state->correllation[i];
+      _schedule_restored_contexts(self, &self->shards[i]);
     }
+
   iv_validate_now();
   IV_TIMER_INIT(&self->tick);
   self->tick.cookie = self;
@@ -433,9 +625,15 @@ grouping_by_deinit(LogPipe *s)
       iv_timer_unregister(&self->tick);
     }
 
-  cfg_persist_config_add(cfg, grouping_by_format_persist_name(self), self->correllation,
-                         (GDestroyNotify) correllation_state_free, FALSE);
-  self->correllation = NULL;
+  for (gint i = 0; i < GROUPING_BY_STATE_SHARDS; i++)
+    {
+      _unschedule_contexts(&self->shards[i]);
+      self->shards[i].correllation = NULL;
+    }
+  self->persist_state->now = _get_time(self);
+  cfg_persist_config_add(cfg, grouping_by_format_persist_name(self), self->persist_state,
+                         (GDestroyNotify) _persist_state_free, FALSE);
+  self->persist_state = NULL;
   return stateful_parser_deinit_method(s);
 }
 
@@ -457,11 +655,15 @@ grouping_by_free(LogPipe *s)
 {
   GroupingBy *self = (GroupingBy *) s;
 
-  g_static_mutex_free(&self->lock);
+  for (gint i = 0; i < GROUPING_BY_STATE_SHARDS; i++)
+    {
+      timer_wheel_free(self->shards[i].timer_wheel);
+      g_static_mutex_free(&self->shards[i].lock);
+    }
+  g_static_mutex_free(&self->time_lock);
   log_template_unref(self->key_template);
   if (self->synthetic_message)
     synthetic_message_free(self->synthetic_message);
-  timer_wheel_free(self->timer_wheel);
   stateful_parser_free_method(s);
 }
 
@@ -476,10 +678,17 @@ grouping_by_new(GlobalConfig *cfg)
   self->super.super.super.deinit = grouping_by_deinit;
   self->super.super.super.clone = grouping_by_clone;
   self->super.super.process = grouping_by_process;
-  g_static_mutex_init(&self->lock);
+  for (gint i = 0; i < GROUPING_BY_STATE_SHARDS; i++)
+    {
+      GroupingByShard *shard = &self->shards[i];
+
+      g_static_mutex_init(&shard->lock);
+      shard->owner = self;
+      shard->timer_wheel = timer_wheel_new();
+      timer_wheel_set_associated_data(shard->timer_wheel, shard, NULL);
+    }
+  g_static_mutex_init(&self->time_lock);
   self->scope = RCS_GLOBAL;
-  self->timer_wheel = timer_wheel_new();
-  timer_wheel_set_associated_data(self->timer_wheel, self, NULL);
   cached_g_current_time(&self->last_tick);
   self->timeout = -1;
   return &self->super.super;
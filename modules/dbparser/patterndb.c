@@ -36,6 +36,7 @@
 #include "str-utils.h"
 #include "filter/filter-expr-parser.h"
 #include "logpipe.h"
+#include "atomic-gssize.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -46,6 +47,9 @@ static NVHandle context_id_handle = 0;
 
 #define EXPECTED_NUMBER_OF_MESSAGES_EMITTED 32
 
+/* number of independently locked partitions of the correllation state */
+#define PATTERN_DB_STATE_SHARDS 16
+
 typedef struct _PDBProcessParams
 {
   PDBRule *rule;
@@ -56,21 +60,60 @@ typedef struct _PDBProcessParams
   gpointer emitted_messages[EXPECTED_NUMBER_OF_MESSAGES_EMITTED];
   GPtrArray *emitted_messages_overflow;
   gint num_emitted_messages;
+
+  /* contexts created by create-context actions, these are inserted into
+   * their shard once no shard lock is held anymore */
+  GPtrArray *created_contexts;
 } PDBProcessParams;
 
-struct _PatternDB
+/*
+ * The correllation state is partitioned into shards by the hash of the
+ * correllation key, each shard having its own lock and timer wheel.  This
+ * way messages that belong to unrelated contexts can be processed in
+ * parallel.  The rules of engagement:
+ *
+ *   - at most one shard lock is held at any time, contexts that belong to
+ *     a different shard (e.g. the ones created by create-context actions)
+ *     are queued in PDBProcessParams and are inserted once the lock is
+ *     released
+ *
+ *   - the current time of the correllation engine is stored in PatternDB
+ *     and the timer wheel of a shard is moved forward to that value
+ *     whenever the shard is locked.  When the time advances, all shards are
+ *     updated, so that contexts time out even if their shard is idle.
+ *
+ *   - ratelimit_lock may be taken while a shard lock is held, never the
+ *     other way around.  pattern_db_forget_state() is the only function
+ *     that holds all shard locks, it takes them in index order.
+ */
+typedef struct _PDBStateShard
 {
-  GStaticRWLock lock;
-  PDBRuleSet *ruleset;
+  GStaticMutex lock;
+  PatternDB *pdb;
   CorrellationState correllation;
-  GHashTable *rate_limits;
   TimerWheel *timer_wheel;
-  GTimeVal last_tick;
 
   /* process_params used by the timer expiration callback.  Should only be
-   * set with the write lock held and only during the duration of
+   * set with the shard lock held and only during the duration of
    * timer_wheel_set_time() */
   PDBProcessParams *timer_process_params;
+} PDBStateShard;
+
+struct _PatternDB
+{
+  /* protects the ruleset */
+  GStaticRWLock lock;
+  PDBRuleSet *ruleset;
+  PDBStateShard shards[PATTERN_DB_STATE_SHARDS];
+
+  GStaticMutex ratelimit_lock;
+  GHashTable *rate_limits;
+
+  /* protects last_tick and updates of now */
+  GStaticMutex time_lock;
+  atomic_gssize now;
+  GTimeVal last_tick;
+
   PatternDBEmitFunc emit;
   gpointer emit_data;
 };
@@ -158,6 +201,51 @@ _flush_emitted_messages(PatternDB *self, PDBProcessParams *process_params)
     }
 }
 
+static inline guint64
+_get_time(PatternDB *self)
+{
+  return (guint64) atomic_gssize_get(&self->now);
+}
+
+static inline PDBStateShard *
+_get_shard(PatternDB *self, CorrellationKey *key)
+{
+  return &self->shards[correllation_key_hash(key) % PATTERN_DB_STATE_SHARDS];
+}
+
+/* NOTE: the shard lock must be held, as the timer wheel may call
+ * pattern_db_expire_entry() */
+static void
+_shard_set_time(PDBStateShard *shard, PDBProcessParams *process_params, guint64 now)
+{
+  shard->timer_process_params = process_params;
+  timer_wheel_set_time(shard->timer_wheel, now);
+  shard->timer_process_params = NULL;
+}
+
+static void
+_lock_shard(PatternDB *self, PDBStateShard *shard, PDBProcessParams *process_params)
+{
+  g_static_mutex_lock(&shard->lock);
+  _shard_set_time(shard, process_params, _get_time(self));
+}
+
+static void
+_unlock_shard(PDBStateShard *shard)
+{
+  g_static_mutex_unlock(&shard->lock);
+}
+
+static void
+_advance_shards(PatternDB *self, PDBProcessParams *process_params)
+{
+  for (gint i = 0; i < PATTERN_DB_STATE_SHARDS; i++)
+    {
+      _lock_shard(self, &self->shards[i], process_params);
+      _unlock_shard(&self->shards[i]);
+    }
+}
+
 /*
  * Timing
  * ======
@@ -207,6 +295,7 @@ _is_action_within_rate_limit(PatternDB *db, PDBProcessParams *process_params)
   CorrellationKey key;
   PDBRateLimit *rl;
   guint64 now;
+  gboolean within_rate_limit = FALSE;
 
   if (action->rate == 0)
     return TRUE;
@@ -214,6 +303,7 @@ _is_action_within_rate_limit(PatternDB *db, PDBProcessParams *process_params)
   g_string_printf(buffer, "%s:%d", rule->rule_id, action->id);
   correllation_key_setup(&key, rule->context.scope, msg, buffer->str);
 
+  g_static_mutex_lock(&db->ratelimit_lock);
   rl = g_hash_table_lookup(db->rate_limits, &key);
   if (!rl)
     {
@@ -221,7 +311,7 @@ _is_action_within_rate_limit(PatternDB *db, PDBProcessParams *process_params)
       g_hash_table_insert(db->rate_limits, &rl->key, rl);
       g_string_steal(buffer);
     }
-  now = timer_wheel_get_time(db->timer_wheel);
+  now = _get_time(db);
   if (rl->last_check == 0)
     {
       rl->last_check = now;
@@ -245,9 +335,10 @@ _is_action_within_rate_limit(PatternDB *db, PDBProcessParams *process_params)
   if (rl->buckets)
     {
       rl->buckets--;
-      return TRUE;
+      within_rate_limit = TRUE;
     }
-  return FALSE;
+  g_static_mutex_unlock(&db->ratelimit_lock);
+  return within_rate_limit;
 }
 
 static gboolean
@@ -337,19 +428,19 @@ _execute_action_create_context(PatternDB *db, PDBProcessParams *process_params)
             evt_tag_str("rule", rule->rule_id),
             evt_tag_str("context", buffer->str),
             evt_tag_int("context_timeout", syn_context->timeout),
-            evt_tag_int("context_expiration", timer_wheel_get_time(db->timer_wheel) + syn_context->timeout));
+            evt_tag_int("context_expiration", _get_time(db) + syn_context->timeout));
 
   correllation_key_setup(&key, syn_context->scope, context_msg, buffer->str);
   new_context = pdb_context_new(&key);
-  g_hash_table_insert(db->correllation.state, &new_context->super.key, new_context);
   g_string_steal(buffer);
 
   g_ptr_array_add(new_context->super.messages, context_msg);
-
-  new_context->super.timer = timer_wheel_add_timer(db->timer_wheel, rule->context.timeout, pattern_db_expire_entry,
-                                                   correllation_context_ref(&new_context->super),
-                                                   (GDestroyNotify) correllation_context_unref);
   new_context->rule = pdb_rule_ref(rule);
+
+  /* the new context may belong to a shard other than the one being locked */
+  if (!process_params->created_contexts)
+    process_params->created_contexts = g_ptr_array_new();
+  g_ptr_array_add(process_params->created_contexts, new_context);
 }
 
 static void
@@ -401,8 +492,7 @@ _execute_rule_actions(PatternDB *db, PDBProcessParams *process_params, PDBAction
  * PatternDB
  *********************************************************/
 
-/* NOTE: this function requires PatternDB reader/writer lock to be
- * write-locked.
+/* NOTE: this function requires the lock of the shard to be held.
  *
  * Currently, it is, as timer_wheel_set_time() is only called with that
  * precondition, and timer-wheel callbacks are only called from within
@@ -413,20 +503,21 @@ static void
 pattern_db_expire_entry(TimerWheel *wheel, guint64 now, gpointer user_data)
 {
   PDBContext *context = user_data;
-  PatternDB *pdb = (PatternDB *) timer_wheel_get_associated_data(wheel);
+  PDBStateShard *shard = (PDBStateShard *) timer_wheel_get_associated_data(wheel);
+  PatternDB *pdb = shard->pdb;
   GString *buffer = g_string_sized_new(256);
   LogMessage *msg = correllation_context_get_last_message(&context->super);
-  PDBProcessParams *process_params = pdb->timer_process_params;
+  PDBProcessParams *process_params = shard->timer_process_params;
 
   msg_debug("Expiring patterndb correllation context",
             evt_tag_str("last_rule", context->rule->rule_id),
-            evt_tag_long("utc", timer_wheel_get_time(pdb->timer_wheel)));
+            evt_tag_long("utc", timer_wheel_get_time(wheel)));
   process_params->context = context;
   process_params->rule = context->rule;
   process_params->msg = msg;
   process_params->buffer = buffer;
   _execute_rule_actions(pdb, process_params, RAT_TIMEOUT);
-  g_hash_table_remove(pdb->correllation.state, &context->super.key);
+  g_hash_table_remove(shard->correllation.state, &context->super.key);
   g_string_free(buffer, TRUE);
 
   /* pdb_context_free is automatically called when returning from
@@ -434,6 +525,40 @@ pattern_db_expire_entry(TimerWheel *wheel, guint64 now, gpointer user_data)
      callback. */
 }
 
+/* Inserts the contexts created by create-context actions into their
+ * shards.  Must be called without any shard locks held. */
+static void
+_insert_created_contexts(PatternDB *self, PDBProcessParams *process_params)
+{
+  if (!process_params->created_contexts)
+    return;
+
+  /* locking a shard may expire further contexts, which may create new
+   * ones, these are appended to the same array */
+  while (process_params->created_contexts->len > 0)
+    {
+      PDBContext *context = g_ptr_array_remove_index(process_params->created_contexts, 0);
+      PDBStateShard *shard = _get_shard(self, &context->super.key);
+
+      _lock_shard(self, shard, process_params);
+      g_hash_table_insert(shard->correllation.state, &context->super.key, context);
+      context->super.timer = timer_wheel_add_timer(shard->timer_wheel, context->rule->context.timeout,
+                                                   pattern_db_expire_entry,
+                                                   correllation_context_ref(&context->super),
+                                                   (GDestroyNotify) correllation_context_unref);
+      _unlock_shard(shard);
+    }
+  g_ptr_array_free(process_params->created_contexts, TRUE);
+  process_params->created_contexts = NULL;
+}
+
+static void
+_finish_processing(PatternDB *self, PDBProcessParams *process_params)
+{
+  _insert_created_contexts(self, process_params);
+  _flush_emitted_messages(self, process_params);
+}
+
 /*
  * This function can be called any time when pattern-db is not processing
  * messages, but we expect the correllation timer to move forward.  It
@@ -447,11 +572,11 @@ pattern_db_timer_tick(PatternDB *self)
 {
   GTimeVal now;
   glong diff;
+  gboolean advanced = FALSE;
   PDBProcessParams process_params_p = {0};
   PDBProcessParams *process_params = &process_params_p;
 
-  g_static_rw_lock_writer_lock(&self->lock);
-  self->timer_process_params = process_params;
+  g_static_mutex_lock(&self->time_lock);
   cached_g_current_time(&now);
   diff = g_time_val_diff(&now, &self->last_tick);
 
@@ -459,9 +584,8 @@ pattern_db_timer_tick(PatternDB *self)
     {
       glong diff_sec = (glong) (diff / 1e6);
 
-      timer_wheel_set_time(self->timer_wheel, timer_wheel_get_time(self->timer_wheel) + diff_sec);
-      msg_debug("Advancing patterndb current time because of timer tick",
-                evt_tag_long("utc", timer_wheel_get_time(self->timer_wheel)));
+      atomic_gssize_set(&self->now, _get_time(self) + diff_sec);
+      advanced = TRUE;
       /* update last_tick, take the fraction of the seconds not calculated into this update into account */
 
       self->last_tick = now;
@@ -475,41 +599,52 @@ pattern_db_timer_tick(PatternDB *self)
        */
       self->last_tick = now;
     }
-  self->timer_process_params = NULL;
-  g_static_rw_lock_writer_unlock(&self->lock);
-  _flush_emitted_messages(self, process_params);
+  g_static_mutex_unlock(&self->time_lock);
+
+  if (advanced)
+    {
+      msg_debug("Advancing patterndb current time because of timer tick",
+                evt_tag_long("utc", _get_time(self)));
+      _advance_shards(self, process_params);
+    }
+  _finish_processing(self, process_params);
 }
 
-/* NOTE: lock should be acquired for writing before calling this function. */
+/* NOTE: must be called without shard locks held. */
 static void
 _advance_time_based_on_message(PatternDB *self, PDBProcessParams *process_params, const LogStamp *ls)
 {
   GTimeVal now;
+  gboolean advanced = FALSE;
 
   /* clamp the current time between the timestamp of the current message
    * (low limit) and the current system time (high limit).  This ensures
    * that incorrect clocks do not skew the current time know by the
    * correllation engine too much. */
 
+  g_static_mutex_lock(&self->time_lock);
   cached_g_current_time(&now);
   self->last_tick = now;
 
   if (ls->tv_sec < now.tv_sec)
     now.tv_sec = ls->tv_sec;
 
-  /* the expire callback uses this pointer to find the process_params it
-   * needs to emit messages.  ProcessParams itself is a per-thread value,
-   * however the timer callback is executing with the writer lock held.
-   * There's no other mechanism to pass this pointer to the timer callback,
-   * so we add it to PatternDB, but make sure it is properly protected by
-   * locks.
-   * */
-  self->timer_process_params = process_params;
-  timer_wheel_set_time(self->timer_wheel, now.tv_sec);
-  self->timer_process_params = NULL;
+  /* time is not allowed to go backwards */
+  if (now.tv_sec > _get_time(self))
+    {
+      atomic_gssize_set(&self->now, now.tv_sec);
+      advanced = TRUE;
+    }
+  g_static_mutex_unlock(&self->time_lock);
 
-  msg_debug("Advancing patterndb current time because of an incoming message",
-            evt_tag_long("utc", timer_wheel_get_time(self->timer_wheel)));
+  /* the time advances at most once per second, move all shards forward,
+   * so that contexts in idle shards expire in time too */
+  if (advanced)
+    {
+      _advance_shards(self, process_params);
+      msg_debug("Advancing patterndb current time because of an incoming message",
+                evt_tag_long("utc", _get_time(self)));
+    }
 }
 
 void
@@ -517,15 +652,13 @@ pattern_db_advance_time(PatternDB *self, gint timeout)
 {
   PDBProcessParams process_params_p = {0};
   PDBProcessParams *process_params = &process_params_p;
-  time_t new_time;
-
-  g_static_rw_lock_writer_lock(&self->lock);
-  new_time = timer_wheel_get_time(self->timer_wheel) + timeout;
-  self->timer_process_params = process_params;
-  timer_wheel_set_time(self->timer_wheel, new_time);
-  self->timer_process_params = NULL;
-  g_static_rw_lock_writer_unlock(&self->lock);
-  _flush_emitted_messages(self, process_params);
+
+  g_static_mutex_lock(&self->time_lock);
+  atomic_gssize_set(&self->now, _get_time(self) + timeout);
+  g_static_mutex_unlock(&self->time_lock);
+
+  _advance_shards(self, process_params);
+  _finish_processing(self, process_params);
 }
 
 gboolean
@@ -586,11 +719,11 @@ static void
 _pattern_db_process_matching_rule(PatternDB *self, PDBProcessParams *process_params)
 {
   PDBContext *context = NULL;
+  PDBStateShard *shard = NULL;
   PDBRule *rule = process_params->rule;
   LogMessage *msg = process_params->msg;
   GString *buffer = g_string_sized_new(32);
 
-  g_static_rw_lock_writer_lock(&self->lock);
   _advance_time_based_on_message(self, process_params, &msg->timestamps[LM_TS_STAMP]);
   if (rule->context.id_template)
     {
@@ -600,16 +733,19 @@ _pattern_db_process_matching_rule(PatternDB *self, PDBProcessParams *process_par
       log_msg_set_value(msg, context_id_handle, buffer->str, -1);
 
       correllation_key_setup(&key, rule->context.scope, msg, buffer->str);
-      context = g_hash_table_lookup(self->correllation.state, &key);
+      shard = _get_shard(self, &key);
+      _lock_shard(self, shard, process_params);
+
+      context = g_hash_table_lookup(shard->correllation.state, &key);
       if (!context)
         {
           msg_debug("Correllation context lookup failure, starting a new context",
                     evt_tag_str("rule", rule->rule_id),
                     evt_tag_str("context", buffer->str),
                     evt_tag_int("context_timeout", rule->context.timeout),
-                    evt_tag_int("context_expiration", timer_wheel_get_time(self->timer_wheel) + rule->context.timeout));
+                    evt_tag_int("context_expiration", timer_wheel_get_time(shard->timer_wheel) + rule->context.timeout));
           context = pdb_context_new(&key);
-          g_hash_table_insert(self->correllation.state, &context->super.key, context);
+          g_hash_table_insert(shard->correllation.state, &context->super.key, context);
           g_string_steal(buffer);
         }
       else
@@ -618,7 +754,7 @@ _pattern_db_process_matching_rule(PatternDB *self, PDBProcessParams *process_par
                     evt_tag_str("rule", rule->rule_id),
                     evt_tag_str("context", buffer->str),
                     evt_tag_int("context_timeout", rule->context.timeout),
-                    evt_tag_int("context_expiration", timer_wheel_get_time(self->timer_wheel) + rule->context.timeout),
+                    evt_tag_int("context_expiration", timer_wheel_get_time(shard->timer_wheel) + rule->context.timeout),
                     evt_tag_int("num_messages", context->super.messages->len));
         }
 
@@ -626,11 +762,11 @@ _pattern_db_process_matching_rule(PatternDB *self, PDBProcessParams *process_par
 
       if (context->super.timer)
         {
-          timer_wheel_mod_timer(self->timer_wheel, context->super.timer, rule->context.timeout);
+          timer_wheel_mod_timer(shard->timer_wheel, context->super.timer, rule->context.timeout);
         }
       else
         {
-          context->super.timer = timer_wheel_add_timer(self->timer_wheel, rule->context.timeout, pattern_db_expire_entry,
+          context->super.timer = timer_wheel_add_timer(shard->timer_wheel, rule->context.timeout, pattern_db_expire_entry,
                                                        correllation_context_ref(&context->super),
                                                        (GDestroyNotify) correllation_context_unref);
         }
@@ -646,6 +782,9 @@ _pattern_db_process_matching_rule(PatternDB *self, PDBProcessParams *process_par
       context = NULL;
     }
 
+  /* expiring contexts while moving the time forward reuses process_params */
+  process_params->rule = rule;
+  process_params->msg = msg;
   process_params->context = context;
   process_params->buffer = buffer;
   synthetic_message_apply(&rule->msg, &context->super, msg, buffer);
@@ -653,8 +792,9 @@ _pattern_db_process_matching_rule(PatternDB *self, PDBProcessParams *process_par
   _emit_message(self, process_params, FALSE, msg);
   _execute_rule_actions(self, process_params, RAT_MATCH);
 
+  if (shard)
+    _unlock_shard(shard);
   pdb_rule_unref(rule);
-  g_static_rw_lock_writer_unlock(&self->lock);
 
   if (context)
     log_msg_write_protect(msg);
@@ -667,10 +807,8 @@ _pattern_db_process_unmatching_rule(PatternDB *self, PDBProcessParams *process_p
 {
   LogMessage *msg = process_params->msg;
 
-  g_static_rw_lock_writer_lock(&self->lock);
   _advance_time_based_on_message(self, process_params, &msg->timestamps[LM_TS_STAMP]);
   _emit_message(self, process_params, FALSE, msg);
-  g_static_rw_lock_writer_unlock(&self->lock);
 }
 
 static gboolean
@@ -679,6 +817,7 @@ _pattern_db_process(PatternDB *self, PDBLookupParams *lookup, GArray *dbg_list)
   LogMessage *msg = lookup->msg;
   PDBProcessParams process_params_p = {0};
   PDBProcessParams *process_params = &process_params_p;
+  gboolean matched;
 
   g_static_rw_lock_reader_lock(&self->lock);
   if (_pattern_db_is_empty(self))
@@ -689,12 +828,15 @@ _pattern_db_process(PatternDB *self, PDBLookupParams *lookup, GArray *dbg_list)
   process_params->rule = pdb_ruleset_lookup(self->ruleset, lookup, dbg_list);
   process_params->msg = msg;
   g_static_rw_lock_reader_unlock(&self->lock);
-  if (process_params->rule)
+
+  /* process_params->rule may be changed by expiring contexts */
+  matched = process_params->rule != NULL;
+  if (matched)
     _pattern_db_process_matching_rule(self, process_params);
   else
     _pattern_db_process_unmatching_rule(self, process_params);
-  _flush_emitted_messages(self, process_params);
-  return process_params->rule != NULL;
+  _finish_processing(self, process_params);
+  return matched;
 }
 
 gboolean
@@ -733,13 +875,33 @@ pattern_db_expire_state(PatternDB *self)
   PDBProcessParams process_params_p = {0};
   PDBProcessParams *process_params = &process_params_p;
 
-  g_static_rw_lock_writer_lock(&self->lock);
-  self->timer_process_params = process_params;
-  timer_wheel_expire_all(self->timer_wheel);
-  self->timer_process_params = NULL;
-  g_static_rw_lock_writer_unlock(&self->lock);
-  _flush_emitted_messages(self, process_params);
+  for (gint i = 0; i < PATTERN_DB_STATE_SHARDS; i++)
+    {
+      PDBStateShard *shard = &self->shards[i];
+
+      g_static_mutex_lock(&shard->lock);
+      shard->timer_process_params = process_params;
+      timer_wheel_expire_all(shard->timer_wheel);
+      shard->timer_process_params = NULL;
+      g_static_mutex_unlock(&shard->lock);
+    }
+  _finish_processing(self, process_params);
+}
 
+static void
+_init_shard_state(PDBStateShard *shard)
+{
+  correllation_state_init_instance(&shard->correllation);
+  shard->timer_wheel = timer_wheel_new();
+  timer_wheel_set_associated_data(shard->timer_wheel, shard, NULL);
+}
+
+static void
+_destroy_shard_state(PDBStateShard *shard)
+{
+  if (shard->timer_wheel)
+    timer_wheel_free(shard->timer_wheel);
+  correllation_state_deinit_instance(&shard->correllation);
 }
 
 static void
@@ -747,28 +909,37 @@ _init_state(PatternDB *self)
 {
   self->rate_limits = g_hash_table_new_full(correllation_key_hash, correllation_key_equal, NULL,
                                             (GDestroyNotify) pdb_rate_limit_free);
-  correllation_state_init_instance(&self->correllation);
-  self->timer_wheel = timer_wheel_new();
-  timer_wheel_set_associated_data(self->timer_wheel, self, NULL);
+  for (gint i = 0; i < PATTERN_DB_STATE_SHARDS; i++)
+    _init_shard_state(&self->shards[i]);
 }
 
 static void
 _destroy_state(PatternDB *self)
 {
-  if (self->timer_wheel)
-    timer_wheel_free(self->timer_wheel);
-
+  for (gint i = 0; i < PATTERN_DB_STATE_SHARDS; i++)
+    _destroy_shard_state(&self->shards[i]);
   g_hash_table_destroy(self->rate_limits);
-  correllation_state_deinit_instance(&self->correllation);
 }
 
 void
 pattern_db_forget_state(PatternDB *self)
 {
-  g_static_rw_lock_writer_lock(&self->lock);
+  /* ratelimit_lock comes last, see the rules of engagement above */
+  for (gint i = 0; i < PATTERN_DB_STATE_SHARDS; i++)
+    g_static_mutex_lock(&self->shards[i].lock);
+  g_static_mutex_lock(&self->ratelimit_lock);
+
   _destroy_state(self);
   _init_state(self);
-  g_static_rw_lock_writer_unlock(&self->lock);
+
+  /* the timer wheels start from scratch, so does our idea of the current time */
+  g_static_mutex_lock(&self->time_lock);
+  atomic_gssize_set(&self->now, 0);
+  g_static_mutex_unlock(&self->time_lock);
+
+  g_static_mutex_unlock(&self->ratelimit_lock);
+  for (gint i = PATTERN_DB_STATE_SHARDS - 1; i >= 0; i--)
+    g_static_mutex_unlock(&self->shards[i].lock);
 }
 
 PatternDB *
@@ -777,9 +948,16 @@ pattern_db_new(void)
   PatternDB *self = g_new0(PatternDB, 1);
 
   self->ruleset = pdb_rule_set_new();
+  for (gint i = 0; i < PATTERN_DB_STATE_SHARDS; i++)
+    {
+      g_static_mutex_init(&self->shards[i].lock);
+      self->shards[i].pdb = self;
+    }
   _init_state(self);
   cached_g_current_time(&self->last_tick);
   g_static_rw_lock_init(&self->lock);
+  g_static_mutex_init(&self->ratelimit_lock);
+  g_static_mutex_init(&self->time_lock);
   return self;
 }
 
@@ -789,7 +967,11 @@ pattern_db_free(PatternDB *self)
   if (self->ruleset)
     pdb_rule_set_free(self->ruleset);
   _destroy_state(self);
+  for (gint i = 0; i < PATTERN_DB_STATE_SHARDS; i++)
+    g_static_mutex_free(&self->shards[i].lock);
   g_static_rw_lock_free(&self->lock);
+  g_static_mutex_free(&self->ratelimit_lock);
+  g_static_mutex_free(&self->time_lock);
   g_free(self);
 }
 
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+/* the shards and the timer tick are internals of grouping-by() */
+#include "groupingby.c"
+#include "stateful-parser.c"
+#include "filter/filter-tags.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "plugin.h"
+
+#include <criterion/criterion.h>
+
+#define TEST_TIMEOUT 10
+
+static GPtrArray *emitted_messages;
+static FilterExprNode *trigger;
+
+static void
+_capture_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options)
+{
+  g_ptr_array_add(emitted_messages, msg);
+}
+
+static LogParser *
+_create_grouping_by(LogPipe *capture)
+{
+  LogParser *parser = grouping_by_new(configuration);
+  LogTemplate *key = log_template_new(configuration, NULL);
+  SyntheticMessage *aggregate = synthetic_message_new();
+
+  cr_assert(log_template_compile(key, "$HOST", NULL));
+  grouping_by_set_key_template(parser, key);
+  log_template_unref(key);
+
+  cr_assert(synthetic_message_add_value_template_string(aggregate, configuration, "HOST", "$HOST", NULL));
+  cr_assert(synthetic_message_add_value_template_string(aggregate, configuration, "COUNT", "$(context-length)", NULL));
+  grouping_by_set_synthetic_message(parser, aggregate);
+
+  grouping_by_set_trigger_condition(parser, trigger);
+  grouping_by_set_timeout(parser, TEST_TIMEOUT);
+  log_pipe_append(&parser->super, capture);
+
+  cr_assert(log_pipe_init(&parser->super));
+  return parser;
+}
+
+static void
+_feed_message(LogParser *parser, const gchar *host, gboolean stop)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg = log_msg_new_empty();
+
+  log_msg_set_value(msg, LM_V_HOST, host, -1);
+  if (stop)
+    log_msg_set_tag_by_name(msg, "stop");
+
+  cr_assert(log_parser_process_message(parser, &msg, &path_options));
+  log_msg_unref(msg);
+}
+
+/* as if timeout() elapsed since the last timer tick */
+static void
+_expire_contexts(LogParser *parser)
+{
+  GroupingBy *self = (GroupingBy *) parser;
+
+  g_time_val_add(&self->last_tick, -(TEST_TIMEOUT + 1) * G_USEC_PER_SEC);
+  _grouping_by_timer_tick(self);
+}
+
+static gint
+_count_contexts(LogParser *parser)
+{
+  GroupingBy *self = (GroupingBy *) parser;
+  gint num_contexts = 0;
+
+  for (gint i = 0; i < GROUPING_BY_STATE_SHARDS; i++)
+    num_contexts += g_hash_table_size(self->shards[i].correllation->state);
+  return num_contexts;
+}
+
+static gint
+_count_used_shards(LogParser *parser)
+{
+  GroupingBy *self = (GroupingBy *) parser;
+  gint num_shards = 0;
+
+  for (gint i = 0; i < GROUPING_BY_STATE_SHARDS; i++)
+    {
+      if (g_hash_table_size(self->shards[i].correllation->state) > 0)
+        num_shards++;
+    }
+  return num_shards;
+}
+
+static void
+_assert_emitted_message(gint index, const gchar *host, const gchar *count)
+{
+  cr_assert_lt(index, emitted_messages->len);
+  LogMessage *msg = (LogMessage *) g_ptr_array_index(emitted_messages, index);
+
+  cr_assert_str_eq(log_msg_get_value_by_name(msg, "HOST", NULL), host);
+  cr_assert_str_eq(log_msg_get_value_by_name(msg, "COUNT", NULL), count);
+}
+
+static void
+_free_grouping_by(LogParser *parser)
+{
+  log_pipe_deinit(&parser->super);
+  log_pipe_unref(&parser->super);
+}
+
+static void
+setup(void)
+{
+  app_startup();
+  configuration = cfg_new_snippet();
+  cr_assert(cfg_load_module(configuration, "basicfuncs"));
+  grouping_by_global_init();
+
+  emitted_messages = g_ptr_array_new_with_free_func((GDestroyNotify) log_msg_unref);
+  trigger = filter_tags_new(g_list_append(NULL, g_strdup("stop")));
+}
+
+static void
+teardown(void)
+{
+  filter_expr_unref(trigger);
+  g_ptr_array_free(emitted_messages, TRUE);
+  cfg_free(configuration);
+  app_shutdown();
+}
+
+TestSuite(grouping_by, .init = setup, .fini = teardown);
+
+Test(grouping_by, test_trigger_closes_the_context_and_emits_the_aggregate)
+{
+  LogPipe *capture = log_pipe_new(configuration);
+  capture->queue = _capture_queue;
+  LogParser *parser = _create_grouping_by(capture);
+
+  _feed_message(parser, "host1", FALSE);
+  _feed_message(parser, "host2", FALSE);
+  _feed_message(parser, "host1", FALSE);
+  cr_assert_eq(emitted_messages->len, 0);
+
+  _feed_message(parser, "host1", TRUE);
+
+  cr_assert_eq(emitted_messages->len, 1);
+  _assert_emitted_message(0, "host1", "3");
+  cr_assert_eq(_count_contexts(parser), 1, "only the context of host2 should remain open");
+
+  _free_grouping_by(parser);
+  log_pipe_unref(capture);
+}
+
+Test(grouping_by, test_contexts_in_all_shards_time_out)
+{
+  LogPipe *capture = log_pipe_new(configuration);
+  capture->queue = _capture_queue;
+  LogParser *parser = _create_grouping_by(capture);
+  const gint num_hosts = 4 * GROUPING_BY_STATE_SHARDS;
+
+  for (gint i = 0; i < num_hosts; i++)
+    {
+      gchar host[32];
+
+      g_snprintf(host, sizeof(host), "host%d", i);
+      _feed_message(parser, host, FALSE);
+    }
+  cr_assert_eq(_count_contexts(parser), num_hosts);
+  cr_assert_gt(_count_used_shards(parser), 1, "the contexts should be spread over multiple shards");
+
+  _expire_contexts(parser);
+
+  cr_assert_eq(emitted_messages->len, num_hosts);
+  cr_assert_eq(_count_contexts(parser), 0);
+
+  _free_grouping_by(parser);
+  log_pipe_unref(capture);
+}
+
+Test(grouping_by, test_contexts_survive_a_reload)
+{
+  LogPipe *capture = log_pipe_new(configuration);
+  capture->queue = _capture_queue;
+  LogParser *old_parser = _create_grouping_by(capture);
+
+  _feed_message(old_parser, "host1", FALSE);
+  _feed_message(old_parser, "host1", FALSE);
+  _feed_message(old_parser, "host2", FALSE);
+
+  configuration->persist = persist_config_new();
+  log_pipe_deinit(&old_parser->super);
+  LogParser *new_parser = _create_grouping_by(capture);
+  /* the old instance is freed after the new one took over its state,
+   * taking its timer wheels with it */
+  log_pipe_unref(&old_parser->super);
+  persist_config_free(configuration->persist);
+  configuration->persist = NULL;
+
+  cr_assert_eq(_count_contexts(new_parser), 2);
+
+  _feed_message(new_parser, "host1", TRUE);
+  cr_assert_eq(emitted_messages->len, 1);
+  _assert_emitted_message(0, "host1", "3");
+
+  /* the restored context is rescheduled in the new instance */
+  _expire_contexts(new_parser);
+  cr_assert_eq(emitted_messages->len, 2);
+  _assert_emitted_message(1, "host2", "1");
+  cr_assert_eq(_count_contexts(new_parser), 0);
+
+  _free_grouping_by(new_parser);
+  log_pipe_unref(capture);
+}
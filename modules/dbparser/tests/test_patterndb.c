@@ -376,6 +376,33 @@ Test(pattern_db, test_correllation_rule_with_action_on_timeout)
   g_free(filename);
 }
 
+Test(pattern_db, test_correllation_contexts_with_different_keys_all_time_out)
+{
+  gchar *filename;
+  PatternDB *patterndb = _create_pattern_db(pdb_ruletest_skeleton, &filename);
+  const gint num_contexts = 64;
+
+  /* the context-id is $PID, so these contexts are spread over the state shards */
+  for (gint i = 0; i < num_contexts; i++)
+    {
+      gchar pid[16];
+
+      g_snprintf(pid, sizeof(pid), "%d", i);
+      _feed_message_to_correllation_state(patterndb, "prog1", "correllated-message-with-action-on-timeout",
+                                          "PID", pid);
+    }
+  cr_assert_eq(messages->len, num_contexts);
+
+  _advance_time(patterndb, 60);
+  cr_assert_eq(messages->len, 2 * num_contexts, "all contexts are expected to time out, generated messages: %d",
+               messages->len - num_contexts);
+  for (gint i = num_contexts; i < 2 * num_contexts; i++)
+    assert_output_message_nvpair_equals(i, "MESSAGE", "generated-message-on-timeout");
+
+  _destroy_pattern_db(patterndb, filename);
+  g_free(filename);
+}
+
 Test(pattern_db, test_correllation_rule_with_action_condition)
 {
   gchar *filename;
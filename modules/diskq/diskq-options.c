@@ -25,6 +25,9 @@
 #include "syslog-ng.h"
 #include "messages.h"
 #include "reloc.h"
+#include "timeutils.h"
+
+#include <string.h>
 
 void
 disk_queue_options_qout_size_set(DiskQueueOptions *self, gint qout_size)
@@ -72,9 +75,74 @@ disk_queue_options_mem_buf_length_set(DiskQueueOptions *self, gint mem_buf_lengt
   self->mem_buf_length = mem_buf_length;
 }
 
+gboolean
+disk_queue_options_sync_mode_set(DiskQueueOptions *self, const gchar *sync_mode)
+{
+  if (strcmp(sync_mode, "none") == 0)
+    self->sync_mode = DISKQ_SYNC_NONE;
+  else if (strcmp(sync_mode, "batch") == 0)
+    self->sync_mode = DISKQ_SYNC_BATCH;
+  else if (strcmp(sync_mode, "always") == 0)
+    self->sync_mode = DISKQ_SYNC_ALWAYS;
+  else
+    return FALSE;
+  return TRUE;
+}
+
+void
+disk_queue_options_sync_interval_set(DiskQueueOptions *self, gint sync_interval)
+{
+  self->sync_mode = DISKQ_SYNC_INTERVAL;
+  self->sync_interval = sync_interval;
+}
+
+/* tells whether records written since last_sync should be synced now */
+gboolean
+disk_queue_options_is_sync_due(DiskQueueOptions *self, GTimeVal *last_sync)
+{
+  GTimeVal now;
+
+  switch (self->sync_mode)
+    {
+    case DISKQ_SYNC_NONE:
+      return FALSE;
+    case DISKQ_SYNC_INTERVAL:
+      cached_g_current_time(&now);
+      return g_time_val_diff(&now, last_sync) >= (glong) self->sync_interval * 1000;
+    default:
+      return TRUE;
+    }
+}
+
+void
+disk_queue_options_segmented_set(DiskQueueOptions *self, gboolean segmented)
+{
+  self->segmented = segmented;
+}
+
+void
+disk_queue_options_segment_size_set(DiskQueueOptions *self, gint64 segment_size)
+{
+  if (segment_size < MIN_SEGMENT_SIZE)
+    {
+      msg_warning("WARNING: The configured segment size is smaller than the minimum allowed",
+                  evt_tag_int("configured_size", segment_size),
+                  evt_tag_int("minimum_allowed_size", MIN_SEGMENT_SIZE),
+                  evt_tag_int("new_size", MIN_SEGMENT_SIZE));
+      segment_size = MIN_SEGMENT_SIZE;
+    }
+  self->segment_size = segment_size;
+}
+
 void
 disk_queue_options_check_plugin_settings(DiskQueueOptions *self)
 {
+  if (self->segmented && !self->reliable)
+    {
+      msg_warning("WARNING: segmented disk buffers are always reliable, reliable(yes) is implied by segmented(yes)");
+      self->reliable = TRUE;
+    }
+
   if (self->reliable)
     {
       if (self->mem_buf_length > 0)
@@ -121,6 +189,10 @@ disk_queue_options_set_default_options(DiskQueueOptions *self)
   self->reliable = FALSE;
   self->mem_buf_size = -1;
   self->qout_size = -1;
+  self->sync_mode = DISKQ_SYNC_NONE;
+  self->sync_interval = 0;
+  self->segmented = FALSE;
+  self->segment_size = DEFAULT_SEGMENT_SIZE;
   self->dir = g_strdup(get_installation_path_for(SYSLOG_NG_PATH_LOCALSTATEDIR));
 }
 
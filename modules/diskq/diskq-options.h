@@ -28,6 +28,16 @@
 #include "logmsg/logmsg-serialize.h"
 
 #define MIN_DISK_BUF_SIZE 1024*1024
+#define MIN_SEGMENT_SIZE 64*1024
+#define DEFAULT_SEGMENT_SIZE 16*1024*1024
+
+typedef enum
+{
+  DISKQ_SYNC_NONE,
+  DISKQ_SYNC_BATCH,
+  DISKQ_SYNC_INTERVAL,
+  DISKQ_SYNC_ALWAYS,
+} DiskQueueSyncMode;
 
 typedef struct _DiskQueueOptions
 {
@@ -38,6 +48,10 @@ typedef struct _DiskQueueOptions
   gint mem_buf_size;
   gint mem_buf_length;
   gchar *dir;
+  DiskQueueSyncMode sync_mode;
+  gint sync_interval;
+  gboolean segmented;
+  gint64 segment_size;
 } DiskQueueOptions;
 
 void disk_queue_options_qout_size_set(DiskQueueOptions *self, gint qout_size);
@@ -45,6 +59,11 @@ void disk_queue_options_disk_buf_size_set(DiskQueueOptions *self, gint64 disk_bu
 void disk_queue_options_reliable_set(DiskQueueOptions *self, gboolean reliable);
 void disk_queue_options_mem_buf_size_set(DiskQueueOptions *self, gint mem_buf_size);
 void disk_queue_options_mem_buf_length_set(DiskQueueOptions *self, gint mem_buf_length);
+gboolean disk_queue_options_sync_mode_set(DiskQueueOptions *self, const gchar *sync_mode);
+void disk_queue_options_sync_interval_set(DiskQueueOptions *self, gint sync_interval);
+gboolean disk_queue_options_is_sync_due(DiskQueueOptions *self, GTimeVal *last_sync);
+void disk_queue_options_segmented_set(DiskQueueOptions *self, gboolean segmented);
+void disk_queue_options_segment_size_set(DiskQueueOptions *self, gint64 segment_size);
 void disk_queue_options_check_plugin_settings(DiskQueueOptions *self);
 void disk_queue_options_set_dir(DiskQueueOptions *self, const gchar *dir);
 void disk_queue_options_set_default_options(DiskQueueOptions *self);
@@ -37,6 +37,10 @@ static CfgLexerKeyword diskq_keywords[] =
   { "mem_buf_size",      KW_MEM_BUF_SIZE },
   { "qout_size",         KW_QOUT_SIZE },
   { "dir",               KW_DIR },
+  { "sync",              KW_SYNC },
+  { "interval",          KW_INTERVAL },
+  { "segmented",         KW_SEGMENTED },
+  { "segment_size",      KW_SEGMENT_SIZE },
   { NULL }
 };
 
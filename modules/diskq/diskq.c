@@ -28,6 +28,7 @@
 #include "logqueue-disk.h"
 #include "logqueue-disk-reliable.h"
 #include "logqueue-disk-non-reliable.h"
+#include "logqueue-disk-segmented.h"
 #include "persist-state.h"
 
 #define DISKQ_PLUGIN_NAME "diskq"
@@ -66,7 +67,9 @@ _acquire_queue(LogDestDriver *dd, const gchar *persist_name)
       queue = NULL;
     }
 
-  if (self->options.reliable)
+  if (self->options.segmented)
+    queue = log_queue_disk_segmented_new(&self->options, persist_name);
+  else if (self->options.reliable)
     queue = log_queue_disk_reliable_new(&self->options, persist_name);
   else
     queue = log_queue_disk_non_reliable_new(&self->options, persist_name);
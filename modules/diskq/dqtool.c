@@ -30,6 +30,7 @@
 #include "logqueue-disk.h"
 #include "logqueue-disk-reliable.h"
 #include "logqueue-disk-non-reliable.h"
+#include "logqueue-disk-segmented.h"
 #include "logmsg/logmsg-serialize.h"
 #include "scratch-buffers.h"
 
@@ -62,6 +63,7 @@ open_queue(char *filename, LogQueue **lq, DiskQueueOptions *options)
 {
   options->read_only = TRUE;
   options->reliable = FALSE;
+  options->segmented = FALSE;
   FILE *f = fopen(filename, "rb");
   if (f)
     {
@@ -72,6 +74,8 @@ open_queue(char *filename, LogQueue **lq, DiskQueueOptions *options)
       idbuf[4] = '\0';
       if (!strcmp(idbuf, "SLRQ"))
         options->reliable = TRUE;
+      else if (!strcmp(idbuf, QSEGMENTS_FILE_ID))
+        options->reliable = options->segmented = TRUE;
     }
   else
     {
@@ -79,7 +83,14 @@ open_queue(char *filename, LogQueue **lq, DiskQueueOptions *options)
       return FALSE;
     }
 
-  if (options->reliable)
+  if (options->segmented)
+    {
+      /* segments are mapped as they are found, the limits do not apply */
+      options->disk_buf_size = 1;
+      options->segment_size = MIN_SEGMENT_SIZE;
+      *lq = log_queue_disk_segmented_new(options, NULL);
+    }
+  else if (options->reliable)
     {
       options->disk_buf_size = 128;
       options->mem_buf_size = 1024 * 1024;
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+
+#include "syslog-ng.h"
+#include "logqueue-disk-segmented.h"
+#include "logpipe.h"
+#include "messages.h"
+#include "serialize.h"
+#include "logmsg/logmsg-serialize.h"
+#include "stats/stats-registry.h"
+
+static gint64
+_get_length(LogQueueDisk *s)
+{
+  LogQueueDiskSegmented *self = (LogQueueDiskSegmented *) s;
+
+  return qsegments_get_length(self->qsegments);
+}
+
+static gboolean
+_push_tail(LogQueueDisk *s, LogMessage *msg, LogPathOptions *local_options, const LogPathOptions *path_options)
+{
+  LogQueueDiskSegmented *self = (LogQueueDiskSegmented *) s;
+  SerializeArchive *sa;
+
+  g_string_truncate(self->serialized, 0);
+  sa = serialize_string_archive_new(self->serialized);
+  log_msg_serialize(msg, sa);
+  serialize_archive_free(sa);
+
+  if (!qsegments_push_tail(self->qsegments, self->serialized))
+    {
+      msg_error("Destination segmented queue full, dropping message",
+                evt_tag_str("filename", qsegments_get_filename(self->qsegments)),
+                evt_tag_long("queue_len", qsegments_get_length(self->qsegments)),
+                evt_tag_long("segments", qsegments_get_segment_count(self->qsegments)),
+                evt_tag_long("disk_buf_size", qdisk_get_options(s->qdisk)->disk_buf_size),
+                evt_tag_str("persist_name", self->super.super.persist_name));
+      return FALSE;
+    }
+  return TRUE;
+}
+
+static LogMessage *
+_read_message(LogQueueDiskSegmented *self)
+{
+  LogMessage *msg;
+  SerializeArchive *sa;
+
+  if (!qsegments_pop_head(self->qsegments, self->serialized))
+    {
+      msg_error("Error reading from disk-queue file, dropping disk queue",
+                evt_tag_str("filename", qsegments_get_filename(self->qsegments)));
+      self->super.restart_corrupted(&self->super);
+      return NULL;
+    }
+
+  msg = log_msg_new_empty();
+  sa = serialize_string_archive_new(self->serialized);
+  if (!log_msg_deserialize(msg, sa))
+    {
+      msg_error("Can't read correct message from disk-queue file",
+                evt_tag_str("filename", qsegments_get_filename(self->qsegments)));
+      log_msg_unref(msg);
+      msg = NULL;
+    }
+  serialize_archive_free(sa);
+
+  if (!self->super.super.use_backlog)
+    qsegments_ack(self->qsegments, 1);
+
+  return msg;
+}
+
+static LogMessage *
+_pop_head(LogQueueDisk *s, LogPathOptions *path_options)
+{
+  LogQueueDiskSegmented *self = (LogQueueDiskSegmented *) s;
+  LogMessage *msg = NULL;
+
+  while (!msg && qsegments_initialized(self->qsegments) && qsegments_get_length(self->qsegments) > 0)
+    msg = _read_message(self);
+
+  /* the record stays on disk until the destination acks it */
+  if (msg)
+    path_options->ack_needed = FALSE;
+  return msg;
+}
+
+static void
+_ack_backlog(LogQueueDisk *s, guint num_msg_to_ack)
+{
+  LogQueueDiskSegmented *self = (LogQueueDiskSegmented *) s;
+
+  qsegments_ack(self->qsegments, num_msg_to_ack);
+}
+
+static void
+_rewind_backlog(LogQueueDisk *s, guint rewind_count)
+{
+  LogQueueDiskSegmented *self = (LogQueueDiskSegmented *) s;
+  gint64 backlog_count = qsegments_get_backlog_count(self->qsegments);
+
+  qsegments_rewind(self->qsegments, rewind_count);
+  stats_counter_add(self->super.super.queued_messages,
+                    backlog_count - qsegments_get_backlog_count(self->qsegments));
+}
+
+static gboolean
+_start(LogQueueDisk *s, const gchar *filename)
+{
+  LogQueueDiskSegmented *self = (LogQueueDiskSegmented *) s;
+
+  return qsegments_start(self->qsegments, filename);
+}
+
+/* the checkpoint is always up-to-date, there is nothing to dump */
+static gboolean
+_save_queue(LogQueueDisk *s, gboolean *persistent)
+{
+  LogQueueDiskSegmented *self = (LogQueueDiskSegmented *) s;
+
+  *persistent = TRUE;
+  qsegments_stop(self->qsegments);
+  return TRUE;
+}
+
+static void
+_restart_corrupted(LogQueueDisk *s)
+{
+  LogQueueDiskSegmented *self = (LogQueueDiskSegmented *) s;
+
+  qsegments_restart_corrupted(self->qsegments);
+}
+
+static gboolean
+_is_initialized(LogQueueDisk *s)
+{
+  LogQueueDiskSegmented *self = (LogQueueDiskSegmented *) s;
+
+  return qsegments_initialized(self->qsegments);
+}
+
+static gboolean
+_commit(LogQueueDisk *s)
+{
+  LogQueueDiskSegmented *self = (LogQueueDiskSegmented *) s;
+
+  return qsegments_commit(self->qsegments);
+}
+
+static const gchar *
+_get_filename(LogQueueDisk *s)
+{
+  LogQueueDiskSegmented *self = (LogQueueDiskSegmented *) s;
+
+  return qsegments_get_filename(self->qsegments);
+}
+
+static void
+_free_queue(LogQueueDisk *s)
+{
+  LogQueueDiskSegmented *self = (LogQueueDiskSegmented *) s;
+
+  qsegments_free(self->qsegments);
+  self->qsegments = NULL;
+  g_string_free(self->serialized, TRUE);
+}
+
+static void
+_set_virtual_functions(LogQueueDisk *self)
+{
+  self->get_length = _get_length;
+  self->ack_backlog = _ack_backlog;
+  self->rewind_backlog = _rewind_backlog;
+  self->pop_head = _pop_head;
+  self->push_tail = _push_tail;
+  self->free_fn = _free_queue;
+  self->load_queue = _start;
+  self->start = _start;
+  self->save_queue = _save_queue;
+  self->restart_corrupted = _restart_corrupted;
+  self->is_initialized = _is_initialized;
+  self->commit = _commit;
+  self->get_filename = _get_filename;
+}
+
+LogQueue *
+log_queue_disk_segmented_new(DiskQueueOptions *options, const gchar *persist_name)
+{
+  g_assert(options->segmented == TRUE);
+  LogQueueDiskSegmented *self = g_new0(LogQueueDiskSegmented, 1);
+  log_queue_disk_init_instance(&self->super, persist_name);
+  /* QDisk itself is not started, it only carries the options */
+  qdisk_init(self->super.qdisk, options);
+  self->qsegments = qsegments_new(options);
+  self->serialized = g_string_sized_new(256);
+  _set_virtual_functions(&self->super);
+  return &self->super.super;
+}
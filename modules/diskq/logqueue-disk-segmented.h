@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+
+#ifndef LOGQUEUE_DISK_SEGMENTED_H_
+#define LOGQUEUE_DISK_SEGMENTED_H_
+
+#include "logqueue-disk.h"
+#include "qsegments.h"
+
+typedef struct _LogQueueDiskSegmented
+{
+  LogQueueDisk super;
+  QSegments *qsegments;
+  /* serialization buffer, only used with the queue lock held */
+  GString *serialized;
+} LogQueueDiskSegmented;
+
+LogQueue *log_queue_disk_segmented_new(DiskQueueOptions *options, const gchar *persist_name);
+
+#endif /* LOGQUEUE_DISK_SEGMENTED_H_ */
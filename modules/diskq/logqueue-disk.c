@@ -29,6 +29,7 @@
 #include "stats/stats-registry.h"
 #include "reloc.h"
 #include "qdisk.h"
+#include "mainloop-worker.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -48,13 +49,111 @@ _get_length(LogQueue *s)
   LogQueueDisk *self = (LogQueueDisk *) s;
   gint64 qdisk_length = 0;
 
-  if (qdisk_initialized(self->qdisk) && self->get_length)
+  if (self->is_initialized(self) && self->get_length)
     {
       qdisk_length = self->get_length(self);
     }
   return qdisk_length;
 }
 
+static void
+_ack_messages(GQueue *acks)
+{
+  LogMessage *msg;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+
+  while ((msg = g_queue_pop_head(acks)))
+    {
+      POINTER_TO_LOG_PATH_OPTIONS(g_queue_pop_head(acks), &path_options);
+      log_msg_ack(msg, &path_options, AT_PROCESSED);
+      log_msg_unref(msg);
+    }
+}
+
+/* NOTE: must be called with the lock held. The acks of the committed
+ * records are moved to @committed_acks. If the commit fails, they are kept
+ * on pending_acks and are only sent after the next successful commit. */
+static gboolean
+_commit_records(LogQueueDisk *self, GQueue *committed_acks)
+{
+  if (self->is_initialized(self) && !self->commit(self))
+    {
+      msg_error("Error committing records to the disk-queue file, acknowledgements are delayed until the next successful commit",
+                evt_tag_str("filename", self->get_filename(self)),
+                evt_tag_int("pending_acks", g_queue_get_length(&self->pending_acks) / 2));
+      return FALSE;
+    }
+
+  *committed_acks = self->pending_acks;
+  g_queue_init(&self->pending_acks);
+  return TRUE;
+}
+
+/* NOTE: consumes the reference of msg, must be called with the lock held */
+static void
+_add_pending_ack(LogQueueDisk *self, LogMessage *msg, LogPathOptions *local_options)
+{
+  if (local_options->ack_needed)
+    {
+      g_queue_push_tail(&self->pending_acks, msg);
+      g_queue_push_tail(&self->pending_acks, LOG_PATH_OPTIONS_TO_POINTER(local_options));
+    }
+  else
+    {
+      log_msg_unref(msg);
+    }
+}
+
+/* invoked at the end of an input thread's batch, commits every record
+ * pushed so far (by any thread) and acks the ones waiting for it */
+static gpointer
+_commit_batch(gpointer user_data)
+{
+  LogQueueDisk *self = (LogQueueDisk *) user_data;
+  gint thread_id = main_loop_worker_get_thread_id();
+  GQueue acks = G_QUEUE_INIT;
+
+  g_assert(thread_id >= 0);
+
+  g_static_mutex_lock(&self->super.lock);
+  _commit_records(self, &acks);
+  g_static_mutex_unlock(&self->super.lock);
+
+  _ack_messages(&acks);
+
+  self->commit_input[thread_id].cb_registered = FALSE;
+  log_queue_unref(&self->super);
+  return NULL;
+}
+
+/* NOTE: consumes the reference of msg, must be called with the lock held */
+static void
+_ack_when_committed(LogQueueDisk *self, LogMessage *msg, LogPathOptions *local_options)
+{
+  gint thread_id = main_loop_worker_get_thread_id();
+
+  g_assert(thread_id < 0 || log_queue_max_threads > thread_id);
+
+  _add_pending_ack(self, msg, local_options);
+
+  if (thread_id < 0 || qdisk_get_options(self->qdisk)->sync_mode == DISKQ_SYNC_ALWAYS)
+    {
+      /* there is no batch to group this record with */
+      GQueue acks = G_QUEUE_INIT;
+
+      _commit_records(self, &acks);
+      _ack_messages(&acks);
+      return;
+    }
+
+  if (!self->commit_input[thread_id].cb_registered)
+    {
+      main_loop_worker_register_batch_callback(&self->commit_input[thread_id].cb);
+      self->commit_input[thread_id].cb_registered = TRUE;
+      log_queue_ref(&self->super);
+    }
+}
+
 static void
 _push_tail(LogQueue *s, LogMessage *msg, const LogPathOptions *path_options)
 {
@@ -67,8 +166,7 @@ _push_tail(LogQueue *s, LogMessage *msg, const LogPathOptions *path_options)
         {
           log_queue_push_notify (&self->super);
           stats_counter_inc(self->super.queued_messages);
-          log_msg_ack(msg, &local_options, AT_PROCESSED);
-          log_msg_unref(msg);
+          _ack_when_committed(self, msg, &local_options);
           g_static_mutex_unlock(&self->super.lock);
           return;
         }
@@ -165,7 +263,7 @@ log_queue_disk_save_queue(LogQueue *s, gboolean *persistent)
 {
   LogQueueDisk *self = (LogQueueDisk *) s;
 
-  if (!qdisk_initialized(self->qdisk))
+  if (!self->is_initialized(self))
     {
       *persistent = FALSE;
       return TRUE;
@@ -182,7 +280,7 @@ log_queue_disk_load_queue(LogQueue *s, const gchar *filename)
   LogQueueDisk *self = (LogQueueDisk *) s;
 
   /* qdisk portion is not yet started when this happens */
-  g_assert(!qdisk_initialized(self->qdisk));
+  g_assert(!self->is_initialized(self));
 
   if (self->load_queue)
     return self->load_queue(self, filename);
@@ -202,7 +300,7 @@ const gchar *
 log_queue_disk_get_filename(LogQueue *s)
 {
   LogQueueDisk *self = (LogQueueDisk *) s;
-  return qdisk_get_filename(self->qdisk);
+  return self->get_filename(self);
 }
 
 static void
@@ -216,6 +314,11 @@ _free(LogQueue *s)
   qdisk_deinit(self->qdisk);
   qdisk_free(self->qdisk);
 
+  /* batch callbacks hold a reference, only the acks of records whose
+   * commit failed can be pending here, nothing can retry them anymore */
+  _ack_messages(&self->pending_acks);
+  g_free(self->commit_input);
+
   log_queue_free_method(s);
 }
 
@@ -322,6 +425,24 @@ _restart_diskq(LogQueueDisk *self, gboolean corrupted)
   g_free(filename);
 }
 
+static gboolean
+_is_initialized(LogQueueDisk *self)
+{
+  return qdisk_initialized(self->qdisk);
+}
+
+static gboolean
+_commit(LogQueueDisk *self)
+{
+  return qdisk_commit(self->qdisk);
+}
+
+static const gchar *
+_get_filename(LogQueueDisk *self)
+{
+  return qdisk_get_filename(self->qdisk);
+}
+
 static void
 _restart(LogQueueDisk *self)
 {
@@ -341,6 +462,15 @@ log_queue_disk_init_instance(LogQueueDisk *self, const gchar *persist_name)
   log_queue_init_instance(&self->super, persist_name);
   self->qdisk = qdisk_new();
 
+  self->commit_input = g_new0(LogQueueDiskCommitInput, log_queue_max_threads);
+  for (gint i = 0; i < log_queue_max_threads; i++)
+    {
+      worker_batch_callback_init(&self->commit_input[i].cb);
+      self->commit_input[i].cb.func = _commit_batch;
+      self->commit_input[i].cb.user_data = self;
+    }
+  g_queue_init(&self->pending_acks);
+
   self->super.type = log_queue_disk_type;
   self->super.get_length = _get_length;
   self->super.push_tail = _push_tail;
@@ -355,4 +485,7 @@ log_queue_disk_init_instance(LogQueueDisk *self, const gchar *persist_name)
   self->write_message = _write_message;
   self->restart = _restart;
   self->restart_corrupted = _restart_corrupted;
+  self->is_initialized = _is_initialized;
+  self->commit = _commit;
+  self->get_filename = _get_filename;
 }
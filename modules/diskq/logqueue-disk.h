@@ -28,13 +28,27 @@
 #include "logqueue.h"
 #include "qdisk.h"
 #include "logmsg/logmsg-serialize.h"
+#include "mainloop-worker.h"
 
 typedef struct _LogQueueDisk LogQueueDisk;
 
+typedef struct _LogQueueDiskCommitInput
+{
+  WorkerBatchCallback cb;
+  gboolean cb_registered;
+} LogQueueDiskCommitInput;
+
 struct _LogQueueDisk
 {
   LogQueue super;
   QDisk *qdisk;         /* disk based queue */
+
+  /* records pushed by an input thread are committed to disk as a group
+   * once its batch is finished, one entry for each input thread */
+  LogQueueDiskCommitInput *commit_input;
+  /* msg, path options pairs to be acked once their group is committed */
+  GQueue pending_acks;
+
   gint64 (*get_length)(LogQueueDisk *s);
   gboolean (*push_tail)(LogQueueDisk *s, LogMessage *msg, LogPathOptions *local_options,
                         const LogPathOptions *path_options);
@@ -51,6 +65,11 @@ struct _LogQueueDisk
   gboolean (*write_message)(LogQueueDisk *self, LogMessage *msg);
   void (*restart)(LogQueueDisk *self);
   void (*restart_corrupted)(LogQueueDisk *self);
+
+  /* the storage the records are kept in, QDisk unless overridden */
+  gboolean (*is_initialized)(LogQueueDisk *s);
+  gboolean (*commit)(LogQueueDisk *s);
+  const gchar *(*get_filename)(LogQueueDisk *s);
 };
 
 extern QueueType log_queue_disk_type;
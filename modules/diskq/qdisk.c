@@ -29,6 +29,7 @@
 #include "stats/stats-registry.h"
 #include "reloc.h"
 #include "compat/lfs.h"
+#include "timeutils.h"
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -36,6 +37,8 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <string.h>
 
 /* MADV_RANDOM not defined on legacy Linux systems. Could be removed in the
  * future, when support for Glibc 2.1.X drops.*/
@@ -50,6 +53,10 @@
 
 #define PATH_QDISK              PATH_LOCALSTATEDIR
 
+/* records are collected in a write-combining buffer of this size before
+ * they get written to the file */
+#define QDISK_WRITE_BUFFER_SIZE (64 * 1024)
+
 typedef union _QDiskFileHeader
 {
   struct
@@ -78,6 +85,8 @@ typedef union _QDiskFileHeader
   gchar _pad2[QDISK_RESERVED_SPACE];
 } QDiskFileHeader;
 
+#define QDISK_HEADER_USED_SIZE (G_STRUCT_OFFSET(QDiskFileHeader, backlog_len) + sizeof(gint64))
+
 struct _QDisk
 {
   gchar *filename;
@@ -86,6 +95,17 @@ struct _QDisk
   gint64 file_size;
   QDiskFileHeader *hdr;
   DiskQueueOptions *options;
+
+  /* when writable, hdr is an in-memory copy of the header mapped at
+   * file_hdr, published only when it doesn't refer to buffered records */
+  QDiskFileHeader *file_hdr;
+
+  /* records already accounted for in hdr->write_head, but not yet written
+   * to the file, starting at write_buffer_ofs */
+  GString *write_buffer;
+  gint64 write_buffer_ofs;
+  gboolean unsynced;
+  GTimeVal last_sync;
 };
 
 static gboolean
@@ -107,6 +127,91 @@ pwrite_strict(gint fd, const void *buf, size_t count, off_t offset)
   return result;
 }
 
+static gboolean
+pwritev_strict(gint fd, const struct iovec *iov, gint iovcnt, off_t offset)
+{
+  gsize count = 0;
+  gint i;
+
+  for (i = 0; i < iovcnt; i++)
+    count += iov[i].iov_len;
+
+#if SYSLOG_NG_HAVE_PWRITEV
+  ssize_t written = pwritev(fd, iov, iovcnt, offset);
+#else
+  ssize_t written = 0;
+  for (i = 0; i < iovcnt; i++)
+    {
+      if (!pwrite_strict(fd, iov[i].iov_base, iov[i].iov_len, offset + written))
+        return FALSE;
+      written += iov[i].iov_len;
+    }
+#endif
+  gboolean result = TRUE;
+  if (written != count)
+    {
+      if (written != -1)
+        {
+          msg_error("Short write while writing disk buffer",
+                    evt_tag_int("bytes_to_write", count),
+                    evt_tag_int("bytes_written", written));
+          errno = ENOSPC;
+        }
+      result = FALSE;
+    }
+  return result;
+}
+
+static inline gint64
+_write_buffer_end(QDisk *self)
+{
+  return self->write_buffer_ofs + self->write_buffer->len;
+}
+
+static gboolean
+_flush_write_buffer(QDisk *self)
+{
+  if (self->write_buffer->len == 0)
+    return TRUE;
+
+  if (!pwrite_strict(self->fd, self->write_buffer->str, self->write_buffer->len, self->write_buffer_ofs))
+    {
+      msg_error("Error writing disk-queue file",
+                evt_tag_error("error"),
+                evt_tag_str("filename", self->filename));
+      return FALSE;
+    }
+  g_string_truncate(self->write_buffer, 0);
+  return TRUE;
+}
+
+static void
+_discard_write_buffer(QDisk *self)
+{
+  g_string_truncate(self->write_buffer, 0);
+}
+
+static void
+_publish_header(QDisk *self)
+{
+  if (self->file_hdr && self->write_buffer->len == 0)
+    memcpy(self->file_hdr, self->hdr, QDISK_HEADER_USED_SIZE);
+}
+
+/* pread() that also sees records still sitting in the write buffer. A
+ * record is either completely in the buffer or completely in the file. */
+static gssize
+_pread(QDisk *self, gpointer buffer, gsize count, gint64 position)
+{
+  if (self->write_buffer->len > 0 &&
+      position >= self->write_buffer_ofs && position < _write_buffer_end(self))
+    {
+      count = MIN(count, _write_buffer_end(self) - position);
+      memcpy(buffer, self->write_buffer->str + (position - self->write_buffer_ofs), count);
+      return count;
+    }
+  return pread(self->fd, buffer, count, position);
+}
 
 static gboolean
 _is_position_eof(QDisk *self, gint64 position)
@@ -236,12 +341,39 @@ qdisk_push_tail(QDisk *self, GString *record)
       return FALSE;
     }
 
-  if (!pwrite_strict(self->fd, (gchar *) &n, sizeof(n), self->hdr->write_head) ||
-      !pwrite_strict(self->fd, record->str, record->len, self->hdr->write_head + sizeof(n)))
+  /* the write buffer must be contiguous with the record being added */
+  if (self->write_buffer->len > 0 && _write_buffer_end(self) != self->hdr->write_head)
     {
-      msg_error("Error writing disk-queue file",
-                evt_tag_error("error"));
-      return FALSE;
+      if (!_flush_write_buffer(self))
+        return FALSE;
+    }
+
+  if (self->write_buffer->len + sizeof(n) + record->len <= QDISK_WRITE_BUFFER_SIZE)
+    {
+      if (self->write_buffer->len == 0)
+        self->write_buffer_ofs = self->hdr->write_head;
+      g_string_append_len(self->write_buffer, (gchar *) &n, sizeof(n));
+      g_string_append_len(self->write_buffer, record->str, record->len);
+    }
+  else
+    {
+      /* the record doesn't fit: write out the buffer along with the
+       * record using a single syscall */
+      const struct iovec iov[] =
+      {
+        { self->write_buffer->str, self->write_buffer->len },
+        { &n, sizeof(n) },
+        { record->str, record->len },
+      };
+      gint64 ofs = self->write_buffer->len > 0 ? self->write_buffer_ofs : self->hdr->write_head;
+
+      if (!pwritev_strict(self->fd, iov, G_N_ELEMENTS(iov), ofs))
+        {
+          msg_error("Error writing disk-queue file",
+                    evt_tag_error("error"));
+          return FALSE;
+        }
+      g_string_truncate(self->write_buffer, 0);
     }
 
   self->hdr->write_head = self->hdr->write_head + record->len + sizeof(n);
@@ -287,9 +419,38 @@ qdisk_push_tail(QDisk *self, GString *record)
            * for the next message, the condition at the beginning of this
            * function will cause the push to fail */
           self->hdr->write_head = QDISK_RESERVED_SPACE;
+
+          /* if this fails, the next push retries it */
+          _flush_write_buffer(self);
         }
     }
   self->hdr->length++;
+  self->unsynced = TRUE;
+  _publish_header(self);
+  return TRUE;
+}
+
+/* writes out the pending records and syncs the file, as configured by
+ * sync(). Returns TRUE if everything pushed so far made it to the file. */
+gboolean
+qdisk_commit(QDisk *self)
+{
+  if (!_flush_write_buffer(self))
+    return FALSE;
+  _publish_header(self);
+
+  if (!self->unsynced || !disk_queue_options_is_sync_due(self->options, &self->last_sync))
+    return TRUE;
+
+  if (fsync(self->fd) < 0)
+    {
+      msg_error("Error syncing disk-queue file",
+                evt_tag_error("error"),
+                evt_tag_str("filename", self->filename));
+      return FALSE;
+    }
+  cached_g_current_time(&self->last_sync);
+  self->unsynced = FALSE;
   return TRUE;
 }
 
@@ -306,13 +467,13 @@ qdisk_pop_head(QDisk *self, GString *record)
     {
       guint32 n;
       gssize res;
-      res = pread(self->fd, (gchar *) &n, sizeof(n), self->hdr->read_head);
+      res = _pread(self, (gchar *) &n, sizeof(n), self->hdr->read_head);
 
       if (res == 0)
         {
           /* hmm, we are either at EOF or at hdr->qout_ofs, we need to wrap */
           self->hdr->read_head = QDISK_RESERVED_SPACE;
-          res = pread(self->fd, (gchar *) &n, sizeof(n), self->hdr->read_head);
+          res = _pread(self, (gchar *) &n, sizeof(n), self->hdr->read_head);
         }
       if (res != sizeof(n))
         {
@@ -339,7 +500,7 @@ qdisk_pop_head(QDisk *self, GString *record)
         }
 
       g_string_set_size(record, n);
-      res = pread(self->fd, record->str, n, self->hdr->read_head + sizeof(n));
+      res = _pread(self, record->str, n, self->hdr->read_head + sizeof(n));
       if (res != n)
         {
           msg_error("Error reading disk-queue file",
@@ -373,8 +534,10 @@ qdisk_pop_head(QDisk *self, GString *record)
               self->hdr->backlog_head = self->hdr->read_head;
             }
           self->hdr->length = 0;
+          _discard_write_buffer(self);
           _truncate_file(self, self->hdr->write_head);
         }
+      _publish_header(self);
       return TRUE;
 
     }
@@ -644,6 +807,9 @@ qdisk_save_state(QDisk *self, GQueue *qout, GQueue *qbacklog, GQueue *qoverflow)
   gint32 qoverflow_len = 0;
   gint32 qoverflow_count = 0;
 
+  if (!_flush_write_buffer(self))
+    return FALSE;
+
   if (!self->options->reliable)
     {
       qout_count = qout->length / 2;
@@ -682,6 +848,7 @@ qdisk_save_state(QDisk *self, GQueue *qout, GQueue *qbacklog, GQueue *qoverflow)
              evt_tag_str("filename", self->filename),
              evt_tag_int("qdisk_length", self->hdr->length));
 
+  _publish_header(self);
   return TRUE;
 }
 
@@ -846,6 +1013,12 @@ qdisk_start(QDisk *self, const gchar *filename, GQueue *qout, GQueue *qbacklog,
         }
 
     }
+
+  if (!self->options->read_only)
+    {
+      self->file_hdr = self->hdr;
+      self->hdr = g_memdup(self->file_hdr, sizeof(QDiskFileHeader));
+    }
   return TRUE;
 }
 
@@ -855,6 +1028,9 @@ qdisk_init(QDisk *self, DiskQueueOptions *options)
   self->fd = -1;
   self->file_size = 0;
   self->options = options;
+  self->unsynced = FALSE;
+  self->last_sync.tv_sec = 0;
+  self->last_sync.tv_usec = 0;
   if (!self->options->reliable)
     self->file_id = "SLQF";
   else
@@ -870,18 +1046,25 @@ qdisk_init(QDisk *self, DiskQueueOptions *options)
 void
 qdisk_deinit(QDisk *self)
 {
+  if (qdisk_initialized(self) && !self->options->read_only)
+    qdisk_commit(self);
+  _discard_write_buffer(self);
+
   if (self->filename)
     {
       g_free(self->filename);
       self->filename = NULL;
     }
 
+  if (self->file_hdr)
+    {
+      munmap((void *)self->file_hdr, sizeof(QDiskFileHeader));
+      self->file_hdr = NULL;
+    }
+
   if (self->hdr)
     {
-      if (self->options->read_only)
-        g_free(self->hdr);
-      else
-        munmap((void *)self->hdr, sizeof(QDiskFileHeader));
+      g_free(self->hdr);
       self->hdr = NULL;
     }
 
@@ -898,11 +1081,11 @@ gssize
 qdisk_read_from_backlog(QDisk *self, gpointer buffer, gsize bytes_to_read)
 {
   gssize res;
-  res = pread(self->fd, buffer, bytes_to_read, self->hdr->backlog_head);
+  res = _pread(self, buffer, bytes_to_read, self->hdr->backlog_head);
   if (res == 0)
     {
       self->hdr->backlog_head = QDISK_RESERVED_SPACE;
-      res = pread(self->fd, buffer, bytes_to_read, self->hdr->backlog_head);
+      res = _pread(self, buffer, bytes_to_read, self->hdr->backlog_head);
     }
   if (res != bytes_to_read)
     {
@@ -914,6 +1097,7 @@ qdisk_read_from_backlog(QDisk *self, gpointer buffer, gsize bytes_to_read)
     {
       self->hdr->backlog_head = _correct_position_if_eof(self, &self->hdr->backlog_head);
     }
+  _publish_header(self);
   return res;
 }
 
@@ -921,7 +1105,7 @@ gssize
 qdisk_read(QDisk *self, gpointer buffer, gsize bytes_to_read, gint64 position)
 {
   gssize res;
-  res = pread(self->fd, buffer, bytes_to_read, position);
+  res = _pread(self, buffer, bytes_to_read, position);
   if (res <= 0)
     {
       msg_error("Error reading disk-queue file",
@@ -950,6 +1134,7 @@ void
 qdisk_set_backlog_count(QDisk *self, gint64 new_value)
 {
   self->hdr->backlog_len = new_value;
+  _publish_header(self);
 }
 
 void
@@ -960,7 +1145,9 @@ qdisk_reset_file_if_possible(QDisk *self)
       self->hdr->read_head = QDISK_RESERVED_SPACE;
       self->hdr->write_head = QDISK_RESERVED_SPACE;
       self->hdr->backlog_head = QDISK_RESERVED_SPACE;
+      _discard_write_buffer(self);
       _truncate_file (self, QDISK_RESERVED_SPACE);
+      _publish_header(self);
     }
 }
 
@@ -980,6 +1167,7 @@ void
 qdisk_set_length(QDisk *self, gint64 new_value)
 {
   self->hdr->length = new_value;
+  _publish_header(self);
 }
 
 gint64
@@ -1010,6 +1198,7 @@ void
 qdisk_set_reader_head(QDisk *self, gint64 new_value)
 {
   self->hdr->read_head = new_value;
+  _publish_header(self);
 }
 
 gint64
@@ -1022,18 +1211,21 @@ void
 qdisk_set_backlog_head(QDisk *self, gint64 new_value)
 {
   self->hdr->backlog_head = new_value;
+  _publish_header(self);
 }
 
 void
 qdisk_inc_backlog(QDisk *self)
 {
   self->hdr->backlog_len++;
+  _publish_header(self);
 }
 
 void
 qdisk_dec_backlog(QDisk *self)
 {
   self->hdr->backlog_len--;
+  _publish_header(self);
 }
 
 gint64
@@ -1057,6 +1249,7 @@ qdisk_is_read_only(QDisk *self)
 void
 qdisk_free(QDisk *self)
 {
+  g_string_free(self->write_buffer, TRUE);
   g_free(self);
 }
 
@@ -1064,5 +1257,6 @@ QDisk *
 qdisk_new(void)
 {
   QDisk *self = g_new0(QDisk, 1);
+  self->write_buffer = g_string_sized_new(QDISK_WRITE_BUFFER_SIZE);
   return self;
 }
@@ -44,6 +44,7 @@ QDisk *qdisk_new(void);
 gboolean qdisk_is_space_avail(QDisk *self, gint at_least);
 gboolean qdisk_push_tail(QDisk *self, GString *record);
 gboolean qdisk_pop_head(QDisk *self, GString *record);
+gboolean qdisk_commit(QDisk *self);
 gboolean qdisk_start(QDisk *self, const gchar *filename, GQueue *qout, GQueue *qbacklog, GQueue *qoverflow);
 void qdisk_init(QDisk *self, DiskQueueOptions *options);
 void qdisk_deinit(QDisk *self);
@@ -0,0 +1,949 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+
+#include "qsegments.h"
+#include "messages.h"
+#include "timeutils.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define QSEGMENTS_CHECKPOINT_SIZE 4096
+#define QSEGMENT_FILE_ID "SLSG"
+#define QSEGMENT_HEADER_SIZE 64
+#define QSEGMENT_RECORD_HEADER_SIZE (2 * sizeof(guint32))
+
+/* written in place of a record length when a segment is sealed before it
+ * is completely filled */
+#define QSEGMENT_END_MARKER 0xFFFFFFFF
+
+/* number of fully acked segment files kept around for reuse */
+#define QSEGMENTS_MAX_SPARES 2
+
+typedef union _QSegmentsCheckpoint
+{
+  struct
+  {
+    gchar magic[4];
+    guint8 version;
+    guint8 big_endian;
+    guint8 _pad1[2];
+
+    /* the oldest record not acked yet */
+    guint64 head_segment;
+    gint64 head_offset;
+    /* the place of the next record to be pushed */
+    guint64 tail_segment;
+    gint64 tail_offset;
+    /* number of records between head and tail */
+    gint64 length;
+  };
+  gchar _pad2[QSEGMENTS_CHECKPOINT_SIZE];
+} QSegmentsCheckpoint;
+
+typedef struct _QSegmentHeader
+{
+  gchar magic[4];
+  guint8 version;
+  guint8 _pad1[3];
+  guint64 sequence;
+} QSegmentHeader;
+
+typedef struct _QSegment
+{
+  guint64 sequence;
+  gchar *base;
+  gint64 size;
+} QSegment;
+
+typedef struct _QSegmentsPosition
+{
+  guint64 segment;
+  gint64 offset;
+} QSegmentsPosition;
+
+struct _QSegments
+{
+  DiskQueueOptions *options;
+  gchar *filename;
+  gint fd;
+  QSegmentsCheckpoint *checkpoint;
+
+  /* segments mapped so far, indexed by their sequence number */
+  GHashTable *segments;
+  gint spares;
+
+  /* records between the head and the read position are in the backlog,
+   * they are read again after a restart unless acked */
+  QSegmentsPosition read;
+  gint64 backlog_count;
+
+  QSegmentsPosition synced;
+  gboolean unsynced;
+  GTimeVal last_sync;
+};
+
+static guint32 crc32_table[256];
+
+static gpointer
+_crc32_init_table(gpointer user_data)
+{
+  for (guint32 i = 0; i < 256; i++)
+    {
+      guint32 c = i;
+
+      for (gint k = 0; k < 8; k++)
+        c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+      crc32_table[i] = c;
+    }
+  return NULL;
+}
+
+static guint32
+_crc32_update(guint32 crc, const guchar *data, gsize len)
+{
+  for (gsize i = 0; i < len; i++)
+    crc = crc32_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+/* the sequence number of the segment is part of the checksum, so that
+ * stale records left behind in a recycled segment never validate */
+static guint32
+_record_crc(guint64 sequence, const gchar *payload, guint32 len)
+{
+  guint64 sequence_be = GUINT64_TO_BE(sequence);
+  guint32 crc = 0xFFFFFFFF;
+
+  crc = _crc32_update(crc, (const guchar *) &sequence_be, sizeof(sequence_be));
+  crc = _crc32_update(crc, (const guchar *) payload, len);
+  return crc ^ 0xFFFFFFFF;
+}
+
+static inline guint32
+_get_uint32(const gchar *p)
+{
+  guint32 n;
+
+  memcpy(&n, p, sizeof(n));
+  return GUINT32_FROM_BE(n);
+}
+
+static inline void
+_put_uint32(gchar *p, guint32 value)
+{
+  guint32 n = GUINT32_TO_BE(value);
+
+  memcpy(p, &n, sizeof(n));
+}
+
+static gchar *
+_format_segment_filename(const gchar *filename, guint64 sequence)
+{
+  return g_strdup_printf("%s.%08" G_GINT64_MODIFIER "x", filename, sequence);
+}
+
+static gchar *
+_format_spare_filename(const gchar *filename, gint index)
+{
+  return g_strdup_printf("%s.spare%d", filename, index);
+}
+
+static gchar *
+_next_filename(QSegments *self)
+{
+  gint i = 0;
+  gboolean success = FALSE;
+  gchar tmpfname[256];
+
+  /* NOTE: this'd be a security problem if we were not in our private directory. But we are. */
+  while (!success && i < 100000)
+    {
+      struct stat st;
+
+      g_snprintf(tmpfname, sizeof(tmpfname), "%s/syslog-ng-%05d.sqf", self->options->dir, i);
+      success = (stat(tmpfname, &st) < 0);
+      i++;
+    }
+  if (!success)
+    {
+      msg_error("Error generating unique queue filename, not using disk queue");
+      return NULL;
+    }
+  return g_strdup(tmpfname);
+}
+
+static gint
+_count_spares(QSegments *self)
+{
+  gint spares = 0;
+
+  while (spares < QSEGMENTS_MAX_SPARES)
+    {
+      struct stat st;
+      gchar *spare = _format_spare_filename(self->filename, spares);
+      gboolean exists = (stat(spare, &st) == 0);
+
+      g_free(spare);
+      if (!exists)
+        break;
+      spares++;
+    }
+  return spares;
+}
+
+static void
+_segment_free(QSegment *segment)
+{
+  munmap(segment->base, segment->size);
+  g_free(segment);
+}
+
+static gboolean
+_allocate_file(gint fd, gint64 size)
+{
+  if (ftruncate(fd, size) < 0)
+    return FALSE;
+
+#if SYSLOG_NG_HAVE_POSIX_FALLOCATE
+  /* running out of disk space while writing through the mapping would
+   * be fatal, so reserve the blocks upfront */
+  gint err = posix_fallocate(fd, 0, size);
+  if (err != 0)
+    {
+      errno = err;
+      return FALSE;
+    }
+#endif
+  return TRUE;
+}
+
+/* NOTE: takes over fd */
+static QSegment *
+_map_segment_file(QSegments *self, const gchar *filename, gint fd, guint64 sequence)
+{
+  QSegment *segment;
+  struct stat st;
+  gchar *p;
+
+  if (fstat(fd, &st) < 0 || st.st_size < QSEGMENT_HEADER_SIZE)
+    {
+      msg_error("Error loading disk-queue segment",
+                evt_tag_str("filename", filename),
+                evt_tag_error("error"));
+      close(fd);
+      return NULL;
+    }
+
+  p = mmap(0, st.st_size, self->options->read_only ? (PROT_READ) : (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (p == MAP_FAILED)
+    {
+      msg_error("Error returned by mmap",
+                evt_tag_error("errno"),
+                evt_tag_str("filename", filename));
+      return NULL;
+    }
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+  segment = g_new0(QSegment, 1);
+  segment->sequence = sequence;
+  segment->base = p;
+  segment->size = st.st_size;
+  g_hash_table_insert(self->segments, &segment->sequence, segment);
+  return segment;
+}
+
+static gboolean
+_is_segment_header_valid(QSegment *segment)
+{
+  QSegmentHeader *hdr = (QSegmentHeader *) segment->base;
+
+  return memcmp(hdr->magic, QSEGMENT_FILE_ID, 4) == 0 &&
+         hdr->version == 1 &&
+         hdr->sequence == segment->sequence;
+}
+
+static void
+_release_segment(QSegments *self, QSegment *segment)
+{
+  g_hash_table_remove(self->segments, &segment->sequence);
+}
+
+static QSegment *
+_open_segment(QSegments *self, guint64 sequence)
+{
+  gchar *filename = _format_segment_filename(self->filename, sequence);
+  QSegment *segment = NULL;
+  gint fd;
+
+  fd = open(filename, self->options->read_only ? (O_RDONLY | O_LARGEFILE) : (O_RDWR | O_LARGEFILE));
+  if (fd < 0)
+    {
+      msg_error("Error opening disk-queue segment",
+                evt_tag_str("filename", filename),
+                evt_tag_error("error"));
+      goto exit;
+    }
+
+  segment = _map_segment_file(self, filename, fd, sequence);
+  if (segment && !_is_segment_header_valid(segment))
+    {
+      msg_error("Invalid disk-queue segment header",
+                evt_tag_str("filename", filename));
+      _release_segment(self, segment);
+      segment = NULL;
+    }
+
+exit:
+  g_free(filename);
+  return segment;
+}
+
+static QSegment *
+_create_segment(QSegments *self, guint64 sequence, gint64 record_size)
+{
+  gint64 size = MAX(self->options->segment_size, QSEGMENT_HEADER_SIZE + record_size);
+  gchar *filename = _format_segment_filename(self->filename, sequence);
+  QSegment *segment = NULL;
+  gint fd = -1;
+
+  if (self->spares > 0)
+    {
+      gchar *spare = _format_spare_filename(self->filename, --self->spares);
+
+      if (rename(spare, filename) == 0)
+        fd = open(filename, O_RDWR | O_LARGEFILE);
+      g_free(spare);
+    }
+
+  if (fd < 0)
+    fd = open(filename, O_RDWR | O_LARGEFILE | O_CREAT | O_TRUNC, 0600);
+
+  if (fd < 0 || !_allocate_file(fd, size))
+    {
+      msg_error("Error creating disk-queue segment",
+                evt_tag_str("filename", filename),
+                evt_tag_long("size", size),
+                evt_tag_error("error"));
+      if (fd >= 0)
+        {
+          close(fd);
+          unlink(filename);
+        }
+      goto exit;
+    }
+
+  segment = _map_segment_file(self, filename, fd, sequence);
+  if (segment)
+    {
+      QSegmentHeader *hdr = (QSegmentHeader *) segment->base;
+
+      memcpy(hdr->magic, QSEGMENT_FILE_ID, 4);
+      hdr->version = 1;
+      hdr->sequence = sequence;
+    }
+
+exit:
+  g_free(filename);
+  return segment;
+}
+
+static QSegment *
+_get_segment(QSegments *self, guint64 sequence)
+{
+  QSegment *segment = g_hash_table_lookup(self->segments, &sequence);
+
+  if (!segment)
+    segment = _open_segment(self, sequence);
+  return segment;
+}
+
+/* all records of the segment are acked: keep the file for reuse unless we
+ * already have enough spares */
+static void
+_recycle_segment(QSegments *self, guint64 sequence)
+{
+  QSegment *segment = g_hash_table_lookup(self->segments, &sequence);
+  gchar *filename;
+
+  if (segment)
+    _release_segment(self, segment);
+
+  if (self->options->read_only)
+    return;
+
+  filename = _format_segment_filename(self->filename, sequence);
+  if (self->spares < QSEGMENTS_MAX_SPARES)
+    {
+      gchar *spare = _format_spare_filename(self->filename, self->spares);
+
+      if (rename(filename, spare) == 0)
+        self->spares++;
+      else
+        unlink(filename);
+      g_free(spare);
+    }
+  else
+    {
+      unlink(filename);
+    }
+  g_free(filename);
+}
+
+/* disk-buf-size() limits the number of segments, including the one being
+ * filled */
+static gboolean
+_is_segment_avail(QSegments *self)
+{
+  gint64 max_segments = MAX(self->options->disk_buf_size / self->options->segment_size, 2);
+
+  return qsegments_get_segment_count(self) < max_segments;
+}
+
+static gboolean
+_check_record(QSegment *segment, gint64 offset, const gchar **payload, guint32 *len)
+{
+  if (offset + QSEGMENT_RECORD_HEADER_SIZE > segment->size)
+    return FALSE;
+
+  *len = _get_uint32(segment->base + offset);
+  if (*len == QSEGMENT_END_MARKER || offset + QSEGMENT_RECORD_HEADER_SIZE + *len > segment->size)
+    return FALSE;
+
+  *payload = segment->base + offset + QSEGMENT_RECORD_HEADER_SIZE;
+  return _get_uint32(segment->base + offset + sizeof(guint32)) == _record_crc(segment->sequence, *payload, *len);
+}
+
+/* moves pos to the next record, stepping over the end of sealed segments */
+static QSegment *
+_seek_record(QSegments *self, QSegmentsPosition *pos)
+{
+  while (pos->segment <= self->checkpoint->tail_segment)
+    {
+      QSegment *segment = _get_segment(self, pos->segment);
+
+      if (!segment)
+        return NULL;
+
+      if (pos->segment == self->checkpoint->tail_segment ||
+          (pos->offset + QSEGMENT_RECORD_HEADER_SIZE <= segment->size &&
+           _get_uint32(segment->base + pos->offset) != QSEGMENT_END_MARKER))
+        return segment;
+
+      pos->segment++;
+      pos->offset = QSEGMENT_HEADER_SIZE;
+    }
+  return NULL;
+}
+
+static gboolean
+_skip_record(QSegments *self, QSegmentsPosition *pos)
+{
+  QSegment *segment = _seek_record(self, pos);
+  guint32 len;
+
+  if (!segment || pos->offset + QSEGMENT_RECORD_HEADER_SIZE > segment->size)
+    return FALSE;
+
+  len = _get_uint32(segment->base + pos->offset);
+  if (pos->offset + QSEGMENT_RECORD_HEADER_SIZE + len > segment->size)
+    return FALSE;
+
+  pos->offset += QSEGMENT_RECORD_HEADER_SIZE + len;
+  return TRUE;
+}
+
+gboolean
+qsegments_push_tail(QSegments *self, GString *record)
+{
+  QSegmentsCheckpoint *cp = self->checkpoint;
+  gint64 record_size = QSEGMENT_RECORD_HEADER_SIZE + record->len;
+  QSegment *segment;
+  gchar *p;
+
+  if (!qsegments_initialized(self) || record->len >= QSEGMENT_END_MARKER)
+    return FALSE;
+
+  segment = _get_segment(self, cp->tail_segment);
+  if (!segment)
+    return FALSE;
+
+  if (cp->tail_offset + record_size > segment->size)
+    {
+      QSegment *next;
+
+      if (!_is_segment_avail(self))
+        return FALSE;
+
+      next = _create_segment(self, cp->tail_segment + 1, record_size);
+      if (!next)
+        return FALSE;
+
+      /* seal the current one, unless it is so full that readers skip the rest anyway */
+      if (cp->tail_offset + QSEGMENT_RECORD_HEADER_SIZE <= segment->size)
+        _put_uint32(segment->base + cp->tail_offset, QSEGMENT_END_MARKER);
+
+      cp->tail_segment = next->sequence;
+      cp->tail_offset = QSEGMENT_HEADER_SIZE;
+      segment = next;
+    }
+
+  p = segment->base + cp->tail_offset;
+  _put_uint32(p, record->len);
+  _put_uint32(p + sizeof(guint32), _record_crc(segment->sequence, record->str, record->len));
+  memcpy(p + QSEGMENT_RECORD_HEADER_SIZE, record->str, record->len);
+
+  cp->tail_offset += record_size;
+  cp->length++;
+  self->unsynced = TRUE;
+  return TRUE;
+}
+
+gboolean
+qsegments_pop_head(QSegments *self, GString *record)
+{
+  QSegment *segment;
+  const gchar *payload;
+  guint32 len;
+
+  if (qsegments_get_length(self) == 0)
+    return FALSE;
+
+  segment = _seek_record(self, &self->read);
+  if (!segment || !_check_record(segment, self->read.offset, &payload, &len))
+    {
+      msg_error("Invalid record found in disk-queue segment",
+                evt_tag_str("filename", self->filename),
+                evt_tag_long("segment", self->read.segment),
+                evt_tag_long("offset", self->read.offset));
+      return FALSE;
+    }
+
+  g_string_truncate(record, 0);
+  g_string_append_len(record, payload, len);
+
+  self->read.offset += QSEGMENT_RECORD_HEADER_SIZE + len;
+  self->backlog_count++;
+  return TRUE;
+}
+
+static void
+_move_head(QSegments *self, QSegmentsPosition *head)
+{
+  QSegmentsCheckpoint *cp = self->checkpoint;
+  guint64 sequence = cp->head_segment;
+
+  /* the checkpoint must not refer to a segment after it was recycled */
+  cp->head_segment = head->segment;
+  cp->head_offset = head->offset;
+
+  for (; sequence < head->segment; sequence++)
+    _recycle_segment(self, sequence);
+}
+
+void
+qsegments_ack(QSegments *self, gint64 count)
+{
+  QSegmentsCheckpoint *cp = self->checkpoint;
+  QSegmentsPosition head;
+  gint64 acked;
+
+  count = MIN(count, self->backlog_count);
+  if (count <= 0)
+    return;
+
+  head.segment = cp->head_segment;
+  head.offset = cp->head_offset;
+  for (acked = 0; acked < count; acked++)
+    {
+      if (!_skip_record(self, &head))
+        break;
+    }
+
+  /* step over a sealed end, so that the segment behind it can go */
+  if (acked > 0 && head.segment < cp->tail_segment)
+    _seek_record(self, &head);
+
+  /* the reader may still point to the end of the segment we are about to recycle */
+  if (self->read.segment < head.segment)
+    self->read = head;
+
+  _move_head(self, &head);
+  cp->length -= acked;
+  self->backlog_count -= acked;
+}
+
+void
+qsegments_rewind(QSegments *self, gint64 count)
+{
+  QSegmentsPosition pos;
+  gint64 number_of_records_stay_in_backlog;
+
+  count = MIN(count, self->backlog_count);
+  if (count <= 0)
+    return;
+
+  pos.segment = self->checkpoint->head_segment;
+  pos.offset = self->checkpoint->head_offset;
+  number_of_records_stay_in_backlog = self->backlog_count - count;
+
+  for (gint64 i = 0; i < number_of_records_stay_in_backlog; i++)
+    {
+      if (!_skip_record(self, &pos))
+        break;
+    }
+
+  self->read = pos;
+  self->backlog_count = number_of_records_stay_in_backlog;
+}
+
+static gboolean
+_sync_range(QSegment *segment, gint64 from, gint64 to)
+{
+  gint64 start = from - from % sysconf(_SC_PAGESIZE);
+
+  if (to <= start)
+    return TRUE;
+  return msync(segment->base + start, to - start, MS_SYNC) == 0;
+}
+
+/* syncs the records pushed since the last commit, as configured by sync() */
+gboolean
+qsegments_commit(QSegments *self)
+{
+  QSegmentsCheckpoint *cp = self->checkpoint;
+  gboolean success = TRUE;
+
+  if (self->options->read_only || !self->unsynced ||
+      !disk_queue_options_is_sync_due(self->options, &self->last_sync))
+    return TRUE;
+
+  /* data first, so that the checkpoint never refers to records that are not on the disk */
+  for (guint64 sequence = MAX(self->synced.segment, cp->head_segment); sequence <= cp->tail_segment; sequence++)
+    {
+      QSegment *segment = g_hash_table_lookup(self->segments, &sequence);
+      gint64 from, to;
+
+      if (!segment)
+        continue;
+
+      from = (sequence == self->synced.segment) ? self->synced.offset : 0;
+      to = (sequence == cp->tail_segment) ? cp->tail_offset : segment->size;
+      success = _sync_range(segment, from, to) && success;
+    }
+  success = success && msync(cp, sizeof(*cp), MS_SYNC) == 0;
+
+  if (!success)
+    {
+      msg_error("Error syncing disk-queue segments",
+                evt_tag_error("error"),
+                evt_tag_str("filename", self->filename));
+      return FALSE;
+    }
+
+  self->synced.segment = cp->tail_segment;
+  self->synced.offset = cp->tail_offset;
+  self->unsynced = FALSE;
+  cached_g_current_time(&self->last_sync);
+  return TRUE;
+}
+
+static gboolean
+_init_checkpoint(QSegments *self)
+{
+  QSegmentsCheckpoint *cp = self->checkpoint;
+
+  memcpy(cp->magic, QSEGMENTS_FILE_ID, 4);
+  cp->version = 1;
+  cp->big_endian = (G_BYTE_ORDER == G_BIG_ENDIAN);
+  cp->head_segment = cp->tail_segment = 0;
+  cp->head_offset = cp->tail_offset = QSEGMENT_HEADER_SIZE;
+  cp->length = 0;
+
+  return _create_segment(self, 0, 0) != NULL;
+}
+
+/* records pushed after the checkpoint last made it to the disk are
+ * recovered by validating whatever follows the recorded tail */
+static gboolean
+_recover_tail(QSegments *self)
+{
+  QSegmentsCheckpoint *cp = self->checkpoint;
+  QSegment *segment = _get_segment(self, cp->tail_segment);
+  const gchar *payload;
+  guint32 len;
+
+  if (!segment)
+    return FALSE;
+
+  while (_check_record(segment, cp->tail_offset, &payload, &len))
+    {
+      cp->tail_offset += QSEGMENT_RECORD_HEADER_SIZE + len;
+      cp->length++;
+    }
+  return TRUE;
+}
+
+static gboolean
+_load_checkpoint(QSegments *self)
+{
+  QSegmentsCheckpoint *cp = self->checkpoint;
+
+  if (memcmp(cp->magic, QSEGMENTS_FILE_ID, 4) != 0 || cp->version != 1 ||
+      cp->head_segment > cp->tail_segment || cp->length < 0)
+    {
+      msg_error("Invalid disk-queue file header",
+                evt_tag_str("filename", self->filename));
+      return FALSE;
+    }
+
+  if (cp->big_endian != (G_BYTE_ORDER == G_BIG_ENDIAN))
+    {
+      msg_error("Disk-queue file was written on a host with a different byte order",
+                evt_tag_str("filename", self->filename));
+      return FALSE;
+    }
+
+  return _recover_tail(self);
+}
+
+gboolean
+qsegments_start(QSegments *self, const gchar *filename)
+{
+  gboolean new_file = FALSE;
+  struct stat st;
+  gint openflags;
+  gpointer p;
+
+  g_assert(!qsegments_initialized(self));
+
+  if (self->options->disk_buf_size <= 0)
+    return TRUE;
+
+  if (self->options->read_only && !filename)
+    return FALSE;
+
+  if (!filename)
+    {
+      new_file = TRUE;
+      self->filename = _next_filename(self);
+      if (!self->filename)
+        return FALSE;
+    }
+  else
+    {
+      new_file = (stat(filename, &st) < 0);
+      self->filename = g_strdup(filename);
+    }
+
+  openflags = self->options->read_only ? (O_RDONLY | O_LARGEFILE) : (O_RDWR | O_LARGEFILE | (new_file ? O_CREAT : 0));
+  self->fd = open(self->filename, openflags, 0600);
+  if (self->fd < 0)
+    {
+      msg_error("Error opening disk-queue file",
+                evt_tag_str("filename", self->filename),
+                evt_tag_error("error"));
+      goto error;
+    }
+
+  if (new_file ? (ftruncate(self->fd, sizeof(QSegmentsCheckpoint)) < 0)
+      : (fstat(self->fd, &st) < 0 || st.st_size < (off_t) sizeof(QSegmentsCheckpoint)))
+    {
+      msg_error("Error loading disk-queue file",
+                evt_tag_str("filename", self->filename),
+                evt_tag_error("error"));
+      goto error;
+    }
+
+  p = mmap(0, sizeof(QSegmentsCheckpoint), self->options->read_only ? (PROT_READ) : (PROT_READ | PROT_WRITE),
+           MAP_SHARED, self->fd, 0);
+  if (p == MAP_FAILED)
+    {
+      msg_error("Error returned by mmap",
+                evt_tag_error("errno"),
+                evt_tag_str("filename", self->filename));
+      goto error;
+    }
+
+  if (self->options->read_only)
+    {
+      self->checkpoint = g_memdup(p, sizeof(QSegmentsCheckpoint));
+      munmap(p, sizeof(QSegmentsCheckpoint));
+    }
+  else
+    {
+      self->checkpoint = p;
+    }
+
+  self->spares = _count_spares(self);
+  if (!(new_file ? _init_checkpoint(self) : _load_checkpoint(self)))
+    goto error;
+
+  self->read.segment = self->checkpoint->head_segment;
+  self->read.offset = self->checkpoint->head_offset;
+  self->backlog_count = 0;
+  self->synced.segment = self->checkpoint->tail_segment;
+  self->synced.offset = self->checkpoint->tail_offset;
+  self->unsynced = FALSE;
+  cached_g_current_time(&self->last_sync);
+
+  msg_info("Segmented disk-buffer state loaded",
+           evt_tag_str("filename", self->filename),
+           evt_tag_long("queue_length", self->checkpoint->length),
+           evt_tag_long("segments", qsegments_get_segment_count(self)));
+  return TRUE;
+
+error:
+  qsegments_stop(self);
+  return FALSE;
+}
+
+void
+qsegments_stop(QSegments *self)
+{
+  if (qsegments_initialized(self) && self->checkpoint)
+    qsegments_commit(self);
+
+  g_hash_table_remove_all(self->segments);
+
+  if (self->checkpoint)
+    {
+      if (self->options->read_only)
+        g_free(self->checkpoint);
+      else
+        munmap((void *) self->checkpoint, sizeof(QSegmentsCheckpoint));
+      self->checkpoint = NULL;
+    }
+
+  if (self->fd != -1)
+    {
+      close(self->fd);
+      self->fd = -1;
+    }
+
+  g_free(self->filename);
+  self->filename = NULL;
+}
+
+static void
+_rename_to_corrupted(const gchar *filename)
+{
+  gchar *new_file = g_strdup_printf("%s.corrupted", filename);
+
+  rename(filename, new_file);
+  g_free(new_file);
+}
+
+/* moves the queue files out of the way and starts an empty queue */
+void
+qsegments_restart_corrupted(QSegments *self)
+{
+  gchar *filename = g_strdup(self->filename);
+  guint64 head_segment = self->checkpoint->head_segment;
+  guint64 tail_segment = self->checkpoint->tail_segment;
+
+  qsegments_stop(self);
+
+  /* reading a copy of the queue, there is nothing to recover to */
+  if (self->options->read_only)
+    {
+      g_free(filename);
+      return;
+    }
+
+  _rename_to_corrupted(filename);
+  for (guint64 sequence = head_segment; sequence <= tail_segment; sequence++)
+    {
+      gchar *segment_filename = _format_segment_filename(filename, sequence);
+
+      _rename_to_corrupted(segment_filename);
+      g_free(segment_filename);
+    }
+
+  qsegments_start(self, filename);
+  g_free(filename);
+}
+
+gboolean
+qsegments_initialized(QSegments *self)
+{
+  return self->fd >= 0;
+}
+
+gint64
+qsegments_get_length(QSegments *self)
+{
+  if (!self->checkpoint)
+    return 0;
+  return self->checkpoint->length - self->backlog_count;
+}
+
+gint64
+qsegments_get_backlog_count(QSegments *self)
+{
+  return self->backlog_count;
+}
+
+gint64
+qsegments_get_segment_count(QSegments *self)
+{
+  if (!self->checkpoint)
+    return 0;
+  return self->checkpoint->tail_segment - self->checkpoint->head_segment + 1;
+}
+
+const gchar *
+qsegments_get_filename(QSegments *self)
+{
+  return self->filename;
+}
+
+QSegments *
+qsegments_new(DiskQueueOptions *options)
+{
+  static GOnce crc32_table_once = G_ONCE_INIT;
+  QSegments *self = g_new0(QSegments, 1);
+
+  g_once(&crc32_table_once, _crc32_init_table, NULL);
+
+  self->options = options;
+  self->fd = -1;
+  self->segments = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, (GDestroyNotify) _segment_free);
+  return self;
+}
+
+void
+qsegments_free(QSegments *self)
+{
+  qsegments_stop(self);
+  g_hash_table_destroy(self->segments);
+  g_free(self);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+
+#ifndef QSEGMENTS_H_
+#define QSEGMENTS_H_
+
+#include "syslog-ng.h"
+#include "diskq-options.h"
+
+#define QSEGMENTS_FILE_ID "SLSQ"
+
+/*
+ * Segmented disk queue storage: records are appended to fixed size,
+ * mmapped segment files, each record carrying its own CRC.  Segments are
+ * recycled as soon as all of their records are acknowledged.  The queue
+ * positions are kept in a small, mmapped checkpoint file that is updated
+ * as records are pushed and acked, so neither starting nor stopping the
+ * queue needs to walk its contents.
+ */
+typedef struct _QSegments QSegments;
+
+QSegments *qsegments_new(DiskQueueOptions *options);
+void qsegments_free(QSegments *self);
+
+gboolean qsegments_start(QSegments *self, const gchar *filename);
+void qsegments_stop(QSegments *self);
+void qsegments_restart_corrupted(QSegments *self);
+gboolean qsegments_initialized(QSegments *self);
+
+gboolean qsegments_push_tail(QSegments *self, GString *record);
+gboolean qsegments_pop_head(QSegments *self, GString *record);
+void qsegments_ack(QSegments *self, gint64 count);
+void qsegments_rewind(QSegments *self, gint64 count);
+gboolean qsegments_commit(QSegments *self);
+
+gint64 qsegments_get_length(QSegments *self);
+gint64 qsegments_get_backlog_count(QSegments *self);
+gint64 qsegments_get_segment_count(QSegments *self);
+const gchar *qsegments_get_filename(QSegments *self);
+
+#endif /* QSEGMENTS_H_ */
@@ -317,6 +317,69 @@ testcase_with_threads(void)
   fprintf(stderr, "Feed speed: %.2lf\n", (double) TEST_RUNS * MESSAGES_SUM * 1000000 / sum_time);
 }
 
+static gint64
+_get_file_size(const gchar *filename)
+{
+  struct stat st;
+
+  if (stat(filename, &st) < 0)
+    return -1;
+  return st.st_size;
+}
+
+static gpointer
+threaded_feed_one_batch(gpointer args)
+{
+  LogQueue *q = (LogQueue *) args;
+  const gchar *filename = log_queue_disk_get_filename(q);
+
+  iv_init();
+  main_loop_worker_thread_start(NULL);
+
+  feed_some_messages(q, 10, &parse_options);
+
+  assert_gint(acked_messages, 0, "%s: messages were acked before their group was committed\n", __FUNCTION__);
+  assert_gint64(_get_file_size(filename), QDISK_RESERVED_SPACE,
+                "%s: records were written before the end of the batch\n", __FUNCTION__);
+
+  main_loop_worker_invoke_batch_callbacks();
+
+  assert_gint(acked_messages, fed_messages, "%s: messages were not acked after commit\n", __FUNCTION__);
+  assert_true(_get_file_size(filename) > QDISK_RESERVED_SPACE,
+              "%s: records were not written at the end of the batch\n", __FUNCTION__);
+
+  main_loop_worker_thread_stop();
+  return NULL;
+}
+
+static void
+testcase_sync_batch_acks_after_commit(void)
+{
+  LogQueue *q;
+  DiskQueueOptions options = {0};
+  const gchar *filename = "test-sync-batch.rqf";
+
+  _construct_options(&options, 10000000, 100000, TRUE);
+  options.sync_mode = DISKQ_SYNC_BATCH;
+  log_queue_set_max_threads(FEEDERS);
+
+  q = log_queue_disk_reliable_new(&options, NULL);
+  log_queue_set_use_backlog(q, TRUE);
+  unlink(filename);
+  log_queue_disk_load_queue(q, filename);
+
+  fed_messages = 0;
+  acked_messages = 0;
+  g_thread_join(g_thread_create(threaded_feed_one_batch, q, TRUE, NULL));
+
+  send_some_messages(q, fed_messages);
+  app_ack_some_messages(q, fed_messages);
+
+  log_queue_unref(q);
+  unlink(filename);
+  disk_queue_options_destroy(&options);
+}
+
 static void
 testcase_diskbuffer_restart_corrupted(void)
 {
@@ -593,6 +656,7 @@ main(void)
   testcase_zero_diskbuf_alternating_send_acks();
   testcase_zero_diskbuf_and_normal_acks();
   testcase_diskbuffer_restart_corrupted();
+  testcase_sync_batch_acks_after_commit();
 
   return 0;
 }
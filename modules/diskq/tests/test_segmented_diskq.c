@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+
+#include "test_diskq_tools.h"
+#include "testutils.h"
+#include "logqueue-disk-segmented.h"
+#include "apphook.h"
+#include "plugin.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define FILENAME "test_segmented_diskq.sqf"
+#define NUMBER_OF_MESSAGES 300
+/* large enough to spread the messages over several segments */
+#define PADDING_SIZE 1000
+
+MsgFormatOptions parse_options;
+DiskQueueOptions options;
+
+static gint num_of_ack;
+
+static void
+_dummy_ack(LogMessage *lm, AckType ack_type)
+{
+  num_of_ack++;
+}
+
+static gchar *
+_segment_filename(guint64 sequence)
+{
+  return g_strdup_printf("%s.%08" G_GINT64_MODIFIER "x", FILENAME, sequence);
+}
+
+static gboolean
+_file_exists(const gchar *filename)
+{
+  struct stat st;
+
+  return stat(filename, &st) == 0;
+}
+
+static void
+_remove_queue_files(void)
+{
+  gchar *filename;
+
+  unlink(FILENAME);
+  for (gint i = 0; i < 64; i++)
+    {
+      filename = _segment_filename(i);
+      unlink(filename);
+      g_free(filename);
+    }
+  unlink(FILENAME ".spare0");
+  unlink(FILENAME ".spare1");
+  unlink(FILENAME ".corrupted");
+  unlink(FILENAME ".00000000.corrupted");
+}
+
+static LogQueueDiskSegmented *
+_create_queue(gint64 disk_buf_size)
+{
+  LogQueue *q;
+
+  _construct_options(&options, disk_buf_size, 0, TRUE);
+  options.segmented = TRUE;
+  options.segment_size = MIN_SEGMENT_SIZE;
+
+  q = log_queue_disk_segmented_new(&options, NULL);
+  assert_true(log_queue_disk_load_queue(q, FILENAME), ASSERTION_ERROR("Can't start segmented queue"));
+  q->use_backlog = TRUE;
+  return (LogQueueDiskSegmented *) q;
+}
+
+static void
+_feed_messages(LogQueueDiskSegmented *dq, gint from, gint count)
+{
+  gchar *padding = g_strnfill(PADDING_SIZE, 'x');
+
+  for (gint i = from; i < from + count; i++)
+    {
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      LogMessage *msg = log_msg_new_empty();
+      gchar *value = g_strdup_printf("message %05d %s", i, padding);
+
+      log_msg_set_value(msg, LM_V_MSG, value, -1);
+      msg->ack_func = _dummy_ack;
+      log_msg_add_ack(msg, &path_options);
+      log_queue_push_tail(&dq->super.super, msg, &path_options);
+      g_free(value);
+    }
+  g_free(padding);
+}
+
+static void
+_consume_messages(LogQueueDiskSegmented *dq, gint from, gint count)
+{
+  for (gint i = from; i < from + count; i++)
+    {
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      LogMessage *msg = log_queue_pop_head(&dq->super.super, &path_options);
+      gchar *expected = g_strdup_printf("message %05d ", i);
+
+      assert_true(msg != NULL, ASSERTION_ERROR("Can't read message from queue"));
+      assert_true(g_str_has_prefix(log_msg_get_value(msg, LM_V_MSG, NULL), expected),
+                  ASSERTION_ERROR("Messages are read in bad order"));
+      log_msg_unref(msg);
+      g_free(expected);
+    }
+}
+
+static void
+test_push_pop_ack_over_segments(void)
+{
+  LogQueueDiskSegmented *dq;
+  gchar *first_segment = _segment_filename(0);
+
+  _remove_queue_files();
+  num_of_ack = 0;
+  dq = _create_queue(NUMBER_OF_MESSAGES * PADDING_SIZE * 2);
+
+  _feed_messages(dq, 0, NUMBER_OF_MESSAGES);
+  assert_gint(num_of_ack, NUMBER_OF_MESSAGES, ASSERTION_ERROR("Messages aren't acked after written to disk"));
+  assert_gint(log_queue_get_length(&dq->super.super), NUMBER_OF_MESSAGES, ASSERTION_ERROR("Bad queue length"));
+  assert_true(qsegments_get_segment_count(dq->qsegments) > 2, ASSERTION_ERROR("Messages are not spread over segments"));
+
+  _consume_messages(dq, 0, NUMBER_OF_MESSAGES);
+  assert_gint(log_queue_get_length(&dq->super.super), 0, ASSERTION_ERROR("Queue isn't empty"));
+  assert_gint(qsegments_get_backlog_count(dq->qsegments), NUMBER_OF_MESSAGES,
+              ASSERTION_ERROR("Messages aren't in the backlog"));
+  assert_true(_file_exists(first_segment), ASSERTION_ERROR("Segment is recycled before it is acked"));
+
+  log_queue_ack_backlog(&dq->super.super, NUMBER_OF_MESSAGES);
+  assert_gint(qsegments_get_backlog_count(dq->qsegments), 0, ASSERTION_ERROR("Backlog isn't empty"));
+  assert_gint(qsegments_get_segment_count(dq->qsegments), 1, ASSERTION_ERROR("Acked segments aren't recycled"));
+  assert_false(_file_exists(first_segment), ASSERTION_ERROR("Acked segment still exists"));
+  assert_true(_file_exists(FILENAME ".spare0"), ASSERTION_ERROR("Acked segment isn't kept for reuse"));
+
+  /* the spare segments are reused */
+  _feed_messages(dq, 0, NUMBER_OF_MESSAGES);
+  assert_false(_file_exists(FILENAME ".spare0"), ASSERTION_ERROR("Spare segment isn't reused"));
+  _consume_messages(dq, 0, NUMBER_OF_MESSAGES);
+
+  log_queue_unref(&dq->super.super);
+  _remove_queue_files();
+  g_free(first_segment);
+}
+
+static void
+test_rewind_backlog(void)
+{
+  LogQueueDiskSegmented *dq;
+
+  _remove_queue_files();
+  dq = _create_queue(NUMBER_OF_MESSAGES * PADDING_SIZE * 2);
+
+  _feed_messages(dq, 0, NUMBER_OF_MESSAGES);
+  _consume_messages(dq, 0, NUMBER_OF_MESSAGES);
+  log_queue_ack_backlog(&dq->super.super, 10);
+
+  log_queue_rewind_backlog(&dq->super.super, 100);
+  assert_gint(log_queue_get_length(&dq->super.super), 100, ASSERTION_ERROR("Bad queue length after rewind"));
+  assert_gint(qsegments_get_backlog_count(dq->qsegments), NUMBER_OF_MESSAGES - 110,
+              ASSERTION_ERROR("Bad backlog length after rewind"));
+  _consume_messages(dq, NUMBER_OF_MESSAGES - 100, 100);
+
+  log_queue_rewind_backlog_all(&dq->super.super);
+  assert_gint(log_queue_get_length(&dq->super.super), NUMBER_OF_MESSAGES - 10,
+              ASSERTION_ERROR("Bad queue length after rewinding the whole backlog"));
+  _consume_messages(dq, 10, NUMBER_OF_MESSAGES - 10);
+
+  log_queue_unref(&dq->super.super);
+  _remove_queue_files();
+}
+
+static void
+test_restart_keeps_unacked_messages(void)
+{
+  LogQueueDiskSegmented *dq;
+  gboolean persistent;
+
+  _remove_queue_files();
+  dq = _create_queue(NUMBER_OF_MESSAGES * PADDING_SIZE * 2);
+
+  _feed_messages(dq, 0, NUMBER_OF_MESSAGES);
+  _consume_messages(dq, 0, 150);
+  log_queue_ack_backlog(&dq->super.super, 100);
+
+  assert_true(log_queue_disk_save_queue(&dq->super.super, &persistent), ASSERTION_ERROR("Can't save queue"));
+  assert_true(persistent, ASSERTION_ERROR("Segmented queue isn't persistent"));
+  log_queue_unref(&dq->super.super);
+
+  /* the 50 messages left in the backlog are delivered again */
+  dq = _create_queue(NUMBER_OF_MESSAGES * PADDING_SIZE * 2);
+  assert_gint(log_queue_get_length(&dq->super.super), NUMBER_OF_MESSAGES - 100,
+              ASSERTION_ERROR("Bad queue length after restart"));
+  _consume_messages(dq, 100, NUMBER_OF_MESSAGES - 100);
+
+  log_queue_unref(&dq->super.super);
+  _remove_queue_files();
+}
+
+static void
+test_queue_full(void)
+{
+  LogQueueDiskSegmented *dq;
+
+  _remove_queue_files();
+  num_of_ack = 0;
+  /* room for two segments only */
+  dq = _create_queue(2 * MIN_SEGMENT_SIZE);
+
+  _feed_messages(dq, 0, NUMBER_OF_MESSAGES);
+  assert_gint(qsegments_get_segment_count(dq->qsegments), 2, ASSERTION_ERROR("Segment limit isn't respected"));
+  assert_true(log_queue_get_length(&dq->super.super) < NUMBER_OF_MESSAGES, ASSERTION_ERROR("Messages aren't dropped"));
+  assert_gint(num_of_ack, NUMBER_OF_MESSAGES, ASSERTION_ERROR("Dropped messages aren't acked"));
+
+  log_queue_unref(&dq->super.super);
+  _remove_queue_files();
+}
+
+static void
+test_corrupted_record_restarts_queue(void)
+{
+  LogQueueDiskSegmented *dq;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  gchar *first_segment = _segment_filename(0);
+  gint fd;
+
+  _remove_queue_files();
+  dq = _create_queue(NUMBER_OF_MESSAGES * PADDING_SIZE * 2);
+  _feed_messages(dq, 0, 10);
+
+  /* flip a byte in the payload of the first record */
+  fd = open(first_segment, O_RDWR);
+  assert_true(fd >= 0, ASSERTION_ERROR("Can't open segment"));
+  assert_gint(pwrite(fd, "\xff", 1, 100), 1, ASSERTION_ERROR("Can't corrupt segment"));
+  close(fd);
+
+  assert_true(log_queue_pop_head(&dq->super.super, &path_options) == NULL,
+              ASSERTION_ERROR("Corrupted record is returned"));
+  assert_gint(log_queue_get_length(&dq->super.super), 0, ASSERTION_ERROR("Corrupted queue isn't dropped"));
+  assert_true(_file_exists(FILENAME ".corrupted"), ASSERTION_ERROR("Corrupted queue file isn't kept"));
+  assert_true(_file_exists(FILENAME ".00000000.corrupted"), ASSERTION_ERROR("Corrupted segment isn't kept"));
+
+  _feed_messages(dq, 0, 10);
+  _consume_messages(dq, 0, 10);
+
+  log_queue_unref(&dq->super.super);
+  _remove_queue_files();
+  g_free(first_segment);
+}
+
+gint
+main(gint argc, gchar **argv)
+{
+  app_startup();
+
+  configuration = cfg_new_snippet();
+  cfg_load_module(configuration, "syslogformat");
+  cfg_load_module(configuration, "disk-buffer");
+  msg_format_options_defaults(&parse_options);
+  msg_format_options_init(&parse_options, configuration);
+
+  test_push_pop_ack_over_segments();
+  test_rewind_backlog();
+  test_restart_keeps_unacked_messages();
+  test_queue_full();
+  test_corrupted_record_restarts_queue();
+
+  cfg_free(configuration);
+  app_shutdown();
+  return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "http-loadbalancer.h"
+#include "timeutils.h"
+#include "messages.h"
+
+#include <string.h>
+
+void
+http_load_balancer_add_target(HTTPLoadBalancer *self, const gchar *url)
+{
+  HTTPLoadBalancerTarget *target;
+
+  self->targets = g_renew(HTTPLoadBalancerTarget, self->targets, self->num_targets + 1);
+  target = &self->targets[self->num_targets];
+  memset(target, 0, sizeof(*target));
+  target->url = g_strdup(url);
+  target->index = self->num_targets;
+  target->state = HTTP_TARGET_OPERATIONAL;
+  self->num_targets++;
+}
+
+void
+http_load_balancer_drop_all_targets(HTTPLoadBalancer *self)
+{
+  for (gint i = 0; i < self->num_targets; i++)
+    g_free(self->targets[i].url);
+  g_free(self->targets);
+  self->targets = NULL;
+  self->num_targets = 0;
+  self->num_failed_targets = 0;
+  self->next_target = 0;
+}
+
+gboolean
+http_load_balancer_set_method(HTTPLoadBalancer *self, const gchar *method)
+{
+  if (strcmp(method, "round-robin") == 0 || strcmp(method, "round_robin") == 0)
+    self->method = HTTP_LB_ROUND_ROBIN;
+  else if (strcmp(method, "least-outstanding") == 0 || strcmp(method, "least_outstanding") == 0)
+    self->method = HTTP_LB_LEAST_OUTSTANDING;
+  else
+    return FALSE;
+  return TRUE;
+}
+
+void
+http_load_balancer_set_recovery_timeout(HTTPLoadBalancer *self, gint recovery_timeout)
+{
+  self->recovery_timeout = recovery_timeout;
+}
+
+/* NOTE: lock must be held */
+static HTTPLoadBalancerTarget *
+_choose_target_to_probe(HTTPLoadBalancer *self, time_t now)
+{
+  for (gint i = 0; i < self->num_targets; i++)
+    {
+      HTTPLoadBalancerTarget *target = &self->targets[i];
+
+      if (target->state == HTTP_TARGET_FAILED && now - target->last_failure_time >= self->recovery_timeout)
+        {
+          /* restart the timer, so that only a single request probes the
+           * target until its result arrives */
+          target->last_failure_time = now;
+          return target;
+        }
+    }
+  return NULL;
+}
+
+/* NOTE: lock must be held */
+static HTTPLoadBalancerTarget *
+_choose_operational_target(HTTPLoadBalancer *self)
+{
+  HTTPLoadBalancerTarget *chosen = NULL;
+
+  /* starting at next_target distributes requests evenly among targets
+   * with the same number of outstanding requests too */
+  for (gint i = 0; i < self->num_targets; i++)
+    {
+      HTTPLoadBalancerTarget *target = &self->targets[(self->next_target + i) % self->num_targets];
+
+      if (target->state != HTTP_TARGET_OPERATIONAL)
+        continue;
+
+      if (self->method == HTTP_LB_ROUND_ROBIN)
+        {
+          chosen = target;
+          break;
+        }
+
+      if (!chosen || target->outstanding_requests < chosen->outstanding_requests)
+        chosen = target;
+    }
+
+  if (chosen)
+    self->next_target = (chosen->index + 1) % self->num_targets;
+  return chosen;
+}
+
+/* NOTE: lock must be held */
+static HTTPLoadBalancerTarget *
+_choose_least_recently_failed_target(HTTPLoadBalancer *self)
+{
+  HTTPLoadBalancerTarget *chosen = &self->targets[0];
+
+  for (gint i = 1; i < self->num_targets; i++)
+    {
+      if (self->targets[i].last_failure_time < chosen->last_failure_time)
+        chosen = &self->targets[i];
+    }
+  return chosen;
+}
+
+HTTPLoadBalancerTarget *
+http_load_balancer_choose_target(HTTPLoadBalancer *self)
+{
+  HTTPLoadBalancerTarget *target = NULL;
+
+  g_assert(self->num_targets > 0);
+
+  g_static_mutex_lock(&self->lock);
+  if (self->num_failed_targets > 0)
+    target = _choose_target_to_probe(self, cached_g_current_time_sec());
+  if (!target)
+    target = _choose_operational_target(self);
+  if (!target)
+    target = _choose_least_recently_failed_target(self);
+
+  target->outstanding_requests++;
+  g_static_mutex_unlock(&self->lock);
+  return target;
+}
+
+void
+http_load_balancer_release_target(HTTPLoadBalancer *self, HTTPLoadBalancerTarget *target)
+{
+  g_static_mutex_lock(&self->lock);
+  g_assert(target->outstanding_requests > 0);
+  target->outstanding_requests--;
+  g_static_mutex_unlock(&self->lock);
+}
+
+void
+http_load_balancer_set_target_successful(HTTPLoadBalancer *self, HTTPLoadBalancerTarget *target)
+{
+  g_static_mutex_lock(&self->lock);
+  if (target->state == HTTP_TARGET_FAILED)
+    {
+      msg_notice("http: target recovered, putting it back into rotation",
+                 evt_tag_str("url", target->url));
+      target->state = HTTP_TARGET_OPERATIONAL;
+      self->num_failed_targets--;
+    }
+  g_static_mutex_unlock(&self->lock);
+}
+
+void
+http_load_balancer_set_target_failed(HTTPLoadBalancer *self, HTTPLoadBalancerTarget *target)
+{
+  g_static_mutex_lock(&self->lock);
+  if (target->state == HTTP_TARGET_OPERATIONAL)
+    {
+      msg_warning("http: target failed, ejecting it temporarily",
+                  evt_tag_str("url", target->url),
+                  evt_tag_int("recovery_timeout", self->recovery_timeout));
+      target->state = HTTP_TARGET_FAILED;
+      self->num_failed_targets++;
+    }
+  target->last_failure_time = cached_g_current_time_sec();
+  g_static_mutex_unlock(&self->lock);
+}
+
+gboolean
+http_load_balancer_has_operational_targets(HTTPLoadBalancer *self)
+{
+  gboolean result;
+
+  g_static_mutex_lock(&self->lock);
+  result = self->num_failed_targets < self->num_targets;
+  g_static_mutex_unlock(&self->lock);
+  return result;
+}
+
+HTTPLoadBalancer *
+http_load_balancer_new(void)
+{
+  HTTPLoadBalancer *self = g_new0(HTTPLoadBalancer, 1);
+
+  g_static_mutex_init(&self->lock);
+  self->method = HTTP_LB_ROUND_ROBIN;
+  self->recovery_timeout = HTTP_DEFAULT_RECOVERY_TIMEOUT;
+  return self;
+}
+
+void
+http_load_balancer_free(HTTPLoadBalancer *self)
+{
+  http_load_balancer_drop_all_targets(self);
+  g_static_mutex_free(&self->lock);
+  g_free(self);
+}
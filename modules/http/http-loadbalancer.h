@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef HTTP_LOADBALANCER_H_INCLUDED
+#define HTTP_LOADBALANCER_H_INCLUDED 1
+
+#include "syslog-ng.h"
+
+#define HTTP_DEFAULT_RECOVERY_TIMEOUT 60
+
+typedef enum
+{
+  HTTP_LB_ROUND_ROBIN,
+  HTTP_LB_LEAST_OUTSTANDING,
+} HTTPLoadBalancingMethod;
+
+typedef enum
+{
+  HTTP_TARGET_OPERATIONAL,
+  HTTP_TARGET_FAILED,
+} HTTPLoadBalancerTargetState;
+
+typedef struct _HTTPLoadBalancerTarget
+{
+  gchar *url;
+  gint index;
+  HTTPLoadBalancerTargetState state;
+  gint outstanding_requests;
+  time_t last_failure_time;
+} HTTPLoadBalancerTarget;
+
+/* Distributes requests among a set of targets (URLs).  It is shared by the
+ * workers of a driver, so all methods are thread safe.
+ *
+ * A target returned by choose_target() counts as an outstanding request
+ * until it is passed to release_target().  The outcome of the request is
+ * reported using set_target_successful()/set_target_failed(), requests
+ * that are abandoned are simply released.
+ *
+ * A target that fails is ejected: no requests are sent to it until
+ * recovery_timeout elapses, after which a single request is sent to it as
+ * a probe.  If the probe succeeds, the target is put back into rotation,
+ * otherwise the timeout starts again.  If all targets are failed, requests
+ * go to the one that failed the longest time ago. */
+typedef struct _HTTPLoadBalancer
+{
+  GStaticMutex lock;
+  HTTPLoadBalancerTarget *targets;
+  gint num_targets;
+  gint num_failed_targets;
+  gint next_target;
+  HTTPLoadBalancingMethod method;
+  gint recovery_timeout;
+} HTTPLoadBalancer;
+
+void http_load_balancer_add_target(HTTPLoadBalancer *self, const gchar *url);
+void http_load_balancer_drop_all_targets(HTTPLoadBalancer *self);
+gboolean http_load_balancer_set_method(HTTPLoadBalancer *self, const gchar *method);
+void http_load_balancer_set_recovery_timeout(HTTPLoadBalancer *self, gint recovery_timeout);
+
+HTTPLoadBalancerTarget *http_load_balancer_choose_target(HTTPLoadBalancer *self);
+void http_load_balancer_release_target(HTTPLoadBalancer *self, HTTPLoadBalancerTarget *target);
+void http_load_balancer_set_target_successful(HTTPLoadBalancer *self, HTTPLoadBalancerTarget *target);
+void http_load_balancer_set_target_failed(HTTPLoadBalancer *self, HTTPLoadBalancerTarget *target);
+gboolean http_load_balancer_has_operational_targets(HTTPLoadBalancer *self);
+
+HTTPLoadBalancer *http_load_balancer_new(void);
+void http_load_balancer_free(HTTPLoadBalancer *self);
+
+#endif
@@ -47,6 +47,14 @@ static CfgLexerKeyword http_keywords[] =
   { "peer_verify",  KW_PEER_VERIFY },
   { "timeout",      KW_TIMEOUT },
   { "tls",          KW_TLS },
+  { "batch_bytes",  KW_BATCH_BYTES },
+  { "body_prefix",  KW_BODY_PREFIX },
+  { "body_suffix",  KW_BODY_SUFFIX },
+  { "delimiter",    KW_DELIMITER },
+  { "compression",  KW_COMPRESSION },
+  { "max_in_flight", KW_MAX_IN_FLIGHT },
+  { "load_balancing", KW_LOAD_BALANCING },
+  { "recovery_timeout", KW_RECOVERY_TIMEOUT },
   { NULL }
 };
 
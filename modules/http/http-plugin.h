@@ -27,12 +27,20 @@
 #define METHOD_TYPE_POST 1
 #define METHOD_TYPE_PUT  2
 
+#define HTTP_COMPRESSION_NONE    0
+#define HTTP_COMPRESSION_GZIP    1
+#define HTTP_COMPRESSION_DEFLATE 2
+
+#define HTTP_DEFAULT_DELIMITER "\n"
+
 #include "logthrdestdrv.h"
+#include "http-loadbalancer.h"
 
 typedef struct
 {
   LogThreadedDestDriver super;
-  gchar *curl;
+  HTTPLoadBalancer *load_balancer;
+  /* the first target, used to name the persistent state and the stats */
   gchar *url;
   gchar *user;
   gchar *password;
@@ -49,12 +57,18 @@ typedef struct
   glong timeout;
   LogTemplate *body_template;
   LogTemplateOptions template_options;
+  glong batch_bytes;
+  gchar *body_prefix;
+  gchar *body_suffix;
+  gchar *delimiter;
+  short int compression;
+  gint max_in_flight;
 } HTTPDestinationDriver;
 
 gboolean http_dd_init(LogPipe *s);
 gboolean http_dd_deinit(LogPipe *s);
 LogDriver *http_dd_new(GlobalConfig *cfg);
-void http_dd_set_url(LogDriver *d, const gchar *url);
+void http_dd_set_urls(LogDriver *d, GList *urls);
 void http_dd_set_user(LogDriver *d, const gchar *user);
 void http_dd_set_password(LogDriver *d, const gchar *password);
 void http_dd_set_method(LogDriver *d, const gchar *method);
@@ -69,6 +83,14 @@ void http_dd_set_cipher_suite(LogDriver *d, const gchar *ciphers);
 void http_dd_set_ssl_version(LogDriver *d, const gchar *value);
 void http_dd_set_peer_verify(LogDriver *d, gboolean verify);
 void http_dd_set_timeout(LogDriver *d, glong timeout);
+void http_dd_set_batch_bytes(LogDriver *d, glong batch_bytes);
+void http_dd_set_body_prefix(LogDriver *d, const gchar *body_prefix);
+void http_dd_set_body_suffix(LogDriver *d, const gchar *body_suffix);
+void http_dd_set_delimiter(LogDriver *d, const gchar *delimiter);
+gboolean http_dd_set_compression(LogDriver *d, const gchar *compression);
+void http_dd_set_max_in_flight(LogDriver *d, gint max_in_flight);
+gboolean http_dd_set_load_balancing(LogDriver *d, const gchar *method);
+void http_dd_set_recovery_timeout(LogDriver *d, gint recovery_timeout);
 LogTemplateOptions *http_dd_get_template_options(LogDriver *d);
 
 #endif
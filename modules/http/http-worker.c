@@ -0,0 +1,969 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+
+#include "http-worker.h"
+#include "http-plugin.h"
+#include "syslog-names.h"
+#include "timeutils.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+static size_t
+_http_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  // Discard response content
+  return nmemb * size;
+}
+
+static struct curl_slist *
+_get_message_headers(HTTPDestinationWorker *self, LogMessage *msg)
+{
+  struct curl_slist *curl_headers = NULL;
+  gchar header_host[128] = {0};
+  gchar header_program[32] = {0};
+  gchar header_facility[32] = {0};
+  gchar header_level[32] = {0};
+
+  g_snprintf(header_host, sizeof(header_host),
+             "X-Syslog-Host: %s", log_msg_get_value(msg, LM_V_HOST, NULL));
+  curl_headers = curl_slist_append(curl_headers, header_host);
+
+  g_snprintf(header_program, sizeof(header_program),
+             "X-Syslog-Program: %s", log_msg_get_value(msg, LM_V_PROGRAM, NULL));
+  curl_headers = curl_slist_append(curl_headers, header_program);
+
+  g_snprintf(header_facility, sizeof(header_facility),
+             "X-Syslog-Facility: %s", syslog_name_lookup_name_by_value(msg->pri & LOG_FACMASK, sl_facilities));
+  curl_headers = curl_slist_append(curl_headers, header_facility);
+
+  g_snprintf(header_level, sizeof(header_level),
+             "X-Syslog-Level: %s", syslog_name_lookup_name_by_value(msg->pri & LOG_PRIMASK, sl_levels));
+  curl_headers = curl_slist_append(curl_headers, header_level);
+
+  return curl_headers;
+}
+
+static struct curl_slist *
+_get_request_headers(HTTPDestinationWorker *self)
+{
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) self->super.owner;
+  struct curl_slist *curl_headers = NULL;
+
+  for (GList *l = owner->headers; l; l = l->next)
+    curl_headers = curl_slist_append(curl_headers, (const gchar *) l->data);
+
+  if (owner->compression == HTTP_COMPRESSION_GZIP)
+    curl_headers = curl_slist_append(curl_headers, "Content-Encoding: gzip");
+  else if (owner->compression == HTTP_COMPRESSION_DEFLATE)
+    curl_headers = curl_slist_append(curl_headers, "Content-Encoding: deflate");
+
+  /* batched request bodies easily exceed the size where libcurl would
+   * send "Expect: 100-continue" and wait for the server to respond to it */
+  curl_headers = curl_slist_append(curl_headers, "Expect:");
+
+  return curl_headers;
+}
+
+static void
+_append_message_to_body(HTTPDestinationWorker *self, LogMessage *msg)
+{
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) self->super.owner;
+
+  if (owner->body_template)
+    log_template_append_format(owner->body_template, msg, &owner->template_options, LTZ_SEND,
+                               self->super.seq_num, NULL, self->request->body);
+  else
+    g_string_append(self->request->body, log_msg_get_value(msg, LM_V_MESSAGE, NULL));
+}
+
+static
+void _http_trace_sanitize_dump(const gchar *text, gchar *data, size_t size)
+{
+  gchar *sanitized = g_new0(gchar, size+1);
+  int i;
+  for (i = 0; i < size && data[i]; i++)
+    {
+      sanitized[i] = g_ascii_isprint(data[i]) ? data[i] : '.';
+    }
+  sanitized[i] = 0;
+  msg_debug("curl trace log",
+            evt_tag_str("curl_info_type", text),
+            evt_tag_str("data", sanitized));
+  g_free(sanitized);
+}
+
+gchar *curl_infotype_to_text[] =
+{
+  "curl_trace_text",
+  "curl_trace_header_in",
+  "curl_trace_header_out",
+  "curl_trace_data_in",
+  "curl_trace_data_out",
+  "curl_trace_ssl_data_in",
+  "curl_trace_ssl_data_out",
+};
+
+static
+gint _http_trace(CURL *handle, curl_infotype type,
+                 char *data, size_t size,
+                 void *userp)
+{
+  if (!G_UNLIKELY(debug_flag))
+    return 0;
+
+  g_assert(type < sizeof(curl_infotype_to_text)/sizeof(curl_infotype_to_text[0]));
+
+  _http_trace_sanitize_dump(curl_infotype_to_text[type], data, size);
+
+  return 0;
+}
+
+static void
+_set_curl_opt(HTTPDestinationWorker *self, CURL *curl)
+{
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) self->super.owner;
+
+  curl_easy_reset(curl);
+
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _http_write_cb);
+
+  if (owner->user)
+    curl_easy_setopt(curl, CURLOPT_USERNAME, owner->user);
+
+  if (owner->password)
+    curl_easy_setopt(curl, CURLOPT_PASSWORD, owner->password);
+
+  if (owner->user_agent)
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, owner->user_agent);
+
+  if (owner->ca_dir)
+    curl_easy_setopt(curl, CURLOPT_CAPATH, owner->ca_dir);
+
+  if (owner->ca_file)
+    curl_easy_setopt(curl, CURLOPT_CAINFO, owner->ca_file);
+
+  if (owner->cert_file)
+    curl_easy_setopt(curl, CURLOPT_SSLCERT, owner->cert_file);
+
+  if (owner->key_file)
+    curl_easy_setopt(curl, CURLOPT_SSLKEY, owner->key_file);
+
+  if (owner->ciphers)
+    curl_easy_setopt(curl, CURLOPT_SSL_CIPHER_LIST, owner->ciphers);
+
+  curl_easy_setopt(curl, CURLOPT_SSLVERSION, owner->ssl_version);
+
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, owner->peer_verify ? 2L : 0L);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, owner->peer_verify ? 1L : 0L);
+
+  curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, _http_trace);
+  curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, owner->timeout);
+
+  if (owner->method_type == METHOD_TYPE_PUT)
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
+}
+
+#if SYSLOG_NG_HAVE_ZLIB
+
+static void
+_init_compressor(HTTPDestinationWorker *self)
+{
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) self->super.owner;
+  /* 15 is the largest window, +16 asks zlib for a gzip header instead of a zlib one */
+  gint window_bits = (owner->compression == HTTP_COMPRESSION_GZIP) ? 15 + 16 : 15;
+
+  if (owner->compression == HTTP_COMPRESSION_NONE)
+    return;
+
+  memset(&self->compressor, 0, sizeof(self->compressor));
+  if (deflateInit2(&self->compressor, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      msg_error("http: error initializing compression",
+                evt_tag_str("error", self->compressor.msg ? : "unknown"),
+                evt_tag_int("worker_index", self->super.worker_index),
+                log_pipe_location_tag(&self->super.owner->super.super.super));
+      return;
+    }
+  self->compressor_initialized = TRUE;
+}
+
+static void
+_deinit_compressor(HTTPDestinationWorker *self)
+{
+  if (self->compressor_initialized)
+    deflateEnd(&self->compressor);
+  self->compressor_initialized = FALSE;
+}
+
+static gboolean
+_compress_body(HTTPDestinationWorker *self, HTTPRequest *request)
+{
+  z_stream *compressor = &self->compressor;
+
+  if (!self->compressor_initialized || deflateReset(compressor) != Z_OK)
+    return FALSE;
+
+  g_string_set_size(request->compressed_body, deflateBound(compressor, request->body->len));
+
+  compressor->next_in = (Bytef *) request->body->str;
+  compressor->avail_in = request->body->len;
+  compressor->next_out = (Bytef *) request->compressed_body->str;
+  compressor->avail_out = request->compressed_body->len;
+
+  /* the output buffer is large enough to hold the entire compressed body,
+   * so a single call is sufficient */
+  if (deflate(compressor, Z_FINISH) != Z_STREAM_END)
+    return FALSE;
+
+  g_string_truncate(request->compressed_body, compressor->total_out);
+  return TRUE;
+}
+
+#endif
+
+static gboolean
+_is_async(HTTPDestinationWorker *self)
+{
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) self->super.owner;
+
+  return owner->max_in_flight > 1;
+}
+
+/*
+ * HTTPRequest
+ *
+ * A request, along with its own curl handle.  In synchronous mode the
+ * worker reuses a single instance, in asynchronous mode requests move
+ * between the free list, the one being filled by _insert() and the
+ * in-flight queue.
+ */
+
+static int _close_socket_cb(void *clientp, curl_socket_t fd);
+
+static HTTPRequest *
+_request_new(HTTPDestinationWorker *self)
+{
+  HTTPRequest *request = g_new0(HTTPRequest, 1);
+
+  if (!(request->curl = curl_easy_init()))
+    {
+      g_free(request);
+      return NULL;
+    }
+  _set_curl_opt(self, request->curl);
+
+  if (_is_async(self))
+    {
+      curl_easy_setopt(request->curl, CURLOPT_PRIVATE, request);
+      curl_easy_setopt(request->curl, CURLOPT_CLOSESOCKETFUNCTION, _close_socket_cb);
+      curl_easy_setopt(request->curl, CURLOPT_CLOSESOCKETDATA, self);
+    }
+
+  request->body = g_string_sized_new(4096);
+#if SYSLOG_NG_HAVE_ZLIB
+  request->compressed_body = g_string_sized_new(4096);
+#endif
+  return request;
+}
+
+static void
+_release_target(HTTPDestinationWorker *self, HTTPRequest *request)
+{
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) self->super.owner;
+
+  if (!request->target)
+    return;
+
+  http_load_balancer_release_target(owner->load_balancer, request->target);
+  request->target = NULL;
+}
+
+static void
+_request_reset(HTTPDestinationWorker *self, HTTPRequest *request)
+{
+  _release_target(self, request);
+  request->attempts = 0;
+
+  /* the static headers are chained after the message specific ones while
+   * the request is being sent, don't free them */
+  if (request->last_message_header)
+    request->last_message_header->next = NULL;
+  request->last_message_header = NULL;
+
+  curl_slist_free_all(request->message_headers);
+  request->message_headers = NULL;
+  g_string_truncate(request->body, 0);
+  request->num_messages = 0;
+  request->completed = FALSE;
+}
+
+static void
+_request_free(HTTPDestinationWorker *self, HTTPRequest *request)
+{
+  _request_reset(self, request);
+  curl_easy_cleanup(request->curl);
+  g_string_free(request->body, TRUE);
+#if SYSLOG_NG_HAVE_ZLIB
+  g_string_free(request->compressed_body, TRUE);
+#endif
+  g_free(request);
+}
+
+static HTTPRequest *
+_acquire_request(HTTPDestinationWorker *self)
+{
+  HTTPRequest *request = g_queue_pop_head(self->requests_free);
+
+  if (request)
+    return request;
+
+  request = _request_new(self);
+  if (!request)
+    msg_error("curl: cannot initialize libcurl",
+              evt_tag_int("worker_index", self->super.worker_index),
+              log_pipe_location_tag(&self->super.owner->super.super.super));
+  return request;
+}
+
+static void
+_release_request(HTTPDestinationWorker *self, HTTPRequest *request)
+{
+  _request_reset(self, request);
+  g_queue_push_head(self->requests_free, request);
+}
+
+static gboolean
+_prepare_request(HTTPDestinationWorker *self, HTTPRequest *request)
+{
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) self->super.owner;
+  GString *body = request->body;
+
+  if (owner->body_suffix)
+    g_string_append(request->body, owner->body_suffix);
+
+#if SYSLOG_NG_HAVE_ZLIB
+  if (owner->compression != HTTP_COMPRESSION_NONE)
+    {
+      if (!_compress_body(self, request))
+        {
+          msg_error("http: error compressing HTTP request body",
+                    evt_tag_int("worker_index", self->super.worker_index),
+                    log_pipe_location_tag(&self->super.owner->super.super.super));
+          return FALSE;
+        }
+      body = request->compressed_body;
+    }
+#endif
+
+  curl_easy_setopt(request->curl, CURLOPT_POSTFIELDSIZE, (long) body->len);
+  curl_easy_setopt(request->curl, CURLOPT_POSTFIELDS, body->str);
+
+  /* chain the static headers after the message specific ones, so we don't
+   * need to copy them for each request */
+  request->last_message_header = request->message_headers;
+  while (request->last_message_header->next)
+    request->last_message_header = request->last_message_header->next;
+  request->last_message_header->next = self->request_headers;
+  curl_easy_setopt(request->curl, CURLOPT_HTTPHEADER, request->message_headers);
+
+  request->num_messages = self->super.batch_size;
+  return TRUE;
+}
+
+/* the URL is chosen separately for each attempt to send the request */
+static void
+_start_attempt(HTTPDestinationWorker *self, HTTPRequest *request)
+{
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) self->super.owner;
+
+  request->target = http_load_balancer_choose_target(owner->load_balancer);
+  request->attempts++;
+  curl_easy_setopt(request->curl, CURLOPT_URL, request->target->url);
+}
+
+/* Reports the outcome of the attempt to the load balancer.  Returns TRUE
+ * if the request failed, but may be sent to another target right away,
+ * without rewinding and waiting for time-reopen(). */
+static gboolean
+_finish_attempt(HTTPDestinationWorker *self, HTTPRequest *request, worker_insert_result_t result)
+{
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) self->super.owner;
+  HTTPLoadBalancer *load_balancer = owner->load_balancer;
+  gboolean failed = (result == WORKER_INSERT_RESULT_ERROR || result == WORKER_INSERT_RESULT_NOT_CONNECTED);
+
+  if (failed)
+    http_load_balancer_set_target_failed(load_balancer, request->target);
+  else
+    http_load_balancer_set_target_successful(load_balancer, request->target);
+  _release_target(self, request);
+
+  return failed && request->attempts < load_balancer->num_targets &&
+         http_load_balancer_has_operational_targets(load_balancer);
+}
+
+static worker_insert_result_t
+_map_http_status_to_worker_status(glong http_code)
+{
+  worker_insert_result_t retval;
+
+  switch (http_code/100)
+    {
+    case 4:
+      msg_debug("curl: 4XX: msg dropped",
+                evt_tag_int("status_code", http_code));
+      retval = WORKER_INSERT_RESULT_DROP;
+      break;
+    case 5:
+      msg_debug("curl: 5XX: message will be retried",
+                evt_tag_int("status_code", http_code));
+      retval = WORKER_INSERT_RESULT_ERROR;
+      break;
+    default:
+      msg_debug("curl: OK status code",
+                evt_tag_int("status_code", http_code));
+      retval = WORKER_INSERT_RESULT_SUCCESS;
+      break;
+    }
+
+  return retval;
+}
+
+static worker_insert_result_t
+_get_request_result(HTTPDestinationWorker *self, HTTPRequest *request, CURLcode ret)
+{
+  if (ret != CURLE_OK)
+    {
+      msg_error("curl: error sending HTTP request",
+                evt_tag_str("error", curl_easy_strerror(ret)),
+                evt_tag_str("url", request->target->url),
+                evt_tag_int("worker_index", self->super.worker_index),
+                evt_tag_int("batch_size", request->num_messages),
+                log_pipe_location_tag(&self->super.owner->super.super.super));
+      return WORKER_INSERT_RESULT_NOT_CONNECTED;
+    }
+
+  glong http_code = 0;
+  curl_easy_getinfo (request->curl, CURLINFO_RESPONSE_CODE, &http_code);
+  return _map_http_status_to_worker_status(http_code);
+}
+
+/*
+ * Asynchronous mode
+ *
+ * Requests are sent using a curl multi handle, that is driven by the
+ * ivykis loop of the worker thread: curl tells us the sockets and the
+ * timeout it is interested in, and we call curl_multi_socket_action()
+ * when they fire.  As the backlog of the queue can only be acked in
+ * order, completed requests are reported to LogThreadedDestWorker in the
+ * order they were sent.
+ */
+
+typedef struct _HTTPSocket
+{
+  struct iv_fd fd;
+  HTTPDestinationWorker *owner;
+  gint what;
+} HTTPSocket;
+
+static void
+_socket_free(HTTPSocket *sock)
+{
+  if (iv_fd_registered(&sock->fd))
+    iv_fd_unregister(&sock->fd);
+  g_free(sock);
+}
+
+static void
+_complete_requests_in_order(HTTPDestinationWorker *self)
+{
+  HTTPRequest *request;
+
+  while ((request = g_queue_peek_head(self->requests_in_flight)) && request->completed)
+    {
+      gint num_messages = request->num_messages;
+      worker_insert_result_t result = request->result;
+
+      g_queue_pop_head(self->requests_in_flight);
+      _release_request(self, request);
+
+      /* this may disconnect us, which abandons the rest of the requests */
+      log_threaded_dest_worker_complete_pending(&self->super, num_messages, result);
+    }
+}
+
+static void
+_process_completed_requests(HTTPDestinationWorker *self)
+{
+  CURLMsg *msg;
+  gint msgs_left;
+
+  while ((msg = curl_multi_info_read(self->multi, &msgs_left)))
+    {
+      HTTPRequest *request = NULL;
+      CURL *curl = msg->easy_handle;
+      CURLcode ret = msg->data.result;
+
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+
+      curl_easy_getinfo(curl, CURLINFO_PRIVATE, (gchar **) &request);
+      curl_multi_remove_handle(self->multi, curl);
+
+      request->result = _get_request_result(self, request, ret);
+      if (_finish_attempt(self, request, request->result))
+        {
+          /* the request stays in flight, so its position is kept */
+          _start_attempt(self, request);
+          if (curl_multi_add_handle(self->multi, curl) == CURLM_OK)
+            continue;
+        }
+      request->completed = TRUE;
+    }
+
+  _complete_requests_in_order(self);
+}
+
+static void
+_socket_action(HTTPDestinationWorker *self, curl_socket_t fd, gint ev_bitmask)
+{
+  gint running_handles;
+
+  curl_multi_socket_action(self->multi, fd, ev_bitmask, &running_handles);
+  _process_completed_requests(self);
+}
+
+/* NOTE: curl_multi_socket_action() may free the HTTPSocket instance */
+static void
+_socket_in(gpointer s)
+{
+  HTTPSocket *sock = (HTTPSocket *) s;
+
+  _socket_action(sock->owner, sock->fd.fd, CURL_CSELECT_IN);
+}
+
+static void
+_socket_out(gpointer s)
+{
+  HTTPSocket *sock = (HTTPSocket *) s;
+
+  _socket_action(sock->owner, sock->fd.fd, CURL_CSELECT_OUT);
+}
+
+static void
+_socket_err(gpointer s)
+{
+  HTTPSocket *sock = (HTTPSocket *) s;
+
+  _socket_action(sock->owner, sock->fd.fd, CURL_CSELECT_ERR);
+}
+
+static int
+_multi_socket_cb(CURL *curl, curl_socket_t fd, int what, void *userp, void *socketp)
+{
+  HTTPDestinationWorker *self = (HTTPDestinationWorker *) userp;
+  HTTPSocket *sock = g_hash_table_lookup(self->sockets, GINT_TO_POINTER(fd));
+
+  if (what == CURL_POLL_REMOVE)
+    {
+      g_hash_table_remove(self->sockets, GINT_TO_POINTER(fd));
+      return 0;
+    }
+
+  if (!sock)
+    {
+      sock = g_new0(HTTPSocket, 1);
+      sock->owner = self;
+      IV_FD_INIT(&sock->fd);
+      sock->fd.fd = fd;
+      sock->fd.cookie = sock;
+      sock->fd.handler_err = _socket_err;
+      iv_fd_register(&sock->fd);
+      g_hash_table_insert(self->sockets, GINT_TO_POINTER(fd), sock);
+    }
+
+  sock->what = what;
+  iv_fd_set_handler_in(&sock->fd, (what & CURL_POLL_IN) ? _socket_in : NULL);
+  iv_fd_set_handler_out(&sock->fd, (what & CURL_POLL_OUT) ? _socket_out : NULL);
+  return 0;
+}
+
+/* curl may close a socket without telling us to stop polling it first,
+ * make sure it is unregistered from ivykis before it is closed */
+static int
+_close_socket_cb(void *clientp, curl_socket_t fd)
+{
+  HTTPDestinationWorker *self = (HTTPDestinationWorker *) clientp;
+
+  g_hash_table_remove(self->sockets, GINT_TO_POINTER(fd));
+  return close(fd);
+}
+
+static int
+_multi_timer_cb(CURLM *multi, long timeout_ms, void *userp)
+{
+  HTTPDestinationWorker *self = (HTTPDestinationWorker *) userp;
+
+  self->multi_timeout = timeout_ms;
+  if (iv_timer_registered(&self->multi_timer))
+    iv_timer_unregister(&self->multi_timer);
+
+  if (timeout_ms >= 0)
+    {
+      iv_validate_now();
+      self->multi_timer.expires = iv_now;
+      timespec_add_msec(&self->multi_timer.expires, timeout_ms);
+      iv_timer_register(&self->multi_timer);
+    }
+  return 0;
+}
+
+static void
+_multi_timer_expired(gpointer s)
+{
+  HTTPDestinationWorker *self = (HTTPDestinationWorker *) s;
+
+  _socket_action(self, CURL_SOCKET_TIMEOUT, 0);
+}
+
+/* Drives the transfers without returning to the ivykis loop, used when
+ * we need to wait for requests to complete. */
+static void
+_wait_for_socket_events(HTTPDestinationWorker *self)
+{
+  gint num_sockets = g_hash_table_size(self->sockets);
+  struct pollfd *pfds = g_new0(struct pollfd, num_sockets);
+  GHashTableIter iter;
+  HTTPSocket *sock;
+  gint i = 0;
+  gint rc;
+
+  g_hash_table_iter_init(&iter, self->sockets);
+  while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &sock))
+    {
+      pfds[i].fd = sock->fd.fd;
+      pfds[i].events = ((sock->what & CURL_POLL_IN) ? POLLIN : 0) | ((sock->what & CURL_POLL_OUT) ? POLLOUT : 0);
+      i++;
+    }
+
+  rc = poll(pfds, num_sockets, self->multi_timeout >= 0 ? self->multi_timeout : 1000);
+  if (rc > 0)
+    {
+      for (i = 0; i < num_sockets; i++)
+        {
+          gint ev_bitmask = 0;
+
+          if (pfds[i].revents & POLLIN)
+            ev_bitmask |= CURL_CSELECT_IN;
+          if (pfds[i].revents & POLLOUT)
+            ev_bitmask |= CURL_CSELECT_OUT;
+          if (pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+            ev_bitmask |= CURL_CSELECT_ERR;
+          if (ev_bitmask)
+            _socket_action(self, pfds[i].fd, ev_bitmask);
+        }
+    }
+  else
+    {
+      _socket_action(self, CURL_SOCKET_TIMEOUT, 0);
+    }
+  g_free(pfds);
+}
+
+static void
+_wait_for_requests_in_flight(HTTPDestinationWorker *self, guint max_requests)
+{
+  while (g_queue_get_length(self->requests_in_flight) > max_requests)
+    _wait_for_socket_events(self);
+}
+
+static void
+_abandon_requests_in_flight(HTTPDestinationWorker *self)
+{
+  HTTPRequest *request;
+
+  while ((request = g_queue_pop_head(self->requests_in_flight)))
+    {
+      if (!request->completed)
+        curl_multi_remove_handle(self->multi, request->curl);
+      _release_request(self, request);
+    }
+}
+
+static gboolean
+_init_multi(HTTPDestinationWorker *self)
+{
+  if (self->multi)
+    return TRUE;
+
+  if (!(self->multi = curl_multi_init()))
+    return FALSE;
+
+  curl_multi_setopt(self->multi, CURLMOPT_SOCKETFUNCTION, _multi_socket_cb);
+  curl_multi_setopt(self->multi, CURLMOPT_SOCKETDATA, self);
+  curl_multi_setopt(self->multi, CURLMOPT_TIMERFUNCTION, _multi_timer_cb);
+  curl_multi_setopt(self->multi, CURLMOPT_TIMERDATA, self);
+  return TRUE;
+}
+
+/*
+ * LogThreadedDestWorker interface
+ */
+
+static gboolean
+_start_batch(HTTPDestinationWorker *self, LogMessage *msg)
+{
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) self->super.owner;
+
+  if (!self->request && !(self->request = _acquire_request(self)))
+    return FALSE;
+
+  _request_reset(self, self->request);
+  if (owner->body_prefix)
+    g_string_append(self->request->body, owner->body_prefix);
+  self->request->message_headers = _get_message_headers(self, msg);
+  return TRUE;
+}
+
+static gboolean
+_is_batching_enabled(HTTPDestinationWorker *self)
+{
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) self->super.owner;
+
+  return owner->super.batch_lines > 0 || owner->batch_bytes > 0;
+}
+
+static gboolean
+_is_batch_bytes_reached(HTTPDestinationWorker *self)
+{
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) self->super.owner;
+
+  return owner->batch_bytes > 0 && self->request->body->len >= owner->batch_bytes;
+}
+
+static worker_insert_result_t
+_flush_sync(HTTPDestinationWorker *self)
+{
+  HTTPRequest *request = self->request;
+  worker_insert_result_t retval;
+
+  if (!_prepare_request(self, request))
+    {
+      _request_reset(self, request);
+      return WORKER_INSERT_RESULT_ERROR;
+    }
+
+  do
+    {
+      _start_attempt(self, request);
+      retval = _get_request_result(self, request, curl_easy_perform(request->curl));
+    }
+  while (_finish_attempt(self, request, retval));
+
+  _request_reset(self, request);
+  return retval;
+}
+
+static worker_insert_result_t
+_flush_async(HTTPDestinationWorker *self)
+{
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) self->super.owner;
+  HTTPRequest *request = self->request;
+  CURLMcode ret;
+
+  if (owner->super.under_termination)
+    {
+      /* we are exiting: wait for the requests in flight and send the rest
+       * synchronously, so that these messages are not sent again after a
+       * reload */
+      _wait_for_requests_in_flight(self, 0);
+      if (self->super.batch_size == 0)
+        return WORKER_INSERT_RESULT_SUCCESS;
+      return _flush_sync(self);
+    }
+
+  _wait_for_requests_in_flight(self, owner->max_in_flight - 1);
+  if (self->super.batch_size == 0)
+    {
+      /* a request failed meanwhile, and the batch has been rewound */
+      _request_reset(self, request);
+      return WORKER_INSERT_RESULT_REWIND;
+    }
+
+  if (!_prepare_request(self, request))
+    {
+      _request_reset(self, request);
+      return WORKER_INSERT_RESULT_ERROR;
+    }
+
+  _start_attempt(self, request);
+  if ((ret = curl_multi_add_handle(self->multi, request->curl)) != CURLM_OK)
+    {
+      msg_error("curl: error sending HTTP request",
+                evt_tag_str("error", curl_multi_strerror(ret)),
+                evt_tag_int("worker_index", self->super.worker_index),
+                log_pipe_location_tag(&self->super.owner->super.super.super));
+      _request_reset(self, request);
+      return WORKER_INSERT_RESULT_NOT_CONNECTED;
+    }
+
+  g_queue_push_tail(self->requests_in_flight, request);
+  self->request = NULL;
+  return WORKER_INSERT_RESULT_PENDING;
+}
+
+static worker_insert_result_t
+_flush(LogThreadedDestWorker *s)
+{
+  HTTPDestinationWorker *self = (HTTPDestinationWorker *) s;
+
+  if (_is_async(self))
+    return _flush_async(self);
+  return _flush_sync(self);
+}
+
+static worker_insert_result_t
+_insert(LogThreadedDestWorker *s, LogMessage *msg)
+{
+  HTTPDestinationWorker *self = (HTTPDestinationWorker *) s;
+  HTTPDestinationDriver *owner = (HTTPDestinationDriver *) s->owner;
+
+  /* batch_size is reset to zero whenever the batch is acked or rewound,
+   * and incremented before calling insert() */
+  if (self->super.batch_size == 1)
+    {
+      if (!_start_batch(self, msg))
+        return WORKER_INSERT_RESULT_NOT_CONNECTED;
+    }
+  else if (owner->delimiter)
+    g_string_append(self->request->body, owner->delimiter);
+
+  _append_message_to_body(self, msg);
+
+  if (!_is_batching_enabled(self) || _is_batch_bytes_reached(self))
+    return _flush(s);
+
+  /* the batch is sent by flush(), once batch-lines() is reached, the
+   * queue becomes empty or batch-timeout() expires */
+  return WORKER_INSERT_RESULT_QUEUED;
+}
+
+static gboolean
+_connect(LogThreadedDestWorker *s)
+{
+  HTTPDestinationWorker *self = (HTTPDestinationWorker *) s;
+
+  if (_is_async(self) && !_init_multi(self))
+    {
+      msg_error("curl: cannot initialize libcurl multi interface",
+                evt_tag_int("worker_index", self->super.worker_index),
+                log_pipe_location_tag(&s->owner->super.super.super));
+      return FALSE;
+    }
+
+  if (!self->request && !(self->request = _acquire_request(self)))
+    return FALSE;
+
+  return TRUE;
+}
+
+static void
+_disconnect(LogThreadedDestWorker *s)
+{
+  HTTPDestinationWorker *self = (HTTPDestinationWorker *) s;
+
+  if (self->multi)
+    _abandon_requests_in_flight(self);
+}
+
+static void
+_thread_init(LogThreadedDestWorker *s)
+{
+  HTTPDestinationWorker *self = (HTTPDestinationWorker *) s;
+
+  self->request_headers = _get_request_headers(self);
+  self->requests_free = g_queue_new();
+  self->requests_in_flight = g_queue_new();
+  self->sockets = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) _socket_free);
+
+  IV_TIMER_INIT(&self->multi_timer);
+  self->multi_timer.cookie = self;
+  self->multi_timer.handler = _multi_timer_expired;
+  self->multi_timeout = -1;
+
+#if SYSLOG_NG_HAVE_ZLIB
+  _init_compressor(self);
+#endif
+}
+
+static void
+_thread_deinit(LogThreadedDestWorker *s)
+{
+  HTTPDestinationWorker *self = (HTTPDestinationWorker *) s;
+  HTTPRequest *request;
+
+  if (self->multi)
+    _abandon_requests_in_flight(self);
+  if (self->request)
+    _request_free(self, self->request);
+  self->request = NULL;
+  while ((request = g_queue_pop_head(self->requests_free)))
+    _request_free(self, request);
+
+  /* closing the cached connections calls back to _close_socket_cb() */
+  if (self->multi)
+    curl_multi_cleanup(self->multi);
+  self->multi = NULL;
+
+  if (iv_timer_registered(&self->multi_timer))
+    iv_timer_unregister(&self->multi_timer);
+  g_hash_table_destroy(self->sockets);
+  g_queue_free(self->requests_in_flight);
+  g_queue_free(self->requests_free);
+
+  curl_slist_free_all(self->request_headers);
+  self->request_headers = NULL;
+#if SYSLOG_NG_HAVE_ZLIB
+  _deinit_compressor(self);
+#endif
+}
+
+LogThreadedDestWorker *
+http_dw_new(LogThreadedDestDriver *owner, gint worker_index)
+{
+  HTTPDestinationWorker *self = g_new0(HTTPDestinationWorker, 1);
+
+  log_threaded_dest_worker_init_instance(&self->super, owner, worker_index);
+  self->super.thread_init = _thread_init;
+  self->super.thread_deinit = _thread_deinit;
+  self->super.connect = _connect;
+  self->super.disconnect = _disconnect;
+  self->super.insert = _insert;
+  self->super.flush = _flush;
+
+  return &self->super;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+
+#ifndef HTTP_WORKER_H_INCLUDED
+#define HTTP_WORKER_H_INCLUDED 1
+
+#include "logthrdestdrv.h"
+#include "http-loadbalancer.h"
+
+#include <curl/curl.h>
+#if SYSLOG_NG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+typedef struct _HTTPRequest
+{
+  CURL *curl;
+  GString *body;
+#if SYSLOG_NG_HAVE_ZLIB
+  GString *compressed_body;
+#endif
+  /* headers derived from the first message of the batch, the static
+   * headers of the worker are chained after last_message_header while
+   * the request is being sent */
+  struct curl_slist *message_headers;
+  struct curl_slist *last_message_header;
+  gint num_messages;
+  /* the target the request is being sent to, and the number of targets
+   * tried so far */
+  HTTPLoadBalancerTarget *target;
+  gint attempts;
+  gboolean completed;
+  worker_insert_result_t result;
+} HTTPRequest;
+
+typedef struct _HTTPDestinationWorker
+{
+  LogThreadedDestWorker super;
+
+  /* headers that don't depend on the message, built once per thread */
+  struct curl_slist *request_headers;
+  /* the request the current batch is added to */
+  HTTPRequest *request;
+  GQueue *requests_free;
+#if SYSLOG_NG_HAVE_ZLIB
+  z_stream compressor;
+  gboolean compressor_initialized;
+#endif
+
+  /* asynchronous mode, used if max-in-flight() is larger than 1 */
+  CURLM *multi;
+  GQueue *requests_in_flight;
+  GHashTable *sockets;
+  struct iv_timer multi_timer;
+  glong multi_timeout;
+} HTTPDestinationWorker;
+
+LogThreadedDestWorker *http_dw_new(LogThreadedDestDriver *owner, gint worker_index);
+
+#endif
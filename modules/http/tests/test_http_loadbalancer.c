@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ */
+
+#include <criterion/criterion.h>
+
+#include "http-loadbalancer.h"
+#include "apphook.h"
+
+static HTTPLoadBalancer *lb;
+
+static void
+setup(void)
+{
+  app_startup();
+  lb = http_load_balancer_new();
+  http_load_balancer_add_target(lb, "http://target1/");
+  http_load_balancer_add_target(lb, "http://target2/");
+  http_load_balancer_add_target(lb, "http://target3/");
+}
+
+static void
+teardown(void)
+{
+  http_load_balancer_free(lb);
+  app_shutdown();
+}
+
+static HTTPLoadBalancerTarget *
+_choose_and_release(void)
+{
+  HTTPLoadBalancerTarget *target = http_load_balancer_choose_target(lb);
+
+  http_load_balancer_release_target(lb, target);
+  return target;
+}
+
+TestSuite(http_loadbalancer, .init = setup, .fini = teardown);
+
+Test(http_loadbalancer, test_invalid_method_is_rejected)
+{
+  cr_assert(http_load_balancer_set_method(lb, "least-outstanding"));
+  cr_assert(http_load_balancer_set_method(lb, "round-robin"));
+  cr_assert_not(http_load_balancer_set_method(lb, "random"));
+}
+
+Test(http_loadbalancer, test_round_robin_cycles_through_targets)
+{
+  for (gint i = 0; i < 6; i++)
+    cr_assert_eq(_choose_and_release()->index, i % 3);
+}
+
+Test(http_loadbalancer, test_least_outstanding_prefers_idle_targets)
+{
+  http_load_balancer_set_method(lb, "least-outstanding");
+
+  HTTPLoadBalancerTarget *first = http_load_balancer_choose_target(lb);
+  HTTPLoadBalancerTarget *second = http_load_balancer_choose_target(lb);
+  HTTPLoadBalancerTarget *third = http_load_balancer_choose_target(lb);
+
+  cr_assert_eq(first->index, 0);
+  cr_assert_eq(second->index, 1);
+  cr_assert_eq(third->index, 2);
+
+  /* target2 becomes idle, so it gets the next request, even though
+   * target1 would be next in order */
+  http_load_balancer_release_target(lb, second);
+  cr_assert_eq(http_load_balancer_choose_target(lb), second);
+
+  http_load_balancer_release_target(lb, first);
+  http_load_balancer_release_target(lb, second);
+  http_load_balancer_release_target(lb, third);
+}
+
+Test(http_loadbalancer, test_failed_target_is_ejected)
+{
+  HTTPLoadBalancerTarget *target = http_load_balancer_choose_target(lb);
+
+  cr_assert_eq(target->index, 0);
+  http_load_balancer_set_target_failed(lb, target);
+  http_load_balancer_release_target(lb, target);
+
+  cr_assert(http_load_balancer_has_operational_targets(lb));
+  for (gint i = 0; i < 6; i++)
+    cr_assert_neq(_choose_and_release(), target);
+}
+
+Test(http_loadbalancer, test_failed_target_is_probed_after_recovery_timeout)
+{
+  http_load_balancer_set_recovery_timeout(lb, 0);
+
+  HTTPLoadBalancerTarget *target = http_load_balancer_choose_target(lb);
+  http_load_balancer_set_target_failed(lb, target);
+  http_load_balancer_release_target(lb, target);
+
+  HTTPLoadBalancerTarget *probe = http_load_balancer_choose_target(lb);
+  cr_assert_eq(probe, target);
+  cr_assert_eq(probe->state, HTTP_TARGET_FAILED);
+
+  http_load_balancer_set_target_successful(lb, probe);
+  http_load_balancer_release_target(lb, probe);
+  cr_assert_eq(target->state, HTTP_TARGET_OPERATIONAL);
+  cr_assert_eq(lb->num_failed_targets, 0);
+}
+
+Test(http_loadbalancer, test_all_targets_failed_still_returns_a_target)
+{
+  for (gint i = 0; i < 3; i++)
+    {
+      HTTPLoadBalancerTarget *target = http_load_balancer_choose_target(lb);
+      http_load_balancer_set_target_failed(lb, target);
+      http_load_balancer_release_target(lb, target);
+    }
+
+  cr_assert_not(http_load_balancer_has_operational_targets(lb));
+  cr_assert_not_null(_choose_and_release());
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ */
+
+/* the request is built using the static functions of the worker, nothing
+ * is sent */
+#include "http-worker.c"
+#include "apphook.h"
+#include "cfg.h"
+
+#include <criterion/criterion.h>
+
+static GlobalConfig *cfg;
+static LogDriver *driver;
+static HTTPDestinationWorker *worker;
+
+static void
+setup(void)
+{
+  app_startup();
+  cfg = cfg_new_snippet();
+  driver = http_dd_new(cfg);
+}
+
+static void
+teardown(void)
+{
+  if (worker)
+    {
+      _thread_deinit(&worker->super);
+      log_threaded_dest_worker_free(&worker->super);
+      worker = NULL;
+    }
+  log_pipe_unref(&driver->super);
+  cfg_free(cfg);
+  app_shutdown();
+}
+
+static void
+_start_worker(void)
+{
+  worker = (HTTPDestinationWorker *) http_dw_new((LogThreadedDestDriver *) driver, 0);
+  _thread_init(&worker->super);
+  cr_assert(_connect(&worker->super));
+}
+
+/* adds a message to the batch the same way LogThreadedDestWorker does */
+static worker_insert_result_t
+_add_message(const gchar *message)
+{
+  LogMessage *msg = log_msg_new_empty();
+  worker_insert_result_t result;
+
+  log_msg_set_value(msg, LM_V_MESSAGE, message, -1);
+  worker->super.batch_size++;
+  result = _insert(&worker->super, msg);
+  log_msg_unref(msg);
+  return result;
+}
+
+static void
+_add_batch(void)
+{
+  cr_assert_eq(_add_message("foo"), WORKER_INSERT_RESULT_QUEUED);
+  cr_assert_eq(_add_message("bar"), WORKER_INSERT_RESULT_QUEUED);
+  cr_assert_eq(_add_message("baz"), WORKER_INSERT_RESULT_QUEUED);
+}
+
+static GString *
+_prepare_body(void)
+{
+  cr_assert(_prepare_request(worker, worker->request));
+  cr_assert_eq(worker->request->num_messages, worker->super.batch_size);
+  return worker->request->body;
+}
+
+static gboolean
+_has_request_header(const gchar *header)
+{
+  for (struct curl_slist *l = worker->request_headers; l; l = l->next)
+    {
+      if (strcmp(l->data, header) == 0)
+        return TRUE;
+    }
+  return FALSE;
+}
+
+TestSuite(http_request_body, .init = setup, .fini = teardown);
+
+Test(http_request_body, test_messages_are_separated_by_newlines_by_default)
+{
+  log_threaded_dest_driver_set_batch_lines(driver, 10);
+  _start_worker();
+
+  _add_batch();
+  cr_assert_str_eq(_prepare_body()->str, "foo\nbar\nbaz");
+}
+
+Test(http_request_body, test_batch_is_framed_by_prefix_delimiter_and_suffix)
+{
+  log_threaded_dest_driver_set_batch_lines(driver, 10);
+  http_dd_set_body_prefix(driver, "[");
+  http_dd_set_delimiter(driver, ",");
+  http_dd_set_body_suffix(driver, "]\n");
+  _start_worker();
+
+  _add_batch();
+  cr_assert_str_eq(_prepare_body()->str, "[foo,bar,baz]\n");
+}
+
+Test(http_request_body, test_single_message_has_no_delimiter)
+{
+  log_threaded_dest_driver_set_batch_lines(driver, 10);
+  http_dd_set_body_prefix(driver, "[");
+  http_dd_set_delimiter(driver, ",");
+  http_dd_set_body_suffix(driver, "]");
+  _start_worker();
+
+  cr_assert_eq(_add_message("foo"), WORKER_INSERT_RESULT_QUEUED);
+  cr_assert_str_eq(_prepare_body()->str, "[foo]");
+}
+
+Test(http_request_body, test_next_batch_starts_with_an_empty_body)
+{
+  log_threaded_dest_driver_set_batch_lines(driver, 10);
+  http_dd_set_body_prefix(driver, "[");
+  http_dd_set_delimiter(driver, ",");
+  http_dd_set_body_suffix(driver, "]");
+  _start_worker();
+
+  _add_batch();
+  cr_assert_str_eq(_prepare_body()->str, "[foo,bar,baz]");
+
+  /* the batch is acked, as if it was sent successfully */
+  _request_reset(worker, worker->request);
+  worker->super.batch_size = 0;
+
+  cr_assert_eq(_add_message("qux"), WORKER_INSERT_RESULT_QUEUED);
+  cr_assert_str_eq(_prepare_body()->str, "[qux]");
+}
+
+Test(http_request_body, test_batch_bytes_counts_the_framing)
+{
+  http_dd_set_body_prefix(driver, "[");
+  http_dd_set_delimiter(driver, ",");
+  http_dd_set_batch_bytes(driver, 9);
+  _start_worker();
+
+  cr_assert_eq(_add_message("foo"), WORKER_INSERT_RESULT_QUEUED);
+  cr_assert_eq(_add_message("bar"), WORKER_INSERT_RESULT_QUEUED);
+  cr_assert_str_eq(worker->request->body->str, "[foo,bar");
+  cr_assert_not(_is_batch_bytes_reached(worker));
+
+  /* the prefix and the delimiter are part of the 8 bytes */
+  http_dd_set_batch_bytes(driver, 8);
+  cr_assert(_is_batch_bytes_reached(worker));
+}
+
+Test(http_request_body, test_uncompressed_body_has_no_content_encoding)
+{
+  log_threaded_dest_driver_set_batch_lines(driver, 10);
+  _start_worker();
+
+  cr_assert_not(_has_request_header("Content-Encoding: gzip"));
+  cr_assert_not(_has_request_header("Content-Encoding: deflate"));
+  cr_assert(_has_request_header("Expect:"));
+}
+
+#if SYSLOG_NG_HAVE_ZLIB
+
+static GString *
+_inflate(GString *compressed, gint window_bits)
+{
+  GString *inflated = g_string_sized_new(4096);
+  z_stream stream;
+  gint rc;
+
+  memset(&stream, 0, sizeof(stream));
+  cr_assert_eq(inflateInit2(&stream, window_bits), Z_OK);
+
+  stream.next_in = (Bytef *) compressed->str;
+  stream.avail_in = compressed->len;
+  stream.next_out = (Bytef *) inflated->str;
+  stream.avail_out = inflated->allocated_len - 1;
+  rc = inflate(&stream, Z_FINISH);
+  cr_assert_eq(rc, Z_STREAM_END, "inflate() failed: %d, %s", rc, stream.msg ? : "");
+  cr_assert_eq(stream.avail_in, 0, "trailing data after the compressed body");
+
+  g_string_set_size(inflated, stream.total_out);
+  inflateEnd(&stream);
+  return inflated;
+}
+
+static void
+_assert_compressed_body(const gchar *expected_body, gint window_bits)
+{
+  GString *body = _prepare_body();
+  GString *inflated;
+
+  cr_assert_str_eq(body->str, expected_body);
+
+  inflated = _inflate(worker->request->compressed_body, window_bits);
+  cr_assert_eq(inflated->len, body->len);
+  cr_assert_str_eq(inflated->str, expected_body);
+  g_string_free(inflated, TRUE);
+}
+
+Test(http_request_body, test_gzip_compressed_body)
+{
+  log_threaded_dest_driver_set_batch_lines(driver, 10);
+  http_dd_set_body_prefix(driver, "[");
+  http_dd_set_delimiter(driver, ",");
+  http_dd_set_body_suffix(driver, "]");
+  cr_assert(http_dd_set_compression(driver, "gzip"));
+  _start_worker();
+
+  cr_assert(_has_request_header("Content-Encoding: gzip"));
+  cr_assert_not(_has_request_header("Content-Encoding: deflate"));
+
+  _add_batch();
+  /* starts with the gzip magic */
+  cr_assert_eq((guchar) worker->request->compressed_body->str[0], 0x1f);
+  _assert_compressed_body("[foo,bar,baz]", 15 + 16);
+}
+
+Test(http_request_body, test_deflate_compressed_body)
+{
+  log_threaded_dest_driver_set_batch_lines(driver, 10);
+  http_dd_set_body_prefix(driver, "[");
+  http_dd_set_delimiter(driver, ",");
+  http_dd_set_body_suffix(driver, "]");
+  cr_assert(http_dd_set_compression(driver, "deflate"));
+  _start_worker();
+
+  cr_assert(_has_request_header("Content-Encoding: deflate"));
+  cr_assert_not(_has_request_header("Content-Encoding: gzip"));
+
+  _add_batch();
+  _assert_compressed_body("[foo,bar,baz]", 15);
+}
+
+Test(http_request_body, test_compressor_is_reused_by_the_next_batch)
+{
+  log_threaded_dest_driver_set_batch_lines(driver, 10);
+  cr_assert(http_dd_set_compression(driver, "gzip"));
+  _start_worker();
+
+  _add_batch();
+  _assert_compressed_body("foo\nbar\nbaz", 15 + 16);
+
+  _request_reset(worker, worker->request);
+  worker->super.batch_size = 0;
+
+  cr_assert_eq(_add_message("qux"), WORKER_INSERT_RESULT_QUEUED);
+  _assert_compressed_body("qux", 15 + 16);
+}
+
+#endif
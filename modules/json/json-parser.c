@@ -23,8 +23,10 @@
 #define JSON_C_VER_013 (13 << 8)
 
 #include "json-parser.h"
+#include "json-scanner.h"
 #include "dot-notation.h"
 #include "scratch-buffers.h"
+#include "string-list.h"
 
 #include <string.h>
 #include <ctype.h>
@@ -42,6 +44,8 @@ typedef struct _JSONParser
   gchar *marker;
   gint marker_len;
   gchar *extract_prefix;
+  GPtrArray *extract_keys;
+  gsize prefix_len;
 } JSONParser;
 
 void
@@ -51,6 +55,7 @@ json_parser_set_prefix(LogParser *p, const gchar *prefix)
 
   g_free(self->prefix);
   self->prefix = g_strdup(prefix);
+  self->prefix_len = prefix ? strlen(prefix) : 0;
 }
 
 void
@@ -72,15 +77,38 @@ json_parser_set_extract_prefix(LogParser *s, const gchar *extract_prefix)
   self->extract_prefix = g_strdup(extract_prefix);
 }
 
+/* takes ownership of extract_keys */
+void
+json_parser_set_extract_keys(LogParser *s, GList *extract_keys)
+{
+  JSONParser *self = (JSONParser *) s;
+
+  if (self->extract_keys)
+    g_ptr_array_free(self->extract_keys, TRUE);
+  self->extract_keys = NULL;
+
+  for (GList *l = extract_keys; l; l = l->next)
+    {
+      if (!self->extract_keys)
+        self->extract_keys = g_ptr_array_new_with_free_func(g_free);
+      g_ptr_array_add(self->extract_keys, g_strdup(l->data));
+    }
+  string_list_free(extract_keys);
+}
+
 static void
-json_parser_process_object(struct json_object *jso,
+json_parser_process_object(JSONParser *self,
+                           struct json_object *jso,
                            const gchar *prefix,
+                           JSONKeyFilterResult filter,
                            LogMessage *msg);
 
 static void
-json_parser_process_single(struct json_object *jso,
+json_parser_process_single(JSONParser *self,
+                           struct json_object *jso,
                            const gchar *prefix,
                            const gchar *obj_key,
+                           JSONKeyFilterResult filter,
                            LogMessage *msg)
 {
   GString *key, *value;
@@ -93,6 +121,17 @@ json_parser_process_single(struct json_object *jso,
   key = scratch_buffers_alloc_and_mark(&marker);
   value = scratch_buffers_alloc();
 
+  if (filter == JSON_KEY_DESCEND)
+    {
+      if (prefix)
+        g_string_assign(key, prefix);
+      g_string_append(key, obj_key);
+      filter = json_key_filter_match(self->extract_keys, key->str + self->prefix_len, key->len - self->prefix_len);
+      if (filter == JSON_KEY_SKIP)
+        goto exit;
+      g_string_truncate(key, 0);
+    }
+
   switch (json_object_get_type(jso))
     {
     case json_type_boolean:
@@ -122,7 +161,7 @@ json_parser_process_single(struct json_object *jso,
         g_string_assign(key, prefix);
       g_string_append(key, obj_key);
       g_string_append_c(key, '.');
-      json_parser_process_object(jso, key->str, msg);
+      json_parser_process_object(self, jso, key->str, filter, msg);
       break;
     case json_type_array:
     {
@@ -136,9 +175,9 @@ json_parser_process_single(struct json_object *jso,
         {
           g_string_truncate(key, plen);
           g_string_append_printf(key, "[%d]", i);
-          json_parser_process_single(json_object_array_get_idx(jso, i),
+          json_parser_process_single(self, json_object_array_get_idx(jso, i),
                                      prefix,
-                                     key->str, msg);
+                                     key->str, filter, msg);
         }
       break;
     }
@@ -150,7 +189,8 @@ json_parser_process_single(struct json_object *jso,
       break;
     }
 
-  if (parsed)
+  /* scalars are only extracted if they are selected by extract-keys() */
+  if (parsed && filter == JSON_KEY_EXTRACT)
     {
       if (prefix)
         {
@@ -168,19 +208,22 @@ json_parser_process_single(struct json_object *jso,
                                   value->len);
     }
 
+exit:
   scratch_buffers_reclaim_marked(marker);
 }
 
 static void
-json_parser_process_object(struct json_object *jso,
+json_parser_process_object(JSONParser *self,
+                           struct json_object *jso,
                            const gchar *prefix,
+                           JSONKeyFilterResult filter,
                            LogMessage *msg)
 {
   struct json_object_iter itr;
 
   json_object_object_foreachC(jso, itr)
   {
-    json_parser_process_single(itr.val, prefix, itr.key, msg);
+    json_parser_process_single(self, itr.val, prefix, itr.key, filter, msg);
   }
 }
 
@@ -195,10 +238,48 @@ json_parser_extract(JSONParser *self, struct json_object *jso, LogMessage *msg)
       return FALSE;
     }
 
-  json_parser_process_object(jso, self->prefix, msg);
+  json_parser_process_object(self, jso, self->prefix, self->extract_keys ? JSON_KEY_DESCEND : JSON_KEY_EXTRACT, msg);
   return TRUE;
 }
 
+/*
+ * Parses the input with JSONScanner, without building a json-c object
+ * tree.  Returns FALSE if the input needs to be handled by json-c, the
+ * message is left untouched in this case.
+ */
+static gboolean
+json_parser_process_with_scanner(JSONParser *self, LogMessage **pmsg, const LogPathOptions *path_options,
+                                 const gchar *input, gsize input_len)
+{
+  ScratchBuffersMarker marker;
+  GString *buffer = scratch_buffers_alloc_and_mark(&marker);
+  GString *fields = scratch_buffers_alloc();
+  gboolean success;
+
+  /* with extract-prefix() only a part of the document is needed, leave that to json_extract() */
+  if (self->extract_prefix)
+    success = FALSE;
+  else
+    success = json_scanner_scan(input, input_len, self->prefix, self->extract_keys, buffer, fields);
+
+  if (success)
+    {
+      JSONScannerField *field = (JSONScannerField *) fields->str;
+      JSONScannerField *fields_end = (JSONScannerField *) (fields->str + fields->len);
+
+      log_msg_make_writable(pmsg, path_options);
+      for (; field < fields_end; field++)
+        {
+          const gchar *value = (field->value_in_input ? input : buffer->str) + field->value_ofs;
+
+          log_msg_set_value_by_name(*pmsg, buffer->str + field->name_ofs, value, field->value_len);
+        }
+    }
+
+  scratch_buffers_reclaim_marked(marker);
+  return success;
+}
+
 #ifndef JSON_C_VERSION
 const char *
 json_tokener_error_desc(enum json_tokener_error err)
@@ -231,11 +312,18 @@ json_parser_process(LogParser *s, LogMessage **pmsg, const LogPathOptions *path_
           return FALSE;
         }
       input += self->marker_len;
+      input_len -= self->marker_len;
 
-      while (isspace(*input))
-        input++;
+      while (input_len > 0 && isspace(*input))
+        {
+          input++;
+          input_len--;
+        }
     }
 
+  if (json_parser_process_with_scanner(self, pmsg, path_options, input, input_len))
+    return TRUE;
+
   tok = json_tokener_new();
   jso = json_tokener_parse_ex(tok, input, input_len);
   if (tok->err != json_tokener_success || !jso)
@@ -273,6 +361,14 @@ json_parser_clone(LogPipe *s)
   json_parser_set_prefix(cloned, self->prefix);
   json_parser_set_marker(cloned, self->marker);
   json_parser_set_extract_prefix(cloned, self->extract_prefix);
+  if (self->extract_keys)
+    {
+      JSONParser *cloned_self = (JSONParser *) cloned;
+
+      cloned_self->extract_keys = g_ptr_array_new_with_free_func(g_free);
+      for (guint i = 0; i < self->extract_keys->len; i++)
+        g_ptr_array_add(cloned_self->extract_keys, g_strdup(g_ptr_array_index(self->extract_keys, i)));
+    }
   log_parser_set_template(cloned, log_template_ref(self->super.template));
 
   return &cloned->super;
@@ -286,6 +382,8 @@ json_parser_free(LogPipe *s)
   g_free(self->prefix);
   g_free(self->marker);
   g_free(self->extract_prefix);
+  if (self->extract_keys)
+    g_ptr_array_free(self->extract_keys, TRUE);
   log_parser_free_method(s);
 }
 
@@ -26,6 +26,7 @@
 #include "parser/parser-expr.h"
 
 void json_parser_set_extract_prefix(LogParser *s, const gchar *extract_prefix);
+void json_parser_set_extract_keys(LogParser *s, GList *extract_keys);
 void json_parser_set_prefix(LogParser *p, const gchar *prefix);
 void json_parser_set_marker(LogParser *p, const gchar *marker);
 LogParser *json_parser_new(GlobalConfig *cfg);
@@ -0,0 +1,786 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ */
+
+#include "json-scanner.h"
+#include "scratch-buffers.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#define JSON_SCANNER_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/*
+ * JSONScanner
+ *
+ * A single pass JSON scanner that produces the same name-value pairs as
+ * walking the json-c object tree in json-parser.c, without building the
+ * tree.  Names are built incrementally in a single buffer, string values
+ * without escapes are referenced directly from the input, everything else
+ * is stored in a buffer supplied by the caller.
+ *
+ * The scanner only accepts strict JSON with an object at the top level.
+ * It gives up on anything it is not sure to handle exactly like json-c
+ * (single quotes, comments, NaN, \u0000, unpaired surrogates, integers
+ * that may not fit into 64 bits, deep nesting, etc.); the caller is
+ * expected to fall back to json-c in that case.
+ *
+ * Values that are not selected by extract_keys are skipped by only
+ * matching quotes and brackets, so these are not fully validated.
+ *
+ * Strings make up most of a typical document, their ends are looked for
+ * with SSE2/AVX2 instructions where the CPU supports them, the same way
+ * as find_cr_or_lf() does.
+ *
+ * Duplicate keys are not detected: the last value wins as with json-c,
+ * but members of a previous, object typed value are extracted as well.
+ */
+
+/* json-c refuses to parse documents nested deeper than 32 levels, leave them to it */
+#define JSON_SCANNER_MAX_DEPTH 30
+#define JSON_SCANNER_MAX_NUMBER_LEN 64
+/* the number of digits that always fit into a gint64 */
+#define JSON_SCANNER_MAX_INT_DIGITS 18
+
+/* returns the first quote, backslash or control character in [s, end), end if there is none */
+typedef const gchar *(*FindStringSpecialFunc)(const gchar *s, const gchar *end);
+
+typedef struct _JSONScanner
+{
+  FindStringSpecialFunc find_string_special;
+  const gchar *input;
+  const gchar *pos;
+  const gchar *end;
+  GPtrArray *extract_keys;
+  GString *key;
+  gsize prefix_len;
+  GString *buffer;
+  GString *fields;
+  gint depth;
+} JSONScanner;
+
+/* characters stopping the scanning of a string: quote, backslash and control characters */
+static const guint8 json_string_special_chars[256] =
+{
+  [0 ... 0x1f] = 1,
+  ['"'] = 1,
+  ['\\'] = 1,
+};
+
+static const gchar *
+_find_string_special_scalar(const gchar *s, const gchar *end)
+{
+  while (s < end && !json_string_special_chars[(guchar) *s])
+    s++;
+  return s;
+}
+
+#if JSON_SCANNER_X86_SIMD
+
+/* SSE2 is part of the x86-64 baseline, no need to check for it */
+static const gchar *
+_find_string_special_sse2(const gchar *s, const gchar *end)
+{
+  const __m128i quote_mask = _mm_set1_epi8('"');
+  const __m128i backslash_mask = _mm_set1_epi8('\\');
+  const __m128i control_max = _mm_set1_epi8(0x1f);
+
+  while (end - s >= (gssize) sizeof(__m128i))
+    {
+      __m128i chunk = _mm_loadu_si128((const __m128i *) s);
+      /* unsigned chunk <= 0x1f */
+      __m128i controls = _mm_cmpeq_epi8(_mm_min_epu8(chunk, control_max), chunk);
+      __m128i matches = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote_mask),
+                                                   _mm_cmpeq_epi8(chunk, backslash_mask)),
+                                     controls);
+      guint bits = _mm_movemask_epi8(matches);
+
+      if (bits)
+        return s + __builtin_ctz(bits);
+
+      s += sizeof(__m128i);
+    }
+
+  return _find_string_special_scalar(s, end);
+}
+
+__attribute__((target("avx2")))
+static const gchar *
+_find_string_special_avx2(const gchar *s, const gchar *end)
+{
+  const __m256i quote_mask = _mm256_set1_epi8('"');
+  const __m256i backslash_mask = _mm256_set1_epi8('\\');
+  const __m256i control_max = _mm256_set1_epi8(0x1f);
+
+  while (end - s >= (gssize) sizeof(__m256i))
+    {
+      __m256i chunk = _mm256_loadu_si256((const __m256i *) s);
+      __m256i controls = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, control_max), chunk);
+      __m256i matches = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote_mask),
+                                                        _mm256_cmpeq_epi8(chunk, backslash_mask)),
+                                        controls);
+      guint bits = _mm256_movemask_epi8(matches);
+
+      if (bits)
+        return s + __builtin_ctz(bits);
+
+      s += sizeof(__m256i);
+    }
+
+  return _find_string_special_sse2(s, end);
+}
+
+static gboolean
+_cpu_has_avx2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+static gboolean
+_always_supported(void)
+{
+  return TRUE;
+}
+
+/* in the order of preference */
+static struct
+{
+  const gchar *name;
+  FindStringSpecialFunc func;
+  gboolean (*is_supported)(void);
+} implementations[] =
+{
+#if JSON_SCANNER_X86_SIMD
+  { "avx2", _find_string_special_avx2, _cpu_has_avx2 },
+  { "sse2", _find_string_special_sse2, _always_supported },
+#endif
+  { "scalar", _find_string_special_scalar, _always_supported },
+};
+
+static gint current_implementation = -1;
+
+static gint
+_select_implementation(void)
+{
+  gint i;
+
+  for (i = 0; i < G_N_ELEMENTS(implementations) - 1; i++)
+    {
+      if (implementations[i].is_supported())
+        break;
+    }
+  return i;
+}
+
+/* every thread comes up with the same choice, it doesn't matter which one
+ * stores it first */
+static inline FindStringSpecialFunc
+_get_find_string_special(void)
+{
+  gint impl = g_atomic_int_get(&current_implementation);
+
+  if (G_UNLIKELY(impl < 0))
+    {
+      impl = _select_implementation();
+      g_atomic_int_set(&current_implementation, impl);
+    }
+  return implementations[impl].func;
+}
+
+/* Selects the implementation used to find the end of strings, it is only
+ * meant for testing and benchmarking.  NULL reverts to the one detected
+ * from the CPU. */
+gboolean
+json_scanner_set_implementation(const gchar *name)
+{
+  if (!name)
+    {
+      g_atomic_int_set(&current_implementation, _select_implementation());
+      return TRUE;
+    }
+
+  for (gint i = 0; i < G_N_ELEMENTS(implementations); i++)
+    {
+      if (strcmp(implementations[i].name, name) == 0)
+        {
+          if (!implementations[i].is_supported())
+            return FALSE;
+          g_atomic_int_set(&current_implementation, i);
+          return TRUE;
+        }
+    }
+  return FALSE;
+}
+
+const gchar *
+json_scanner_get_implementation(void)
+{
+  _get_find_string_special();
+  return implementations[g_atomic_int_get(&current_implementation)].name;
+}
+
+JSONKeyFilterResult
+json_key_filter_match(GPtrArray *extract_keys, const gchar *path, gsize path_len)
+{
+  gboolean descend = FALSE;
+
+  for (guint i = 0; i < extract_keys->len; i++)
+    {
+      const gchar *extract_key = g_ptr_array_index(extract_keys, i);
+      gsize extract_key_len = strlen(extract_key);
+
+      if (extract_key_len <= path_len)
+        {
+          if (memcmp(path, extract_key, extract_key_len) == 0 &&
+              (extract_key_len == path_len || path[extract_key_len] == '.' || path[extract_key_len] == '['))
+            return JSON_KEY_EXTRACT;
+        }
+      else if (memcmp(extract_key, path, path_len) == 0 &&
+               (extract_key[path_len] == '.' || extract_key[path_len] == '['))
+        {
+          descend = TRUE;
+        }
+    }
+  return descend ? JSON_KEY_DESCEND : JSON_KEY_SKIP;
+}
+
+static inline void
+_skip_whitespace(JSONScanner *self)
+{
+  while (self->pos < self->end &&
+         (*self->pos == ' ' || *self->pos == '\t' || *self->pos == '\n' || *self->pos == '\r'))
+    self->pos++;
+}
+
+static inline gboolean
+_is_delimiter(JSONScanner *self, const gchar *p)
+{
+  if (p >= self->end)
+    return TRUE;
+
+  switch (*p)
+    {
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+    case ',':
+    case '}':
+    case ']':
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+/* self->pos points after the opening quote, the contents are returned without decoding the escapes */
+static gboolean
+_scan_string(JSONScanner *self, const gchar **start, gsize *len, gboolean *escaped)
+{
+  const gchar *p = self->pos;
+
+  *start = p;
+  *escaped = FALSE;
+  while (TRUE)
+    {
+      p = self->find_string_special(p, self->end);
+
+      if (p >= self->end)
+        return FALSE;
+
+      if (*p == '"')
+        break;
+
+      if (*p != '\\')
+        return FALSE;
+
+      /* the escape sequence itself is validated by _decode_string() */
+      *escaped = TRUE;
+      p += 2;
+    }
+  *len = p - *start;
+  self->pos = p + 1;
+  return TRUE;
+}
+
+static gboolean
+_read_hex4(const gchar *p, const gchar *end, gunichar *result)
+{
+  *result = 0;
+  if (end - p < 4)
+    return FALSE;
+
+  for (gint i = 0; i < 4; i++)
+    {
+      gint digit = g_ascii_xdigit_value(p[i]);
+
+      if (digit < 0)
+        return FALSE;
+      *result = (*result << 4) + digit;
+    }
+  return TRUE;
+}
+
+static gboolean
+_decode_string(const gchar *p, gsize len, GString *result)
+{
+  const gchar *end = p + len;
+
+  while (p < end)
+    {
+      const gchar *backslash = memchr(p, '\\', end - p);
+      gunichar c, low;
+
+      if (!backslash)
+        {
+          g_string_append_len(result, p, end - p);
+          break;
+        }
+      g_string_append_len(result, p, backslash - p);
+
+      /* _scan_string() guarantees a character after the backslash */
+      p = backslash + 2;
+      switch (backslash[1])
+        {
+        case '"':
+        case '\\':
+        case '/':
+          g_string_append_c(result, backslash[1]);
+          break;
+        case 'b':
+          g_string_append_c(result, '\b');
+          break;
+        case 'f':
+          g_string_append_c(result, '\f');
+          break;
+        case 'n':
+          g_string_append_c(result, '\n');
+          break;
+        case 'r':
+          g_string_append_c(result, '\r');
+          break;
+        case 't':
+          g_string_append_c(result, '\t');
+          break;
+        case 'u':
+          if (!_read_hex4(p, end, &c))
+            return FALSE;
+          p += 4;
+
+          if (c >= 0xD800 && c <= 0xDBFF)
+            {
+              if (end - p < 6 || p[0] != '\\' || p[1] != 'u' || !_read_hex4(p + 2, end, &low) ||
+                  low < 0xDC00 || low > 0xDFFF)
+                return FALSE;
+              p += 6;
+              c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+            }
+          else if ((c >= 0xDC00 && c <= 0xDFFF) || c == 0)
+            {
+              return FALSE;
+            }
+          g_string_append_unichar(result, c);
+          break;
+        default:
+          return FALSE;
+        }
+    }
+  return TRUE;
+}
+
+static void
+_add_field(JSONScanner *self, gsize name_ofs, gsize value_ofs, gsize value_len, gboolean value_in_input)
+{
+  JSONScannerField field =
+  {
+    .name_ofs = name_ofs,
+    .value_ofs = value_ofs,
+    .value_len = value_len,
+    .value_in_input = value_in_input,
+  };
+
+  g_string_append_len(self->fields, (const gchar *) &field, sizeof(field));
+}
+
+static gsize
+_add_name(JSONScanner *self)
+{
+  gsize name_ofs = self->buffer->len;
+
+  g_string_append_len(self->buffer, self->key->str, self->key->len + 1);
+  return name_ofs;
+}
+
+static void
+_add_input_value(JSONScanner *self, const gchar *value, gsize value_len)
+{
+  _add_field(self, _add_name(self), value - self->input, value_len, TRUE);
+}
+
+static gboolean
+_scan_literal(JSONScanner *self, JSONKeyFilterResult filter, const gchar *literal, gboolean extract)
+{
+  gsize len = strlen(literal);
+
+  if ((gsize) (self->end - self->pos) < len || memcmp(self->pos, literal, len) != 0 || !_is_delimiter(self, self->pos + len))
+    return FALSE;
+
+  if (extract && filter == JSON_KEY_EXTRACT)
+    _add_input_value(self, self->pos, len);
+  self->pos += len;
+  return TRUE;
+}
+
+static gboolean
+_scan_digits(JSONScanner *self, const gchar **p)
+{
+  if (*p >= self->end || !g_ascii_isdigit(**p))
+    return FALSE;
+
+  while (*p < self->end && g_ascii_isdigit(**p))
+    (*p)++;
+  return TRUE;
+}
+
+static gboolean
+_scan_number(JSONScanner *self, JSONKeyFilterResult filter)
+{
+  const gchar *start = self->pos;
+  const gchar *p = start;
+  gboolean is_double = FALSE;
+  gchar number[JSON_SCANNER_MAX_NUMBER_LEN];
+  gsize len, name_ofs, value_ofs;
+
+  if (*p == '-')
+    p++;
+
+  /* no leading zeroes */
+  if (p < self->end && *p == '0')
+    p++;
+  else if (!_scan_digits(self, &p))
+    return FALSE;
+
+  if (p < self->end && *p == '.')
+    {
+      is_double = TRUE;
+      p++;
+      if (!_scan_digits(self, &p))
+        return FALSE;
+    }
+
+  if (p < self->end && (*p == 'e' || *p == 'E'))
+    {
+      is_double = TRUE;
+      p++;
+      if (p < self->end && (*p == '+' || *p == '-'))
+        p++;
+      if (!_scan_digits(self, &p))
+        return FALSE;
+    }
+
+  if (!_is_delimiter(self, p))
+    return FALSE;
+
+  self->pos = p;
+  if (filter != JSON_KEY_EXTRACT)
+    return TRUE;
+
+  len = p - start;
+  if (len >= sizeof(number) || (!is_double && len - (*start == '-') > JSON_SCANNER_MAX_INT_DIGITS))
+    return FALSE;
+  memcpy(number, start, len);
+  number[len] = 0;
+
+  /* format numbers the same way as json-parser does with json-c's values */
+  name_ofs = _add_name(self);
+  value_ofs = self->buffer->len;
+  if (is_double)
+    {
+      g_string_append_printf(self->buffer, "%f", g_ascii_strtod(number, NULL));
+    }
+  else
+    {
+      gint64 value = g_ascii_strtoll(number, NULL, 10);
+
+      g_string_append_printf(self->buffer, "%i", (gint) CLAMP(value, G_MININT32, G_MAXINT32));
+    }
+  _add_field(self, name_ofs, value_ofs, self->buffer->len - value_ofs, FALSE);
+  return TRUE;
+}
+
+static gboolean
+_scan_string_value(JSONScanner *self, JSONKeyFilterResult filter)
+{
+  const gchar *value;
+  gsize value_len, name_ofs, value_ofs;
+  gboolean escaped;
+
+  self->pos++;
+  if (!_scan_string(self, &value, &value_len, &escaped))
+    return FALSE;
+
+  if (filter != JSON_KEY_EXTRACT)
+    return TRUE;
+
+  if (!escaped)
+    {
+      _add_input_value(self, value, value_len);
+      return TRUE;
+    }
+
+  name_ofs = _add_name(self);
+  value_ofs = self->buffer->len;
+  if (!_decode_string(value, value_len, self->buffer))
+    return FALSE;
+  _add_field(self, name_ofs, value_ofs, self->buffer->len - value_ofs, FALSE);
+  return TRUE;
+}
+
+/* skips a value without looking into it, self->pos is left at the delimiter following it */
+static gboolean
+_skip_value(JSONScanner *self)
+{
+  gint depth = 0;
+  const gchar *value;
+  gsize value_len;
+  gboolean escaped;
+
+  while (self->pos < self->end)
+    {
+      switch (*self->pos)
+        {
+        case '"':
+          self->pos++;
+          if (!_scan_string(self, &value, &value_len, &escaped))
+            return FALSE;
+          if (depth == 0)
+            return TRUE;
+          break;
+        case '{':
+        case '[':
+          if (self->depth + ++depth > JSON_SCANNER_MAX_DEPTH)
+            return FALSE;
+          self->pos++;
+          break;
+        case '}':
+        case ']':
+          if (depth == 0)
+            return TRUE;
+          self->pos++;
+          if (--depth == 0)
+            return TRUE;
+          break;
+        case ',':
+          if (depth == 0)
+            return TRUE;
+          self->pos++;
+          break;
+        default:
+          self->pos++;
+          break;
+        }
+    }
+  return FALSE;
+}
+
+static gboolean _scan_value(JSONScanner *self, JSONKeyFilterResult filter);
+
+static gboolean
+_scan_member_value(JSONScanner *self, JSONKeyFilterResult filter)
+{
+  if (filter == JSON_KEY_DESCEND)
+    filter = json_key_filter_match(self->extract_keys, self->key->str + self->prefix_len,
+                                   self->key->len - self->prefix_len);
+
+  if (filter == JSON_KEY_SKIP)
+    return _skip_value(self);
+  return _scan_value(self, filter);
+}
+
+static gboolean
+_scan_object(JSONScanner *self, JSONKeyFilterResult filter, gboolean top_level)
+{
+  gsize key_len = self->key->len;
+  const gchar *name;
+  gsize name_len;
+  gboolean escaped;
+
+  if (++self->depth > JSON_SCANNER_MAX_DEPTH)
+    return FALSE;
+
+  self->pos++;
+  _skip_whitespace(self);
+  if (self->pos < self->end && *self->pos == '}')
+    {
+      self->pos++;
+      self->depth--;
+      return TRUE;
+    }
+
+  while (TRUE)
+    {
+      if (self->pos >= self->end || *self->pos != '"')
+        return FALSE;
+
+      self->pos++;
+      if (!_scan_string(self, &name, &name_len, &escaped))
+        return FALSE;
+
+      g_string_truncate(self->key, key_len);
+      if (!top_level)
+        g_string_append_c(self->key, '.');
+      if (!escaped)
+        g_string_append_len(self->key, name, name_len);
+      else if (!_decode_string(name, name_len, self->key))
+        return FALSE;
+
+      _skip_whitespace(self);
+      if (self->pos >= self->end || *self->pos != ':')
+        return FALSE;
+      self->pos++;
+      _skip_whitespace(self);
+
+      if (!_scan_member_value(self, filter))
+        return FALSE;
+
+      _skip_whitespace(self);
+      if (self->pos >= self->end)
+        return FALSE;
+      if (*self->pos == '}')
+        break;
+      if (*self->pos != ',')
+        return FALSE;
+      self->pos++;
+      _skip_whitespace(self);
+    }
+  self->pos++;
+  g_string_truncate(self->key, key_len);
+  self->depth--;
+  return TRUE;
+}
+
+static gboolean
+_scan_array(JSONScanner *self, JSONKeyFilterResult filter)
+{
+  gsize key_len = self->key->len;
+
+  if (++self->depth > JSON_SCANNER_MAX_DEPTH)
+    return FALSE;
+
+  self->pos++;
+  _skip_whitespace(self);
+  if (self->pos < self->end && *self->pos == ']')
+    {
+      self->pos++;
+      self->depth--;
+      return TRUE;
+    }
+
+  for (gint i = 0; ; i++)
+    {
+      g_string_truncate(self->key, key_len);
+      g_string_append_printf(self->key, "[%d]", i);
+
+      if (!_scan_member_value(self, filter))
+        return FALSE;
+
+      _skip_whitespace(self);
+      if (self->pos >= self->end)
+        return FALSE;
+      if (*self->pos == ']')
+        break;
+      if (*self->pos != ',')
+        return FALSE;
+      self->pos++;
+      _skip_whitespace(self);
+    }
+  self->pos++;
+  g_string_truncate(self->key, key_len);
+  self->depth--;
+  return TRUE;
+}
+
+static gboolean
+_scan_value(JSONScanner *self, JSONKeyFilterResult filter)
+{
+  if (self->pos >= self->end)
+    return FALSE;
+
+  switch (*self->pos)
+    {
+    case '{':
+      return _scan_object(self, filter, FALSE);
+    case '[':
+      return _scan_array(self, filter);
+    case '"':
+      return _scan_string_value(self, filter);
+    case 't':
+      return _scan_literal(self, filter, "true", TRUE);
+    case 'f':
+      return _scan_literal(self, filter, "false", TRUE);
+    case 'n':
+      return _scan_literal(self, filter, "null", FALSE);
+    default:
+      return _scan_number(self, filter);
+    }
+}
+
+/*
+ * Scans the JSON object in input and collects its members as name-value
+ * pairs.  Names are prefixed with prefix and stored in buffer, while the
+ * pairs themselves are appended to fields as an array of JSONScannerField
+ * structs.  Returns FALSE if the input should be parsed with json-c
+ * instead, the contents of buffer and fields are undefined in this case.
+ */
+gboolean
+json_scanner_scan(const gchar *input, gsize input_len, const gchar *prefix, GPtrArray *extract_keys,
+                  GString *buffer, GString *fields)
+{
+  ScratchBuffersMarker marker;
+  JSONScanner self =
+  {
+    .find_string_special = _get_find_string_special(),
+    .input = input,
+    .pos = input,
+    .end = input + input_len,
+    .extract_keys = extract_keys,
+    .key = scratch_buffers_alloc_and_mark(&marker),
+    .buffer = buffer,
+    .fields = fields,
+  };
+  gboolean success = FALSE;
+
+  if (prefix)
+    g_string_assign(self.key, prefix);
+  self.prefix_len = self.key->len;
+
+  _skip_whitespace(&self);
+  if (self.pos < self.end && *self.pos == '{')
+    success = _scan_object(&self, extract_keys ? JSON_KEY_DESCEND : JSON_KEY_EXTRACT, TRUE);
+
+  scratch_buffers_reclaim_marked(marker);
+  return success;
+}
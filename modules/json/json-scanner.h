@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ */
+
+#ifndef JSON_SCANNER_H_INCLUDED
+#define JSON_SCANNER_H_INCLUDED
+
+#include "syslog-ng.h"
+
+typedef enum
+{
+  /* the value and all its members are extracted */
+  JSON_KEY_EXTRACT,
+  /* some members of the value are extracted */
+  JSON_KEY_DESCEND,
+  JSON_KEY_SKIP,
+} JSONKeyFilterResult;
+
+JSONKeyFilterResult json_key_filter_match(GPtrArray *extract_keys, const gchar *path, gsize path_len);
+
+/* a name-value pair found by json_scanner_scan() */
+typedef struct _JSONScannerField
+{
+  /* offset of the NUL terminated name in the buffer */
+  gsize name_ofs;
+  /* offset of the value in the input or in the buffer */
+  gsize value_ofs;
+  gsize value_len;
+  gboolean value_in_input;
+} JSONScannerField;
+
+gboolean json_scanner_scan(const gchar *input, gsize input_len, const gchar *prefix, GPtrArray *extract_keys,
+                           GString *buffer, GString *fields);
+
+gboolean json_scanner_set_implementation(const gchar *name);
+const gchar *json_scanner_get_implementation(void);
+
+#endif
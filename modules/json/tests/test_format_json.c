@@ -28,6 +28,8 @@
 #include "plugin.h"
 #include "cfg.h"
 #include "logmsg/logmsg.h"
+#include "template/templates.h"
+#include "scratch-buffers.h"
 
 void
 setup(void)
@@ -187,3 +189,74 @@ Test(format_json, test_format_json_performance)
                     "..RSTAMP='${R_UNIXTIME}${R_TZ}' "
                     "..TAGS=${TAGS})\n");
 }
+
+#define THREADED_TEST_ITERATIONS 10000
+#define THREADED_TEST_THREADS 8
+
+typedef struct _FormatJsonThread
+{
+  GThread *thread;
+  LogTemplate *template;
+  LogMessage *msg;
+  const gchar *expected;
+  gint mismatches;
+  GString *first_mismatch;
+} FormatJsonThread;
+
+static gpointer
+_format_json_thread(gpointer user_data)
+{
+  FormatJsonThread *self = (FormatJsonThread *) user_data;
+  GString *result = g_string_sized_new(1024);
+
+  app_thread_start();
+  for (gint i = 0; i < THREADED_TEST_ITERATIONS; i++)
+    {
+      log_template_format(self->template, self->msg, NULL, LTZ_LOCAL, 0, NULL, result);
+      if (g_strcmp0(result->str, self->expected) != 0 && self->mismatches++ == 0)
+        self->first_mismatch = g_string_new(result->str);
+      scratch_buffers_explicit_gc();
+    }
+  app_thread_stop();
+
+  g_string_free(result, TRUE);
+  return NULL;
+}
+
+/* the same compiled template is shared by all threads, and template
+ * functions are evaluated without locking: each thread must produce the
+ * same output as a single thread does */
+Test(format_json, test_format_json_with_threads)
+{
+  FormatJsonThread threads[THREADED_TEST_THREADS];
+  LogTemplate *template = compile_template("$(format-json --scope rfc5424 --key APP.* "
+                                           "INNER=$(format-json MSG=$MSG PID=$PID))\n", FALSE);
+  LogMessage *msg = create_sample_message();
+  GString *expected = g_string_sized_new(1024);
+
+  log_template_format(template, msg, NULL, LTZ_LOCAL, 0, NULL, expected);
+
+  for (gint i = 0; i < THREADED_TEST_THREADS; i++)
+    {
+      memset(&threads[i], 0, sizeof(threads[i]));
+      threads[i].template = template;
+      threads[i].msg = msg;
+      threads[i].expected = expected->str;
+      threads[i].thread = g_thread_create(_format_json_thread, &threads[i], TRUE, NULL);
+    }
+
+  for (gint i = 0; i < THREADED_TEST_THREADS; i++)
+    {
+      g_thread_join(threads[i].thread);
+      cr_expect_eq(threads[i].mismatches, 0,
+                   "thread %d produced %d different results, the first one: %s, expected: %s",
+                   i, threads[i].mismatches,
+                   threads[i].first_mismatch ? threads[i].first_mismatch->str : "", expected->str);
+      if (threads[i].first_mismatch)
+        g_string_free(threads[i].first_mismatch, TRUE);
+    }
+
+  g_string_free(expected, TRUE);
+  log_template_unref(template);
+  log_msg_unref(msg);
+}
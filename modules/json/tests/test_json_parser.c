@@ -21,8 +21,10 @@
  */
 #include "testutils.h"
 #include "json-parser.h"
+#include "json-scanner.h"
 #include "apphook.h"
 #include "msg_parse_lib.h"
+#include "string-list.h"
 
 #define json_parser_testcase_begin(func, args)             \
   do                                                            \
@@ -186,6 +188,97 @@ test_json_parser_works_with_templates(void)
   log_msg_unref(msg);
 }
 
+static void
+test_json_parser_parses_double_quoted_json_without_json_c(void)
+{
+  LogMessage *msg;
+
+  json_parser_set_prefix(json_parser, ".prefix.");
+  msg = parse_json_into_log_message("{\"str\": \"foo\\n\\\"bar\\u00e1\\ud83d\\ude00\", \"int\": -42, "
+                                    "\"double\": 1.5e2, \"bool\": true, \"null\": null, "
+                                    "\"object\": {\"member\": \"foo\", \"empty\": {}}, "
+                                    "\"array\": [1, [\"nested\"], {\"key\": \"value\"}]}");
+  assert_log_message_value(msg, log_msg_get_value_handle(".prefix.str"), "foo\n\"bar\xc3\xa1\xf0\x9f\x98\x80");
+  assert_log_message_value(msg, log_msg_get_value_handle(".prefix.int"), "-42");
+  assert_log_message_value(msg, log_msg_get_value_handle(".prefix.double"), "150.000000");
+  assert_log_message_value(msg, log_msg_get_value_handle(".prefix.bool"), "true");
+  assert_log_message_value(msg, log_msg_get_value_handle(".prefix.object.member"), "foo");
+  assert_log_message_value(msg, log_msg_get_value_handle(".prefix.array[0]"), "1");
+  assert_log_message_value(msg, log_msg_get_value_handle(".prefix.array[1][0]"), "nested");
+  assert_log_message_value(msg, log_msg_get_value_handle(".prefix.array[2].key"), "value");
+  log_msg_unref(msg);
+}
+
+static void
+test_json_parser_fails_for_truncated_double_quoted_json(void)
+{
+  assert_json_parser_fails("{\"foo\": \"bar\"");
+  assert_json_parser_fails("{\"foo\": [1, 2}");
+}
+
+static void
+test_json_parser_extracts_only_the_selected_keys_if_extract_keys_is_specified(void)
+{
+  const gchar *extract_keys[] = { "foo", "object.member1", "array[1]", NULL };
+  const gchar *inputs[] =
+  {
+    "{\"foo\": \"bar\", \"bar\": \"foo\", \"object\": {\"member1\": \"foo\", \"member2\": [\"bar\"]}, "
+    "\"array\": [1, {\"key\": \"value\"}], \"skipped\": {\"key\": [\"}]\"]}}",
+    /* the same document, handled by json-c */
+    "{'foo': 'bar', 'bar': 'foo', 'object': {'member1': 'foo', 'member2': ['bar']}, "
+    "'array': [1, {'key': 'value'}], 'skipped': {'key': ['}]']}}",
+    NULL
+  };
+  LogMessage *msg;
+
+  json_parser_set_prefix(json_parser, ".prefix.");
+  json_parser_set_extract_keys(json_parser, string_array_to_list(extract_keys));
+  for (gint i = 0; inputs[i]; i++)
+    {
+      msg = parse_json_into_log_message(inputs[i]);
+      assert_log_message_value(msg, log_msg_get_value_handle(".prefix.foo"), "bar");
+      assert_log_message_value(msg, log_msg_get_value_handle(".prefix.object.member1"), "foo");
+      assert_log_message_value(msg, log_msg_get_value_handle(".prefix.array[1].key"), "value");
+      assert_log_message_value(msg, log_msg_get_value_handle(".prefix.bar"), "");
+      assert_log_message_value(msg, log_msg_get_value_handle(".prefix.object.member2[0]"), "");
+      assert_log_message_value(msg, log_msg_get_value_handle(".prefix.array[0]"), "");
+      assert_log_message_value(msg, log_msg_get_value_handle(".prefix.skipped.key[0]"), "");
+      log_msg_unref(msg);
+    }
+}
+
+/* the end of the strings falls on every position of the SIMD chunks */
+static void
+test_json_parser_finds_the_end_of_strings_with_every_implementation(void)
+{
+  const gchar *implementations[] = { "scalar", "sse2", "avx2", NULL };
+  LogMessage *msg;
+
+  for (gint i = 0; implementations[i]; i++)
+    {
+      if (!json_scanner_set_implementation(implementations[i]))
+        continue;
+
+      for (gint len = 0; len < 80; len++)
+        {
+          gchar *padding = g_strnfill(len, 'a');
+          gchar *json = g_strdup_printf("{\"plain\": \"%s\", \"escaped\": \"%s\\tb\"}", padding, padding);
+          gchar *escaped = g_strdup_printf("%s\tb", padding);
+
+          msg = parse_json_into_log_message(json);
+          assert_log_message_value(msg, log_msg_get_value_handle("plain"), padding);
+          assert_log_message_value(msg, log_msg_get_value_handle("escaped"), escaped);
+          log_msg_unref(msg);
+
+          g_free(escaped);
+          g_free(json);
+          g_free(padding);
+        }
+    }
+  json_scanner_set_implementation(NULL);
+  assert_not_null(json_scanner_get_implementation(), "no implementation selected");
+}
+
 static void
 test_json_parser(void)
 {
@@ -198,6 +291,10 @@ test_json_parser(void)
   JSON_PARSER_TESTCASE(test_json_parser_fails_for_non_object_top_element);
   JSON_PARSER_TESTCASE(test_json_parser_extracts_subobjects_if_extract_prefix_is_specified);
   JSON_PARSER_TESTCASE(test_json_parser_works_with_templates);
+  JSON_PARSER_TESTCASE(test_json_parser_parses_double_quoted_json_without_json_c);
+  JSON_PARSER_TESTCASE(test_json_parser_fails_for_truncated_double_quoted_json);
+  JSON_PARSER_TESTCASE(test_json_parser_extracts_only_the_selected_keys_if_extract_keys_is_specified);
+  JSON_PARSER_TESTCASE(test_json_parser_finds_the_end_of_strings_with_every_implementation);
 }
 
 int
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "redis-pipeline.h"
+
+/* error replies that may succeed if the command is sent again later */
+gboolean
+redis_is_transient_error(const gchar *error)
+{
+  static const gchar *transient_errors[] =
+  {
+    "LOADING", "BUSY", "TRYAGAIN", "MASTERDOWN", "CLUSTERDOWN", "READONLY", "OOM", NULL
+  };
+
+  for (gint i = 0; transient_errors[i]; i++)
+    {
+      if (g_str_has_prefix(error, transient_errors[i]))
+        return TRUE;
+    }
+  return FALSE;
+}
+
+worker_insert_result_t
+redis_reply_get_result(const redisReply *reply)
+{
+  if (reply->type != REDIS_REPLY_ERROR)
+    return WORKER_INSERT_RESULT_SUCCESS;
+
+  return redis_is_transient_error(reply->str) ? WORKER_INSERT_RESULT_ERROR : WORKER_INSERT_RESULT_DROP;
+}
+
+/* Consecutive replies with the same outcome are completed together, the
+ * first one that calls for a retry stops processing: its result is
+ * returned, and that message and the ones after it are left in the batch
+ * without reading their replies. */
+worker_insert_result_t
+redis_pipeline_process_replies(gint num_replies,
+                               RedisPipelineReadReply read_reply,
+                               RedisPipelineCompleteHead complete_head,
+                               gpointer user_data)
+{
+  worker_insert_result_t head_result = WORKER_INSERT_RESULT_SUCCESS;
+  gint head_length = 0;
+
+  for (gint i = 0; i < num_replies; i++)
+    {
+      worker_insert_result_t result = read_reply(user_data);
+
+      if (result != head_result && head_length > 0)
+        {
+          complete_head(head_length, head_result, user_data);
+          head_length = 0;
+        }
+
+      if (result != WORKER_INSERT_RESULT_SUCCESS && result != WORKER_INSERT_RESULT_DROP)
+        return result;
+
+      head_result = result;
+      head_length++;
+    }
+
+  if (head_length > 0)
+    complete_head(head_length, head_result, user_data);
+
+  return WORKER_INSERT_RESULT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef REDIS_PIPELINE_H_INCLUDED
+#define REDIS_PIPELINE_H_INCLUDED
+
+#include "logthrdestdrv.h"
+
+#include <hiredis/hiredis.h>
+
+/* reads the next reply of the pipeline and returns its result, returns
+ * WORKER_INSERT_RESULT_NOT_CONNECTED if the reply cannot be read */
+typedef worker_insert_result_t (*RedisPipelineReadReply)(gpointer user_data);
+/* completes the next num_messages messages of the batch with result */
+typedef void (*RedisPipelineCompleteHead)(gint num_messages, worker_insert_result_t result, gpointer user_data);
+
+gboolean redis_is_transient_error(const gchar *error);
+worker_insert_result_t redis_reply_get_result(const redisReply *reply);
+worker_insert_result_t redis_pipeline_process_replies(gint num_replies,
+                                                      RedisPipelineReadReply read_reply,
+                                                      RedisPipelineCompleteHead complete_head,
+                                                      gpointer user_data);
+
+#endif
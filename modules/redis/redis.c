@@ -26,6 +26,7 @@
 
 #include "redis.h"
 #include "redis-parser.h"
+#include "redis-pipeline.h"
 #include "plugin.h"
 #include "messages.h"
 #include "stats/stats-registry.h"
@@ -46,14 +47,20 @@ typedef struct
 
   GString *command;
   LogTemplate *key;
-  GString *key_str;
   LogTemplate *param1;
-  GString *param1_str;
   LogTemplate *param2;
+} RedisDriver;
+
+typedef struct
+{
+  LogThreadedDestWorker super;
+
+  GString *key_str;
+  GString *param1_str;
   GString *param2_str;
 
   redisContext *c;
-} RedisDriver;
+} RedisDestWorker;
 
 /*
  * Configuration
@@ -145,7 +152,7 @@ redis_dd_format_persist_name(const LogPipe *s)
 }
 
 static gboolean
-send_redis_command(RedisDriver *self, const char *format, ...)
+send_redis_command(RedisDestWorker *self, const char *format, ...)
 {
   va_list ap;
   va_start(ap, format);
@@ -159,20 +166,21 @@ send_redis_command(RedisDriver *self, const char *format, ...)
 }
 
 static gboolean
-check_connection_to_redis(RedisDriver *self)
+check_connection_to_redis(RedisDestWorker *self)
 {
   return send_redis_command(self, "ping");
 }
 
 static gboolean
-authenticate_to_redis(RedisDriver *self, const gchar *password)
+authenticate_to_redis(RedisDestWorker *self, const gchar *password)
 {
-  return send_redis_command(self, "AUTH %s", self->auth);
+  return send_redis_command(self, "AUTH %s", password);
 }
 
 static gboolean
-redis_dd_connect(RedisDriver *self, gboolean reconnect)
+redis_dw_connect(RedisDestWorker *self, gboolean reconnect)
 {
+  RedisDriver *owner = (RedisDriver *) self->super.owner;
   redisReply *reply;
 
   if (reconnect && (self->c != NULL))
@@ -185,22 +193,30 @@ redis_dd_connect(RedisDriver *self, gboolean reconnect)
       if (!self->c->err)
         return TRUE;
       else
-        self->c = redisConnect(self->host, self->port);
+        {
+          redisFree(self->c);
+          self->c = redisConnect(owner->host, owner->port);
+        }
     }
   else
-    self->c = redisConnect(self->host, self->port);
+    {
+      if (self->c)
+        redisFree(self->c);
+      self->c = redisConnect(owner->host, owner->port);
+    }
 
   if (self->c->err)
     {
       msg_error("REDIS server error, suspending",
-                evt_tag_str("driver", self->super.super.super.id),
+                evt_tag_str("driver", owner->super.super.super.id),
+                evt_tag_int("worker_index", self->super.worker_index),
                 evt_tag_str("error", self->c->errstr),
-                evt_tag_int("time_reopen", self->super.time_reopen));
+                evt_tag_int("time_reopen", owner->super.time_reopen));
       return FALSE;
     }
 
-  if (self->auth)
-    if (!authenticate_to_redis(self, self->auth))
+  if (owner->auth)
+    if (!authenticate_to_redis(self, owner->auth))
       {
         msg_error("REDIS: failed to authenticate");
         return FALSE;
@@ -213,15 +229,16 @@ redis_dd_connect(RedisDriver *self, gboolean reconnect)
     }
 
   msg_debug("Connecting to REDIS succeeded",
-            evt_tag_str("driver", self->super.super.super.id));
+            evt_tag_str("driver", owner->super.super.super.id),
+            evt_tag_int("worker_index", self->super.worker_index));
 
   return TRUE;
 }
 
 static void
-redis_dd_disconnect(LogThreadedDestDriver *s)
+redis_dw_disconnect(LogThreadedDestWorker *s)
 {
-  RedisDriver *self = (RedisDriver *)s;
+  RedisDestWorker *self = (RedisDestWorker *)s;
 
   if (self->c)
     redisFree(self->c);
@@ -232,74 +249,84 @@ redis_dd_disconnect(LogThreadedDestDriver *s)
  * Worker thread
  */
 
-static worker_insert_result_t
-redis_worker_insert(LogThreadedDestDriver *s, LogMessage *msg)
+static gint
+redis_worker_format_command(RedisDestWorker *self, LogMessage *msg, const char *argv[], size_t argvlen[])
 {
-  RedisDriver *self = (RedisDriver *)s;
-  redisReply *reply;
-  const char *argv[5];
-  size_t argvlen[5];
+  RedisDriver *owner = (RedisDriver *) self->super.owner;
   int argc = 2;
 
-  if (!redis_dd_connect(self, TRUE))
-    return WORKER_INSERT_RESULT_NOT_CONNECTED;
-
-  if (self->c->err)
-    return WORKER_INSERT_RESULT_ERROR;
-
-  if (!check_connection_to_redis(self))
-    {
-      msg_error("REDIS: worker failed to connect");
-      return WORKER_INSERT_RESULT_NOT_CONNECTED;
-    }
-
-  log_template_format(self->key, msg, &self->template_options, LTZ_SEND,
+  log_template_format(owner->key, msg, &owner->template_options, LTZ_SEND,
                       self->super.seq_num, NULL, self->key_str);
 
-  if (self->param1)
-    log_template_format(self->param1, msg, &self->template_options, LTZ_SEND,
+  if (owner->param1)
+    log_template_format(owner->param1, msg, &owner->template_options, LTZ_SEND,
                         self->super.seq_num, NULL, self->param1_str);
-  if (self->param2)
-    log_template_format(self->param2, msg, &self->template_options, LTZ_SEND,
+  if (owner->param2)
+    log_template_format(owner->param2, msg, &owner->template_options, LTZ_SEND,
                         self->super.seq_num, NULL, self->param2_str);
 
-  argv[0] = self->command->str;
-  argvlen[0] = self->command->len;
+  argv[0] = owner->command->str;
+  argvlen[0] = owner->command->len;
   argv[1] = self->key_str->str;
   argvlen[1] = self->key_str->len;
 
-  if (self->param1)
+  if (owner->param1)
     {
       argv[2] = self->param1_str->str;
       argvlen[2] = self->param1_str->len;
       argc++;
     }
 
-  if (self->param2)
+  if (owner->param2)
     {
       argv[3] = self->param2_str->str;
       argvlen[3] = self->param2_str->len;
       argc++;
     }
 
+  return argc;
+}
+
+static worker_insert_result_t
+redis_worker_send_command(RedisDestWorker *self, LogMessage *msg)
+{
+  RedisDriver *owner = (RedisDriver *) self->super.owner;
+  redisReply *reply;
+  const char *argv[5];
+  size_t argvlen[5];
+  int argc;
+
+  if (!redis_dw_connect(self, TRUE))
+    return WORKER_INSERT_RESULT_NOT_CONNECTED;
+
+  if (self->c->err)
+    return WORKER_INSERT_RESULT_ERROR;
+
+  if (!check_connection_to_redis(self))
+    {
+      msg_error("REDIS: worker failed to connect");
+      return WORKER_INSERT_RESULT_NOT_CONNECTED;
+    }
+
+  argc = redis_worker_format_command(self, msg, argv, argvlen);
   reply = redisCommandArgv(self->c, argc, argv, argvlen);
 
   if (!reply)
     {
       msg_error("REDIS server error, suspending",
-                evt_tag_str("driver", self->super.super.super.id),
-                evt_tag_str("command", self->command->str),
+                evt_tag_str("driver", owner->super.super.super.id),
+                evt_tag_str("command", owner->command->str),
                 evt_tag_str("key", self->key_str->str),
                 evt_tag_str("param1", self->param1_str->str),
                 evt_tag_str("param2", self->param2_str->str),
                 evt_tag_str("error", self->c->errstr),
-                evt_tag_int("time_reopen", self->super.time_reopen));
+                evt_tag_int("time_reopen", owner->super.time_reopen));
       return WORKER_INSERT_RESULT_ERROR;
     }
 
   msg_debug("REDIS command sent",
-            evt_tag_str("driver", self->super.super.super.id),
-            evt_tag_str("command", self->command->str),
+            evt_tag_str("driver", owner->super.super.super.id),
+            evt_tag_str("command", owner->command->str),
             evt_tag_str("key", self->key_str->str),
             evt_tag_str("param1", self->param1_str->str),
             evt_tag_str("param2", self->param2_str->str));
@@ -308,29 +335,171 @@ redis_worker_insert(LogThreadedDestDriver *s, LogMessage *msg)
   return WORKER_INSERT_RESULT_SUCCESS;
 }
 
+/*
+ * Pipelining
+ *
+ * With batch-lines() set, commands are only appended to the output buffer
+ * of the connection by insert(), flush() sends them in one go and reads
+ * back the replies.
+ */
+
+static gboolean
+redis_dd_is_pipelining_enabled(RedisDriver *self)
+{
+  return self->super.batch_lines > 0;
+}
+
+static worker_insert_result_t
+redis_worker_append_command(RedisDestWorker *self, LogMessage *msg)
+{
+  RedisDriver *owner = (RedisDriver *) self->super.owner;
+  const char *argv[5];
+  size_t argvlen[5];
+  int argc;
+
+  /* the connection is only checked once per batch, the replies tell us
+   * whether it is still alive */
+  if (self->super.batch_size == 1 && !redis_dw_connect(self, TRUE))
+    return WORKER_INSERT_RESULT_NOT_CONNECTED;
+
+  argc = redis_worker_format_command(self, msg, argv, argvlen);
+
+  /* NOT_CONNECTED disconnects, discarding the commands appended so far */
+  if (redisAppendCommandArgv(self->c, argc, argv, argvlen) != REDIS_OK)
+    {
+      msg_error("REDIS error appending command to pipeline",
+                evt_tag_str("driver", owner->super.super.super.id),
+                evt_tag_str("command", owner->command->str),
+                evt_tag_str("error", self->c->errstr));
+      return WORKER_INSERT_RESULT_NOT_CONNECTED;
+    }
+
+  return WORKER_INSERT_RESULT_QUEUED;
+}
+
+static worker_insert_result_t
+redis_worker_read_reply(gpointer s)
+{
+  RedisDestWorker *self = (RedisDestWorker *) s;
+  RedisDriver *owner = (RedisDriver *) self->super.owner;
+  worker_insert_result_t result;
+  redisReply *reply;
+
+  if (redisGetReply(self->c, (void **) &reply) != REDIS_OK)
+    {
+      msg_error("REDIS server error, suspending",
+                evt_tag_str("driver", owner->super.super.super.id),
+                evt_tag_str("command", owner->command->str),
+                evt_tag_str("error", self->c->errstr),
+                evt_tag_int("time_reopen", owner->super.time_reopen));
+      return WORKER_INSERT_RESULT_NOT_CONNECTED;
+    }
+
+  result = redis_reply_get_result(reply);
+  if (reply->type == REDIS_REPLY_ERROR)
+    {
+      msg_error("REDIS command failed",
+                evt_tag_str("driver", owner->super.super.super.id),
+                evt_tag_str("command", owner->command->str),
+                evt_tag_str("error", reply->str),
+                evt_tag_str("action", result == WORKER_INSERT_RESULT_DROP ? "drop" : "retry"));
+    }
+
+  freeReplyObject(reply);
+  return result;
+}
+
 static void
-redis_worker_thread_init(LogThreadedDestDriver *d)
+redis_worker_complete_batch_head(gint num_messages, worker_insert_result_t result, gpointer s)
 {
-  RedisDriver *self = (RedisDriver *)d;
+  RedisDestWorker *self = (RedisDestWorker *) s;
 
-  msg_debug("Worker thread started",
-            evt_tag_str("driver", self->super.super.super.id));
+  log_threaded_dest_worker_complete_batch_head(&self->super, num_messages, result);
+}
 
-  self->key_str = g_string_sized_new(1024);
-  self->param1_str = g_string_sized_new(1024);
-  self->param2_str = g_string_sized_new(1024);
+static worker_insert_result_t
+redis_worker_flush(LogThreadedDestWorker *s)
+{
+  RedisDestWorker *self = (RedisDestWorker *)s;
+  gint num_replies = self->super.batch_size;
+  worker_insert_result_t result;
+
+  if (!self->c)
+    return WORKER_INSERT_RESULT_NOT_CONNECTED;
+
+  result = redis_pipeline_process_replies(num_replies, redis_worker_read_reply,
+                                          redis_worker_complete_batch_head, self);
+  if (result != WORKER_INSERT_RESULT_SUCCESS)
+    {
+      /* the replies of the rest of the batch are not read, start over
+       * with a new connection */
+      redis_dw_disconnect(s);
+      return result;
+    }
+
+  msg_debug("REDIS pipeline flushed",
+            evt_tag_str("driver", s->owner->super.super.id),
+            evt_tag_int("worker_index", s->worker_index),
+            evt_tag_int("batch_size", num_replies));
+
+  return WORKER_INSERT_RESULT_SUCCESS;
+}
+
+static worker_insert_result_t
+redis_worker_insert(LogThreadedDestWorker *s, LogMessage *msg)
+{
+  RedisDestWorker *self = (RedisDestWorker *)s;
+  RedisDriver *owner = (RedisDriver *) s->owner;
+
+  if (redis_dd_is_pipelining_enabled(owner))
+    return redis_worker_append_command(self, msg);
 
-  redis_dd_connect(self, FALSE);
+  return redis_worker_send_command(self, msg);
 }
 
 static void
-redis_worker_thread_deinit(LogThreadedDestDriver *d)
+redis_worker_thread_init(LogThreadedDestWorker *s)
 {
-  RedisDriver *self = (RedisDriver *)d;
+  RedisDestWorker *self = (RedisDestWorker *)s;
+
+  msg_debug("Worker thread started",
+            evt_tag_str("driver", s->owner->super.super.id),
+            evt_tag_int("worker_index", s->worker_index));
+
+  redis_dw_connect(self, FALSE);
+}
+
+static void
+redis_dw_free(LogThreadedDestWorker *s)
+{
+  RedisDestWorker *self = (RedisDestWorker *)s;
 
   g_string_free(self->key_str, TRUE);
   g_string_free(self->param1_str, TRUE);
   g_string_free(self->param2_str, TRUE);
+  if (self->c)
+    redisFree(self->c);
+
+  log_threaded_dest_worker_free_method(s);
+}
+
+static LogThreadedDestWorker *
+redis_dw_new(LogThreadedDestDriver *owner, gint worker_index)
+{
+  RedisDestWorker *self = g_new0(RedisDestWorker, 1);
+
+  log_threaded_dest_worker_init_instance(&self->super, owner, worker_index);
+  self->super.thread_init = redis_worker_thread_init;
+  self->super.disconnect = redis_dw_disconnect;
+  self->super.insert = redis_worker_insert;
+  self->super.flush = redis_worker_flush;
+  self->super.free_fn = redis_dw_free;
+
+  self->key_str = g_string_sized_new(1024);
+  self->param1_str = g_string_sized_new(1024);
+  self->param2_str = g_string_sized_new(1024);
+
+  return &self->super;
 }
 
 /*
@@ -376,8 +545,6 @@ redis_dd_free(LogPipe *d)
   log_template_unref(self->key);
   log_template_unref(self->param1);
   log_template_unref(self->param2);
-  if (self->c)
-    redisFree(self->c);
 
   log_threaded_dest_driver_free(d);
 }
@@ -396,10 +563,7 @@ redis_dd_new(GlobalConfig *cfg)
   self->super.super.super.super.free_fn = redis_dd_free;
   self->super.super.super.super.generate_persist_name = redis_dd_format_persist_name;
 
-  self->super.worker.thread_init = redis_worker_thread_init;
-  self->super.worker.thread_deinit = redis_worker_thread_deinit;
-  self->super.worker.disconnect = redis_dd_disconnect;
-  self->super.worker.insert = redis_worker_insert;
+  self->super.construct_worker = redis_dw_new;
 
   self->super.format.stats_instance = redis_dd_format_stats_instance;
   self->super.stats_source = SCS_REDIS;
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2018 Balabit
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ */
+
+#include <criterion/criterion.h>
+
+#include "redis-pipeline.h"
+
+#include <string.h>
+
+#define MAX_REPLIES 8
+
+typedef struct
+{
+  worker_insert_result_t result;
+  gint num_messages;
+} CompletedHead;
+
+typedef struct
+{
+  /* the results of the replies on the connection */
+  worker_insert_result_t replies[MAX_REPLIES];
+  gint num_replies_read;
+
+  CompletedHead completed[MAX_REPLIES];
+  gint num_completed;
+} TestPipeline;
+
+static worker_insert_result_t
+_read_reply(gpointer user_data)
+{
+  TestPipeline *pipeline = (TestPipeline *) user_data;
+
+  cr_assert_lt(pipeline->num_replies_read, MAX_REPLIES);
+  return pipeline->replies[pipeline->num_replies_read++];
+}
+
+static void
+_complete_head(gint num_messages, worker_insert_result_t result, gpointer user_data)
+{
+  TestPipeline *pipeline = (TestPipeline *) user_data;
+
+  cr_assert_lt(pipeline->num_completed, MAX_REPLIES);
+  pipeline->completed[pipeline->num_completed].num_messages = num_messages;
+  pipeline->completed[pipeline->num_completed].result = result;
+  pipeline->num_completed++;
+}
+
+static worker_insert_result_t
+_process_replies(TestPipeline *pipeline, gint num_replies)
+{
+  return redis_pipeline_process_replies(num_replies, _read_reply, _complete_head, pipeline);
+}
+
+static void
+_assert_completed(TestPipeline *pipeline, gint index, gint num_messages, worker_insert_result_t result)
+{
+  cr_assert_lt(index, pipeline->num_completed);
+  cr_assert_eq(pipeline->completed[index].num_messages, num_messages,
+               "unexpected number of messages in completed head %d", index);
+  cr_assert_eq(pipeline->completed[index].result, result,
+               "unexpected result of completed head %d", index);
+}
+
+Test(redis_pipeline, test_all_ok_replies_complete_the_batch_at_once)
+{
+  TestPipeline pipeline =
+  {
+    .replies = { WORKER_INSERT_RESULT_SUCCESS, WORKER_INSERT_RESULT_SUCCESS, WORKER_INSERT_RESULT_SUCCESS }
+  };
+
+  cr_assert_eq(_process_replies(&pipeline, 3), WORKER_INSERT_RESULT_SUCCESS);
+  cr_assert_eq(pipeline.num_replies_read, 3);
+  cr_assert_eq(pipeline.num_completed, 1);
+  _assert_completed(&pipeline, 0, 3, WORKER_INSERT_RESULT_SUCCESS);
+}
+
+Test(redis_pipeline, test_error_reply_in_the_middle_drops_only_its_message)
+{
+  TestPipeline pipeline =
+  {
+    .replies =
+    {
+      WORKER_INSERT_RESULT_SUCCESS, WORKER_INSERT_RESULT_SUCCESS,
+      WORKER_INSERT_RESULT_DROP,
+      WORKER_INSERT_RESULT_SUCCESS
+    }
+  };
+
+  cr_assert_eq(_process_replies(&pipeline, 4), WORKER_INSERT_RESULT_SUCCESS);
+  cr_assert_eq(pipeline.num_replies_read, 4);
+  cr_assert_eq(pipeline.num_completed, 3);
+  _assert_completed(&pipeline, 0, 2, WORKER_INSERT_RESULT_SUCCESS);
+  _assert_completed(&pipeline, 1, 1, WORKER_INSERT_RESULT_DROP);
+  _assert_completed(&pipeline, 2, 1, WORKER_INSERT_RESULT_SUCCESS);
+}
+
+Test(redis_pipeline, test_consecutive_error_replies_are_dropped_together)
+{
+  TestPipeline pipeline =
+  {
+    .replies = { WORKER_INSERT_RESULT_DROP, WORKER_INSERT_RESULT_DROP, WORKER_INSERT_RESULT_SUCCESS }
+  };
+
+  cr_assert_eq(_process_replies(&pipeline, 3), WORKER_INSERT_RESULT_SUCCESS);
+  cr_assert_eq(pipeline.num_completed, 2);
+  _assert_completed(&pipeline, 0, 2, WORKER_INSERT_RESULT_DROP);
+  _assert_completed(&pipeline, 1, 1, WORKER_INSERT_RESULT_SUCCESS);
+}
+
+Test(redis_pipeline, test_transient_error_reply_retries_the_rest_of_the_batch)
+{
+  TestPipeline pipeline =
+  {
+    .replies =
+    {
+      WORKER_INSERT_RESULT_SUCCESS, WORKER_INSERT_RESULT_DROP,
+      WORKER_INSERT_RESULT_ERROR,
+      WORKER_INSERT_RESULT_SUCCESS
+    }
+  };
+
+  cr_assert_eq(_process_replies(&pipeline, 4), WORKER_INSERT_RESULT_ERROR);
+  cr_assert_eq(pipeline.num_replies_read, 3, "replies after the transient error must not be read");
+  cr_assert_eq(pipeline.num_completed, 2);
+  _assert_completed(&pipeline, 0, 1, WORKER_INSERT_RESULT_SUCCESS);
+  _assert_completed(&pipeline, 1, 1, WORKER_INSERT_RESULT_DROP);
+}
+
+Test(redis_pipeline, test_connection_error_while_reading_replies_completes_what_was_read)
+{
+  TestPipeline pipeline =
+  {
+    .replies =
+    {
+      WORKER_INSERT_RESULT_SUCCESS, WORKER_INSERT_RESULT_SUCCESS,
+      WORKER_INSERT_RESULT_NOT_CONNECTED,
+      WORKER_INSERT_RESULT_SUCCESS
+    }
+  };
+
+  cr_assert_eq(_process_replies(&pipeline, 4), WORKER_INSERT_RESULT_NOT_CONNECTED);
+  cr_assert_eq(pipeline.num_replies_read, 3);
+  cr_assert_eq(pipeline.num_completed, 1);
+  _assert_completed(&pipeline, 0, 2, WORKER_INSERT_RESULT_SUCCESS);
+}
+
+Test(redis_pipeline, test_connection_error_on_the_first_reply_completes_nothing)
+{
+  TestPipeline pipeline =
+  {
+    .replies = { WORKER_INSERT_RESULT_NOT_CONNECTED }
+  };
+
+  cr_assert_eq(_process_replies(&pipeline, 3), WORKER_INSERT_RESULT_NOT_CONNECTED);
+  cr_assert_eq(pipeline.num_replies_read, 1);
+  cr_assert_eq(pipeline.num_completed, 0);
+}
+
+static worker_insert_result_t
+_get_result(gint type, const gchar *str)
+{
+  redisReply reply = { .type = type, .str = (gchar *) str, .len = str ? strlen(str) : 0 };
+
+  return redis_reply_get_result(&reply);
+}
+
+Test(redis_pipeline, test_reply_results)
+{
+  cr_assert_eq(_get_result(REDIS_REPLY_STATUS, "OK"), WORKER_INSERT_RESULT_SUCCESS);
+  cr_assert_eq(_get_result(REDIS_REPLY_INTEGER, NULL), WORKER_INSERT_RESULT_SUCCESS);
+  cr_assert_eq(_get_result(REDIS_REPLY_NIL, NULL), WORKER_INSERT_RESULT_SUCCESS);
+
+  cr_assert_eq(_get_result(REDIS_REPLY_ERROR, "ERR unknown command 'FOO'"), WORKER_INSERT_RESULT_DROP);
+  cr_assert_eq(_get_result(REDIS_REPLY_ERROR, "WRONGTYPE Operation against a key holding the wrong kind of value"),
+               WORKER_INSERT_RESULT_DROP);
+
+  cr_assert_eq(_get_result(REDIS_REPLY_ERROR, "LOADING Redis is loading the dataset in memory"),
+               WORKER_INSERT_RESULT_ERROR);
+  cr_assert_eq(_get_result(REDIS_REPLY_ERROR, "BUSY Redis is busy running a script"), WORKER_INSERT_RESULT_ERROR);
+  cr_assert_eq(_get_result(REDIS_REPLY_ERROR, "OOM command not allowed when used memory > 'maxmemory'"),
+               WORKER_INSERT_RESULT_ERROR);
+  cr_assert_eq(_get_result(REDIS_REPLY_ERROR, "READONLY You can't write against a read only replica."),
+               WORKER_INSERT_RESULT_ERROR);
+}
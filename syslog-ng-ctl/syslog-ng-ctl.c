@@ -196,6 +196,33 @@ slng_reopen(int argc, char *argv[], const gchar *mode, GOptionContext *ctx)
   return _dispatch_command("REOPEN");
 }
 
+static gchar *contextual_data_file = NULL;
+
+static GOptionEntry contextual_data_options[] =
+{
+  {
+    "file", 'f', 0, G_OPTION_ARG_STRING, &contextual_data_file,
+    "reload only this database, as specified in the configuration or as an absolute path", "<file>"
+  },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL }
+};
+
+static gint
+slng_reload_contextual_data(int argc, char *argv[], const gchar *mode, GOptionContext *ctx)
+{
+  gchar *cmd;
+  gint result;
+
+  if (contextual_data_file)
+    cmd = g_strdup_printf("CONTEXTUAL_DATA_RELOAD %s", contextual_data_file);
+  else
+    cmd = g_strdup("CONTEXTUAL_DATA_RELOAD");
+
+  result = _dispatch_command(cmd);
+  g_free(cmd);
+  return result;
+}
+
 static const gint QUERY_COMMAND = 0;
 static gboolean query_is_get_sum = FALSE;
 static gboolean query_reset = FALSE;
@@ -553,6 +580,10 @@ static CommandDescriptor modes[] =
   { "stop", no_options, "Stop syslog-ng process", slng_stop, NULL },
   { "reload", no_options, "Reload syslog-ng", slng_reload, NULL },
   { "reopen", no_options, "Re-open of log destination files", slng_reopen, NULL },
+  {
+    "reload-contextual-data", contextual_data_options, "Reload compiled add-contextual-data databases",
+    slng_reload_contextual_data, NULL
+  },
   { "query", query_options, "Query syslog-ng statistics. Possible commands: list, get, get --sum", slng_query, NULL },
   { "show-license-info", license_options, "Show information about the license", slng_license, NULL },
   { "credentials", no_options, "Credentials manager", NULL, credentials_commands },
@@ -24,8 +24,10 @@
 #include <criterion/parameterized.h>
 
 #include "find-crlf.h"
+#include "stopwatch.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 struct findcrlf_params
 {
@@ -123,18 +125,123 @@ ParameterizedTestParameters(findcrlf, test)
   return cr_make_param_array(struct findcrlf_params, params, sizeof (params) / sizeof(struct findcrlf_params));
 }
 
+static const gchar *implementations[] = { "scalar", "sse2", "avx2" };
+
 ParameterizedTest(struct findcrlf_params *params, findcrlf, test)
 {
-  gchar *eom = find_cr_or_lf(params->msg, params->msg_len);
+  for (gint i = 0; i < G_N_ELEMENTS(implementations); i++)
+    {
+      if (!find_crlf_set_implementation(implementations[i]))
+        continue;
+
+      gchar *eom = find_cr_or_lf(params->msg, params->msg_len);
+
+      cr_expect_not(params->eom_ofs == -1 && eom != NULL,
+                    "EOM returned is not NULL, which was expected. impl=%s, eom_ofs=%d, eom=%s\n",
+                    implementations[i], (gint) params->eom_ofs, eom);
+
+      if (params->eom_ofs == -1)
+        continue;
+
+      cr_expect_not(eom - params->msg != params->eom_ofs,
+                    "EOM is at wrong location. impl=%s, msg=%s, eom_ofs=%d, eom=%s\n",
+                    implementations[i], params->msg, (gint) params->eom_ofs, eom);
+    }
+  find_crlf_set_implementation(NULL);
+}
+
+static void
+_assert_terminator_found_at_every_position(const gchar *impl)
+{
+  gchar buffer[256];
+
+  for (gint len = 0; len < 160; len++)
+    {
+      for (gint pos = 0; pos < len; pos++)
+        {
+          memset(buffer, 'a', sizeof(buffer));
+          /* only the first len bytes are to be scanned */
+          buffer[len] = '\n';
+
+          buffer[pos] = '\r';
+          cr_assert_eq(find_cr_or_lf(buffer, len), buffer + pos, "impl=%s, len=%d, pos=%d", impl, len, pos);
+          cr_assert_null(find_char_or_nul(buffer, len, '\n'), "impl=%s, len=%d, pos=%d", impl, len, pos);
+
+          buffer[pos] = '\0';
+          cr_assert_null(find_cr_or_lf(buffer, len), "impl=%s, len=%d, pos=%d", impl, len, pos);
+          cr_assert_eq(find_char_or_nul(buffer, len, '\n'), buffer + pos, "impl=%s, len=%d, pos=%d", impl, len, pos);
+        }
+      memset(buffer, 'a', sizeof(buffer));
+      buffer[len] = '\n';
+      cr_assert_null(find_cr_or_lf(buffer, len), "impl=%s, len=%d", impl, len);
+    }
+}
+
+Test(findcrlf, test_every_implementation_finds_terminators_at_every_position)
+{
+  for (gint i = 0; i < G_N_ELEMENTS(implementations); i++)
+    {
+      if (find_crlf_set_implementation(implementations[i]))
+        _assert_terminator_found_at_every_position(implementations[i]);
+    }
+  find_crlf_set_implementation(NULL);
+  cr_assert_not_null(find_crlf_get_implementation());
+}
+
+#define PERF_BUFFER_SIZE (4 * 1024 * 1024)
+#define PERF_ITERATIONS 100
+
+/* most syslog lines are short, with a long tail of multi-kilobyte ones */
+static gint
+_random_line_length(GRand *rand)
+{
+  gint dice = g_rand_int_range(rand, 0, 100);
+
+  if (dice < 70)
+    return g_rand_int_range(rand, 80, 250);
+  if (dice < 95)
+    return g_rand_int_range(rand, 250, 1000);
+  return g_rand_int_range(rand, 1000, 8192);
+}
+
+Test(findcrlf, test_performance)
+{
+  gchar *buffer = g_malloc(PERF_BUFFER_SIZE);
+  GRand *rand = g_rand_new_with_seed(0);
+  gint lines = 0;
+
+  for (gint i = 0; i < PERF_BUFFER_SIZE; i++)
+    buffer[i] = 'a' + i % 26;
+  for (gint pos = _random_line_length(rand); pos < PERF_BUFFER_SIZE; pos += _random_line_length(rand))
+    {
+      buffer[pos] = '\n';
+      lines++;
+    }
+
+  for (gint i = 0; i < G_N_ELEMENTS(implementations); i++)
+    {
+      gint found = 0;
+
+      if (!find_crlf_set_implementation(implementations[i]))
+        continue;
 
-  cr_expect_not(params->eom_ofs == -1 && eom != NULL,
-                "EOM returned is not NULL, which was expected. eom_ofs=%d, eom=%s\n",
-                (gint) params->eom_ofs, eom);
+      start_stopwatch();
+      for (gint iteration = 0; iteration < PERF_ITERATIONS; iteration++)
+        {
+          gchar *p = buffer;
 
-  if (params->eom_ofs == -1)
-    return;
+          while ((p = find_cr_or_lf(p, buffer + PERF_BUFFER_SIZE - p)))
+            {
+              found++;
+              p++;
+            }
+        }
+      stop_stopwatch_and_display_result(PERF_ITERATIONS, "find_cr_or_lf(%s), %d lines in %d bytes",
+                                        implementations[i], lines, PERF_BUFFER_SIZE);
+      cr_assert_eq(found, lines * PERF_ITERATIONS);
+    }
 
-  cr_expect_not(eom - params->msg != params->eom_ofs,
-                "EOM is at wrong location. msg=%s, eom_ofs=%d, eom=%s\n",
-                params->msg, (gint) params->eom_ofs, eom);
+  find_crlf_set_implementation(NULL);
+  g_rand_free(rand);
+  g_free(buffer);
 }
@@ -25,6 +25,7 @@
 #include "timeutils.h"
 #include "timeutils.h"
 #include "logstamp.h"
+#include "stopwatch.h"
 #include <criterion/criterion.h>
 #include <stdlib.h>
 #include <string.h>
@@ -800,3 +801,88 @@ Test(zone, test_logstamp_format)
 
   g_string_free(target, TRUE);
 }
+
+#define NUM_SPREAD_STAMPS 10000
+#define SPREAD_ITERATIONS 100
+
+/* 1980-01-01 .. 2030-01-01, in random order, like a log file with timestamps from several years */
+static void
+_generate_spread_stamps(time_t *stamps, glong *expected_offsets, const gchar *time_zone)
+{
+  GRand *rand = g_rand_new_with_seed(1234);
+
+  set_time_zone(time_zone);
+  for (gint i = 0; i < NUM_SPREAD_STAMPS; i++)
+    {
+      stamps[i] = g_rand_int_range(rand, 315532800, 1893456000);
+      expected_offsets[i] = get_local_timezone_ofs(stamps[i]);
+    }
+  g_rand_free(rand);
+}
+
+Test(zone, test_time_zone_offsets_spanning_several_years)
+{
+  const gchar *time_zones[] = { "Europe/Budapest", "America/New_York" };
+  time_t stamps[G_N_ELEMENTS(time_zones)][NUM_SPREAD_STAMPS];
+  glong expected_offsets[G_N_ELEMENTS(time_zones)][NUM_SPREAD_STAMPS];
+  TimeZoneInfo *infos[G_N_ELEMENTS(time_zones)];
+
+  for (gint z = 0; z < G_N_ELEMENTS(time_zones); z++)
+    {
+      if (!time_zone_exists(time_zones[z]))
+        {
+          printf("SKIP: %s\n", time_zones[z]);
+          return;
+        }
+      _generate_spread_stamps(stamps[z], expected_offsets[z], time_zones[z]);
+      infos[z] = time_zone_info_new(time_zones[z]);
+    }
+
+  /* interleave the zones, so that they compete for the per-thread lookup cache */
+  for (gint i = 0; i < NUM_SPREAD_STAMPS; i++)
+    for (gint z = 0; z < G_N_ELEMENTS(time_zones); z++)
+      cr_assert_eq(time_zone_info_get_offset(infos[z], stamps[z][i]), expected_offsets[z][i],
+                   "unixtimestamp: %ld TimeZoneName (%s) localtime offset(%ld), timezone file offset(%ld)",
+                   (glong) stamps[z][i], time_zones[z], expected_offsets[z][i],
+                   (glong) time_zone_info_get_offset(infos[z], stamps[z][i]));
+
+  for (gint z = 0; z < G_N_ELEMENTS(time_zones); z++)
+    time_zone_info_free(infos[z]);
+}
+
+Test(zone, test_time_zone_offset_performance)
+{
+  const gchar *time_zone = "Europe/Budapest";
+  time_t stamps[NUM_SPREAD_STAMPS];
+  glong expected_offsets[NUM_SPREAD_STAMPS];
+  TimeZoneInfo *info;
+  glong sum = 0;
+  gint iteration;
+
+  if (!time_zone_exists(time_zone))
+    {
+      printf("SKIP: %s\n", time_zone);
+      return;
+    }
+
+  _generate_spread_stamps(stamps, expected_offsets, time_zone);
+  info = time_zone_info_new(time_zone);
+
+  start_stopwatch();
+  for (iteration = 0; iteration < SPREAD_ITERATIONS; iteration++)
+    for (gint i = 0; i < NUM_SPREAD_STAMPS; i++)
+      sum += time_zone_info_get_offset(info, stamps[i]);
+  stop_stopwatch_and_display_result(iteration * NUM_SPREAD_STAMPS,
+                                    "time_zone_info_get_offset() with timestamps spanning 50 years");
+
+  /* monotonic timestamps, the usual case for live traffic */
+  start_stopwatch();
+  for (iteration = 0; iteration < SPREAD_ITERATIONS; iteration++)
+    for (gint i = 0; i < NUM_SPREAD_STAMPS; i++)
+      sum += time_zone_info_get_offset(info, 1500000000 + iteration * NUM_SPREAD_STAMPS + i);
+  stop_stopwatch_and_display_result(iteration * NUM_SPREAD_STAMPS,
+                                    "time_zone_info_get_offset() with increasing timestamps");
+
+  cr_assert_neq(sum, 0);
+  time_zone_info_free(info);
+}